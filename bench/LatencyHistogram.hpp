@@ -0,0 +1,137 @@
+#ifndef __CPP_SOCKETS_BENCH_LATENCY_HISTOGRAM_HPP__
+#define __CPP_SOCKETS_BENCH_LATENCY_HISTOGRAM_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+/*
+ * A histogram of latencies in nanoseconds laid out the way HdrHistogram lays
+ * out its buckets.  Values are grouped by their highest set bit, and each of
+ * those power of two ranges is split into 2^SUB_BUCKET_BITS equal sub
+ * buckets, so every recorded value is kept to within 1/2^SUB_BUCKET_BITS
+ * (under 1%) of its true value from 1 nanosecond to hours with a fixed array
+ * of counters.  Recording is a few shifts and an increment, cheap enough to
+ * do for every message of a benchmark.
+ *
+ * Histograms of different threads are combined with merge() after the run
+ * rather than sharing one, so the measurement does not measure contention on
+ * the histogram.
+ */
+class LatencyHistogram {
+public:
+
+    static constexpr unsigned SUB_BUCKET_BITS = 7;
+    static constexpr std::uint64_t SUB_BUCKETS = std::uint64_t{1} <<
+        SUB_BUCKET_BITS;
+
+    LatencyHistogram() : counts((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS) {}
+
+    void record(std::uint64_t value) {
+        ++this->counts[index_of(value)];
+        ++this->total;
+        this->sum += value;
+        this->minimum = std::min(this->minimum, value);
+        this->maximum = std::max(this->maximum, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (std::size_t i = 0; i < this->counts.size(); ++i) {
+            this->counts[i] += other.counts[i];
+        }
+        this->total += other.total;
+        this->sum += other.sum;
+        this->minimum = std::min(this->minimum, other.minimum);
+        this->maximum = std::max(this->maximum, other.maximum);
+    }
+
+    std::uint64_t count() const { return this->total; }
+    std::uint64_t min() const { return this->total ? this->minimum : 0; }
+    std::uint64_t max() const { return this->maximum; }
+    double mean() const {
+        return this->total ? static_cast<double>(this->sum) /
+            static_cast<double>(this->total) : 0.0;
+    }
+
+    /*
+     * The value below which the given percentage of the recorded values lie,
+     * reported as the highest value of its sub bucket as HdrHistogram does,
+     * and never more than the largest value actually recorded
+     */
+    std::uint64_t percentile(double percent) const {
+        if (!this->total) {
+            return 0;
+        }
+        auto rank = static_cast<std::uint64_t>(percent / 100.0 *
+                static_cast<double>(this->total) + 0.5);
+        rank = std::max<std::uint64_t>(rank, 1);
+        std::uint64_t seen {0};
+        for (std::size_t i = 0; i < this->counts.size(); ++i) {
+            seen += this->counts[i];
+            if (seen >= rank) {
+                return std::min(highest_in(i), this->maximum);
+            }
+        }
+        return this->maximum;
+    }
+
+    /* The summary as a JSON object, all values in nanoseconds */
+    std::string to_json() const {
+        std::string json {"{"};
+        json += "\"count\": " + std::to_string(this->count());
+        json += ", \"min_ns\": " + std::to_string(this->min());
+        json += ", \"mean_ns\": " + std::to_string(
+                static_cast<std::uint64_t>(this->mean()));
+        for (auto percent : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+            auto name = std::to_string(percent);
+            name.erase(name.find_last_not_of('0') + 1);
+            if (name.back() == '.') {
+                name.pop_back();
+            }
+            json += ", \"p" + name + "_ns\": " +
+                std::to_string(this->percentile(percent));
+        }
+        json += ", \"max_ns\": " + std::to_string(this->max());
+        return json + "}";
+    }
+
+private:
+
+    /*
+     * Values below SUB_BUCKETS have a sub bucket each, above that the
+     * exponent picks a row of sub buckets and the bits below the highest set
+     * bit pick the sub bucket in the row
+     */
+    static std::size_t index_of(std::uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<std::size_t>(value);
+        }
+        auto exponent = 63u - static_cast<unsigned>(__builtin_clzll(value));
+        auto shift = exponent - SUB_BUCKET_BITS;
+        auto row = shift + 1;
+        auto sub_bucket = (value >> shift) & (SUB_BUCKETS - 1);
+        return static_cast<std::size_t>(row * SUB_BUCKETS + sub_bucket);
+    }
+
+    static std::uint64_t highest_in(std::size_t index) {
+        auto row = index / SUB_BUCKETS;
+        auto sub_bucket = index % SUB_BUCKETS;
+        if (!row) {
+            return sub_bucket;
+        }
+        auto shift = row - 1;
+        auto lowest = (SUB_BUCKETS + sub_bucket) << shift;
+        return lowest + ((std::uint64_t{1} << shift) - 1);
+    }
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total {0};
+    std::uint64_t sum {0};
+    std::uint64_t minimum {std::numeric_limits<std::uint64_t>::max()};
+    std::uint64_t maximum {0};
+};
+
+#endif
@@ -0,0 +1,966 @@
+/*
+ * Loopback benchmarks for the library, built and run by `make bench`.
+ *
+ * Every benchmark starts a server in this process and drives it from client
+ * threads over loopback TCP or a unix socket, for each of the ways the
+ * library can serve connections:
+ *
+ *      threaded    : accept() in a loop and a thread per connection, the
+ *                    model of tests/tcp_server.cpp
+ *      event_loop  : one EventLoop thread, the model of
+ *                    tests/event_loop_server.cpp
+ *      sharded     : a ShardedServer with a shard per core, over TCP only
+ *      completion_queue
+ *                  : one thread reaping a CompletionQueue (io_uring) with
+ *                    multishot accept and recv into a buffer ring, skipped
+ *                    when the kernel does not support io_uring
+ *      coroutine   : a coroutine per connection on one EventLoop thread,
+ *                    the model of tests/coroutine_server.cpp
+ *
+ * and the benchmarks are
+ *
+ *      ping_pong   : round trip time of a small message echoed back, with
+ *                    one connection per client thread
+ *      throughput  : one large transfer per connection, bytes per second
+ *      accept_rate : connections set up and torn down without any data, how
+ *                    fast the server accepts them
+ *      churn       : a connection, one echoed byte and a close each time,
+ *                    the whole life of a short connection
+ *
+ * The client side runs at a range of concurrency levels.  Latencies go into
+ * HdrHistogram style histograms (see LatencyHistogram.hpp) and every result
+ * is written out as one JSON document.  The coroutine model makes this file
+ * C++20, like tests/coroutine_server.cpp it is built against the C++14
+ * library.
+ *
+ * Usage : socketbench [--quick] [--filter <text>] [--output <file>]
+ *
+ *      --quick     fewer iterations and concurrency levels, for a smoke run
+ *      --filter    only runs the benchmarks whose name contains the text,
+ *                  names look like ping_pong/tcp/event_loop/4
+ *      --output    writes the JSON there instead of to stdout
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SocketUtilities.hpp"
+#include "EventLoop.hpp"
+#include "CompletionQueue.hpp"
+#include "AsyncSocket.hpp"
+#include "Coroutine.hpp"
+#include "SharedMemoryChannel.hpp"
+#include "LatencyHistogram.hpp"
+using namespace std;
+using SocketUtilities::AsyncSocket;
+using SocketUtilities::SocketType;
+using SocketUtilities::Task;
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t nanoseconds_since(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<
+            std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+/* How the benchmarks are run, from the command line */
+struct Settings {
+    bool quick {false};
+    string filter;
+    string output;
+    vector<unsigned> concurrency {1, 4, 16};
+    size_t ping_pong_iterations {20000};
+    size_t warmup_iterations {1000};
+    size_t throughput_bytes {256 * 1024 * 1024};
+    size_t throughput_runs {5};
+    size_t connections {2000};
+};
+
+enum class Transport { TCP, UNIX };
+enum class Model { THREADED, EVENT_LOOP, SHARDED, COMPLETION_QUEUE,
+    COROUTINE };
+
+/*
+ * ECHO sends back whatever arrives.  SINK reads an 8 byte length followed by
+ * that many bytes and answers with a single byte once it has all of them, so
+ * the client knows when a transfer has been received
+ */
+enum class Mode { ECHO, SINK };
+
+static const char* name_of(Transport transport) {
+    return transport == Transport::TCP ? "tcp" : "unix";
+}
+static const char* name_of(Model model) {
+    switch (model) {
+        case Model::THREADED: return "threaded";
+        case Model::EVENT_LOOP: return "event_loop";
+        case Model::SHARDED: return "sharded";
+        case Model::COMPLETION_QUEUE: return "completion_queue";
+        case Model::COROUTINE: return "coroutine";
+    }
+    return "";
+}
+
+/* The clients close with a reset so that TIME_WAIT does not use up ports */
+static void close_with_reset(SocketType sock_fd) {
+    linger option {1, 0};
+    ::setsockopt(sock_fd, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+    ::close(sock_fd);
+}
+
+static void set_no_delay(SocketType sock_fd) {
+    int one {1};
+    ::setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* Receives exactly length bytes, false if the connection ended first */
+static bool recv_exactly(SocketType sock_fd, void* buffer, size_t length) {
+    size_t received {0};
+    while (received < length) {
+        auto result = SocketUtilities::try_recv(sock_fd,
+                static_cast<char*>(buffer) + received, length - received);
+        if (!result || !result.value()) {
+            return false;
+        }
+        received += result.value();
+    }
+    return true;
+}
+
+/*
+ * Keeps track of the transfer a SINK connection is receiving, shared by both
+ * server models.  Returns how many transfers the bytes completed
+ */
+class SinkState {
+public:
+    size_t consume(const char* data, size_t length) {
+        size_t completed {0};
+        while (length) {
+            if (this->header_received < sizeof(this->expected)) {
+                auto take = std::min(length, sizeof(this->expected) -
+                        this->header_received);
+                std::memcpy(reinterpret_cast<char*>(&this->expected) +
+                        this->header_received, data, take);
+                this->header_received += take;
+                data += take;
+                length -= take;
+                continue;
+            }
+            auto take = static_cast<size_t>(std::min<uint64_t>(length,
+                        this->expected - this->received));
+            this->received += take;
+            data += take;
+            length -= take;
+            if (this->received == this->expected) {
+                ++completed;
+                this->header_received = 0;
+                this->received = 0;
+            }
+        }
+        return completed;
+    }
+
+private:
+    uint64_t expected {0};
+    size_t header_received {0};
+    uint64_t received {0};
+};
+
+class EchoHandler : public SocketUtilities::ConnectionHandler {
+public:
+    void on_read(SocketUtilities::Connection& connection, const char* data,
+            size_t length) override {
+        connection.write(data, length);
+    }
+};
+
+class SinkHandler : public SocketUtilities::ConnectionHandler {
+public:
+    void on_read(SocketUtilities::Connection& connection, const char* data,
+            size_t length) override {
+        for (auto completed = this->state.consume(data, length); completed;
+                --completed) {
+            connection.write("!", 1);
+        }
+    }
+
+private:
+    SinkState state;
+};
+
+/* The port a listener was bound to */
+static string port_of(SocketType listener) {
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+    auto port = address.ss_family == AF_INET6 ?
+        reinterpret_cast<sockaddr_in6*>(&address)->sin6_port :
+        reinterpret_cast<sockaddr_in*>(&address)->sin_port;
+    return to_string(ntohs(port));
+}
+
+/* The handlers for the event loop models, counting the connections */
+static SocketUtilities::ConnectionHandlerFactory make_handler_factory(
+        Mode mode, std::atomic<size_t>& accepted) {
+    return [mode, &accepted]()
+            -> unique_ptr<SocketUtilities::ConnectionHandler> {
+        accepted.fetch_add(1, std::memory_order_relaxed);
+        if (mode == Mode::ECHO) {
+            return std::make_unique<EchoHandler>();
+        }
+        return std::make_unique<SinkHandler>();
+    };
+}
+
+/*
+ * What the completion queue model keeps for a connection.  Output is sent
+ * one piece at a time so that it goes out in order, echoed data is sent
+ * straight from the buffer ring and the buffer recycled once it has all been
+ * sent
+ */
+class RingOutput {
+public:
+    const char* data;
+    size_t length;
+    int buffer_id;
+};
+
+class RingConnection {
+public:
+    SinkState state;
+    std::deque<RingOutput> pending;
+    bool sending {false};
+    bool closing {false};
+};
+
+/*
+ * A server on an ephemeral port or a fresh unix socket path, serving
+ * connections with the model until it is destroyed.  accepted counts the
+ * connections accepted so far.  The sharded model is TCP only since it needs
+ * a port its shards can all listen on, and constructing a completion queue
+ * server throws an exception when the kernel does not support io_uring
+ */
+class BenchServer {
+public:
+
+    BenchServer(Transport transport_in, Model model_in, Mode mode_in) :
+            transport{transport_in}, model{model_in}, mode{mode_in} {
+
+        // before the listener so that nothing is left open if it fails
+        if (this->model == Model::COMPLETION_QUEUE) {
+            this->ring = std::make_unique<SocketUtilities::CompletionQueue>();
+            this->ring->register_buffer_ring(0, RING_BUFFERS,
+                    RING_BUFFER_SIZE);
+        }
+
+        if (this->model == Model::SHARDED) {
+
+            // the shards bind to a port that was free a moment ago
+            auto probe = SocketUtilities::create_server_socket("0", 1);
+            this->port = port_of(probe);
+            ::close(probe);
+            this->sharded = std::make_unique<SocketUtilities::ShardedServer>(
+                    this->port, make_handler_factory(this->mode,
+                        this->accepted),
+                    std::max(std::thread::hardware_concurrency(), 1u), 4096);
+            this->server_thread = std::thread{[this] {
+                this->sharded->run();
+            }};
+            return;
+        }
+
+        if (this->transport == Transport::TCP) {
+            this->listener = SocketUtilities::create_server_socket("0", 4096);
+            this->port = port_of(this->listener);
+        } else {
+            this->path = "/tmp/cppsockets_bench_"s + to_string(::getpid()) +
+                "_"s + to_string(next_path++);
+            ::unlink(this->path.c_str());
+            this->listener = SocketUtilities::create_server_unix_socket(
+                    this->path, 4096);
+        }
+
+        if (this->model == Model::THREADED) {
+            this->server_thread = std::thread{[this] { this->accept_loop(); }};
+        } else if (this->model == Model::EVENT_LOOP) {
+            this->event_loop.add_listener(this->listener,
+                    make_handler_factory(this->mode, this->accepted));
+            this->server_thread = std::thread{[this] {
+                this->event_loop.run();
+            }};
+        } else if (this->model == Model::COMPLETION_QUEUE) {
+            this->server_thread = std::thread{[this] { this->ring_loop(); }};
+        } else {
+            this->async_listener = std::make_unique<AsyncSocket>(
+                    this->event_loop, this->listener);
+            SocketUtilities::spawn(this->accept_async());
+            this->server_thread = std::thread{[this] {
+                this->event_loop.run();
+            }};
+        }
+    }
+
+    ~BenchServer() {
+        if (this->model == Model::EVENT_LOOP) {
+            this->event_loop.stop();
+            this->server_thread.join();
+        } else if (this->model == Model::SHARDED) {
+            this->sharded->stop();
+            this->server_thread.join();
+        } else {
+
+            // a connection wakes the accept loop up to see the flag, the
+            // server then finishes with the connections it has and returns
+            this->stopping = true;
+            ::close(this->connect());
+            if (this->model == Model::COROUTINE) {
+                while (this->active.load()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                }
+                this->event_loop.stop();
+            }
+            this->server_thread.join();
+            while (this->active.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            }
+            if (this->model == Model::COROUTINE) {
+                this->async_listener.reset();
+            } else {
+                ::close(this->listener);
+            }
+        }
+        if (this->transport == Transport::UNIX) {
+            ::unlink(this->path.c_str());
+        }
+    }
+
+    SocketType connect() const {
+        if (this->transport == Transport::TCP) {
+            auto sock_fd = SocketUtilities::create_client_socket("127.0.0.1",
+                    this->port);
+            set_no_delay(sock_fd);
+            return sock_fd;
+        }
+        return SocketUtilities::create_client_unix_socket(this->path);
+    }
+
+    std::atomic<size_t> accepted {0};
+
+private:
+
+    void accept_loop() {
+        while (true) {
+            auto result = SocketUtilities::try_accept(this->listener);
+            if (this->stopping) {
+                if (result) {
+                    ::close(result.value());
+                }
+                return;
+            }
+            if (!result) {
+                continue;
+            }
+            this->accepted.fetch_add(1, std::memory_order_relaxed);
+            ++this->active;
+            auto sock_fd = result.value();
+            std::thread{[this, sock_fd] {
+                this->serve(sock_fd);
+                ::close(sock_fd);
+                --this->active;
+            }}.detach();
+        }
+    }
+
+    void serve(SocketType sock_fd) {
+        if (this->transport == Transport::TCP) {
+            set_no_delay(sock_fd);
+        }
+        vector<char> buffer(64 * 1024);
+        SinkState state;
+        while (true) {
+            auto result = SocketUtilities::try_recv(sock_fd, buffer.data(),
+                    buffer.size());
+            if (!result || !result.value()) {
+                return;
+            }
+            if (this->mode == Mode::ECHO) {
+                if (!SocketUtilities::try_send(sock_fd, buffer.data(),
+                            result.value(), MSG_NOSIGNAL)) {
+                    return;
+                }
+                continue;
+            }
+            for (auto completed = state.consume(buffer.data(),
+                        result.value()); completed; --completed) {
+                if (!SocketUtilities::try_send(sock_fd, "!", 1,
+                            MSG_NOSIGNAL)) {
+                    return;
+                }
+            }
+        }
+    }
+
+    /*
+     * The coroutine model, the server of tests/coroutine_server.cpp with a
+     * coroutine per connection on one event loop thread
+     */
+    Task<> accept_async() {
+        while (true) {
+            SocketType sock_fd {-1};
+            try {
+                sock_fd = co_await SocketUtilities::async_accept(
+                        *this->async_listener);
+            } catch (const std::exception&) {
+                continue;
+            }
+            if (this->stopping) {
+                ::close(sock_fd);
+                co_return;
+            }
+            this->accepted.fetch_add(1, std::memory_order_relaxed);
+            ++this->active;
+            if (this->transport == Transport::TCP) {
+                set_no_delay(sock_fd);
+            }
+            SocketUtilities::spawn(this->serve_async(AsyncSocket{
+                        this->event_loop, sock_fd}));
+        }
+    }
+
+    Task<> serve_async(AsyncSocket sock) {
+        vector<char> buffer(64 * 1024);
+        SinkState state;
+        try {
+            while (auto received = co_await SocketUtilities::async_recv(sock,
+                        buffer.data(), buffer.size())) {
+                if (this->mode == Mode::ECHO) {
+                    co_await SocketUtilities::async_send_all(sock,
+                            buffer.data(), received);
+                    continue;
+                }
+                for (auto completed = state.consume(buffer.data(), received);
+                        completed; --completed) {
+                    co_await SocketUtilities::async_send_all(sock, "!", 1);
+                }
+            }
+        } catch (const std::exception&) {}
+        --this->active;
+    }
+
+    /*
+     * The completion queue model, one thread with an io_uring, a multishot
+     * accept and a multishot recv per connection into a shared buffer ring.
+     * The user data of an operation is its kind in the upper half and the
+     * socket in the lower
+     */
+    enum RingOperation : uint64_t { RING_ACCEPT, RING_RECV, RING_SEND };
+
+    static uint64_t ring_tag(RingOperation operation, SocketType sock_fd) {
+        return (static_cast<uint64_t>(operation) << 32) |
+            static_cast<uint32_t>(sock_fd);
+    }
+
+    void ring_loop() {
+        auto& ring = *this->ring;
+        ring.submit_accept(this->listener, ring_tag(RING_ACCEPT, 0));
+        vector<SocketUtilities::CompletionQueue::Completion> completions;
+        while (!this->stopping || !this->connections.empty()) {
+            ring.get_completions(completions);
+            for (const auto& completion : completions) {
+                auto operation = completion.get_user_data() >> 32;
+                auto sock_fd = static_cast<SocketType>(
+                        completion.get_user_data() & 0xffffffff);
+                if (operation == RING_ACCEPT) {
+                    this->ring_accepted(completion);
+                } else if (operation == RING_RECV) {
+                    this->ring_received(sock_fd, completion);
+                } else {
+                    this->ring_sent(sock_fd, completion);
+                }
+            }
+        }
+    }
+
+    void ring_accepted(
+            const SocketUtilities::CompletionQueue::Completion& completion) {
+        if (!completion.more()) {
+            this->ring->submit_accept(this->listener,
+                    ring_tag(RING_ACCEPT, 0));
+        }
+        auto sock_fd = completion.get_result();
+        if (sock_fd < 0) {
+            return;
+        }
+        if (this->stopping) {
+            ::close(sock_fd);
+            return;
+        }
+        this->accepted.fetch_add(1, std::memory_order_relaxed);
+        if (this->transport == Transport::TCP) {
+            set_no_delay(sock_fd);
+        }
+        this->connections[sock_fd];
+        this->ring->submit_multishot_recv(sock_fd, 0,
+                ring_tag(RING_RECV, sock_fd));
+    }
+
+    void ring_received(SocketType sock_fd,
+            const SocketUtilities::CompletionQueue::Completion& completion) {
+
+        auto& connection = this->connections.at(sock_fd);
+        auto result = completion.get_result();
+        if (completion.has_buffer()) {
+            auto buffer_id = completion.get_buffer_id();
+            auto data = this->ring->get_buffer(0, buffer_id);
+            auto length = static_cast<size_t>(std::max(result, 0));
+            if (this->mode == Mode::ECHO && length) {
+                connection.pending.push_back({data, length, buffer_id});
+            } else {
+                for (auto completed = connection.state.consume(data, length);
+                        completed; --completed) {
+                    connection.pending.push_back({"!", 1, -1});
+                }
+                this->ring->recycle_buffer(0, buffer_id);
+            }
+        }
+
+        // the recv stops when the ring runs out of buffers or the connection
+        // ends, it is armed again in the first case
+        if (!completion.more()) {
+            if (result > 0 || result == -ENOBUFS) {
+                this->ring->submit_multishot_recv(sock_fd, 0,
+                        ring_tag(RING_RECV, sock_fd));
+            } else {
+                connection.closing = true;
+            }
+        }
+        this->ring_send_next(sock_fd, connection);
+    }
+
+    void ring_sent(SocketType sock_fd,
+            const SocketUtilities::CompletionQueue::Completion& completion) {
+
+        auto& connection = this->connections.at(sock_fd);
+        connection.sending = false;
+        auto result = completion.get_result();
+        if (result < 0) {
+
+            // the recv sees the shutdown and ends, which closes the socket
+            ::shutdown(sock_fd, SHUT_RDWR);
+            this->ring_drop_output(connection);
+        } else {
+            auto& output = connection.pending.front();
+            output.data += result;
+            output.length -= static_cast<size_t>(result);
+            if (!output.length) {
+                if (output.buffer_id != -1) {
+                    this->ring->recycle_buffer(0,
+                            static_cast<uint16_t>(output.buffer_id));
+                }
+                connection.pending.pop_front();
+            }
+        }
+        this->ring_send_next(sock_fd, connection);
+    }
+
+    /* Sends the next piece of output, or closes a connection that ended */
+    void ring_send_next(SocketType sock_fd, RingConnection& connection) {
+        if (connection.sending) {
+            return;
+        }
+        if (connection.closing) {
+            this->ring_drop_output(connection);
+            ::close(sock_fd);
+            this->connections.erase(sock_fd);
+            return;
+        }
+        if (!connection.pending.empty()) {
+            auto& output = connection.pending.front();
+            this->ring->submit_send(sock_fd, output.data, output.length,
+                    ring_tag(RING_SEND, sock_fd));
+            connection.sending = true;
+        }
+    }
+
+    void ring_drop_output(RingConnection& connection) {
+        for (const auto& output : connection.pending) {
+            if (output.buffer_id != -1) {
+                this->ring->recycle_buffer(0,
+                        static_cast<uint16_t>(output.buffer_id));
+            }
+        }
+        connection.pending.clear();
+    }
+
+    static constexpr unsigned RING_BUFFERS = 1024;
+    static constexpr size_t RING_BUFFER_SIZE = 16 * 1024;
+    static unsigned next_path;
+
+    Transport transport;
+    Model model;
+    Mode mode;
+    SocketType listener {-1};
+    string port;
+    string path;
+    std::thread server_thread;
+    SocketUtilities::EventLoop event_loop;
+    unique_ptr<SocketUtilities::ShardedServer> sharded;
+    unique_ptr<SocketUtilities::CompletionQueue> ring;
+    std::unordered_map<SocketType, RingConnection> connections;
+    unique_ptr<AsyncSocket> async_listener;
+    std::atomic<bool> stopping {false};
+    std::atomic<size_t> active {0};
+};
+
+unsigned BenchServer::next_path {0};
+
+/* One line of the results */
+struct Result {
+    string name;
+    string benchmark;
+    string transport;
+    string model;
+    unsigned concurrency;
+    size_t message_size;
+    uint64_t operations;
+    double seconds;
+    LatencyHistogram latency;
+    string extra;
+
+    string to_json() const {
+        auto json = "{\"name\": \""s + this->name + "\", \"benchmark\": \""s +
+            this->benchmark + "\", \"transport\": \""s + this->transport +
+            "\", \"model\": \""s + this->model + "\", \"concurrency\": "s +
+            to_string(this->concurrency) + ", \"message_size\": "s +
+            to_string(this->message_size) + ", \"operations\": "s +
+            to_string(this->operations) + ", \"seconds\": "s +
+            to_string(this->seconds) + ", \"operations_per_second\": "s +
+            to_string(this->seconds > 0 ?
+                    static_cast<double>(this->operations) / this->seconds : 0)
+            + ", \"latency\": "s + this->latency.to_json();
+        return json + this->extra + "}";
+    }
+};
+
+/*
+ * Runs the client function on concurrency threads at once and merges their
+ * histograms, the clock runs from when all of them have been started until
+ * the last one finishes
+ */
+static Result run_clients(unsigned concurrency,
+        const std::function<uint64_t (unsigned, LatencyHistogram&)>& client) {
+
+    vector<LatencyHistogram> histograms(concurrency);
+    vector<uint64_t> operations(concurrency);
+    vector<std::thread> threads;
+    std::atomic<unsigned> ready {0};
+    std::atomic<bool> go {false};
+    for (unsigned i = 0; i < concurrency; ++i) {
+        threads.emplace_back([&, i] {
+            ++ready;
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            operations[i] = client(i, histograms[i]);
+        });
+    }
+    while (ready.load() != concurrency) {
+        std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Result result;
+    result.concurrency = concurrency;
+    result.seconds = static_cast<double>(nanoseconds_since(start)) / 1e9;
+    result.operations = 0;
+    for (unsigned i = 0; i < concurrency; ++i) {
+        result.latency.merge(histograms[i]);
+        result.operations += operations[i];
+    }
+    return result;
+}
+
+static Result ping_pong(const Settings& settings, const BenchServer& server,
+        unsigned concurrency, size_t message_size) {
+    return run_clients(concurrency, [&](unsigned, LatencyHistogram& latency) {
+        auto sock_fd = server.connect();
+        vector<char> message(message_size, 'x');
+        vector<char> reply(message_size);
+        auto total = settings.warmup_iterations +
+            settings.ping_pong_iterations;
+        for (size_t i = 0; i < total; ++i) {
+            auto start = Clock::now();
+            SocketUtilities::send_all(sock_fd, message.data(), message.size());
+            if (!recv_exactly(sock_fd, reply.data(), reply.size())) {
+                break;
+            }
+            if (i >= settings.warmup_iterations) {
+                latency.record(nanoseconds_since(start));
+            }
+        }
+        close_with_reset(sock_fd);
+        return static_cast<uint64_t>(settings.ping_pong_iterations);
+    });
+}
+
+/*
+ * Every operation is one chunk written, the latency is how long the whole
+ * transfer took per run, and the rate is reported in bytes
+ */
+static Result throughput(const Settings& settings, const BenchServer& server,
+        unsigned concurrency, size_t chunk_size) {
+
+    auto bytes = settings.throughput_bytes / concurrency;
+    auto result = run_clients(concurrency,
+            [&](unsigned, LatencyHistogram& latency) {
+        auto sock_fd = server.connect();
+        vector<char> chunk(chunk_size, 'x');
+        uint64_t chunks {0};
+        for (size_t run = 0; run < settings.throughput_runs; ++run) {
+            auto start = Clock::now();
+            uint64_t length {bytes};
+            SocketUtilities::send_all(sock_fd, &length, sizeof(length));
+            for (size_t sent = 0; sent < bytes; sent += chunk_size) {
+                SocketUtilities::send_all(sock_fd, chunk.data(),
+                        std::min(chunk_size, bytes - sent));
+                ++chunks;
+            }
+            char acknowledgement;
+            if (!recv_exactly(sock_fd, &acknowledgement, 1)) {
+                break;
+            }
+            latency.record(nanoseconds_since(start));
+        }
+        close_with_reset(sock_fd);
+        return chunks;
+    });
+
+    auto total_bytes = static_cast<double>(bytes) * concurrency *
+        static_cast<double>(settings.throughput_runs);
+    result.extra = ", \"bytes\": "s + to_string(static_cast<uint64_t>(
+                total_bytes)) + ", \"bytes_per_second\": "s +
+        to_string(result.seconds > 0 ? total_bytes / result.seconds : 0);
+    return result;
+}
+
+/*
+ * Connections opened and closed as fast as the server takes them, the clock
+ * stops once the server has accepted every one of them.  The latency is
+ * that of connect()
+ */
+static Result accept_rate(const Settings& settings, BenchServer& server,
+        unsigned concurrency) {
+
+    auto per_client = settings.connections / concurrency;
+    auto before = server.accepted.load();
+    auto start = Clock::now();
+    auto result = run_clients(concurrency,
+            [&](unsigned, LatencyHistogram& latency) {
+        for (size_t i = 0; i < per_client; ++i) {
+            auto start = Clock::now();
+            auto sock_fd = server.connect();
+            latency.record(nanoseconds_since(start));
+            close_with_reset(sock_fd);
+        }
+        return static_cast<uint64_t>(per_client);
+    });
+    while (server.accepted.load() - before < per_client * concurrency) {
+        std::this_thread::yield();
+    }
+    result.seconds = static_cast<double>(nanoseconds_since(start)) / 1e9;
+    return result;
+}
+
+/* A connection, one byte there and back and a close, per operation */
+static Result churn(const Settings& settings, const BenchServer& server,
+        unsigned concurrency) {
+    auto per_client = settings.connections / concurrency;
+    return run_clients(concurrency, [&](unsigned, LatencyHistogram& latency) {
+        for (size_t i = 0; i < per_client; ++i) {
+            auto start = Clock::now();
+            auto sock_fd = server.connect();
+            char byte {'x'};
+            SocketUtilities::send_all(sock_fd, &byte, 1);
+            recv_exactly(sock_fd, &byte, 1);
+            close_with_reset(sock_fd);
+            latency.record(nanoseconds_since(start));
+        }
+        return static_cast<uint64_t>(per_client);
+    });
+}
+
+/*
+ * The shared memory channel between two threads of this process, for
+ * comparison with ping_pong over a unix socket
+ */
+static Result shared_memory_ping_pong(const Settings& settings,
+        size_t message_size) {
+
+    int sockets[2];
+    ::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    std::thread server {[&] {
+        SocketUtilities::SharedMemoryChannel channel {sockets[1],
+            SocketUtilities::SharedMemoryChannel::Role::SERVER};
+        while (channel.receive([&](const char* data, size_t length) {
+            channel.send(data, length);
+        })) {}
+    }};
+
+    auto result = run_clients(1, [&](unsigned, LatencyHistogram& latency) {
+        SocketUtilities::SharedMemoryChannel channel {sockets[0],
+            SocketUtilities::SharedMemoryChannel::Role::CLIENT};
+        vector<char> message(message_size, 'x');
+        auto total = settings.warmup_iterations +
+            settings.ping_pong_iterations;
+        for (size_t i = 0; i < total; ++i) {
+            auto start = Clock::now();
+            channel.send(message.data(), message.size());
+            auto replied = false;
+            while (!replied && channel.receive([&](const char*, size_t) {
+                replied = true;
+            })) {}
+            if (i >= settings.warmup_iterations) {
+                latency.record(nanoseconds_since(start));
+            }
+        }
+        return static_cast<uint64_t>(settings.ping_pong_iterations);
+    });
+
+    server.join();
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+    return result;
+}
+
+static Settings parse_arguments(int argc, char** argv) {
+    Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        string argument {argv[i]};
+        if (argument == "--quick") {
+            settings.quick = true;
+            settings.concurrency = {1, 4};
+            settings.ping_pong_iterations = 2000;
+            settings.warmup_iterations = 200;
+            settings.throughput_bytes = 32 * 1024 * 1024;
+            settings.throughput_runs = 3;
+            settings.connections = 400;
+        } else if (argument == "--filter" && i + 1 < argc) {
+            settings.filter = argv[++i];
+        } else if (argument == "--output" && i + 1 < argc) {
+            settings.output = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--quick] [--filter <text>] "
+                "[--output <file>]" << endl;
+            exit(1);
+        }
+    }
+    return settings;
+}
+
+int main(int argc, char** argv) {
+
+    auto settings = parse_arguments(argc, argv);
+    vector<Result> results;
+
+    // names the result and runs it only if it matches the filter
+    auto run = [&](const string& benchmark, const string& transport,
+            const string& model, unsigned concurrency, size_t message_size,
+            const std::function<Result ()>& benchmark_function) {
+        auto name = benchmark + "/"s + transport + "/"s + model + "/"s +
+            to_string(concurrency);
+        if (name.find(settings.filter) == string::npos) {
+            return;
+        }
+        cerr << " * " << name << endl;
+        auto result = benchmark_function();
+        result.name = name;
+        result.benchmark = benchmark;
+        result.transport = transport;
+        result.model = model;
+        result.message_size = message_size;
+        results.push_back(std::move(result));
+    };
+
+    for (auto transport : {Transport::TCP, Transport::UNIX}) {
+        for (auto model : {Model::THREADED, Model::EVENT_LOOP,
+                Model::SHARDED, Model::COMPLETION_QUEUE, Model::COROUTINE}) {
+            if (model == Model::SHARDED && transport == Transport::UNIX) {
+                continue;
+            }
+            unique_ptr<BenchServer> echo_server;
+            unique_ptr<BenchServer> sink_server;
+            try {
+                echo_server = std::make_unique<BenchServer>(transport, model,
+                        Mode::ECHO);
+                sink_server = std::make_unique<BenchServer>(transport, model,
+                        Mode::SINK);
+            } catch (const std::exception& exception) {
+                cerr << " * Skipping the " << name_of(model) << " model : "
+                    << exception.what() << endl;
+                continue;
+            }
+            auto& echo = *echo_server;
+            auto& sink = *sink_server;
+            for (auto concurrency : settings.concurrency) {
+                run("ping_pong", name_of(transport), name_of(model),
+                        concurrency, 64, [&] {
+                    return ping_pong(settings, echo, concurrency, 64);
+                });
+                run("throughput", name_of(transport), name_of(model),
+                        concurrency, 64 * 1024, [&] {
+                    return throughput(settings, sink, concurrency, 64 * 1024);
+                });
+                run("accept_rate", name_of(transport), name_of(model),
+                        concurrency, 0, [&] {
+                    return accept_rate(settings, echo, concurrency);
+                });
+                run("churn", name_of(transport), name_of(model), concurrency,
+                        1, [&] {
+                    return churn(settings, echo, concurrency);
+                });
+            }
+        }
+    }
+    run("ping_pong", "shared_memory", "channel", 1, 64, [&] {
+        return shared_memory_ping_pong(settings, 64);
+    });
+
+    // one JSON document with everything that was run
+    string json = "{\n  \"cpus\": "s + to_string(
+            std::thread::hardware_concurrency()) + ",\n  \"quick\": "s +
+        (settings.quick ? "true"s : "false"s) + ",\n  \"results\": [\n"s;
+    for (size_t i = 0; i < results.size(); ++i) {
+        json += "    "s + results[i].to_json() +
+            (i + 1 < results.size() ? ",\n"s : "\n"s);
+    }
+    json += "  ]\n}\n";
+
+    if (settings.output.empty()) {
+        cout << json;
+    } else {
+        std::ofstream output {settings.output};
+        output << json;
+        cerr << " * Results written to " << settings.output << endl;
+    }
+    return 0;
+}
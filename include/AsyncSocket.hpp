@@ -0,0 +1 @@
+../src/AsyncSocket.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/BufferPool.hpp
\ No newline at end of file
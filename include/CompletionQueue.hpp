@@ -0,0 +1 @@
+../src/CompletionQueue.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/ConnectionPool.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/Coroutine.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/Datagram.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/DescriptorPassing.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/EventLoop.hpp
\ No newline at end of file
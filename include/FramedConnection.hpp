@@ -0,0 +1 @@
+../src/FramedConnection.hpp
\ No newline at end of file
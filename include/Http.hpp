@@ -0,0 +1 @@
+../src/Http.hpp
\ No newline at end of file
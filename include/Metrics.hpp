@@ -0,0 +1 @@
+../src/Metrics.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/Resolver.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/SharedMemoryChannel.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/SocketOptions.hpp
\ No newline at end of file
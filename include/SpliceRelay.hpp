@@ -0,0 +1 @@
+../src/SpliceRelay.hpp
\ No newline at end of file
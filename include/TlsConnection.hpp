@@ -0,0 +1 @@
+../src/TlsConnection.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/ZeroCopySender.hpp
\ No newline at end of file
@@ -0,0 +1,335 @@
+#include "AsyncSocket.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using SocketUtilities::AcceptOperation;
+using SocketUtilities::AsyncOperation;
+using SocketUtilities::AsyncSocket;
+using SocketUtilities::ConnectOperation;
+using SocketUtilities::EventLoop;
+using SocketUtilities::KernelEventQueue;
+using SocketUtilities::LogLevel;
+using SocketUtilities::Metric;
+using SocketUtilities::RecvOperation;
+using SocketUtilities::SendAllOperation;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::count;
+using SocketUtilities::detail::count_failure;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using SocketUtilities::detail::log_transfer;
+using std::size_t;
+using std::string;
+using std::to_string;
+using namespace std::literals::string_literals; /* for operator "" */
+
+static bool would_block(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+/*
+ * Whether the handshake of a socket has completed, a socket that is still
+ * connecting has no peer yet
+ */
+static bool is_connected(SocketType sock_fd) {
+    sockaddr_storage peer;
+    socklen_t size = sizeof(peer);
+    return ::getpeername(sock_fd, reinterpret_cast<sockaddr*>(&peer),
+            &size) == 0;
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+void AsyncOperation::check_error(const char* operation) const {
+    if (this->error) {
+        throw SocketException {string(operation) + "() returned with error "s +
+            string(std::strerror(this->error))};
+    }
+}
+
+AsyncSocket::AsyncSocket(EventLoop& event_loop_in, SocketType sock_fd_in) :
+        event_loop{&event_loop_in}, sock_fd{sock_fd_in} {
+    SocketUtilities::make_non_blocking(this->sock_fd);
+    this->watch();
+}
+
+AsyncSocket::~AsyncSocket() {
+    this->close();
+}
+
+AsyncSocket::AsyncSocket(AsyncSocket&& other) :
+        event_loop{other.event_loop}, sock_fd{other.sock_fd} {
+    other.sock_fd = -1;
+    this->watch();
+}
+
+AsyncSocket& AsyncSocket::operator=(AsyncSocket&& other) {
+    if (this != &other) {
+        this->close();
+        this->event_loop = other.event_loop;
+        this->sock_fd = other.sock_fd;
+        other.sock_fd = -1;
+        this->watch();
+    }
+    return *this;
+}
+
+void AsyncSocket::watch() {
+
+    // the callback refers to this object so it is replaced whenever the
+    // socket is moved
+    if (this->sock_fd == -1) {
+        return;
+    }
+    this->event_loop->watch(this->sock_fd,
+            [this](const KernelEventQueue::Event& event) {
+        this->on_event(event);
+    });
+}
+
+void AsyncSocket::close() {
+    if (this->sock_fd != -1) {
+        this->event_loop->unwatch(this->sock_fd);
+        ::close(this->sock_fd);
+        this->sock_fd = -1;
+    }
+}
+
+void AsyncSocket::wait_readable(AsyncOperation& operation) {
+    this->reader = &operation;
+}
+
+void AsyncSocket::wait_writable(AsyncOperation& operation) {
+    this->writer = &operation;
+}
+
+void AsyncSocket::on_event(const KernelEventQueue::Event& event) {
+
+    // an error or a hangup is reported to both directions, the operations
+    // then see it from the system call they make
+    auto failed = event.error() || event.hangup();
+    AsyncOperation* completed[2];
+    auto count = 0;
+
+    if (this->writer && (event.writable() || failed)) {
+        auto operation = this->writer;
+        this->writer = nullptr;
+        if (operation->try_complete()) {
+            completed[count++] = operation;
+        } else {
+            operation->wait();
+        }
+    }
+    if (this->reader && (event.readable() || failed)) {
+        auto operation = this->reader;
+        this->reader = nullptr;
+        if (operation->try_complete()) {
+            completed[count++] = operation;
+        } else {
+            operation->wait();
+        }
+    }
+
+    // completing an operation may destroy this socket so nothing in it is
+    // touched from here on
+    for (auto i = 0; i < count; ++i) {
+        completed[i]->on_complete();
+    }
+}
+
+bool RecvOperation::try_complete() {
+
+    while (true) {
+        ssize_t n = ::recv(this->sock.get_socket(), this->buffer,
+                this->length, 0);
+        count_received(n);
+        if (n >= 0) {
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("recv", this->sock.get_socket(), this->buffer, n);
+            }
+            this->received = static_cast<size_t>(n);
+            return true;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        if (would_block(errno)) {
+            return false;
+        }
+        this->error = errno;
+        return true;
+    }
+}
+
+size_t RecvOperation::get_result() const {
+    this->check_error("recv");
+    return this->received;
+}
+
+bool SendAllOperation::try_complete() {
+
+    while (this->sent < this->length) {
+        ssize_t n = ::send(this->sock.get_socket(), this->buffer + this->sent,
+                this->length - this->sent, MSG_NOSIGNAL);
+        count_sent(n);
+        if (n >= 0) {
+            if (static_cast<size_t>(n) < this->length - this->sent) {
+                count(Metric::PARTIAL_WRITES);
+            }
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("send", this->sock.get_socket(),
+                        this->buffer + this->sent, n);
+            }
+            this->sent += static_cast<size_t>(n);
+            continue;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        if (would_block(errno)) {
+            return false;
+        }
+        this->error = errno;
+        return true;
+    }
+    return true;
+}
+
+size_t SendAllOperation::get_result() const {
+    this->check_error("send");
+    return this->sent;
+}
+
+bool AcceptOperation::try_complete() {
+
+    while (true) {
+        this->accepted = ::accept4(this->listener.get_socket(), nullptr,
+                nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (this->accepted != -1) {
+            count(Metric::ACCEPTS);
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output("Accepted connection on socket "s +
+                        to_string(this->accepted));
+            }
+            return true;
+        }
+        count_failure(errno);
+
+        // a connection that was reset while waiting in the backlog is not an
+        // error for the listener
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+        if (would_block(errno)) {
+            return false;
+        }
+        this->error = errno;
+        return true;
+    }
+}
+
+SocketType AcceptOperation::get_result() const {
+    this->check_error("accept");
+    return this->accepted;
+}
+
+ConnectOperation::ConnectOperation(EventLoop& event_loop_in,
+        const string& address, const string& port) :
+        event_loop(event_loop_in) {
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int return_value;
+    if ((return_value = getaddrinfo(address.c_str(), port.c_str(), &hints,
+                    &this->address_information)) != 0) {
+        throw SocketException("getaddrinfo: "s +
+                string(gai_strerror(return_value)));
+    }
+    this->next_address = this->address_information;
+}
+
+ConnectOperation::~ConnectOperation() {
+    freeaddrinfo(this->address_information);
+}
+
+bool ConnectOperation::try_complete() {
+
+    while (true) {
+
+        // woken up by the socket being connected, the outcome of the
+        // handshake is in SO_ERROR
+        if (this->sock) {
+            int socket_error {0};
+            socklen_t size = sizeof(socket_error);
+            if (::getsockopt(this->sock->get_socket(), SOL_SOCKET, SO_ERROR,
+                        &socket_error, &size) == -1) {
+                socket_error = errno;
+            }
+            if (!socket_error && !is_connected(this->sock->get_socket())) {
+                return false;
+            }
+            if (!socket_error) {
+                if (log_enabled(LogLevel::EVENTS)) {
+                    log_output("Connected socket "s +
+                            to_string(this->sock->get_socket()));
+                }
+                return true;
+            }
+            this->error = socket_error;
+            this->failed.push_back(std::move(this->sock));
+        }
+
+        if (!this->next_address) {
+            return true;
+        }
+        auto address = this->next_address;
+        this->next_address = address->ai_next;
+
+        SocketType sock_fd = ::socket(address->ai_family,
+                address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                address->ai_protocol);
+        if (sock_fd == -1) {
+            this->error = errno;
+            continue;
+        }
+        this->sock.reset(new AsyncSocket{this->event_loop, sock_fd});
+
+        // the handshake of a non blocking socket usually completes later, and
+        // the socket becomes writable when it does
+        if (::connect(sock_fd, address->ai_addr, address->ai_addrlen) == 0) {
+            this->error = 0;
+            return true;
+        }
+        if (errno == EINPROGRESS) {
+            this->error = 0;
+            return false;
+        }
+        this->error = errno;
+        this->failed.push_back(std::move(this->sock));
+    }
+}
+
+AsyncSocket ConnectOperation::get_result() {
+    this->check_error("connect");
+    return std::move(*this->sock);
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
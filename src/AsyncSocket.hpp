@@ -0,0 +1,213 @@
+#ifndef __CPP_SOCKETS_ASYNC_SOCKET_HPP__
+#define __CPP_SOCKETS_ASYNC_SOCKET_HPP__
+
+/*
+ * AsyncSocket.hpp
+ *
+ * Non blocking socket operations that wait on an EventLoop instead of
+ * blocking the thread.  Each operation is a small state machine that makes as
+ * much progress as it can without blocking, and when the socket is not ready
+ * it parks itself on the socket until the event loop reports readiness and
+ * then continues from there.
+ *
+ * These are the primitives behind the coroutine awaitables in Coroutine.hpp,
+ * which is what most code should use.  They can be used without coroutines
+ * as well by deriving from an operation and overriding on_complete().
+ */
+
+#include "SocketUtilities.hpp"
+#include "EventLoop.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <netdb.h>
+
+namespace SocketUtilities {
+
+class AsyncSocket;
+
+/*
+ * An operation in progress on an AsyncSocket.  The owner of the operation
+ * first calls try_complete(), and if that returns false calls wait(), after
+ * which the socket calls try_complete() again every time it is ready and
+ * on_complete() once try_complete() has returned true.  The operation must
+ * stay alive until then.
+ */
+class AsyncOperation {
+public:
+    virtual ~AsyncOperation() = default;
+
+    /*
+     * Makes as much progress as possible without blocking.  Returns true once
+     * the operation has finished, successfully or with an error
+     */
+    virtual bool try_complete() = 0;
+
+    /* Parks the operation on the socket that it is waiting for */
+    virtual void wait() = 0;
+
+    /* Called from the event loop once a parked operation has finished */
+    virtual void on_complete() = 0;
+
+    /* The errno value the operation failed with, 0 if it did not */
+    int get_error() const { return this->error; }
+
+protected:
+
+    /* Throws an exception if the operation failed */
+    void check_error(const char* operation) const;
+
+    int error {0};
+};
+
+/*
+ * A non blocking socket registered with an event loop.  The socket is owned
+ * by this object and closed when it is destroyed.  At most one operation may
+ * be waiting to read and one waiting to write at any time, and the socket
+ * must not be destroyed or moved while an operation is waiting on it.
+ *
+ * Only to be used on the thread that runs the event loop.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::AsyncSocket sock {event_loop,
+ *          SocketUtilities::create_client_socket("localhost", "8000")};
+ */
+class AsyncSocket {
+public:
+
+    /*
+     * Takes ownership of the socket, makes it non blocking and watches it on
+     * the event loop
+     */
+    AsyncSocket(EventLoop& event_loop, SocketType sock_fd);
+    ~AsyncSocket();
+
+    AsyncSocket(AsyncSocket&& other);
+    AsyncSocket& operator=(AsyncSocket&& other);
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+    SocketType get_socket() const { return this->sock_fd; }
+    EventLoop& get_event_loop() const { return *this->event_loop; }
+
+    /* Parks an operation until the socket is readable or writable */
+    void wait_readable(AsyncOperation& operation);
+    void wait_writable(AsyncOperation& operation);
+
+private:
+
+    /* Runs the parked operations when the event loop reports the socket */
+    void on_event(const KernelEventQueue::Event& event);
+    void watch();
+    void close();
+
+    EventLoop* event_loop;
+    SocketType sock_fd;
+    AsyncOperation* reader {nullptr};
+    AsyncOperation* writer {nullptr};
+};
+
+/*
+ * Receives whatever is available, at most length bytes.  The result is the
+ * number of bytes received, 0 when the peer has closed the connection.
+ */
+class RecvOperation : public AsyncOperation {
+public:
+    RecvOperation(AsyncSocket& sock_in, void* buffer_in, std::size_t length_in)
+        : sock(sock_in), buffer{buffer_in}, length{length_in} {}
+
+    bool try_complete() override;
+    void wait() override { this->sock.wait_readable(*this); }
+
+    /* ERRORS : Throws an exception if the receive failed */
+    std::size_t get_result() const;
+
+private:
+    AsyncSocket& sock;
+    void* buffer;
+    std::size_t length;
+    std::size_t received {0};
+};
+
+/*
+ * Sends all length bytes, waiting for the socket to drain as many times as
+ * needed.  The result is the number of bytes sent.
+ */
+class SendAllOperation : public AsyncOperation {
+public:
+    SendAllOperation(AsyncSocket& sock_in, const void* buffer_in,
+            std::size_t length_in)
+        : sock(sock_in), buffer{static_cast<const char*>(buffer_in)},
+        length{length_in} {}
+
+    bool try_complete() override;
+    void wait() override { this->sock.wait_writable(*this); }
+
+    /* ERRORS : Throws an exception if the send failed */
+    std::size_t get_result() const;
+
+private:
+    AsyncSocket& sock;
+    const char* buffer;
+    std::size_t length;
+    std::size_t sent {0};
+};
+
+/*
+ * Accepts one connection on a listening socket.  The result is the new
+ * socket, which is already non blocking and should be handed to an
+ * AsyncSocket on the same or another event loop.
+ */
+class AcceptOperation : public AsyncOperation {
+public:
+    explicit AcceptOperation(AsyncSocket& listener_in)
+        : listener(listener_in) {}
+
+    bool try_complete() override;
+    void wait() override { this->listener.wait_readable(*this); }
+
+    /* ERRORS : Throws an exception if accepting failed */
+    SocketType get_result() const;
+
+private:
+    AsyncSocket& listener;
+    SocketType accepted {-1};
+};
+
+/*
+ * Connects to a remote host without blocking on the connection handshake,
+ * trying every address the host resolves to in turn.  The result is the
+ * connected socket.  Name resolution is done in the constructor with
+ * getaddrinfo() which does block.
+ */
+class ConnectOperation : public AsyncOperation {
+public:
+    ConnectOperation(EventLoop& event_loop_in, const std::string& address,
+            const std::string& port);
+    ~ConnectOperation();
+    ConnectOperation(const ConnectOperation&) = delete;
+    ConnectOperation& operator=(const ConnectOperation&) = delete;
+
+    bool try_complete() override;
+    void wait() override { this->sock->wait_writable(*this); }
+
+    /* ERRORS : Throws an exception if no address could be connected to */
+    AsyncSocket get_result();
+
+private:
+    EventLoop& event_loop;
+    addrinfo* address_information {nullptr};
+    addrinfo* next_address {nullptr};
+
+    // the socket being connected, and the ones that failed.  Those are kept
+    // alive until the operation is destroyed since the one reporting a
+    // failure is still running its on_event() while the next address is
+    // tried, and that address may fail straight away as well
+    std::unique_ptr<AsyncSocket> sock;
+    std::vector<std::unique_ptr<AsyncSocket>> failed;
+};
+
+}
+
+#endif
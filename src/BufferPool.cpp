@@ -0,0 +1,325 @@
+#include "BufferPool.hpp"
+#include "SocketException.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+using SocketUtilities::Buffer;
+using SocketUtilities::BufferPool;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::BufferChunk;
+using SocketUtilities::detail::BufferPoolState;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * Chunks move between the free list of a thread and the shared free list of
+ * the pool this many at a time, and a thread keeps at most twice as many
+ */
+static constexpr size_t TRANSFER_BATCH = 32;
+static constexpr size_t THREAD_CACHE_LIMIT = 2 * TRANSFER_BATCH;
+
+/*
+ * The header in front of the memory of every chunk, it takes up exactly one
+ * cache line so that the memory handed out starts on the next one
+ */
+struct SocketUtilities::detail::BufferChunk {
+    std::atomic<std::uint32_t> references;
+    std::size_t length;
+    BufferPoolState* pool;
+    char padding[BufferPool::CACHE_LINE_SIZE - sizeof(std::uint64_t) -
+        sizeof(std::size_t) - sizeof(BufferPoolState*)];
+
+    char* data() {
+        return reinterpret_cast<char*>(this) + sizeof(BufferChunk);
+    }
+};
+static_assert(sizeof(BufferChunk) == BufferPool::CACHE_LINE_SIZE,
+        "the chunk header must fill exactly one cache line");
+
+/* The state shared by a pool and the free lists of every thread using it */
+struct SocketUtilities::detail::BufferPoolState :
+        public std::enable_shared_from_this<BufferPoolState> {
+
+    BufferPoolState(size_t chunk_size_in, size_t chunks_per_slab_in);
+    ~BufferPoolState() {
+        for (auto slab : this->slabs) {
+            std::free(slab);
+        }
+    }
+
+    /* Adds a slab and moves up to count of its chunks into chunks */
+    void grow(vector<BufferChunk*>& chunks, size_t count);
+
+    size_t chunk_size;
+    size_t chunks_per_slab;
+    std::uint64_t id;
+
+    // chunks returned by threads with full free lists, and all the memory
+    mutable std::mutex mutex;
+    vector<BufferChunk*> free_chunks;
+    vector<void*> slabs;
+};
+
+/*
+ * The free lists of one thread, one for every pool the thread has used.  A
+ * thread only ever uses a handful of pools so they are searched linearly,
+ * starting with the one used last
+ */
+class ThreadCache {
+public:
+
+    class FreeList {
+    public:
+        BufferPoolState* pool;
+        std::uint64_t id;
+        std::weak_ptr<BufferPoolState> owner;
+        vector<BufferChunk*> chunks;
+    };
+
+    ~ThreadCache();
+
+    /* The free list of this thread for the pool */
+    FreeList& get_free_list(BufferPoolState* pool);
+
+private:
+    vector<FreeList> free_lists;
+    size_t last_used {0};
+};
+
+/*
+ * Set once the cache of this thread has been destroyed, buffers released by
+ * destructors of other thread local objects after that go straight back to
+ * their pool
+ */
+static thread_local bool thread_cache_destroyed {false};
+static thread_local ThreadCache thread_cache;
+
+static std::atomic<std::uint64_t> next_pool_id {1};
+
+BufferPoolState::BufferPoolState(size_t chunk_size_in,
+        size_t chunks_per_slab_in) :
+        chunk_size{(std::max<size_t>(chunk_size_in, 1) +
+                BufferPool::CACHE_LINE_SIZE - 1) /
+            BufferPool::CACHE_LINE_SIZE * BufferPool::CACHE_LINE_SIZE},
+        chunks_per_slab{std::max<size_t>(chunks_per_slab_in, 1)},
+        id{next_pool_id.fetch_add(1)} {}
+
+void BufferPoolState::grow(vector<BufferChunk*>& chunks, size_t count) {
+
+    auto stride = sizeof(BufferChunk) + this->chunk_size;
+    void* slab;
+    if (::posix_memalign(&slab, BufferPool::CACHE_LINE_SIZE,
+                stride * this->chunks_per_slab)) {
+        throw std::bad_alloc{};
+    }
+    this->slabs.push_back(slab);
+
+    // the shared free list gets room for every chunk there is so that
+    // returning chunks to it never allocates
+    this->free_chunks.reserve(this->slabs.size() * this->chunks_per_slab);
+
+    for (size_t i = 0; i < this->chunks_per_slab; ++i) {
+        auto chunk = new (static_cast<char*>(slab) + i * stride) BufferChunk;
+        chunk->pool = this;
+        (i < count ? chunks : this->free_chunks).push_back(chunk);
+    }
+}
+
+ThreadCache::~ThreadCache() {
+
+    // whatever this thread still holds goes back to pools that are alive
+    for (auto& free_list : this->free_lists) {
+        if (auto pool = free_list.owner.lock()) {
+            std::lock_guard<std::mutex> lck {pool->mutex};
+            pool->free_chunks.insert(pool->free_chunks.end(),
+                    free_list.chunks.begin(), free_list.chunks.end());
+        }
+    }
+    thread_cache_destroyed = true;
+}
+
+ThreadCache::FreeList& ThreadCache::get_free_list(BufferPoolState* pool) {
+
+    if (this->last_used < this->free_lists.size()) {
+        auto& free_list = this->free_lists[this->last_used];
+        if (free_list.pool == pool && free_list.id == pool->id) {
+            return free_list;
+        }
+    }
+    for (size_t i = 0; i < this->free_lists.size(); ++i) {
+        auto& free_list = this->free_lists[i];
+        if (free_list.pool == pool && free_list.id == pool->id) {
+            this->last_used = i;
+            return free_list;
+        }
+    }
+
+    // first use of the pool on this thread, lists of pools that have since
+    // been destroyed are dropped here
+    this->free_lists.erase(std::remove_if(this->free_lists.begin(),
+                this->free_lists.end(), [](const FreeList& free_list) {
+                    return free_list.owner.expired();
+                }), this->free_lists.end());
+    this->free_lists.push_back(FreeList{pool, pool->id,
+            pool->shared_from_this(), {}});
+    this->free_lists.back().chunks.reserve(THREAD_CACHE_LIMIT + 1);
+    this->last_used = this->free_lists.size() - 1;
+    return this->free_lists.back();
+}
+
+/* Gives a chunk nobody refers to any more back to its pool */
+static void release_chunk(BufferChunk* chunk) {
+
+    auto pool = chunk->pool;
+    if (thread_cache_destroyed) {
+        std::lock_guard<std::mutex> lck {pool->mutex};
+        pool->free_chunks.push_back(chunk);
+        return;
+    }
+
+    auto& free_list = thread_cache.get_free_list(pool);
+    free_list.chunks.push_back(chunk);
+    if (free_list.chunks.size() > THREAD_CACHE_LIMIT) {
+        std::lock_guard<std::mutex> lck {pool->mutex};
+        auto first = free_list.chunks.end() - TRANSFER_BATCH;
+        pool->free_chunks.insert(pool->free_chunks.end(), first,
+                free_list.chunks.end());
+        free_list.chunks.erase(first, free_list.chunks.end());
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+Buffer::Buffer(const Buffer& other) : chunk{other.chunk} {
+    if (this->chunk) {
+        this->chunk->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Buffer& Buffer::operator=(const Buffer& other) {
+    if (this->chunk != other.chunk) {
+        this->reset();
+        this->chunk = other.chunk;
+        if (this->chunk) {
+            this->chunk->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return *this;
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        this->reset();
+        this->chunk = other.chunk;
+        other.chunk = nullptr;
+    }
+    return *this;
+}
+
+char* Buffer::data() {
+    return this->chunk ? this->chunk->data() : nullptr;
+}
+
+const char* Buffer::data() const {
+    return this->chunk ? this->chunk->data() : nullptr;
+}
+
+size_t Buffer::size() const {
+    return this->chunk ? this->chunk->length : 0;
+}
+
+size_t Buffer::capacity() const {
+    return this->chunk ? this->chunk->pool->chunk_size : 0;
+}
+
+void Buffer::resize(size_t size) {
+    if (size > this->capacity()) {
+        throw SocketException {"Buffer cannot be resized to "s +
+            to_string(size) + " bytes, its capacity is "s +
+            to_string(this->capacity())};
+    }
+    if (this->chunk) {
+        this->chunk->length = size;
+    }
+}
+
+size_t Buffer::use_count() const {
+    return this->chunk ?
+        this->chunk->references.load(std::memory_order_relaxed) : 0;
+}
+
+void Buffer::reset() {
+
+    // the last handle going away must see every write made through the
+    // others before the chunk is reused
+    if (this->chunk && this->chunk->references.fetch_sub(1,
+                std::memory_order_acq_rel) == 1) {
+        release_chunk(this->chunk);
+    }
+    this->chunk = nullptr;
+}
+
+BufferPool::BufferPool(size_t chunk_size, size_t chunks_per_slab) :
+    state{std::make_shared<BufferPoolState>(chunk_size, chunks_per_slab)} {}
+
+BufferPool::~BufferPool() = default;
+
+Buffer BufferPool::allocate() {
+
+    auto pool = this->state.get();
+    auto& free_list = thread_cache.get_free_list(pool);
+
+    // refill the free list of this thread a batch at a time
+    if (free_list.chunks.empty()) {
+        std::lock_guard<std::mutex> lck {pool->mutex};
+        if (pool->free_chunks.empty()) {
+            pool->grow(free_list.chunks, TRANSFER_BATCH);
+        } else {
+            auto count = std::min(TRANSFER_BATCH, pool->free_chunks.size());
+            auto first = pool->free_chunks.end() - count;
+            free_list.chunks.insert(free_list.chunks.end(), first,
+                    pool->free_chunks.end());
+            pool->free_chunks.erase(first, pool->free_chunks.end());
+        }
+    }
+
+    auto chunk = free_list.chunks.back();
+    free_list.chunks.pop_back();
+    chunk->references.store(1, std::memory_order_relaxed);
+    chunk->length = 0;
+    return Buffer{chunk};
+}
+
+size_t BufferPool::get_chunk_size() const {
+    return this->state->chunk_size;
+}
+
+size_t BufferPool::get_slab_count() const {
+    std::lock_guard<std::mutex> lck {this->state->mutex};
+    return this->state->slabs.size();
+}
+
+ssize_t SocketUtilities::recv(SocketType sock_fd, Buffer& buffer, int flags) {
+    auto n = SocketUtilities::recv(sock_fd, buffer.data(), buffer.capacity(),
+            flags);
+    buffer.resize(static_cast<size_t>(n));
+    return n;
+}
+
+void SocketUtilities::send_all(SocketType sock_fd, const Buffer& buffer) {
+    SocketUtilities::send_all(sock_fd, buffer.data(), buffer.size());
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
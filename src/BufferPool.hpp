@@ -0,0 +1,139 @@
+#ifndef __CPP_SOCKETS_BUFFER_POOL_HPP__
+#define __CPP_SOCKETS_BUFFER_POOL_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace SocketUtilities {
+
+class BufferPool;
+
+namespace detail {
+struct BufferChunk;
+struct BufferPoolState;
+}
+
+/*
+ * A reference counted handle to a chunk of memory from a BufferPool.  Copying
+ * a buffer only copies the handle, so a buffer can be passed from the code
+ * that received into it to a parser and from there to the code that sends it
+ * without the bytes ever being copied.  The chunk goes back to the pool when
+ * the last handle to it is destroyed.
+ *
+ * Every handle to a chunk sees the same bytes and the same size.  The
+ * reference count is atomic so handles can be passed between threads, but
+ * the contents are not synchronized in any way.
+ */
+class Buffer {
+public:
+    Buffer() = default;
+    ~Buffer() { this->reset(); }
+    Buffer(const Buffer& other);
+    Buffer(Buffer&& other) noexcept : chunk{other.chunk} {
+        other.chunk = nullptr;
+    }
+    Buffer& operator=(const Buffer& other);
+    Buffer& operator=(Buffer&& other) noexcept;
+
+    /* The memory of the chunk, aligned to a cache line */
+    char* data();
+    const char* data() const;
+
+    /* The number of bytes in use, and the size of the chunk */
+    std::size_t size() const;
+    std::size_t capacity() const;
+    bool empty() const { return !this->size(); }
+
+    /*
+     * Sets the number of bytes in use, which is shared by all the handles to
+     * the chunk.  Throws an exception if it is more than the capacity
+     */
+    void resize(std::size_t size);
+
+    /* Whether this handle refers to a chunk at all */
+    explicit operator bool() const { return this->chunk; }
+
+    /* The number of handles to the chunk */
+    std::size_t use_count() const;
+
+    /* Lets go of the chunk, returning it to the pool if this was the last */
+    void reset();
+
+private:
+    friend class BufferPool;
+    explicit Buffer(detail::BufferChunk* chunk_in) : chunk{chunk_in} {}
+
+    detail::BufferChunk* chunk {nullptr};
+};
+
+/*
+ * A pool of fixed size buffers for the receive and send paths.  Memory is
+ * taken from the system in slabs of many chunks which are never given back
+ * until the pool is destroyed, and chunks that are released are recycled
+ * through a free list in each thread.  Once the pool has grown to the number
+ * of buffers in flight, allocating and releasing a buffer takes no lock and
+ * does not call malloc().
+ *
+ * Chunks are cache line aligned and a whole number of cache lines long, so
+ * two buffers used by different threads never share a cache line.
+ *
+ * The pool itself is threadsafe and buffers may be released on a different
+ * thread than the one that allocated them.  The pool must outlive all the
+ * buffers allocated from it.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::BufferPool pool {16 * 1024};
+ *      auto buffer = pool.allocate();
+ *      SocketUtilities::recv(sock, buffer);
+ *      auto request = parse(buffer);   // shares the chunk with buffer
+ *      SocketUtilities::send_all(other_sock, buffer);
+ */
+class BufferPool {
+public:
+
+    /* The alignment of every chunk */
+    static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+    /*
+     * chunk_size is rounded up to a multiple of the cache line size, and
+     * memory is taken from the system chunks_per_slab chunks at a time
+     */
+    explicit BufferPool(std::size_t chunk_size = 16 * 1024,
+            std::size_t chunks_per_slab = 64);
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /*
+     * Returns an empty buffer of get_chunk_size() bytes capacity.
+     *
+     * ERRORS : Throws std::bad_alloc when a new slab cannot be allocated.
+     */
+    Buffer allocate();
+
+    /* The capacity of every buffer in the pool */
+    std::size_t get_chunk_size() const;
+
+    /* The number of slabs that have been allocated from the system */
+    std::size_t get_slab_count() const;
+
+private:
+    std::shared_ptr<detail::BufferPoolState> state;
+};
+
+/*
+ * Receives into the whole capacity of the buffer and sets its size to the
+ * number of bytes received, 0 when the peer has closed the connection.
+ *
+ * ERRORS : The same as recv()
+ */
+ssize_t recv(SocketType sock_fd, Buffer& buffer, int flags = 0);
+
+/* Sends the bytes in use in the buffer, see send_all() */
+void send_all(SocketType sock_fd, const Buffer& buffer);
+
+}
+
+#endif
@@ -0,0 +1,486 @@
+#include "CompletionQueue.hpp"
+#include "KernelEventQueue.hpp"
+#include "SocketException.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using SocketUtilities::CompletionQueue;
+using SocketUtilities::KernelEventQueue;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * glibc has no wrappers for the io_uring system calls and this library has
+ * no external requirements, so they are made directly
+ */
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit,
+        unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                min_complete, flags, nullptr, 0));
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, void* argument,
+        unsigned count) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, ring_fd, opcode,
+                argument, count));
+}
+
+/*
+ * The rings are shared with the kernel, the indices written by one side must
+ * be published with release semantics and read with acquire semantics by
+ * the other
+ */
+template <typename Type>
+static Type load_acquire(const Type* location) {
+    return __atomic_load_n(location, __ATOMIC_ACQUIRE);
+}
+template <typename Type>
+static void store_release(Type* location, Type value) {
+    __atomic_store_n(location, value, __ATOMIC_RELEASE);
+}
+
+/* A ring of provided buffers for one buffer group */
+struct BufferRing {
+    io_uring_buf* entries;
+    size_t ring_bytes;
+    unsigned mask;
+    uint16_t tail;
+    size_t buffer_size;
+    vector<char> storage;
+};
+
+class CompletionQueue::Impl {
+public:
+
+    explicit Impl(unsigned entries);
+    ~Impl();
+
+    /* Returns a zeroed entry in the submission queue */
+    io_uring_sqe& get_sqe();
+
+    /* Publishes the queued entries to the kernel, returns how many */
+    unsigned flush();
+
+    /*
+     * Enters the kernel to submit every published entry it has not consumed
+     * yet, and to wait for wait_for completions if that is not 0
+     */
+    void enter(unsigned wait_for);
+
+    /* Moves the completions in the completion queue into reaped */
+    void reap();
+
+    int ring_fd;
+    io_uring_params params;
+
+    // the mappings shared with the kernel
+    void* sq_ring;
+    size_t sq_ring_bytes;
+    void* cq_ring;
+    size_t cq_ring_bytes;
+    io_uring_sqe* sqes;
+    size_t sqes_bytes;
+
+    // pointers into the mappings
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    io_uring_cqe* cqes;
+    unsigned cq_mask;
+
+    // entries handed out by get_sqe() that have not been published yet
+    unsigned sqe_tail {0};
+    unsigned submitted_tail {0};
+
+    std::unordered_map<uint16_t, BufferRing> buffer_rings;
+
+    // completions taken out of the completion queue to make room for more
+    // while submitting, handed out first by the next get_completions()
+    vector<Completion> reaped;
+};
+
+template <typename Type>
+static Type* at_offset(void* base, uint32_t offset) {
+    return reinterpret_cast<Type*>(reinterpret_cast<char*>(base) + offset);
+}
+
+CompletionQueue::Impl::Impl(unsigned entries) {
+
+    std::memset(&this->params, 0, sizeof(this->params));
+    this->ring_fd = io_uring_setup(entries, &this->params);
+    if (this->ring_fd == -1) {
+        throw SocketException {"Error in io_uring_setup() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    // the submission and completion rings share one mapping on all but the
+    // oldest kernels
+    this->sq_ring_bytes = this->params.sq_off.array +
+        this->params.sq_entries * sizeof(unsigned);
+    this->cq_ring_bytes = this->params.cq_off.cqes +
+        this->params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = this->params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        this->sq_ring_bytes = std::max(this->sq_ring_bytes,
+                this->cq_ring_bytes);
+        this->cq_ring_bytes = this->sq_ring_bytes;
+    }
+
+    this->sq_ring = ::mmap(nullptr, this->sq_ring_bytes,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd,
+            IORING_OFF_SQ_RING);
+    this->cq_ring = single_mmap ? this->sq_ring : ::mmap(nullptr,
+            this->cq_ring_bytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_CQ_RING);
+    this->sqes_bytes = this->params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes_memory = ::mmap(nullptr, this->sqes_bytes,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd,
+            IORING_OFF_SQES);
+    if (this->sq_ring == MAP_FAILED || this->cq_ring == MAP_FAILED ||
+            sqes_memory == MAP_FAILED) {
+        auto error = errno;
+        ::close(this->ring_fd);
+        throw SocketException {"Error mapping the io_uring rings : "s +
+            string(std::strerror(error))};
+    }
+    this->sqes = reinterpret_cast<io_uring_sqe*>(sqes_memory);
+
+    this->sq_head = at_offset<unsigned>(this->sq_ring,
+            this->params.sq_off.head);
+    this->sq_tail = at_offset<unsigned>(this->sq_ring,
+            this->params.sq_off.tail);
+    this->sq_array = at_offset<unsigned>(this->sq_ring,
+            this->params.sq_off.array);
+    this->sq_mask = *at_offset<unsigned>(this->sq_ring,
+            this->params.sq_off.ring_mask);
+    this->cq_head = at_offset<unsigned>(this->cq_ring,
+            this->params.cq_off.head);
+    this->cq_tail = at_offset<unsigned>(this->cq_ring,
+            this->params.cq_off.tail);
+    this->cqes = at_offset<io_uring_cqe>(this->cq_ring,
+            this->params.cq_off.cqes);
+    this->cq_mask = *at_offset<unsigned>(this->cq_ring,
+            this->params.cq_off.ring_mask);
+
+    this->sqe_tail = this->submitted_tail = *this->sq_tail;
+}
+
+CompletionQueue::Impl::~Impl() {
+
+    for (auto& buffer_ring : this->buffer_rings) {
+        ::munmap(buffer_ring.second.entries, buffer_ring.second.ring_bytes);
+    }
+    ::munmap(this->sqes, this->sqes_bytes);
+    if (this->cq_ring != this->sq_ring) {
+        ::munmap(this->cq_ring, this->cq_ring_bytes);
+    }
+    ::munmap(this->sq_ring, this->sq_ring_bytes);
+    ::close(this->ring_fd);
+}
+
+io_uring_sqe& CompletionQueue::Impl::get_sqe() {
+
+    // make room by handing what has been queued to the kernel, which
+    // consumes submission entries before io_uring_enter() returns.  It may
+    // consume only some of them so this goes on until there is a free entry,
+    // the entry at the tail may still be waiting for the kernel otherwise
+    while (this->sqe_tail - load_acquire(this->sq_head) >=
+            this->params.sq_entries) {
+        this->flush();
+        this->enter(0);
+    }
+
+    auto& sqe = this->sqes[this->sqe_tail & this->sq_mask];
+    ++this->sqe_tail;
+    std::memset(&sqe, 0, sizeof(sqe));
+    return sqe;
+}
+
+unsigned CompletionQueue::Impl::flush() {
+
+    auto tail = *this->sq_tail;
+    for (auto i = this->submitted_tail; i != this->sqe_tail; ++i) {
+        this->sq_array[tail & this->sq_mask] = i & this->sq_mask;
+        ++tail;
+    }
+    auto to_submit = this->sqe_tail - this->submitted_tail;
+    this->submitted_tail = this->sqe_tail;
+    store_release(this->sq_tail, tail);
+    return to_submit;
+}
+
+void CompletionQueue::Impl::enter(unsigned wait_for) {
+
+    while (true) {
+
+        // everything published and not consumed yet, including what an
+        // earlier call submitted only part of
+        auto to_submit = *this->sq_tail - load_acquire(this->sq_head);
+        if (!to_submit && !wait_for) {
+            return;
+        }
+
+        // the kernel does not wait when it submits fewer entries than asked
+        // to, so the rest is submitted before waiting again
+        unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+        auto submitted = io_uring_enter(this->ring_fd, to_submit, wait_for,
+                flags);
+        if (submitted != -1) {
+            if (static_cast<unsigned>(submitted) >= to_submit) {
+                return;
+            }
+            continue;
+        }
+
+        // a completion queue with no room left is drained here, since the
+        // caller may be in the middle of queueing entries
+        if (errno == EBUSY) {
+            auto before = this->reaped.size();
+            this->reap();
+            auto reaped = static_cast<unsigned>(this->reaped.size() - before);
+            wait_for -= std::min(wait_for, reaped);
+            continue;
+        }
+        if (errno == EINTR || errno == EAGAIN) {
+            continue;
+        }
+        throw SocketException {"Error in io_uring_enter() call : "s +
+            string(std::strerror(errno))};
+    }
+}
+
+void CompletionQueue::Impl::reap() {
+
+    auto head = *this->cq_head;
+    auto tail = load_acquire(this->cq_tail);
+    for (; head != tail; ++head) {
+        auto& cqe = this->cqes[head & this->cq_mask];
+        this->reaped.emplace_back(cqe.user_data, cqe.res, cqe.flags);
+    }
+    store_release(this->cq_head, head);
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+bool CompletionQueue::Completion::more() const {
+    return this->flags & IORING_CQE_F_MORE;
+}
+
+bool CompletionQueue::Completion::has_buffer() const {
+    return this->flags & IORING_CQE_F_BUFFER;
+}
+
+uint16_t CompletionQueue::Completion::get_buffer_id() const {
+    return static_cast<uint16_t>(this->flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+CompletionQueue::CompletionQueue(unsigned entries) :
+    impl_ptr{new Impl{entries}} {}
+
+CompletionQueue::~CompletionQueue() {
+    delete this->impl_ptr;
+}
+
+void CompletionQueue::submit_recv(SocketType sock_fd, void* buffer,
+        size_t length, uint64_t user_data, int flags) {
+
+    auto& sqe = this->impl_ptr->get_sqe();
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = sock_fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(length);
+    sqe.msg_flags = static_cast<uint32_t>(flags);
+    sqe.user_data = user_data;
+}
+
+void CompletionQueue::submit_send(SocketType sock_fd, const void* buffer,
+        size_t length, uint64_t user_data, bool link_next, int flags) {
+
+    auto& sqe = this->impl_ptr->get_sqe();
+    sqe.opcode = IORING_OP_SEND;
+    sqe.fd = sock_fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(length);
+    sqe.msg_flags = static_cast<uint32_t>(flags);
+    sqe.user_data = user_data;
+    if (link_next) {
+        sqe.flags |= IOSQE_IO_LINK;
+    }
+}
+
+void CompletionQueue::submit_accept(SocketType listener, uint64_t user_data,
+        bool multishot, int flags) {
+
+    auto& sqe = this->impl_ptr->get_sqe();
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd = listener;
+    sqe.accept_flags = static_cast<uint32_t>(flags);
+    sqe.user_data = user_data;
+    if (multishot) {
+        sqe.ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+}
+
+void CompletionQueue::submit_multishot_recv(SocketType sock_fd,
+        uint16_t buffer_group, uint64_t user_data) {
+
+    auto& sqe = this->impl_ptr->get_sqe();
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = sock_fd;
+    sqe.ioprio |= IORING_RECV_MULTISHOT;
+    sqe.flags |= IOSQE_BUFFER_SELECT;
+    sqe.buf_group = buffer_group;
+    sqe.user_data = user_data;
+}
+
+void CompletionQueue::submit_poll(FileDescriptorType descriptor,
+        uint32_t mask, uint64_t user_data, bool multishot) {
+
+    auto& sqe = this->impl_ptr->get_sqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = descriptor;
+    sqe.poll32_events = ((mask & KernelEventQueue::READ) ? POLLIN : 0) |
+        ((mask & KernelEventQueue::WRITE) ? POLLOUT : 0);
+    sqe.user_data = user_data;
+    if (multishot) {
+        sqe.len = IORING_POLL_ADD_MULTI;
+    }
+}
+
+void CompletionQueue::submit_cancel(uint64_t target_user_data,
+        uint64_t user_data) {
+
+    auto& sqe = this->impl_ptr->get_sqe();
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = target_user_data;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe.user_data = user_data;
+}
+
+void CompletionQueue::register_buffer_ring(uint16_t buffer_group,
+        unsigned count, size_t buffer_size) {
+
+    if (!count || (count & (count - 1)) || count > (1u << 15)) {
+        throw SocketException {"Buffer ring size must be a power of two no "
+            "larger than 32768"};
+    }
+
+    // the ring of buffer descriptors must be page aligned
+    BufferRing buffer_ring;
+    buffer_ring.ring_bytes = count * sizeof(io_uring_buf);
+    auto memory = ::mmap(nullptr, buffer_ring.ring_bytes,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw SocketException {"Error allocating buffer ring : "s +
+            string(std::strerror(errno))};
+    }
+    buffer_ring.entries = reinterpret_cast<io_uring_buf*>(memory);
+    buffer_ring.mask = count - 1;
+    buffer_ring.tail = 0;
+    buffer_ring.buffer_size = buffer_size;
+    buffer_ring.storage.resize(count * buffer_size);
+
+    io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(memory);
+    registration.ring_entries = count;
+    registration.bgid = buffer_group;
+    if (io_uring_register(this->impl_ptr->ring_fd, IORING_REGISTER_PBUF_RING,
+                &registration, 1) == -1) {
+        auto error = errno;
+        ::munmap(memory, buffer_ring.ring_bytes);
+        throw SocketException {"Error registering buffer ring "s +
+            to_string(buffer_group) + " : "s + string(std::strerror(error))};
+    }
+
+    auto& registered = this->impl_ptr->buffer_rings[buffer_group];
+    registered = std::move(buffer_ring);
+    for (unsigned i = 0; i < count; ++i) {
+        this->recycle_buffer(buffer_group, static_cast<uint16_t>(i));
+    }
+}
+
+char* CompletionQueue::get_buffer(uint16_t buffer_group, uint16_t buffer_id) {
+    auto& buffer_ring = this->impl_ptr->buffer_rings.at(buffer_group);
+    return &buffer_ring.storage[buffer_id * buffer_ring.buffer_size];
+}
+
+void CompletionQueue::recycle_buffer(uint16_t buffer_group,
+        uint16_t buffer_id) {
+
+    auto& buffer_ring = this->impl_ptr->buffer_rings.at(buffer_group);
+    auto& entry = buffer_ring.entries[buffer_ring.tail & buffer_ring.mask];
+    entry.addr = reinterpret_cast<uint64_t>(
+            &buffer_ring.storage[buffer_id * buffer_ring.buffer_size]);
+    entry.len = static_cast<uint32_t>(buffer_ring.buffer_size);
+    entry.bid = buffer_id;
+
+    // the tail of the ring overlays the reserved field of the first entry
+    ++buffer_ring.tail;
+    store_release(&buffer_ring.entries[0].resv, buffer_ring.tail);
+}
+
+unsigned CompletionQueue::submit() {
+    auto to_submit = this->impl_ptr->flush();
+    this->impl_ptr->enter(0);
+    return to_submit;
+}
+
+size_t CompletionQueue::get_completions(vector<Completion>& completions,
+        unsigned wait_for) {
+
+    auto impl = this->impl_ptr;
+    completions.clear();
+
+    // only wait in the kernel when what is already in the completion queue
+    // and what was reaped while submitting is not enough.  The kernel counts
+    // the completions in the queue towards the ones waited for
+    auto reaped = static_cast<unsigned>(impl->reaped.size());
+    auto available = load_acquire(impl->cq_tail) - *impl->cq_head + reaped;
+    impl->flush();
+    impl->enter(available >= wait_for ? 0 : wait_for - reaped);
+
+    // entering may have reaped more
+    completions.swap(impl->reaped);
+    impl->reaped.clear();
+    auto head = *impl->cq_head;
+    auto tail = load_acquire(impl->cq_tail);
+    completions.reserve(completions.size() + (tail - head));
+    for (; head != tail; ++head) {
+        auto& cqe = impl->cqes[head & impl->cq_mask];
+        completions.emplace_back(cqe.user_data, cqe.res, cqe.flags);
+    }
+    store_release(impl->cq_head, head);
+
+    return completions.size();
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
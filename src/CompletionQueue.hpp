@@ -0,0 +1,189 @@
+#ifndef __CPP_SOCKETS_COMPLETION_QUEUE_HPP__
+#define __CPP_SOCKETS_COMPLETION_QUEUE_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace SocketUtilities {
+
+
+/*
+ * A completion based counterpart to KernelEventQueue built on io_uring.
+ * Instead of waiting for a socket to become ready and then making the system
+ * call, operations (recv, send, accept and so on) are described in a
+ * submission queue shared with the kernel and their results are picked up
+ * from a completion queue later.  Any number of operations are submitted and
+ * reaped with a single system call, and often none at all.
+ *
+ * Every operation carries a 64 bit user_data value chosen by the caller that
+ * is handed back with its completion, usually a pointer to or an index of
+ * the connection it belongs to.
+ *
+ * Two io_uring features are exposed for servers
+ *
+ *      1. Multishot operations.  A single multishot accept keeps producing
+ *         a completion for every new connection, and a single multishot recv
+ *         keeps producing a completion every time data arrives, until they
+ *         fail or are cancelled.  Completions with more() set mean that the
+ *         operation is still armed.
+ *
+ *      2. Provided buffer rings.  Rather than dedicating a buffer to every
+ *         pending recv, a pool of buffers is registered with the kernel and
+ *         each multishot recv picks one only when data actually arrives.  The
+ *         completion tells which buffer was used, and the buffer must be
+ *         handed back with recycle_buffer() once the data has been consumed.
+ *
+ * Sends may be linked so that the next operation only starts once the
+ * previous one has completed, which keeps the order of writes to a socket
+ * without waiting for each of them.
+ *
+ * This class is not threadsafe, one queue is meant to be owned by one thread
+ * (run one per thread for more cores).  Buffers passed to operations must
+ * stay alive until their completion has been reaped.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::CompletionQueue ring;
+ *      ring.register_buffer_ring(0, 1024, 4096);
+ *      ring.submit_accept(listener, ACCEPT_TAG);
+ *
+ *      std::vector<SocketUtilities::CompletionQueue::Completion> completions;
+ *      while (true) {
+ *          ring.get_completions(completions);
+ *          for (auto& completion : completions) {
+ *              if (completion.get_user_data() == ACCEPT_TAG) {
+ *                  ring.submit_multishot_recv(completion.get_result(), 0,
+ *                      completion.get_result());
+ *              } else if (completion.has_buffer()) {
+ *                  auto data = ring.get_buffer(0, completion.get_buffer_id());
+ *                  // consume completion.get_result() bytes of data
+ *                  ring.recycle_buffer(0, completion.get_buffer_id());
+ *              }
+ *          }
+ *      }
+ */
+class CompletionQueue {
+public:
+
+    /* A completed operation as reported by the kernel */
+    class Completion {
+    public:
+        Completion() = default;
+        Completion(std::uint64_t user_data_in, int result_in,
+                std::uint32_t flags_in) : user_data{user_data_in},
+            result{result_in}, flags{flags_in} {}
+
+        /* The value passed in when the operation was submitted */
+        std::uint64_t get_user_data() const { return this->user_data; }
+
+        /*
+         * The result of the operation, what the equivalent system call would
+         * have returned (bytes transferred, the accepted socket) or a
+         * negative errno value on failure
+         */
+        int get_result() const { return this->result; }
+
+        /* A multishot operation that will produce more completions */
+        bool more() const;
+
+        /* Whether data was received into a buffer from a buffer ring */
+        bool has_buffer() const;
+        std::uint16_t get_buffer_id() const;
+
+    private:
+        std::uint64_t user_data {0};
+        int result {0};
+        std::uint32_t flags {0};
+    };
+
+    /*
+     * Creates a queue with room for the given number of operations in
+     * flight.  Throws an exception if the kernel does not support io_uring
+     * or refuses to create one
+     */
+    explicit CompletionQueue(unsigned entries = 256);
+    ~CompletionQueue();
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    /*
+     * Queue an operation.  Nothing is sent to the kernel until submit() or
+     * get_completions() is called, unless the submission queue is full in
+     * which case the queued operations are submitted first to make room.
+     *
+     * link_next makes the operation queued right after this one wait for
+     * this one to complete, and fail if this one fails
+     */
+    void submit_recv(SocketType sock_fd, void* buffer, std::size_t length,
+            std::uint64_t user_data, int flags = 0);
+    void submit_send(SocketType sock_fd, const void* buffer,
+            std::size_t length, std::uint64_t user_data,
+            bool link_next = false, int flags = MSG_NOSIGNAL);
+    void submit_accept(SocketType listener, std::uint64_t user_data,
+            bool multishot = true,
+            int flags = SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    /*
+     * A recv that stays armed and picks a buffer from the buffer ring of the
+     * group every time data arrives.  Completes with -ENOBUFS (and stops)
+     * when the ring has run out of buffers, in which case the buffers should
+     * be recycled and the recv submitted again
+     */
+    void submit_multishot_recv(SocketType sock_fd,
+            std::uint16_t buffer_group, std::uint64_t user_data);
+
+    /*
+     * Readiness notification through the ring, the mask uses the READ and
+     * WRITE values of KernelEventQueue::InterestMask.  The result of the
+     * completion is the poll() mask that was signalled
+     */
+    void submit_poll(FileDescriptorType descriptor, std::uint32_t mask,
+            std::uint64_t user_data, bool multishot = false);
+
+    /* Cancels all the operations that were submitted with target_user_data */
+    void submit_cancel(std::uint64_t target_user_data,
+            std::uint64_t user_data);
+
+    /*
+     * Registers a ring of count buffers of buffer_size bytes each for the
+     * group, for use with submit_multishot_recv().  count must be a power of
+     * two.  The memory is owned by the queue
+     */
+    void register_buffer_ring(std::uint16_t buffer_group, unsigned count,
+            std::size_t buffer_size);
+
+    /* The memory of a buffer in a ring, and handing it back to the kernel */
+    char* get_buffer(std::uint16_t buffer_group, std::uint16_t buffer_id);
+    void recycle_buffer(std::uint16_t buffer_group, std::uint16_t buffer_id);
+
+    /*
+     * Sends every queued operation to the kernel, returns how many were
+     * submitted
+     */
+    unsigned submit();
+
+    /*
+     * Submits all the queued operations and waits for at least wait_for
+     * completions, all with one system call.  With wait_for set to 0 this
+     * does not block and if nothing was queued it does not even enter the
+     * kernel.  Every completion that is available is moved into the vector,
+     * which is cleared first and reused.  Returns the number of completions
+     */
+    std::size_t get_completions(std::vector<Completion>& completions,
+            unsigned wait_for = 1);
+
+private:
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+
+}
+
+#endif
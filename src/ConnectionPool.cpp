@@ -0,0 +1,244 @@
+#include "ConnectionPool.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+
+using SocketUtilities::ConnectionPool;
+using SocketUtilities::LogLevel;
+using SocketUtilities::SocketRAII;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::size_t;
+using std::string;
+using std::to_string;
+using namespace std::literals::string_literals; /* for operator "" */
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * Checks without blocking whether an idle connection can still be used.  An
+ * idle connection should have nothing to read, if the peer has closed it the
+ * peek sees the end of the stream and if anything else is waiting (a late
+ * response, an error) the connection is not in a state to be reused either
+ */
+static bool is_usable(SocketType sock_fd) {
+    char byte;
+    ssize_t n;
+    do {
+        n = ::recv(sock_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    } while (n == -1 && errno == EINTR);
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* An idle connection and when it was returned to the pool */
+class IdleConnection {
+public:
+    IdleConnection(SocketRAII sock_in, Clock::time_point since_in) :
+        sock{std::move(sock_in)}, since{since_in} {}
+
+    SocketRAII sock;
+    Clock::time_point since;
+};
+
+/*
+ * The idle connections of the endpoints that hash to one shard.  Connections
+ * are reused last in first out so the most recently used (and most likely
+ * alive) connection is handed out first and the oldest ones sit at the front
+ * where they expire.  Shards are padded to a cache line so that the locks of
+ * neighbouring shards do not share one
+ */
+class Shard {
+public:
+    std::mutex mutex;
+    std::unordered_map<string, std::deque<IdleConnection>> endpoints;
+    char padding[64];
+};
+
+class ConnectionPool::Impl {
+public:
+
+    Impl(size_t max_idle_in, int idle_timeout_in, unsigned shards) :
+        max_idle{max_idle_in}, idle_timeout{idle_timeout_in},
+        shards(std::max(shards, 1u)) {}
+
+    Shard& get_shard(const string& key) {
+        return this->shards[std::hash<string>{}(key) % this->shards.size()];
+    }
+
+    bool is_expired(const IdleConnection& idle, Clock::time_point now) const {
+        return now - idle.since >= this->idle_timeout;
+    }
+
+    size_t max_idle;
+    std::chrono::milliseconds idle_timeout;
+    std::vector<Shard> shards;
+};
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+ConnectionPool::Lease::Lease(ConnectionPool& pool_in, string key_in,
+        SocketRAII sock_in, bool reused_in) : pool{&pool_in},
+    key{std::move(key_in)}, sock{std::move(sock_in)}, reused{reused_in} {}
+
+ConnectionPool::Lease::Lease(Lease&& other) : pool{other.pool},
+        key{std::move(other.key)}, sock{std::move(other.sock)},
+        reused{other.reused}, reusable{other.reusable} {
+    other.pool = nullptr;
+}
+
+ConnectionPool::Lease::~Lease() {
+    if (this->pool && this->reusable) {
+        this->pool->give_back(this->key, std::move(this->sock));
+    }
+}
+
+ConnectionPool::ConnectionPool(size_t max_idle_per_endpoint, int idle_timeout,
+        unsigned shards) :
+    impl_ptr{new Impl{max_idle_per_endpoint, idle_timeout, shards}} {}
+
+ConnectionPool::~ConnectionPool() {
+    delete this->impl_ptr;
+}
+
+ConnectionPool::Lease ConnectionPool::checkout(const string& address,
+        const string& port) {
+    return this->checkout("tcp:"s + address + ":"s + port, address, port,
+            false);
+}
+
+ConnectionPool::Lease ConnectionPool::checkout_unix(
+        const string& socket_path) {
+    return this->checkout("unix:"s + socket_path, socket_path, "", true);
+}
+
+ConnectionPool::Lease ConnectionPool::checkout(const string& key,
+        const string& first, const string& second, bool unix_socket) {
+
+    auto& shard = this->impl_ptr->get_shard(key);
+    while (true) {
+
+        // take the most recently returned connection out under the lock and
+        // check it after letting go of the lock
+        std::unique_lock<std::mutex> lck {shard.mutex};
+        auto endpoint = shard.endpoints.find(key);
+        if (endpoint == shard.endpoints.end() || endpoint->second.empty()) {
+            break;
+        }
+        auto& idle_connections = endpoint->second;
+        if (this->impl_ptr->is_expired(idle_connections.back(),
+                    Clock::now())) {
+
+            // the newest connection is the last to expire, so all of them
+            // have, they are closed once the lock has been released
+            auto expired = std::move(idle_connections);
+            shard.endpoints.erase(endpoint);
+            lck.unlock();
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output("Expired "s + to_string(expired.size()) +
+                        " idle connections to "s + key);
+            }
+            break;
+        }
+
+        SocketRAII sock {std::move(idle_connections.back().sock)};
+        idle_connections.pop_back();
+        lck.unlock();
+
+        if (is_usable(sock)) {
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output("Reusing connection on socket "s +
+                        to_string(static_cast<SocketType>(sock)) + " to "s +
+                        key);
+            }
+            return Lease{*this, key, std::move(sock), true};
+        }
+    }
+
+    auto sock_fd = unix_socket ?
+        SocketUtilities::create_client_unix_socket(first) :
+        SocketUtilities::create_client_socket(first, second);
+    return Lease{*this, key, SocketRAII{sock_fd}, false};
+}
+
+void ConnectionPool::give_back(const string& key, SocketRAII sock) noexcept {
+
+    // this runs in the destructor of a lease, so a failure to allocate room
+    // for the connection closes it rather than throwing.  Connections that
+    // were moved out of the pool before that are closed with expired
+    try {
+        auto& shard = this->impl_ptr->get_shard(key);
+        auto now = Clock::now();
+        std::deque<IdleConnection> expired;
+        std::lock_guard<std::mutex> lck {shard.mutex};
+        auto& idle_connections = shard.endpoints[key];
+
+        // the oldest connections are at the front
+        while (!idle_connections.empty() &&
+                this->impl_ptr->is_expired(idle_connections.front(), now)) {
+            expired.push_back(std::move(idle_connections.front()));
+            idle_connections.pop_front();
+        }
+
+        // a full pool closes the connection when sock goes out of scope
+        if (idle_connections.size() < this->impl_ptr->max_idle) {
+            idle_connections.emplace_back(std::move(sock), now);
+        }
+    } catch (...) {
+        // sock still owns the connection and closes it on return
+    }
+}
+
+size_t ConnectionPool::expire_idle() {
+
+    auto now = Clock::now();
+    size_t closed {0};
+    for (auto& shard : this->impl_ptr->shards) {
+        std::deque<IdleConnection> expired;
+        {
+            std::lock_guard<std::mutex> lck {shard.mutex};
+            for (auto endpoint = shard.endpoints.begin();
+                    endpoint != shard.endpoints.end();) {
+                auto& idle_connections = endpoint->second;
+                while (!idle_connections.empty() && this->impl_ptr->is_expired(
+                            idle_connections.front(), now)) {
+                    expired.push_back(std::move(idle_connections.front()));
+                    idle_connections.pop_front();
+                }
+                if (idle_connections.empty()) {
+                    endpoint = shard.endpoints.erase(endpoint);
+                } else {
+                    ++endpoint;
+                }
+            }
+        }
+        closed += expired.size();
+    }
+    return closed;
+}
+
+size_t ConnectionPool::get_idle_count() const {
+    size_t count {0};
+    for (auto& shard : this->impl_ptr->shards) {
+        std::lock_guard<std::mutex> lck {shard.mutex};
+        for (const auto& endpoint : shard.endpoints) {
+            count += endpoint.second.size();
+        }
+    }
+    return count;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,146 @@
+#ifndef __CPP_SOCKETS_CONNECTION_POOL_HPP__
+#define __CPP_SOCKETS_CONNECTION_POOL_HPP__
+
+#include "SocketUtilities.hpp"
+#include "SocketRAII.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace SocketUtilities {
+
+
+/*
+ * A pool of idle client connections for reuse across requests, keyed by the
+ * remote host and port or by the path of a unix socket.  Reusing a
+ * connection skips name resolution, the TCP handshake and slow start.
+ *
+ * Connections are checked out as a Lease.  Once the caller is done with a
+ * request it calls done() on the lease, which then hands the connection back
+ * to the pool when it is destroyed.  A lease destroyed without done(), by an
+ * exception thrown halfway through a request for example, closes the
+ * connection instead.  Before an idle connection is handed out it
+ * is checked with a non blocking MSG_PEEK, a connection the peer has closed
+ * (or that has unexpected data waiting on it) is dropped and the next one is
+ * tried, and a new connection is made only when no idle one is usable.
+ * Connections that have been idle longer than the idle timeout are closed
+ * rather than reused.
+ *
+ * The pool is threadsafe.  Endpoints are spread over a number of shards each
+ * with its own lock, so threads using different endpoints rarely contend and
+ * no lock is held during a system call.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::ConnectionPool pool;
+ *      {
+ *          auto connection = pool.checkout("backend", "8080");
+ *          SocketUtilities::send_all(connection, request.data(),
+ *                  request.size());
+ *          // read the whole response
+ *          connection.done();
+ *      }   // the connection goes back to the pool here
+ */
+class ConnectionPool {
+public:
+
+    /*
+     * A connection checked out of the pool.  Like SocketRAII a lease owns its
+     * socket and can be moved but not assigned.  On destruction the socket is
+     * returned to the pool for reuse if done() has been called, and closed
+     * otherwise.  Only call done() once the connection is in a state the next
+     * user can start from, for example after the full response to the last
+     * request has been read.
+     */
+    class Lease {
+    public:
+        Lease(Lease&& other);
+        ~Lease();
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        /* The socket of the connection */
+        SocketType get_socket() { return this->sock; }
+        operator SocketType () { return this->sock; }
+
+        /* Whether the connection was reused rather than newly made */
+        bool is_reused() const { return this->reused; }
+
+        /*
+         * Marks the connection as ready for the next user, it goes back to
+         * the pool when the lease is destroyed
+         */
+        void done() { this->reusable = true; }
+
+        /* Closes the connection instead of returning it, undoes done() */
+        void discard() { this->reusable = false; }
+
+    private:
+        friend class ConnectionPool;
+        Lease(ConnectionPool& pool_in, std::string key_in, SocketRAII sock_in,
+                bool reused_in);
+
+        ConnectionPool* pool;
+        std::string key;
+        SocketRAII sock;
+        bool reused;
+        bool reusable {false};
+    };
+
+    /* The defaults for the constructor */
+    static constexpr std::size_t DEFAULT_MAX_IDLE_PER_ENDPOINT = 16;
+    static constexpr int DEFAULT_IDLE_TIMEOUT = 60000;
+    static constexpr unsigned DEFAULT_SHARDS = 16;
+
+    /*
+     * At most max_idle_per_endpoint idle connections are kept for each
+     * endpoint, extra ones are closed when returned.  Connections idle for
+     * more than idle_timeout milliseconds are closed
+     */
+    explicit ConnectionPool(
+            std::size_t max_idle_per_endpoint = DEFAULT_MAX_IDLE_PER_ENDPOINT,
+            int idle_timeout = DEFAULT_IDLE_TIMEOUT,
+            unsigned shards = DEFAULT_SHARDS);
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /*
+     * Checks out a connection to the host and port, or to the unix socket at
+     * the path, reusing an idle one when possible and otherwise connecting
+     * with create_client_socket() or create_client_unix_socket().
+     *
+     * ERRORS : Throws an exception if a new connection cannot be made.
+     */
+    Lease checkout(const std::string& address, const std::string& port);
+    Lease checkout_unix(const std::string& socket_path);
+
+    /*
+     * Closes every connection that has been idle for longer than the idle
+     * timeout and returns how many were closed.  Expired connections are
+     * never handed out, calling this periodically only gives the descriptors
+     * back sooner
+     */
+    std::size_t expire_idle();
+
+    /* The number of idle connections in the pool */
+    std::size_t get_idle_count() const;
+
+private:
+
+    Lease checkout(const std::string& key, const std::string& first,
+            const std::string& second, bool unix_socket);
+    void give_back(const std::string& key, SocketRAII sock) noexcept;
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef __CPP_SOCKETS_COROUTINE_HPP__
+#define __CPP_SOCKETS_COROUTINE_HPP__
+
+/*
+ * Coroutine.hpp
+ *
+ * C++20 coroutines over the event loop.  Instead of splitting the handling of
+ * a connection across callbacks, each connection can be written as straight
+ * line code that co_awaits its socket operations
+ *
+ *      SocketUtilities::Task<> serve(SocketUtilities::AsyncSocket sock) {
+ *          std::array<char, 4096> buffer;
+ *          while (auto n = co_await SocketUtilities::async_recv(sock,
+ *                      buffer.data(), buffer.size())) {
+ *              co_await SocketUtilities::async_send_all(sock, buffer.data(),
+ *                      n);
+ *          }
+ *      }
+ *
+ * An operation that cannot complete right away suspends the coroutine, which
+ * is resumed by the event loop once the socket is ready, so any number of
+ * connections are served by the one thread running the loop.  Operations
+ * that can complete right away do so without suspending.
+ *
+ * The library itself is built as C++14, this header is only usable from code
+ * built as C++20 and needs nothing from the library beyond AsyncSocket.hpp.
+ */
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "Coroutine.hpp requires C++20 coroutines, compile with -std=c++20"
+#endif
+
+#include "SocketUtilities.hpp"
+#include "AsyncSocket.hpp"
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace SocketUtilities {
+
+namespace detail {
+
+/*
+ * The allocator for coroutine frames.  A server creates and destroys a frame
+ * for every connection and often one for every request, and frames of the
+ * same coroutine always have the same size, so freed frames are kept on per
+ * thread free lists by size class and reused without going to the general
+ * purpose allocator.  Frames may be freed on a different thread than the one
+ * that allocated them, they then simply move to that thread's lists.
+ */
+class FramePool {
+public:
+
+    static constexpr std::size_t GRANULARITY = 64;
+    static constexpr std::size_t SIZE_CLASSES = 32;
+    static constexpr std::size_t MAX_CACHED_PER_CLASS = 256;
+
+    static void* allocate(std::size_t size) {
+        auto size_class = (size + GRANULARITY - 1) / GRANULARITY;
+        if (size_class >= SIZE_CLASSES) {
+            return ::operator new(size);
+        }
+
+        auto& free_list = local().free_lists[size_class];
+        if (free_list.head) {
+            auto block = free_list.head;
+            free_list.head = block->next;
+            --free_list.count;
+            return block;
+        }
+        return ::operator new(size_class * GRANULARITY);
+    }
+
+    static void deallocate(void* frame, std::size_t size) {
+        auto size_class = (size + GRANULARITY - 1) / GRANULARITY;
+        if (size_class >= SIZE_CLASSES) {
+            ::operator delete(frame);
+            return;
+        }
+
+        auto& free_list = local().free_lists[size_class];
+        if (free_list.count >= MAX_CACHED_PER_CLASS) {
+            ::operator delete(frame);
+            return;
+        }
+        auto block = static_cast<Block*>(frame);
+        block->next = free_list.head;
+        free_list.head = block;
+        ++free_list.count;
+    }
+
+private:
+
+    struct Block {
+        Block* next;
+    };
+    struct FreeList {
+        Block* head {nullptr};
+        std::size_t count {0};
+    };
+    struct FreeLists {
+        ~FreeLists() {
+            for (auto& free_list : this->free_lists) {
+                while (free_list.head) {
+                    auto block = free_list.head;
+                    free_list.head = block->next;
+                    ::operator delete(block);
+                }
+            }
+        }
+        FreeList free_lists[SIZE_CLASSES];
+    };
+
+    static FreeLists& local() {
+        thread_local FreeLists free_lists;
+        return free_lists;
+    }
+};
+
+/* The parts of the promise of a Task that do not depend on its result */
+class TaskPromiseBase {
+public:
+
+    static void* operator new(std::size_t size) {
+        return FramePool::allocate(size);
+    }
+    static void operator delete(void* frame, std::size_t size) {
+        FramePool::deallocate(frame, size);
+    }
+
+    /*
+     * When a task finishes, whoever co_awaited it is resumed directly (with
+     * symmetric transfer, so long chains of tasks do not grow the stack) and
+     * a spawned task that nobody waits for frees itself
+     */
+    class FinalAwaiter {
+    public:
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<Promise> handle) noexcept {
+            auto& promise = handle.promise();
+            if (promise.continuation) {
+                return promise.continuation;
+            }
+            if (promise.detached) {
+                handle.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { this->exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool detached {false};
+};
+
+template <typename Type>
+class TaskPromise;
+
+/*
+ * Turns one of the operations in AsyncSocket.hpp into an awaitable.  The
+ * operation is tried when it is awaited and the coroutine only suspends if it
+ * could not complete
+ */
+template <typename Operation>
+class OperationAwaitable : public Operation {
+public:
+    using Operation::Operation;
+
+    bool await_ready() { return this->try_complete(); }
+    void await_suspend(std::coroutine_handle<> handle) {
+        this->waiting = handle;
+        this->wait();
+    }
+    decltype(auto) await_resume() { return this->get_result(); }
+
+    void on_complete() override { this->waiting.resume(); }
+
+private:
+    std::coroutine_handle<> waiting;
+};
+
+} // namespace detail
+
+/*
+ * A coroutine producing a value of the given type.  Tasks are lazy, nothing
+ * runs until the task is co_awaited from another coroutine, or handed to
+ * spawn() to run on its own.  An exception thrown in the task is rethrown
+ * from the co_await.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::Task<std::size_t> read_some(
+ *              SocketUtilities::AsyncSocket& sock, std::string& out) {
+ *          char buffer[1024];
+ *          auto n = co_await SocketUtilities::async_recv(sock, buffer,
+ *                  sizeof(buffer));
+ *          out.append(buffer, n);
+ *          co_return n;
+ *      }
+ */
+template <typename Type = void>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<Type>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle_in)
+        : handle{handle_in} {}
+    Task(Task&& other) noexcept : handle{std::exchange(other.handle, {})} {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            this->destroy();
+            this->handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { this->destroy(); }
+
+    /*
+     * Runs the task until it finishes and resumes the awaiting coroutine.
+     * Awaiting an empty task, one that was moved from or released, throws
+     * std::logic_error
+     */
+    auto operator co_await() && noexcept {
+        class Awaiter {
+        public:
+            bool await_ready() noexcept {
+                return !this->handle || this->handle.done();
+            }
+            std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<> awaiting) noexcept {
+                this->handle.promise().continuation = awaiting;
+                return this->handle;
+            }
+            Type await_resume() {
+                if (!this->handle) {
+                    throw std::logic_error {"co_await on an empty Task"};
+                }
+                return this->handle.promise().get_result();
+            }
+            std::coroutine_handle<promise_type> handle;
+        };
+        return Awaiter{this->handle};
+    }
+
+    /* Gives up ownership of the coroutine, used by spawn() */
+    std::coroutine_handle<promise_type> release() {
+        return std::exchange(this->handle, {});
+    }
+
+private:
+    void destroy() {
+        if (this->handle) {
+            this->handle.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename Type>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<Type> get_return_object() {
+        return Task<Type>{
+            std::coroutine_handle<TaskPromise>::from_promise(*this)};
+    }
+
+    template <typename Value>
+    void return_value(Value&& value) {
+        this->result.emplace(std::forward<Value>(value));
+    }
+
+    Type get_result() {
+        if (this->exception) {
+            std::rethrow_exception(this->exception);
+        }
+        return std::move(*this->result);
+    }
+
+private:
+    std::optional<Type> result;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object() {
+        return Task<void>{
+            std::coroutine_handle<TaskPromise>::from_promise(*this)};
+    }
+
+    void return_void() {}
+
+    void get_result() {
+        if (this->exception) {
+            std::rethrow_exception(this->exception);
+        }
+    }
+};
+
+} // namespace detail
+
+/*
+ * Starts a task that runs on its own, typically the coroutine serving one
+ * connection.  The task runs on the calling thread until its first suspension
+ * and is then resumed by the event loop, its frame is freed when it finishes.
+ * An exception that escapes a spawned task ends the task and is otherwise
+ * ignored, like a connection being dropped.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::Task<> accept_loop(
+ *              SocketUtilities::AsyncSocket& listener) {
+ *          while (true) {
+ *              auto sock = co_await SocketUtilities::async_accept(listener);
+ *              SocketUtilities::spawn(serve(SocketUtilities::AsyncSocket{
+ *                  listener.get_event_loop(), sock}));
+ *          }
+ *      }
+ */
+inline void spawn(Task<void> task) {
+    auto handle = task.release();
+    if (handle) {
+        handle.promise().detached = true;
+        handle.resume();
+    }
+}
+
+/*
+ * Receives at most length bytes, returns the number received and 0 once the
+ * peer has closed the connection.  The buffer must stay alive until the
+ * co_await returns.
+ *
+ * ERRORS : The co_await throws an exception if the receive failed.
+ */
+inline detail::OperationAwaitable<RecvOperation> async_recv(
+        AsyncSocket& sock, void* buffer, std::size_t length) {
+    return {sock, buffer, length};
+}
+
+/*
+ * Sends all length bytes, suspending as often as needed for the socket to
+ * drain.  Returns the number of bytes sent.
+ *
+ * ERRORS : The co_await throws an exception if the send failed.
+ */
+inline detail::OperationAwaitable<SendAllOperation> async_send_all(
+        AsyncSocket& sock, const void* buffer, std::size_t length) {
+    return {sock, buffer, length};
+}
+
+/*
+ * Accepts one connection on the listener, returns the new non blocking
+ * socket.
+ *
+ * ERRORS : The co_await throws an exception if accepting failed.
+ */
+inline detail::OperationAwaitable<AcceptOperation> async_accept(
+        AsyncSocket& listener) {
+    return detail::OperationAwaitable<AcceptOperation>{listener};
+}
+
+/*
+ * Connects to the address and port, returns the connected AsyncSocket.  The
+ * name is resolved before the co_await, and blocks while doing so.
+ *
+ * ERRORS : Throws an exception if the name cannot be resolved, and the
+ *          co_await throws an exception if no address could be connected to.
+ * EXAMPLE :
+ *      auto sock = co_await SocketUtilities::async_connect(event_loop,
+ *              "localhost", "8000");
+ */
+inline detail::OperationAwaitable<ConnectOperation> async_connect(
+        EventLoop& event_loop, const std::string& address,
+        const std::string& port) {
+    return {event_loop, address, port};
+}
+
+}
+
+#endif
@@ -0,0 +1,319 @@
+#include "Datagram.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using SocketUtilities::Datagram;
+using SocketUtilities::LogLevel;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * Room for the control message carrying the segment size, both UDP_SEGMENT
+ * (a uint16_t) and UDP_GRO (an int) fit in here
+ */
+static constexpr size_t SEGMENT_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
+/*
+ * The scratch space for the message headers of a batch.  Kept per thread and
+ * only ever grown, so a steady stream of batches does not allocate
+ */
+struct BatchScratch {
+    void resize(size_t count) {
+        if (this->headers.size() < count) {
+            this->headers.resize(count);
+            this->iovecs.resize(count);
+            this->control.resize(count * SEGMENT_CONTROL_SIZE);
+        }
+        std::memset(this->headers.data(), 0, count * sizeof(mmsghdr));
+    }
+
+    vector<mmsghdr> headers;
+    vector<iovec> iovecs;
+    vector<char> control;
+};
+static thread_local BatchScratch scratch;
+
+/*
+ * Resolves the address and creates a datagram socket for the first result
+ * that works, either binding to it or connecting to it
+ */
+static SocketType create_inet_datagram_socket(const char* address,
+        const string& port, bool bind_to_address) {
+
+    addrinfo hints, *address_information;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;        // ipv4 or ipv6
+    hints.ai_socktype = SOCK_DGRAM;     // UDP socket
+    hints.ai_flags = bind_to_address ? AI_PASSIVE : 0;
+
+    int return_value;
+    if ((return_value = getaddrinfo(address, port.c_str(), &hints,
+                    &address_information)) != 0) {
+        throw SocketException("getaddrinfo: "s +
+                string(gai_strerror(return_value)));
+    }
+
+    SocketType sock_fd {-1};
+    for (auto i = address_information; i; i = i->ai_next) {
+        sock_fd = ::socket(i->ai_family, i->ai_socktype | SOCK_CLOEXEC,
+                i->ai_protocol);
+        if (sock_fd == -1) {
+            continue;
+        }
+
+        int result = bind_to_address ?
+            ::bind(sock_fd, i->ai_addr, i->ai_addrlen) :
+            ::connect(sock_fd, i->ai_addr, i->ai_addrlen);
+        if (result == 0) {
+            break;
+        }
+        ::close(sock_fd);
+        sock_fd = -1;
+    }
+    freeaddrinfo(address_information);
+
+    if (sock_fd == -1) {
+        throw SocketException {"Failed to "s +
+            (bind_to_address ? "bind"s : "connect"s) + " UDP socket to port "s +
+            port};
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Created UDP socket "s + to_string(sock_fd) + " on port "s +
+                port);
+    }
+    return sock_fd;
+}
+
+static sockaddr_un make_unix_address(const string& socket_path) {
+
+    sockaddr_un unix_address;
+    std::memset(&unix_address, 0, sizeof(unix_address));
+    if (socket_path.size() >= sizeof(unix_address.sun_path)) {
+        throw SocketException {"Unix socket path is too long : "s +
+            socket_path};
+    }
+    unix_address.sun_family = AF_UNIX;
+    std::copy(socket_path.begin(), socket_path.end(), unix_address.sun_path);
+    return unix_address;
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+SocketType SocketUtilities::create_udp_socket(const string& port) {
+    return create_inet_datagram_socket(nullptr, port, true);
+}
+
+SocketType SocketUtilities::create_udp_socket(const string& address,
+        const string& port) {
+    return create_inet_datagram_socket(address.c_str(), port, false);
+}
+
+SocketType SocketUtilities::create_unix_dgram_socket(
+        const string& socket_path, const string& remote_path) {
+
+    SocketType unix_socket = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (unix_socket == -1) {
+        throw SocketException {"Error occured in socket() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    try {
+        if (!socket_path.empty()) {
+            auto local_address = make_unix_address(socket_path);
+            ::unlink(socket_path.c_str());
+            if (::bind(unix_socket,
+                        reinterpret_cast<sockaddr*>(&local_address),
+                        sizeof(local_address)) == -1) {
+                throw SocketException {"Error occured in bind() call : "s +
+                    string(std::strerror(errno))};
+            }
+        }
+
+        if (!remote_path.empty()) {
+            auto remote_address = make_unix_address(remote_path);
+            if (::connect(unix_socket,
+                        reinterpret_cast<sockaddr*>(&remote_address),
+                        sizeof(remote_address)) == -1) {
+                throw SocketException {"Error in connect() call : "s +
+                    string(std::strerror(errno))};
+            }
+        }
+    } catch (...) {
+        ::close(unix_socket);
+        throw;
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Created unix datagram socket on file descriptor "s +
+                to_string(unix_socket) + " bound to "s + socket_path);
+    }
+    return unix_socket;
+}
+
+size_t SocketUtilities::recv_datagrams(SocketType sock_fd,
+        Datagram* datagrams, size_t count, int flags) {
+
+    count = std::min(count, static_cast<size_t>(UIO_MAXIOV));
+    if (!count) {
+        return 0;
+    }
+    scratch.resize(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        auto& header = scratch.headers[i].msg_hdr;
+        scratch.iovecs[i] = iovec{datagrams[i].buffer, datagrams[i].length};
+        header.msg_iov = &scratch.iovecs[i];
+        header.msg_iovlen = 1;
+        header.msg_name = &datagrams[i].address;
+        header.msg_namelen = sizeof(datagrams[i].address);
+        header.msg_control = &scratch.control[i * SEGMENT_CONTROL_SIZE];
+        header.msg_controllen = SEGMENT_CONTROL_SIZE;
+    }
+
+    // do not wait for the whole batch to fill up, only for the first one.
+    // A batch is counted as one call that received all of its bytes
+    int n;
+    do {
+        n = ::recvmmsg(sock_fd, scratch.headers.data(),
+                static_cast<unsigned>(count), flags | MSG_WAITFORONE, nullptr);
+        if (n == -1) {
+            count_received(-1);
+        }
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        throw SocketException("recvmmsg() on socket "s + to_string(sock_fd) +
+                " returned with error "s + string(std::strerror(errno)));
+    }
+
+    ssize_t bytes {0};
+    for (int i = 0; i < n; ++i) {
+        auto& header = scratch.headers[i].msg_hdr;
+        auto& datagram = datagrams[i];
+        datagram.length = scratch.headers[i].msg_len;
+        bytes += static_cast<ssize_t>(datagram.length);
+        datagram.address_length = header.msg_namelen;
+        datagram.truncated = header.msg_flags & MSG_TRUNC;
+        datagram.segment_size = 0;
+
+        // the segment size of a coalesced GRO buffer
+        for (auto control = CMSG_FIRSTHDR(&header); control;
+                control = CMSG_NXTHDR(&header, control)) {
+            if (control->cmsg_level == SOL_UDP &&
+                    control->cmsg_type == UDP_GRO) {
+                int segment_size;
+                std::memcpy(&segment_size, CMSG_DATA(control),
+                        sizeof(segment_size));
+                datagram.segment_size = static_cast<std::uint16_t>(
+                        segment_size);
+            }
+        }
+    }
+    count_received(bytes);
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Called recvmmsg() on socket "s + to_string(sock_fd) +
+                " : received "s + to_string(n) + " datagrams"s);
+    }
+    return static_cast<size_t>(n);
+}
+
+size_t SocketUtilities::send_datagrams(SocketType sock_fd,
+        const Datagram* datagrams, size_t count, int flags) {
+
+    size_t total_sent {0};
+    while (total_sent < count) {
+
+        auto batch = std::min(count - total_sent,
+                static_cast<size_t>(UIO_MAXIOV));
+        scratch.resize(batch);
+        for (size_t i = 0; i < batch; ++i) {
+            auto& datagram = datagrams[total_sent + i];
+            auto& header = scratch.headers[i].msg_hdr;
+            scratch.iovecs[i] = iovec{datagram.buffer, datagram.length};
+            header.msg_iov = &scratch.iovecs[i];
+            header.msg_iovlen = 1;
+            if (datagram.address_length) {
+                header.msg_name = const_cast<sockaddr_storage*>(
+                        &datagram.address);
+                header.msg_namelen = datagram.address_length;
+            }
+
+            // ask for segmentation offload for this buffer
+            if (datagram.segment_size) {
+                auto control_buffer = &scratch.control[i *
+                    SEGMENT_CONTROL_SIZE];
+                std::memset(control_buffer, 0, SEGMENT_CONTROL_SIZE);
+                header.msg_control = control_buffer;
+                header.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t));
+                auto control = CMSG_FIRSTHDR(&header);
+                control->cmsg_level = SOL_UDP;
+                control->cmsg_type = UDP_SEGMENT;
+                control->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+                std::memcpy(CMSG_DATA(control), &datagram.segment_size,
+                        sizeof(datagram.segment_size));
+            }
+        }
+
+        int n = ::sendmmsg(sock_fd, scratch.headers.data(),
+                static_cast<unsigned>(batch), flags);
+        if (n == -1) {
+            count_sent(-1);
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            throw SocketException("sendmmsg() on socket "s +
+                    to_string(sock_fd) + " returned with error "s +
+                    string(std::strerror(errno)));
+        }
+        ssize_t bytes {0};
+        for (int i = 0; i < n; ++i) {
+            bytes += static_cast<ssize_t>(scratch.headers[i].msg_len);
+        }
+        count_sent(bytes);
+        total_sent += static_cast<size_t>(n);
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Called sendmmsg() on socket "s + to_string(sock_fd) +
+                " : sent "s + to_string(total_sent) + " datagrams"s);
+    }
+    return total_sent;
+}
+
+bool SocketUtilities::enable_udp_gro(SocketType sock_fd) {
+    int yes = 1;
+    return ::setsockopt(sock_fd, SOL_UDP, UDP_GRO, &yes, sizeof(yes)) == 0;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,138 @@
+#ifndef __CPP_SOCKETS_DATAGRAM_HPP__
+#define __CPP_SOCKETS_DATAGRAM_HPP__
+
+/*
+ * Datagram.hpp
+ *
+ * Factories for UDP and unix datagram sockets, and functions that move many
+ * datagrams with a single system call through recvmmsg() and sendmmsg().
+ * At high packet rates the cost of one system call per packet dominates,
+ * with these a batch of packets costs one system call.
+ *
+ * Optionally UDP generic segmentation offload (GSO) and generic receive
+ * offload (GRO) can be used.  With GSO one large buffer is handed to the
+ * kernel along with a segment size and is split into datagrams of that size
+ * further down the stack.  With GRO the kernel hands back several datagrams
+ * from the same flow coalesced into one buffer along with the segment size.
+ */
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+
+namespace SocketUtilities {
+
+/*
+ * Creates a UDP socket bound to the port on all local addresses.  Like
+ * create_server_socket() this is IP version agnostic.
+ *
+ * ERRORS : Throws an exception in exceptional circumstances.
+ * EXAMPLE :
+ *      auto udp_socket = SocketUtilities::create_udp_socket("9000");
+ */
+SocketType create_udp_socket(const std::string& port);
+
+/*
+ * Creates a UDP socket that is connected to the remote address and port,
+ * datagrams can then be sent without an address and only datagrams from that
+ * peer are received.
+ *
+ * ERRORS : Throws an exception in exceptional circumstances.
+ */
+SocketType create_udp_socket(const std::string& address,
+        const std::string& port);
+
+/*
+ * Creates a unix datagram socket bound to socket_path (unless it is empty)
+ * and connected to remote_path (unless it is empty).  A stale socket file at
+ * socket_path is unlinked first.
+ *
+ * ERRORS : Throws an exception in exceptional circumstances.
+ * EXAMPLE :
+ *      auto receiver = SocketUtilities::create_unix_dgram_socket("./rx");
+ *      auto sender = SocketUtilities::create_unix_dgram_socket("", "./rx");
+ */
+SocketType create_unix_dgram_socket(const std::string& socket_path,
+        const std::string& remote_path = "");
+
+/*
+ * One datagram in a batch.  The buffer belongs to the caller and is never
+ * allocated or freed by this library, so a batch of these together with
+ * their buffers can be set up once and reused for every call.
+ *
+ *  buffer          : the memory holding the datagram
+ *  length          : when receiving, the capacity of the buffer on the way
+ *                    in and the number of bytes received on the way out.
+ *                    When sending, the number of bytes to send
+ *  address         : the peer, filled in when receiving.  When sending it is
+ *                    only used if address_length is not 0, otherwise the
+ *                    socket must be connected
+ *  segment_size    : when sending, a non zero value asks the kernel to split
+ *                    the buffer into datagrams of this size (GSO).  When
+ *                    receiving on a socket with GRO enabled, a non zero value
+ *                    means the buffer holds several datagrams of this size,
+ *                    the last of which may be shorter
+ *  truncated       : set when a received datagram did not fit the buffer
+ */
+struct Datagram {
+    void* buffer;
+    std::size_t length;
+    sockaddr_storage address;
+    socklen_t address_length;
+    std::uint16_t segment_size;
+    bool truncated;
+};
+
+/* Convenience to set up a Datagram over a buffer with no address */
+inline Datagram make_datagram(void* buffer, std::size_t length) {
+    Datagram datagram {};
+    datagram.buffer = buffer;
+    datagram.length = length;
+    return datagram;
+}
+
+/*
+ * Receives up to count datagrams with one recvmmsg() call.  Returns the
+ * number of datagrams received, for each of them length, address and the
+ * other fields are updated.  Blocking sockets wait for the first datagram
+ * only and then take whatever else is already queued.
+ *
+ * ERRORS : A non blocking socket with nothing to read returns 0, other errors
+ *          throw an exception.
+ * EXAMPLE :
+ *      std::vector<std::array<char, 2048>> buffers(64);
+ *      std::vector<SocketUtilities::Datagram> batch(64);
+ *      while (true) {
+ *          for (std::size_t i = 0; i < batch.size(); ++i) {
+ *              batch[i] = SocketUtilities::make_datagram(buffers[i].data(),
+ *                      buffers[i].size());
+ *          }
+ *          auto n = SocketUtilities::recv_datagrams(sock, batch.data(),
+ *                  batch.size());
+ *          // handle the first n datagrams
+ *      }
+ */
+std::size_t recv_datagrams(SocketType sock_fd, Datagram* datagrams,
+        std::size_t count, int flags = 0);
+
+/*
+ * Sends count datagrams with as few sendmmsg() calls as possible.  Returns
+ * the number of datagrams sent, which is less than count only when a non
+ * blocking socket is full, the rest should be sent once it is writable.
+ *
+ * ERRORS : Throws an exception in exceptional circumstances.
+ */
+std::size_t send_datagrams(SocketType sock_fd, const Datagram* datagrams,
+        std::size_t count, int flags = 0);
+
+/*
+ * Asks the kernel to coalesce received datagrams with UDP GRO.  Returns false
+ * if the kernel does not support it, in which case nothing changes.
+ */
+bool enable_udp_gro(SocketType sock_fd);
+
+}
+
+#endif
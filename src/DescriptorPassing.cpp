@@ -0,0 +1,233 @@
+#include "DescriptorPassing.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using SocketUtilities::FileDescriptorType;
+using SocketUtilities::LogLevel;
+using SocketUtilities::PeerCredentials;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/* The most descriptors the kernel passes in one message (SCM_MAX_FD) */
+static constexpr size_t MAX_DESCRIPTORS = 253;
+
+/* Room for the most descriptors and a set of credentials in one message */
+static constexpr size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int) *
+        MAX_DESCRIPTORS) + CMSG_SPACE(sizeof(ucred));
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+PeerCredentials SocketUtilities::get_peer_credentials(SocketType sock_fd) {
+
+    ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (::getsockopt(sock_fd, SOL_SOCKET, SO_PEERCRED, &credentials,
+                &length) == -1) {
+        throw SocketException {"Error in getsockopt(SO_PEERCRED) call : "s +
+            string(std::strerror(errno))};
+    }
+    return PeerCredentials{credentials.pid, credentials.uid, credentials.gid};
+}
+
+void SocketUtilities::set_pass_credentials(SocketType sock_fd, bool enable) {
+    int value = enable ? 1 : 0;
+    if (::setsockopt(sock_fd, SOL_SOCKET, SO_PASSCRED, &value,
+                sizeof(value)) == -1) {
+        throw SocketException {"Error in setsockopt(SO_PASSCRED) call : "s +
+            string(std::strerror(errno))};
+    }
+}
+
+void SocketUtilities::send_descriptors(SocketType sock_fd,
+        const FileDescriptorType* descriptors, size_t count,
+        const void* buffer, size_t length) {
+
+    if (count > MAX_DESCRIPTORS) {
+        throw SocketException {"Cannot send more than "s +
+            to_string(MAX_DESCRIPTORS) + " descriptors in one message"s};
+    }
+
+    // the descriptors have to travel with at least one byte
+    char nothing {0};
+    if (!length) {
+        buffer = &nothing;
+        length = 1;
+    }
+
+    alignas(cmsghdr) char control[CONTROL_SIZE];
+    auto control_length = CMSG_SPACE(sizeof(int) * count);
+    std::memset(control, 0, control_length);
+
+    iovec data = SocketUtilities::make_iovec(buffer, length);
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    if (count) {
+        message.msg_control = control;
+        message.msg_controllen = control_length;
+        auto cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(cmsg), descriptors, sizeof(int) * count);
+    }
+
+    ssize_t n;
+    do {
+        n = ::sendmsg(sock_fd, &message, MSG_NOSIGNAL);
+        count_sent(n);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        throw SocketException {"Error in sendmsg() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Sent "s + to_string(count) + " descriptors on socket "s +
+                to_string(sock_fd));
+    }
+
+    // the descriptors went with the first byte, the rest is plain data
+    if (static_cast<size_t>(n) < length) {
+        SocketUtilities::send_all(sock_fd,
+                static_cast<const char*>(buffer) + n,
+                length - static_cast<size_t>(n));
+    }
+}
+
+void SocketUtilities::send_descriptors(SocketType sock_fd,
+        const vector<FileDescriptorType>& descriptors, const void* buffer,
+        size_t length) {
+    SocketUtilities::send_descriptors(sock_fd, descriptors.data(),
+            descriptors.size(), buffer, length);
+}
+
+ssize_t SocketUtilities::recv_descriptors(SocketType sock_fd, void* buffer,
+        size_t length, vector<FileDescriptorType>& descriptors,
+        PeerCredentials* credentials, int flags) {
+
+    alignas(cmsghdr) char control[CONTROL_SIZE];
+    iovec data = SocketUtilities::make_iovec(buffer, length);
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = ::recvmsg(sock_fd, &message, flags | MSG_CMSG_CLOEXEC);
+        count_received(n);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+        }
+        throw SocketException {"Error in recvmsg() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    // take ownership of everything that arrived before checking anything
+    // else, so that no descriptor is leaked on an error
+    auto first_received = descriptors.size();
+    for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg;
+            cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_RIGHTS) {
+            auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            auto received = reinterpret_cast<const unsigned char*>(
+                    CMSG_DATA(cmsg));
+            for (size_t i = 0; i < count; ++i) {
+                int descriptor;
+                std::memcpy(&descriptor, received + i * sizeof(int),
+                        sizeof(int));
+                descriptors.push_back(descriptor);
+            }
+        } else if (cmsg->cmsg_type == SCM_CREDENTIALS && credentials) {
+            ucred sender;
+            std::memcpy(&sender, CMSG_DATA(cmsg), sizeof(sender));
+            *credentials = PeerCredentials{sender.pid, sender.uid,
+                sender.gid};
+        }
+    }
+
+    if (message.msg_flags & MSG_CTRUNC) {
+        for (auto i = first_received; i < descriptors.size(); ++i) {
+            ::close(descriptors[i]);
+        }
+        descriptors.resize(first_received);
+        throw SocketException {"Descriptors received on socket "s +
+            to_string(sock_fd) + " did not fit in the message"s};
+    }
+
+    if (log_enabled(LogLevel::EVENTS) && descriptors.size() > first_received) {
+        log_output("Received "s + to_string(descriptors.size() -
+                    first_received) + " descriptors on socket "s +
+                to_string(sock_fd));
+    }
+    return n;
+}
+
+std::pair<SocketType, SocketType> SocketUtilities::create_handoff_channel() {
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
+        throw SocketException {"Error in socketpair() call : "s +
+            string(std::strerror(errno))};
+    }
+    return std::make_pair(sockets[0], sockets[1]);
+}
+
+void SocketUtilities::hand_off_socket(SocketType channel, SocketType sock_fd) {
+    SocketUtilities::send_descriptors(channel, &sock_fd, 1);
+    ::close(sock_fd);
+}
+
+SocketType SocketUtilities::receive_socket(SocketType channel) {
+
+    // every handoff is one byte with one descriptor, a message that somehow
+    // came without one is skipped
+    vector<FileDescriptorType> descriptors;
+    while (descriptors.empty()) {
+        char byte;
+        auto n = SocketUtilities::recv_descriptors(channel, &byte, 1,
+                descriptors);
+        if (n == 0) {
+            return -1;
+        }
+        if (n == -1) {
+            throw SocketException {"receive_socket() called on a non "
+                "blocking channel with nothing to receive"};
+        }
+    }
+
+    // more than one arrived only if the sender did not use hand_off_socket()
+    for (size_t i = 1; i < descriptors.size(); ++i) {
+        ::close(descriptors[i]);
+    }
+    return descriptors.front();
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,120 @@
+#ifndef __CPP_SOCKETS_DESCRIPTOR_PASSING_HPP__
+#define __CPP_SOCKETS_DESCRIPTOR_PASSING_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+namespace SocketUtilities {
+
+
+/*
+ * Functions for unix sockets that go beyond a byte stream.  Open descriptors
+ * can be sent to another process (SCM_RIGHTS), which receives its own
+ * descriptor for the same open file or socket, and the identity of the
+ * process at the other end of a unix socket can be asked of the kernel
+ * (SO_PEERCRED) or attached to every message (SCM_CREDENTIALS), neither of
+ * which the peer can forge.
+ */
+
+/* The process and user on the other end of a unix socket */
+struct PeerCredentials {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+};
+
+/*
+ * The credentials of the process that connected the socket (or created the
+ * socket pair) as recorded by the kernel at that time.
+ *
+ * ERRORS : Throws an exception if the socket is not a unix socket
+ */
+PeerCredentials get_peer_credentials(SocketType sock_fd);
+
+/*
+ * Makes the kernel attach the credentials of the sender to every message
+ * received on the socket (SO_PASSCRED), recv_descriptors() then reports them
+ */
+void set_pass_credentials(SocketType sock_fd, bool enable = true);
+
+/*
+ * Sends count descriptors to the process at the other end of a unix socket
+ * together with length bytes of data.  At least one byte has to go with the
+ * descriptors, a single 0 byte is sent when no data is given.  The
+ * descriptors stay open in this process, the receiver gets new ones for the
+ * same open files.  Blocks until all the data has been sent.
+ *
+ * ERRORS : Throws an exception in exceptional conditions
+ */
+void send_descriptors(SocketType sock_fd, const FileDescriptorType* descriptors,
+        std::size_t count, const void* buffer = nullptr,
+        std::size_t length = 0);
+void send_descriptors(SocketType sock_fd,
+        const std::vector<FileDescriptorType>& descriptors,
+        const void* buffer = nullptr, std::size_t length = 0);
+
+/*
+ * Receives up to length bytes from a unix socket along with the descriptors
+ * that came with them, which are appended to the vector and owned by the
+ * caller from then on.  They are close on exec.  When credentials is not
+ * null and SO_PASSCRED is on, the credentials of the sender are stored
+ * there.  Returns the number of bytes received, 0 at the end of the stream
+ * and -1 if a non blocking socket has nothing to read.
+ *
+ * The kernel does not merge data sent with descriptors into the bytes of
+ * other messages, so a buffer the size of what the sender sent with the
+ * descriptors receives exactly that.
+ *
+ * ERRORS : Throws an exception in exceptional conditions and when more
+ *          descriptors arrived than fit in the message, in which case the
+ *          ones that did fit are closed
+ */
+ssize_t recv_descriptors(SocketType sock_fd, void* buffer, std::size_t length,
+        std::vector<FileDescriptorType>& descriptors,
+        PeerCredentials* credentials = nullptr, int flags = 0);
+
+/*
+ * Connection handoff between processes.  An acceptor process accepts
+ * connections and hands each one to a worker process over a unix socket,
+ * the worker serves it as if it had accepted it.  Since the listening socket
+ * stays with the acceptor, workers can be restarted without refusing or
+ * dropping connections, the acceptor hands new connections to the workers
+ * that are up while one restarts.  On the worker side
+ * EventLoop::add_handoff_channel() receives the connections.
+ *
+ * create_handoff_channel() makes a connected pair of unix sockets for a
+ * worker that is forked from the acceptor, unrelated processes use
+ * create_server_unix_socket() and create_client_unix_socket() instead.
+ *
+ * hand_off_socket() sends the socket and closes it in this process.  The
+ * socket should not have been read from, bytes read by the acceptor do not
+ * travel with it.
+ *
+ * receive_socket() blocks until a socket arrives and returns it, or -1 if
+ * the other end has closed the channel.
+ *
+ * ERRORS : hand_off_socket() throws if the socket could not be sent, in
+ *          which case it is still open and owned by the caller, for example
+ *          to hand it to a different worker
+ * EXAMPLE :
+ *      // acceptor, with one channel per worker
+ *      auto connection = SocketUtilities::accept(listener);
+ *      SocketUtilities::hand_off_socket(channels[next++ % channels.size()],
+ *              connection);
+ *
+ *      // worker
+ *      SocketUtilities::EventLoop event_loop;
+ *      event_loop.add_handoff_channel(channel, factory);
+ *      event_loop.run();
+ */
+std::pair<SocketType, SocketType> create_handoff_channel();
+void hand_off_socket(SocketType channel, SocketType sock_fd);
+SocketType receive_socket(SocketType channel);
+
+
+}
+
+#endif
@@ -0,0 +1,909 @@
+#include "EventLoop.hpp"
+#include "DescriptorPassing.hpp"
+#include "Metrics.hpp"
+#include "MetricCounters.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using SocketUtilities::Connection;
+using SocketUtilities::ConnectionHandler;
+using SocketUtilities::ConnectionHandlerFactory;
+using SocketUtilities::EventLoop;
+using SocketUtilities::KernelEventQueue;
+using SocketUtilities::LogLevel;
+using SocketUtilities::Metric;
+using SocketUtilities::Server;
+using SocketUtilities::ShardedServer;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketOptions;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::count;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using SocketUtilities::detail::log_transfer;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/* The size of the buffer that every connection of a loop is read into */
+static constexpr size_t READ_BUFFER_SIZE = 64 * 1024;
+
+/*
+ * How long a listener that failed to accept (out of descriptors, usually)
+ * waits before it is tried again
+ */
+static constexpr std::chrono::milliseconds ACCEPT_RETRY_DELAY {100};
+
+/*
+ * What the loop needs to set up the connections accepted on a listener, or
+ * received on a handoff channel from another process
+ */
+class Listener {
+public:
+    ConnectionHandlerFactory factory;
+    SocketOptions options;
+    bool handoff {false};
+};
+
+class EventLoop::Impl {
+public:
+
+    explicit Impl(EventLoop& event_loop_in) : event_loop(event_loop_in),
+            wakeup_fd{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+            read_buffer(READ_BUFFER_SIZE) {
+        if (this->wakeup_fd == -1) {
+            throw SocketException {"Error in eventfd() call : "s +
+                string(std::strerror(errno))};
+        }
+        this->queue.declare_interest(this->wakeup_fd, KernelEventQueue::READ);
+    }
+
+    ~Impl() {
+
+        // the handlers are told about the connections that are still open
+        // like they are when the connections close while the loop runs
+        for (auto& connection : this->connections) {
+            if (connection && !connection->finalized) {
+                connection->finalized = true;
+                connection->handler->on_close(*connection);
+                if (connection->sampled) {
+                    SocketUtilities::untrack_tcp_info(connection->sock_fd);
+                }
+                ::close(connection->sock_fd);
+            }
+        }
+        for (auto& listener : this->listeners) {
+            ::close(listener.first);
+        }
+        ::close(this->wakeup_fd);
+    }
+
+    /* Wakes the thread blocked in the kernel event queue */
+    void wake() {
+        std::uint64_t one {1};
+        while (::write(this->wakeup_fd, &one, sizeof(one)) == -1 &&
+                errno == EINTR) {}
+    }
+
+    void dispatch(const KernelEventQueue::Event& event);
+    void accept_connections(SocketType listener_fd, const Listener& listener);
+    void retry_accepts();
+    int get_timeout(int timeout) const;
+    void receive_connections(SocketType channel, const Listener& listener);
+    Connection& register_connection(SocketType sock_fd,
+            unique_ptr<ConnectionHandler> handler);
+    void read_from(Connection& connection);
+    bool write(Connection& connection, const iovec* buffers, size_t count);
+    void send_output(Connection& connection);
+    void flush(Connection& connection);
+    void schedule_flush(Connection& connection);
+    void run_scheduled_flushes();
+    void mark_dirty(Connection& connection);
+    void process_dirty();
+    void finalize(Connection& connection);
+    void run_posted();
+
+    EventLoop& event_loop;
+    KernelEventQueue queue;
+    int wakeup_fd;
+
+    // connections are indexed by their descriptor, descriptors are small and
+    // dense so this is cheaper than a hash table on every event
+    vector<unique_ptr<Connection>> connections;
+    size_t connection_count {0};
+    std::unordered_map<SocketType, Listener> listeners;
+
+    // connections that need to be looked at after the current callback, and
+    // the ones that have been closed during this iteration.  Closed
+    // connections are destroyed at the end of the iteration so that a
+    // callback further up the stack never sees a dangling connection
+    vector<Connection*> dirty;
+    vector<unique_ptr<Connection>> closed;
+
+    // connections with coalesced output to send at the end of the iteration,
+    // and the batch of them being flushed
+    vector<Connection*> scheduled_flushes;
+    vector<Connection*> flushing;
+
+    // callbacks for descriptors watched with watch(), indexed by descriptor
+    // like the connections.  Callbacks that are removed or replaced are kept
+    // until the end of the iteration as well since the callback being
+    // removed may be the one that is running
+    vector<EventLoop::WatchCallback> watches;
+    vector<EventLoop::WatchCallback> removed_watches;
+
+    vector<char> read_buffer;
+    vector<KernelEventQueue::Event> events;
+    vector<SocketUtilities::AcceptedConnection> accepted;
+
+    // listeners that failed to accept, they are edge triggered and would not
+    // be reported again for the connections left in their backlog
+    vector<SocketType> accept_retries;
+    std::chrono::steady_clock::time_point accept_retry_time;
+    vector<SocketUtilities::FileDescriptorType> received;
+    size_t low_watermark {EventLoop::DEFAULT_LOW_WATERMARK};
+    size_t high_watermark {EventLoop::DEFAULT_HIGH_WATERMARK};
+    size_t coalescing_threshold {EventLoop::DEFAULT_COALESCING_THRESHOLD};
+
+    std::atomic<bool> stopped {false};
+    std::mutex posted_mutex;
+    vector<std::function<void ()>> posted;
+};
+
+void EventLoop::Impl::dispatch(const KernelEventQueue::Event& event) {
+
+    auto descriptor = event.get_descriptor();
+    if (descriptor == this->wakeup_fd) {
+        std::uint64_t count;
+        while (::read(this->wakeup_fd, &count, sizeof(count)) == -1 &&
+                errno == EINTR) {}
+        return;
+    }
+
+    if (static_cast<size_t>(descriptor) < this->watches.size() &&
+            this->watches[descriptor]) {
+        this->watches[descriptor](event);
+        return;
+    }
+
+    auto listener = this->listeners.find(descriptor);
+    if (listener != this->listeners.end()) {
+        if (listener->second.handoff) {
+            this->receive_connections(listener->first, listener->second);
+        } else {
+            this->accept_connections(listener->first, listener->second);
+        }
+        return;
+    }
+
+    if (static_cast<size_t>(descriptor) >= this->connections.size() ||
+            !this->connections[descriptor]) {
+        return;
+    }
+    auto& connection = *this->connections[descriptor];
+
+    if (event.error()) {
+        connection.broken = true;
+        this->mark_dirty(connection);
+        return;
+    }
+    if (event.writable()) {
+        connection.write_blocked = false;
+        this->flush(connection);
+    }
+
+    // a hangup still leaves whatever the peer sent before it in the socket,
+    // reading will see the end of the stream after that
+    if (event.readable() || event.hangup()) {
+        this->read_from(connection);
+    }
+}
+
+void EventLoop::Impl::accept_connections(SocketType listener_fd,
+        const Listener& listener) {
+
+    // accept4() hands back sockets that are already non blocking, and the
+    // whole backlog is drained in one go since the listener is edge triggered.
+    // accept_all() stops early without an exception when an error follows
+    // some accepted connections, so it is called until it finds nothing
+    while (true) {
+        try {
+            if (!SocketUtilities::accept_all(listener_fd, this->accepted)) {
+                return;
+            }
+        } catch (const SocketException& exception) {
+
+            // running out of descriptors and similar conditions leave the
+            // backlog as it is, and no new edge comes for it.  The listener
+            // is tried again after a while rather than taking the whole loop
+            // down or spinning on it
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output(exception.what());
+            }
+            if (std::find(this->accept_retries.begin(),
+                        this->accept_retries.end(), listener_fd) ==
+                    this->accept_retries.end()) {
+                this->accept_retries.push_back(listener_fd);
+            }
+            this->accept_retry_time = std::chrono::steady_clock::now() +
+                ACCEPT_RETRY_DELAY;
+            return;
+        }
+
+        for (const auto& accepted : this->accepted) {
+            try {
+                SocketUtilities::apply_socket_options(accepted.socket,
+                        listener.options);
+            } catch (const SocketException& exception) {
+                if (log_enabled(LogLevel::EVENTS)) {
+                    log_output(exception.what());
+                }
+                ::close(accepted.socket);
+                continue;
+            }
+            this->register_connection(accepted.socket, listener.factory());
+        }
+    }
+}
+
+void EventLoop::Impl::retry_accepts() {
+
+    if (this->accept_retries.empty() ||
+            std::chrono::steady_clock::now() < this->accept_retry_time) {
+        return;
+    }
+
+    // listeners that fail again put themselves back on the list
+    vector<SocketType> retries;
+    retries.swap(this->accept_retries);
+    for (auto listener_fd : retries) {
+        auto listener = this->listeners.find(listener_fd);
+        if (listener != this->listeners.end()) {
+            this->accept_connections(listener->first, listener->second);
+            this->process_dirty();
+        }
+    }
+}
+
+int EventLoop::Impl::get_timeout(int timeout) const {
+
+    // the wait is cut short for a listener that is waiting to be retried
+    if (this->accept_retries.empty()) {
+        return timeout;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            this->accept_retry_time - std::chrono::steady_clock::now())
+        .count() + 1;
+    remaining = std::max<decltype(remaining)>(remaining, 0);
+    if (timeout < 0 || remaining < timeout) {
+        return static_cast<int>(remaining);
+    }
+    return timeout;
+}
+
+void EventLoop::Impl::receive_connections(SocketType channel,
+        const Listener& listener) {
+
+    // the channel is edge triggered as well, so every socket waiting in it is
+    // taken now.  Each one comes with a single byte of its own
+    while (true) {
+        char byte;
+        ssize_t n;
+        this->received.clear();
+        try {
+            n = SocketUtilities::recv_descriptors(channel, &byte, 1,
+                    this->received, nullptr, MSG_DONTWAIT);
+        } catch (const SocketException& exception) {
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output(exception.what());
+            }
+            return;
+        }
+
+        if (n == -1) {
+            return;
+        }
+        if (n == 0) {
+
+            // the process handing off connections has gone away, the
+            // connections it handed off before that are unaffected
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output("Handoff channel "s + to_string(channel) +
+                        " closed"s);
+            }
+            this->queue.rescind_interest(channel);
+            ::close(channel);
+            this->listeners.erase(channel);
+            return;
+        }
+
+        for (auto sock_fd : this->received) {
+            try {
+                SocketUtilities::make_non_blocking(sock_fd);
+                SocketUtilities::apply_socket_options(sock_fd,
+                        listener.options);
+            } catch (const SocketException& exception) {
+                if (log_enabled(LogLevel::EVENTS)) {
+                    log_output(exception.what());
+                }
+                ::close(sock_fd);
+                continue;
+            }
+            this->register_connection(sock_fd, listener.factory());
+        }
+    }
+}
+
+Connection& EventLoop::Impl::register_connection(SocketType sock_fd,
+        unique_ptr<ConnectionHandler> handler) {
+
+    if (static_cast<size_t>(sock_fd) >= this->connections.size()) {
+        this->connections.resize(static_cast<size_t>(sock_fd) * 2 + 1);
+    }
+    this->connections[sock_fd].reset(new Connection{this->event_loop, sock_fd,
+            std::move(handler)});
+    ++this->connection_count;
+    if (SocketUtilities::detail::tcp_info_sampling.load(
+                std::memory_order_relaxed)) {
+        SocketUtilities::track_tcp_info(sock_fd);
+        this->connections[sock_fd]->sampled = true;
+    }
+
+    // read and write interest is declared once in edge triggered mode, the
+    // kernel then only reports changes and the registration never has to be
+    // modified when output starts or stops being buffered
+    auto& connection = *this->connections[sock_fd];
+    this->queue.declare_interest(sock_fd, KernelEventQueue::READ |
+            KernelEventQueue::WRITE | KernelEventQueue::EDGE_TRIGGERED);
+    connection.handler->on_open(connection);
+    return connection;
+}
+
+void EventLoop::Impl::read_from(Connection& connection) {
+
+    while (!connection.closing && !connection.broken &&
+            !connection.reading_paused) {
+
+        ssize_t n = ::recv(connection.sock_fd, this->read_buffer.data(),
+                this->read_buffer.size(), 0);
+        count_received(n);
+        if (n > 0) {
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("recv", connection.sock_fd,
+                        this->read_buffer.data(), n);
+            }
+            connection.handler->on_read(connection, this->read_buffer.data(),
+                    static_cast<size_t>(n));
+            continue;
+        }
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // the peer has finished sending, whatever is still buffered for it
+        // is flushed before closing.  Any other error means the connection
+        // has been reset
+        if (n == 0) {
+            connection.closing = true;
+        } else {
+            connection.broken = true;
+        }
+        break;
+    }
+
+    this->mark_dirty(connection);
+}
+
+bool EventLoop::Impl::write(Connection& connection, const iovec* buffers,
+        size_t count) {
+
+    if (connection.closing || connection.broken) {
+        return false;
+    }
+
+    size_t length {0};
+    for (size_t i = 0; i < count; ++i) {
+        length += buffers[i].iov_len;
+    }
+
+    // small writes are only copied into the output buffer and sent together
+    // at the end of the iteration.  Otherwise the buffered output and the new
+    // data go out in one sendmsg() straight from the caller's buffers, and
+    // only what the kernel would not take is copied
+    auto pending = connection.get_pending_output();
+    size_t sent {0};
+    if (!connection.write_blocked &&
+            pending + length >= this->coalescing_threshold) {
+
+        thread_local vector<iovec> remaining;
+        remaining.clear();
+        if (pending) {
+            remaining.push_back(SocketUtilities::make_iovec(
+                        connection.output.data() + connection.output_offset,
+                        pending));
+        }
+        remaining.insert(remaining.end(), buffers, buffers + count);
+
+        auto current = remaining.data();
+        auto left = remaining.size();
+        while (left) {
+            auto batch = std::min(left, static_cast<size_t>(IOV_MAX));
+            msghdr message;
+            std::memset(&message, 0, sizeof(message));
+            message.msg_iov = current;
+            message.msg_iovlen = batch;
+
+            ssize_t n = ::sendmsg(connection.sock_fd, &message, MSG_NOSIGNAL);
+            count_sent(n);
+            if (n >= 0) {
+                if (log_enabled(LogLevel::EVENTS)) {
+                    log_transfer("sendmsg", connection.sock_fd, current,
+                            batch, n);
+                }
+                auto unsent = left - batch;
+                SocketUtilities::consume_iovecs(current, left,
+                        static_cast<size_t>(n));
+                if (left > unsent) {
+                    SocketUtilities::detail::count(Metric::PARTIAL_WRITES);
+                }
+                sent += static_cast<size_t>(n);
+                continue;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection.broken = true;
+                this->mark_dirty(connection);
+                return false;
+            }
+            connection.write_blocked = true;
+            break;
+        }
+
+        // the buffered output went out first
+        connection.output_offset += std::min(sent, pending);
+        if (!connection.get_pending_output()) {
+            connection.output.clear();
+            connection.output_offset = 0;
+        }
+        sent = sent > pending ? sent - pending : 0;
+    }
+
+    // buffer whatever of the new data has not been sent
+    for (size_t i = 0; i < count; ++i) {
+        auto data = static_cast<const char*>(buffers[i].iov_base);
+        auto skip = std::min(sent, buffers[i].iov_len);
+        sent -= skip;
+        connection.output.insert(connection.output.end(), data + skip,
+                data + buffers[i].iov_len);
+    }
+    if (connection.get_pending_output()) {
+        this->schedule_flush(connection);
+    }
+
+    if (connection.get_pending_output() > this->high_watermark) {
+        connection.reading_paused = true;
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::Impl::send_output(Connection& connection) {
+
+    while (connection.get_pending_output() && !connection.broken) {
+        ssize_t n = ::send(connection.sock_fd,
+                connection.output.data() + connection.output_offset,
+                connection.get_pending_output(), MSG_NOSIGNAL);
+        count_sent(n);
+        if (n >= 0) {
+            if (static_cast<size_t>(n) < connection.get_pending_output()) {
+                count(Metric::PARTIAL_WRITES);
+            }
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("send", connection.sock_fd,
+                        connection.output.data() + connection.output_offset,
+                        n);
+            }
+            connection.output_offset += static_cast<size_t>(n);
+            continue;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            connection.write_blocked = true;
+        } else {
+            connection.broken = true;
+        }
+        break;
+    }
+
+    if (!connection.get_pending_output()) {
+        connection.output.clear();
+        connection.output_offset = 0;
+    }
+}
+
+void EventLoop::Impl::flush(Connection& connection) {
+
+    // with the send buffer full a send() would only fail, the socket becoming
+    // writable clears the flag and flushes
+    if (!connection.write_blocked) {
+        this->send_output(connection);
+    }
+
+    // release the backpressure once enough of the output has drained, any
+    // data that arrived while reading was paused is still in the socket and
+    // since the socket is edge triggered it has to be read here
+    if (connection.reading_paused && !connection.broken &&
+            connection.get_pending_output() <= this->low_watermark) {
+        connection.reading_paused = false;
+        connection.handler->on_write(connection);
+        this->read_from(connection);
+    }
+
+    this->mark_dirty(connection);
+}
+
+void EventLoop::Impl::schedule_flush(Connection& connection) {
+    if (!connection.flush_scheduled && !connection.write_blocked) {
+        connection.flush_scheduled = true;
+        this->scheduled_flushes.push_back(&connection);
+    }
+}
+
+void EventLoop::Impl::run_scheduled_flushes() {
+
+    // flushing calls back into handlers which may write more, connections
+    // closed along the way stay alive in closed until the iteration ends
+    while (!this->scheduled_flushes.empty()) {
+        this->flushing.swap(this->scheduled_flushes);
+        for (auto connection : this->flushing) {
+            connection->flush_scheduled = false;
+            if (!connection->finalized) {
+                this->flush(*connection);
+                this->process_dirty();
+            }
+        }
+        this->flushing.clear();
+    }
+}
+
+void EventLoop::Impl::mark_dirty(Connection& connection) {
+    if (connection.closing || connection.broken) {
+        this->dirty.push_back(&connection);
+    }
+}
+
+void EventLoop::Impl::process_dirty() {
+
+    // finalizing calls back into handlers which may mark more connections
+    while (!this->dirty.empty()) {
+        auto connection = this->dirty.back();
+        this->dirty.pop_back();
+        if (connection->finalized) {
+            continue;
+        }
+
+        if (connection->broken || !connection->get_pending_output()) {
+            this->finalize(*connection);
+        }
+    }
+}
+
+void EventLoop::Impl::finalize(Connection& connection) {
+
+    connection.finalized = true;
+    connection.handler->on_close(connection);
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Closing connection on socket "s +
+                to_string(connection.sock_fd));
+    }
+
+    // the descriptor stops being sampled before it can be reused, and
+    // closing it removes it from the epoll set as well
+    if (connection.sampled) {
+        SocketUtilities::untrack_tcp_info(connection.sock_fd);
+    }
+    ::close(connection.sock_fd);
+    this->closed.push_back(std::move(this->connections[connection.sock_fd]));
+    --this->connection_count;
+}
+
+void EventLoop::Impl::run_posted() {
+
+    vector<std::function<void ()>> tasks;
+    {
+        std::lock_guard<std::mutex> lck {this->posted_mutex};
+        tasks.swap(this->posted);
+    }
+    for (auto& task : tasks) {
+        task();
+        this->process_dirty();
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+Connection::Connection(EventLoop& event_loop_in, SocketType sock_fd_in,
+        unique_ptr<ConnectionHandler> handler_in) :
+    event_loop(event_loop_in), sock_fd{sock_fd_in},
+    handler{std::move(handler_in)} {}
+
+bool Connection::write(const void* buffer, size_t length) {
+    auto data = SocketUtilities::make_iovec(buffer, length);
+    return this->event_loop.impl_ptr->write(*this, &data, 1);
+}
+
+bool Connection::write(const iovec* buffers, size_t count) {
+    return this->event_loop.impl_ptr->write(*this, buffers, count);
+}
+
+bool Connection::write(const vector<char>& data_to_send) {
+    return this->write(data_to_send.data(), data_to_send.size());
+}
+
+bool Connection::write(const string& data_to_send) {
+    return this->write(data_to_send.data(), data_to_send.size());
+}
+
+bool Connection::flush() {
+
+    auto impl = this->event_loop.impl_ptr;
+    if (!this->write_blocked) {
+        impl->send_output(*this);
+    }
+    impl->mark_dirty(*this);
+    return !this->get_pending_output() && !this->broken;
+}
+
+size_t Connection::get_pending_output() const {
+    return this->output.size() - this->output_offset;
+}
+
+void Connection::close() {
+    this->closing = true;
+    this->event_loop.impl_ptr->mark_dirty(*this);
+}
+
+EventLoop::EventLoop() : impl_ptr{new Impl{*this}} {}
+
+EventLoop::~EventLoop() {
+    delete this->impl_ptr;
+}
+
+void EventLoop::add_listener(SocketType listener,
+        ConnectionHandlerFactory factory, const SocketOptions& options) {
+
+    // the loop owns the listener even when it cannot be added, so that
+    // callers can hand over a freshly created socket without leaking it
+    auto added = false;
+    try {
+        SocketUtilities::make_non_blocking(listener);
+        added = this->impl_ptr->listeners.emplace(listener,
+                Listener{std::move(factory), options}).second;
+        this->impl_ptr->queue.declare_interest(listener,
+                KernelEventQueue::READ | KernelEventQueue::EDGE_TRIGGERED);
+    } catch (...) {
+        if (added) {
+            this->impl_ptr->listeners.erase(listener);
+        }
+        ::close(listener);
+        throw;
+    }
+}
+
+void EventLoop::add_handoff_channel(SocketType channel,
+        ConnectionHandlerFactory factory, const SocketOptions& options) {
+
+    SocketUtilities::make_non_blocking(channel);
+    this->impl_ptr->listeners.emplace(channel,
+            Listener{std::move(factory), options, true});
+    this->impl_ptr->queue.declare_interest(channel, KernelEventQueue::READ |
+            KernelEventQueue::EDGE_TRIGGERED);
+}
+
+Connection& EventLoop::add_connection(SocketType sock_fd,
+        unique_ptr<ConnectionHandler> handler) {
+    SocketUtilities::make_non_blocking(sock_fd);
+    return this->impl_ptr->register_connection(sock_fd, std::move(handler));
+}
+
+void EventLoop::watch(FileDescriptorType descriptor, WatchCallback callback) {
+
+    auto impl = this->impl_ptr;
+    if (static_cast<size_t>(descriptor) >= impl->watches.size()) {
+        impl->watches.resize(static_cast<size_t>(descriptor) * 2 + 1);
+    }
+
+    auto& watch = impl->watches[descriptor];
+    if (watch) {
+        impl->removed_watches.push_back(std::move(watch));
+    } else {
+        impl->queue.declare_interest(descriptor, KernelEventQueue::READ |
+                KernelEventQueue::WRITE | KernelEventQueue::EDGE_TRIGGERED);
+    }
+    watch = std::move(callback);
+}
+
+void EventLoop::unwatch(FileDescriptorType descriptor) {
+
+    auto impl = this->impl_ptr;
+    if (static_cast<size_t>(descriptor) >= impl->watches.size() ||
+            !impl->watches[descriptor]) {
+        return;
+    }
+    impl->queue.rescind_interest(descriptor);
+    impl->removed_watches.push_back(std::move(impl->watches[descriptor]));
+    impl->watches[descriptor] = nullptr;
+}
+
+void EventLoop::set_write_watermarks(size_t low, size_t high) {
+    this->impl_ptr->low_watermark = low;
+    this->impl_ptr->high_watermark = high;
+}
+
+void EventLoop::set_write_coalescing(size_t threshold) {
+    this->impl_ptr->coalescing_threshold = threshold;
+}
+
+void EventLoop::run() {
+
+    while (!this->impl_ptr->stopped.load()) {
+        this->run_once();
+    }
+    this->impl_ptr->stopped.store(false);
+}
+
+void EventLoop::run_once(int timeout) {
+
+    // nobody would flush what was written since the last iteration while the
+    // loop waits, and the peer may be waiting for exactly that
+    auto impl = this->impl_ptr;
+    impl->run_scheduled_flushes();
+    impl->queue.get_active_events(impl->events, impl->get_timeout(timeout));
+    for (const auto& event : impl->events) {
+        impl->dispatch(event);
+        impl->process_dirty();
+    }
+    impl->retry_accepts();
+
+    // everything the handlers wrote during this iteration goes out now
+    impl->run_posted();
+    impl->run_scheduled_flushes();
+    impl->closed.clear();
+    impl->removed_watches.clear();
+}
+
+void EventLoop::stop() {
+    this->impl_ptr->stopped.store(true);
+    this->impl_ptr->wake();
+}
+
+void EventLoop::post(std::function<void ()> task) {
+    {
+        std::lock_guard<std::mutex> lck {this->impl_ptr->posted_mutex};
+        this->impl_ptr->posted.push_back(std::move(task));
+    }
+    this->impl_ptr->wake();
+}
+
+size_t EventLoop::get_connection_count() const {
+    return this->impl_ptr->connection_count;
+}
+
+KernelEventQueue& EventLoop::get_kernel_event_queue() {
+    return this->impl_ptr->queue;
+}
+
+Server::Server(const string& port, ConnectionHandlerFactory factory,
+        int backlog) {
+    this->event_loop.add_listener(
+            SocketUtilities::create_server_socket(port, backlog),
+            std::move(factory));
+}
+
+Server::Server(const string& port, ConnectionHandlerFactory factory,
+        const SocketOptions& options, int backlog) {
+    this->event_loop.add_listener(
+            SocketUtilities::create_server_socket(port, options, backlog),
+            std::move(factory), options);
+}
+
+void Server::run() {
+    this->event_loop.run();
+}
+
+void Server::stop() {
+    this->event_loop.stop();
+}
+
+ShardedServer::ShardedServer(const string& port,
+        ConnectionHandlerFactory factory, unsigned shards, int backlog,
+        bool pin_threads_in) : pin_threads{pin_threads_in} {
+
+    auto listeners = SocketUtilities::create_server_sockets(port,
+            static_cast<int>(std::max(shards, 1u)), backlog);
+    for (auto listener : listeners) {
+        this->event_loops.emplace_back(new EventLoop{});
+        this->event_loops.back()->add_listener(listener, factory);
+    }
+}
+
+ShardedServer::ShardedServer(const string& port,
+        ConnectionHandlerFactory factory, unsigned shards,
+        const SocketOptions& options, int backlog, bool pin_threads_in) :
+        pin_threads{pin_threads_in} {
+
+    auto listeners = SocketUtilities::create_server_sockets(port,
+            static_cast<int>(std::max(shards, 1u)), options, backlog);
+    for (auto listener : listeners) {
+        this->event_loops.emplace_back(new EventLoop{});
+        this->event_loops.back()->add_listener(listener, factory, options);
+    }
+}
+
+void ShardedServer::run() {
+
+    auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+    vector<std::thread> threads;
+    for (size_t shard = 0; shard < this->event_loops.size(); ++shard) {
+        threads.emplace_back([this, shard] {
+            this->event_loops[shard]->run();
+        });
+
+        // pinning is best effort, the shard still runs if it fails
+        if (this->pin_threads) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(shard % cores, &cpu_set);
+            ::pthread_setaffinity_np(threads.back().native_handle(),
+                    sizeof(cpu_set), &cpu_set);
+        }
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void ShardedServer::stop() {
+    for (auto& event_loop : this->event_loops) {
+        event_loop->stop();
+    }
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,368 @@
+#ifndef __CPP_SOCKETS_EVENT_LOOP_HPP__
+#define __CPP_SOCKETS_EVENT_LOOP_HPP__
+
+#include "SocketUtilities.hpp"
+#include "KernelEventQueue.hpp"
+#include "SocketOptions.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SocketUtilities {
+
+class EventLoop;
+class Connection;
+
+/*
+ * The per connection state object for the event loop.  One handler is
+ * created for every accepted connection and lives exactly as long as the
+ * connection does, so any state the protocol needs for a connection should be
+ * kept as members of the derived class.
+ *
+ * All the callbacks are invoked on the thread running the event loop that
+ * owns the connection, one at a time, so a handler never needs any locking.
+ *
+ *  on_open()   : the connection has just been added to the loop
+ *  on_read()   : some bytes have been received, the buffer is only valid for
+ *                the duration of the call
+ *  on_write()  : the output buffer has drained below the low watermark after
+ *                a write() returned false, see Connection::write()
+ *  on_close()  : the connection is about to be closed, either because the
+ *                peer went away, an error occured or close() was called.
+ *                The socket is still open during the call
+ */
+class ConnectionHandler {
+public:
+    virtual ~ConnectionHandler() = default;
+
+    virtual void on_open(Connection&) {}
+    virtual void on_read(Connection& connection, const char* data,
+            std::size_t length) = 0;
+    virtual void on_write(Connection&) {}
+    virtual void on_close(Connection&) {}
+};
+
+/*
+ * Creates a new handler for every connection accepted on a listener
+ */
+using ConnectionHandlerFactory =
+    std::function<std::unique_ptr<ConnectionHandler> ()>;
+
+/*
+ * A connection owned by an event loop.  Connections are created by the event
+ * loop and handed to the callbacks of the ConnectionHandler, they must not be
+ * used after on_close() has returned.
+ */
+class Connection {
+public:
+
+    /* The underlying non blocking socket */
+    SocketType get_socket() const { return this->sock_fd; }
+
+    /* The event loop that this connection belongs to */
+    EventLoop& get_event_loop() const { return this->event_loop; }
+
+    /* The handler for this connection */
+    ConnectionHandler& get_handler() const { return *this->handler; }
+
+    /*
+     * Sends the data to the peer without blocking.  Small writes are
+     * coalesced, they are copied into the connection's output buffer and
+     * everything written to the connection during one iteration of the loop
+     * goes out with a single system call at the end of the iteration.  Once
+     * the buffer would reach the coalescing threshold of the event loop it is
+     * sent right away along with the new data in one vectored write, and
+     * whatever the kernel does not take is kept in the buffer and written out
+     * when the socket becomes writable.  Replies made of several small pieces
+     * thereby cost one system call and go out in one segment without
+     * depending on Nagle's algorithm.
+     *
+     * This is where backpressure is applied.  Returns false when the output
+     * buffer has grown past the high watermark of the event loop, after which
+     * the loop stops reading from this connection until the buffer drains
+     * below the low watermark, and then calls on_write().  Callers producing
+     * lots of output should stop when this returns false and continue from
+     * on_write().
+     */
+    bool write(const void* buffer, std::size_t length);
+    bool write(const std::vector<char>& data_to_send);
+    bool write(const std::string& data_to_send);
+
+    /*
+     * The same for count buffers sent in order with one system call, for
+     * example a header and a body that live in different places in memory
+     */
+    bool write(const iovec* buffers, std::size_t count);
+
+    /*
+     * Sends the coalesced output now instead of at the end of the iteration,
+     * for example before a handler does something slow.  Returns true if the
+     * output buffer is empty afterwards, false if the peer is not keeping up
+     * and the rest is written when the socket becomes writable
+     */
+    bool flush();
+
+    /* The number of bytes waiting in the output buffer */
+    std::size_t get_pending_output() const;
+
+    /*
+     * Closes the connection once the output buffer has been flushed.  No more
+     * data is read from the connection after this call
+     */
+    void close();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+private:
+    friend class EventLoop;
+
+    Connection(EventLoop& event_loop_in, SocketType sock_fd_in,
+            std::unique_ptr<ConnectionHandler> handler_in);
+
+    EventLoop& event_loop;
+    SocketType sock_fd;
+    std::unique_ptr<ConnectionHandler> handler;
+
+    // output that could not be written yet, bytes before output_offset have
+    // already been sent
+    std::vector<char> output;
+    std::size_t output_offset {0};
+
+    bool closing {false};
+    bool broken {false};
+    bool finalized {false};
+    bool reading_paused {false};
+    bool sampled {false};
+
+    // the kernel's send buffer was full the last time, nothing is sent until
+    // the socket is writable again.  And whether the connection is waiting
+    // for the output to be flushed at the end of the iteration
+    bool write_blocked {false};
+    bool flush_scheduled {false};
+};
+
+/*
+ * A single threaded reactor built on KernelEventQueue.  The event loop owns a
+ * set of listening sockets and connections, waits for them to become ready
+ * and dispatches to the ConnectionHandler of each connection.  All sockets
+ * are non blocking and watched in edge triggered mode, so a descriptor is
+ * registered with the kernel once and never modified afterwards.
+ *
+ * One event loop should be run on one thread, for more cores run one event
+ * loop per thread.  stop() and post() are the only member functions that may
+ * be called from other threads.
+ *
+ * EXAMPLE :
+ *      class Echo : public SocketUtilities::ConnectionHandler {
+ *      public:
+ *          void on_read(SocketUtilities::Connection& connection,
+ *                  const char* data, std::size_t length) override {
+ *              connection.write(data, length);
+ *          }
+ *      };
+ *
+ *      SocketUtilities::EventLoop event_loop;
+ *      event_loop.add_listener(
+ *          SocketUtilities::create_server_socket("8000"),
+ *          [] { return std::make_unique<Echo>(); });
+ *      event_loop.run();
+ */
+class EventLoop {
+public:
+
+    /*
+     * The default watermarks for the output buffer of each connection, see
+     * Connection::write()
+     */
+    static constexpr std::size_t DEFAULT_LOW_WATERMARK = 64 * 1024;
+    static constexpr std::size_t DEFAULT_HIGH_WATERMARK = 1024 * 1024;
+
+    /*
+     * How much output a connection buffers before it is sent without waiting
+     * for the end of the iteration, see Connection::write()
+     */
+    static constexpr std::size_t DEFAULT_COALESCING_THRESHOLD = 16 * 1024;
+
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /*
+     * Takes ownership of a listening socket, every connection accepted on it
+     * is given a handler from the factory.  The listener is closed when the
+     * event loop is destroyed, or right away if it cannot be added.  When
+     * accepting fails, for example because the process is out of
+     * descriptors, the listener is tried again a little later.  The options
+     * are applied to every accepted connection with apply_socket_options(),
+     * a connection they cannot be applied to is closed
+     */
+    void add_listener(SocketType listener, ConnectionHandlerFactory factory,
+            const SocketOptions& options = SocketOptions{});
+
+    /*
+     * Takes ownership of a unix socket that another process hands off
+     * connections on with hand_off_socket(), see DescriptorPassing.hpp.  Every
+     * connection received is set up like one accepted on a listener.  The
+     * channel is closed when the other end closes it or the event loop is
+     * destroyed
+     */
+    void add_handoff_channel(SocketType channel,
+            ConnectionHandlerFactory factory,
+            const SocketOptions& options = SocketOptions{});
+
+    /*
+     * Takes ownership of an already connected socket, for example one that
+     * was created with create_client_socket(), and returns the connection.
+     * on_open() is called before this returns
+     */
+    Connection& add_connection(SocketType sock_fd,
+            std::unique_ptr<ConnectionHandler> handler);
+
+    /*
+     * Watches a descriptor that is not owned by the loop, the callback is
+     * invoked on the loop thread with every event for it.  The descriptor is
+     * watched for reading and writing in edge triggered mode, so the callback
+     * is only told about changes and should keep reading or writing until
+     * EAGAIN before waiting for the next event.  Watching a descriptor again
+     * replaces its callback.
+     *
+     * This is the building block for code that does its own non blocking
+     * I/O instead of going through a ConnectionHandler, see AsyncSocket.hpp.
+     * unwatch() must be called before the descriptor is closed, the callback
+     * may call unwatch() on its own descriptor
+     */
+    using WatchCallback = std::function<void (const KernelEventQueue::Event&)>;
+    void watch(FileDescriptorType descriptor, WatchCallback callback);
+    void unwatch(FileDescriptorType descriptor);
+
+    /* Changes the output buffer watermarks for all the connections */
+    void set_write_watermarks(std::size_t low, std::size_t high);
+
+    /*
+     * Changes the coalescing threshold for all the connections, with 0 every
+     * write is sent as soon as it is made
+     */
+    void set_write_coalescing(std::size_t threshold);
+
+    /*
+     * Runs the loop on the calling thread until stop() is called.
+     * run_once() waits at most timeout milliseconds for events and handles
+     * one batch of them, output written from outside the loop's callbacks is
+     * flushed before it waits
+     */
+    void run();
+    void run_once(int timeout = -1);
+
+    /*
+     * Makes run() return after the batch of events being handled.  Can be
+     * called from any thread, including from within a callback
+     */
+    void stop();
+
+    /*
+     * Runs the function on the event loop thread during the next iteration of
+     * the loop.  Can be called from any thread, this is how work should be
+     * handed to the connections owned by a loop from the outside
+     */
+    void post(std::function<void ()> task);
+
+    /* The number of connections currently owned by the loop */
+    std::size_t get_connection_count() const;
+
+    /* The kernel event queue that this loop waits on */
+    KernelEventQueue& get_kernel_event_queue();
+
+private:
+    friend class Connection;
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+/*
+ * A TCP server running an event loop on the calling thread.  This is the
+ * event driven alternative to running an accept() loop and a thread per
+ * connection, a handful of these can serve tens of thousands of connections.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::Server server {"8000",
+ *          [] { return std::make_unique<Echo>(); }};
+ *      server.run();
+ */
+class Server {
+public:
+
+    Server(const std::string& port, ConnectionHandlerFactory factory,
+            int backlog = 128);
+
+    /*
+     * The options are applied to the listener and to every connection
+     * accepted from it, see SocketOptions.hpp
+     */
+    Server(const std::string& port, ConnectionHandlerFactory factory,
+            const SocketOptions& options, int backlog = 128);
+
+    /* Serves until stop() is called from another thread or a callback */
+    void run();
+    void stop();
+
+    EventLoop& get_event_loop() { return this->event_loop; }
+
+private:
+    EventLoop event_loop;
+};
+
+/*
+ * A TCP server sharded across several threads.  Each shard is a thread with
+ * its own event loop and its own listening socket on the same port, created
+ * with create_server_sockets(), so the kernel balances new connections across
+ * the shards and no accept queue or lock is shared between them.  By default
+ * the shard threads are pinned to one core each so that a connection is
+ * handled on the same core for its whole life.
+ *
+ * The handler factory is called from all the shard threads so it must be
+ * safe to call concurrently.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::ShardedServer server {"8000",
+ *          [] { return std::make_unique<Echo>(); },
+ *          std::thread::hardware_concurrency()};
+ *      server.run();
+ */
+class ShardedServer {
+public:
+
+    ShardedServer(const std::string& port, ConnectionHandlerFactory factory,
+            unsigned shards, int backlog = 128, bool pin_threads = true);
+    ShardedServer(const std::string& port, ConnectionHandlerFactory factory,
+            unsigned shards, const SocketOptions& options, int backlog = 128,
+            bool pin_threads = true);
+
+    /*
+     * Starts a thread per shard and blocks until stop() is called from
+     * another thread or a callback
+     */
+    void run();
+    void stop();
+
+    std::size_t get_shard_count() const { return this->event_loops.size(); }
+    EventLoop& get_event_loop(std::size_t shard) {
+        return *this->event_loops.at(shard);
+    }
+
+private:
+    std::vector<std::unique_ptr<EventLoop>> event_loops;
+    bool pin_threads;
+};
+
+}
+
+#endif
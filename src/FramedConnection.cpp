@@ -0,0 +1,551 @@
+#include "FramedConnection.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using SocketUtilities::FrameFormat;
+using SocketUtilities::FramedConnection;
+using SocketUtilities::LogLevel;
+using SocketUtilities::Metric;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using SocketUtilities::detail::log_transfer;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/* The longest a varint encoding of a 64 bit length can be */
+static constexpr size_t MAX_VARINT_LENGTH = 10;
+
+/* The smallest ring buffer, so that small frames can be read in bulk */
+static constexpr size_t MIN_RING_CAPACITY = 64 * 1024;
+
+/* Marks that the length of the frame at the front is not known yet */
+static constexpr size_t UNKNOWN = std::numeric_limits<size_t>::max();
+
+/*
+ * A ring buffer whose memory is mapped twice in a row, byte i and byte
+ * i + capacity are the same byte.  The readable and the writable regions are
+ * therefore always contiguous and can be handed to recv() and to the message
+ * callback as they are, whichever way they wrap around the end of the ring
+ */
+class RingBuffer {
+public:
+
+    explicit RingBuffer(size_t minimum_capacity);
+    ~RingBuffer();
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    char* data() { return this->base + this->start; }
+    size_t size() const { return this->used; }
+
+    char* free_space() {
+        return this->base + (this->start + this->used) % this->capacity;
+    }
+    size_t free_size() const { return this->capacity - this->used; }
+
+    /* The bytes written to free_space() become readable */
+    void commit(size_t length) { this->used += length; }
+
+    /* The bytes at the front have been read */
+    void consume(size_t length) {
+        this->start = (this->start + length) % this->capacity;
+        this->used -= length;
+
+        // while empty every read can start at the front again
+        if (!this->used) {
+            this->start = 0;
+        }
+    }
+
+private:
+    char* base;
+    size_t capacity;
+    size_t start {0};
+    size_t used {0};
+};
+
+RingBuffer::RingBuffer(size_t minimum_capacity) {
+
+    // both mappings have to start on a page boundary
+    auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    this->capacity = (minimum_capacity + page_size - 1) / page_size *
+        page_size;
+
+    auto memory_fd = ::memfd_create("cppsockets-ring", MFD_CLOEXEC);
+    if (memory_fd == -1) {
+        throw SocketException {"Error in memfd_create() call : "s +
+            string(std::strerror(errno))};
+    }
+    if (::ftruncate(memory_fd, static_cast<off_t>(this->capacity)) == -1) {
+        auto error = errno;
+        ::close(memory_fd);
+        throw SocketException {"Error in ftruncate() call : "s +
+            string(std::strerror(error))};
+    }
+
+    // reserve twice the address space and map the file over each half
+    auto reserved = ::mmap(nullptr, this->capacity * 2, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        auto error = errno;
+        ::close(memory_fd);
+        throw SocketException {"Error in mmap() call : "s +
+            string(std::strerror(error))};
+    }
+    this->base = static_cast<char*>(reserved);
+    for (size_t half = 0; half < 2; ++half) {
+        auto mapped = ::mmap(this->base + half * this->capacity,
+                this->capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                memory_fd, 0);
+        if (mapped == MAP_FAILED) {
+            auto error = errno;
+            ::munmap(this->base, this->capacity * 2);
+            ::close(memory_fd);
+            throw SocketException {"Error in mmap() call : "s +
+                string(std::strerror(error))};
+        }
+    }
+
+    // the mappings keep the memory alive
+    ::close(memory_fd);
+}
+
+RingBuffer::~RingBuffer() {
+    ::munmap(this->base, this->capacity * 2);
+}
+
+class FramedConnection::Impl {
+public:
+
+    Impl(SocketType sock_fd_in, FrameFormat format_in, size_t max_frame_size_in,
+            size_t coalesce_limit_in, size_t max_pending_output_in);
+
+    /*
+     * Reads the length prefix at the front of the input, returns false when
+     * not all of it has arrived
+     */
+    bool parse_prefix(const char* data, size_t available);
+
+    /* Passes every complete message in the input to the callback */
+    void parse(const FramedConnection::MessageCallback& on_message);
+
+    /* Encodes the prefix for a message of the given length */
+    size_t encode_prefix(char* prefix, size_t length) const;
+
+    /*
+     * Writes the output followed by the payload and the trailer with
+     * sendmsg(), whatever a non blocking socket does not take is copied into
+     * the output
+     */
+    void write_through(const char* payload, size_t length);
+
+    SocketType sock_fd;
+    FrameFormat format;
+    size_t max_frame_size;
+    size_t coalesce_limit;
+    size_t max_pending_output;
+    RingBuffer input;
+
+    // the prefix and message length of the frame at the front of the input
+    // once its prefix has been parsed, or for delimited messages how many
+    // bytes of the input have already been searched for the delimiter
+    size_t prefix_length {0};
+    size_t frame_length {UNKNOWN};
+    size_t searched {0};
+
+    vector<char> output;
+};
+
+FramedConnection::Impl::Impl(SocketType sock_fd_in, FrameFormat format_in,
+        size_t max_frame_size_in, size_t coalesce_limit_in,
+        size_t max_pending_output_in) :
+        sock_fd{sock_fd_in}, format{std::move(format_in)},
+        max_frame_size{max_frame_size_in}, coalesce_limit{coalesce_limit_in},
+        max_pending_output{max_pending_output_in},
+        input{std::max(max_frame_size_in + MAX_VARINT_LENGTH +
+                this->format.delimiter.size(), MIN_RING_CAPACITY)} {
+
+    if (this->format.kind == FrameFormat::Kind::FIXED) {
+        auto width = this->format.prefix_width;
+        if (width != 1 && width != 2 && width != 4 && width != 8) {
+            throw SocketException {"Length prefixes are 1, 2, 4 or 8 bytes "
+                "wide, not "s + to_string(width)};
+        }
+        if (width < 8 && this->max_frame_size >> (width * 8)) {
+            throw SocketException {"The maximum frame size "s +
+                to_string(this->max_frame_size) + " does not fit in a "s +
+                to_string(width) + " byte prefix"s};
+        }
+    }
+    if (this->format.kind == FrameFormat::Kind::DELIMITER &&
+            this->format.delimiter.empty()) {
+        throw SocketException {"The frame delimiter cannot be empty"};
+    }
+}
+
+bool FramedConnection::Impl::parse_prefix(const char* data,
+        size_t available) {
+
+    std::uint64_t length {0};
+    if (this->format.kind == FrameFormat::Kind::VARINT) {
+        size_t i {0};
+        while (true) {
+            if (i == available) {
+                return false;
+            }
+            if (i == MAX_VARINT_LENGTH) {
+                throw SocketException {"Malformed varint frame length"};
+            }
+            auto byte = static_cast<unsigned char>(data[i]);
+
+            // the last byte holds only the 64th bit, anything above it would
+            // be shifted out of the length
+            if (i == MAX_VARINT_LENGTH - 1 && byte > 1) {
+                throw SocketException {"Malformed varint frame length"};
+            }
+            length |= static_cast<std::uint64_t>(byte & 0x7f) << (7 * i);
+            ++i;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        this->prefix_length = i;
+    } else {
+        if (available < this->format.prefix_width) {
+            return false;
+        }
+        for (size_t i = 0; i < this->format.prefix_width; ++i) {
+            length = (length << 8) | static_cast<unsigned char>(data[i]);
+        }
+        this->prefix_length = this->format.prefix_width;
+    }
+
+    if (length > this->max_frame_size) {
+        throw SocketException {"Frame of "s + to_string(length) +
+            " bytes is larger than the maximum of "s +
+            to_string(this->max_frame_size)};
+    }
+    this->frame_length = static_cast<size_t>(length);
+    return true;
+}
+
+void FramedConnection::Impl::parse(
+        const FramedConnection::MessageCallback& on_message) {
+
+    const auto& delimiter = this->format.delimiter;
+    while (this->input.size()) {
+        auto data = this->input.data();
+        auto available = this->input.size();
+
+        if (this->format.kind == FrameFormat::Kind::DELIMITER) {
+
+            // a delimiter may straddle what was searched and what is new
+            auto from = this->searched >= delimiter.size() ?
+                this->searched - delimiter.size() + 1 : 0;
+            auto found = static_cast<const char*>(::memmem(data + from,
+                        available - from, delimiter.data(), delimiter.size()));
+            if (!found) {
+                if (available >= this->max_frame_size + delimiter.size()) {
+                    throw SocketException {"No delimiter in the first "s +
+                        to_string(available) + " bytes, larger than the "
+                        "maximum frame size of "s +
+                        to_string(this->max_frame_size)};
+                }
+                this->searched = available;
+                return;
+            }
+
+            auto length = static_cast<size_t>(found - data);
+            if (length > this->max_frame_size) {
+                throw SocketException {"Frame of "s + to_string(length) +
+                    " bytes is larger than the maximum of "s +
+                    to_string(this->max_frame_size)};
+            }
+            on_message(data, length);
+            this->input.consume(length + delimiter.size());
+            this->searched = 0;
+            continue;
+        }
+
+        if (this->frame_length == UNKNOWN &&
+                !this->parse_prefix(data, available)) {
+            return;
+        }
+        if (available < this->prefix_length + this->frame_length) {
+            return;
+        }
+        on_message(data + this->prefix_length, this->frame_length);
+        this->input.consume(this->prefix_length + this->frame_length);
+        this->frame_length = UNKNOWN;
+    }
+}
+
+size_t FramedConnection::Impl::encode_prefix(char* prefix,
+        size_t length) const {
+
+    if (this->format.kind == FrameFormat::Kind::VARINT) {
+        size_t i {0};
+        while (length >= 0x80) {
+            prefix[i++] = static_cast<char>((length & 0x7f) | 0x80);
+            length >>= 7;
+        }
+        prefix[i++] = static_cast<char>(length);
+        return i;
+    }
+
+    if (this->format.kind == FrameFormat::Kind::FIXED) {
+        auto width = this->format.prefix_width;
+        auto value = static_cast<std::uint64_t>(length);
+        for (size_t i = 0; i < width; ++i) {
+            prefix[width - 1 - i] = static_cast<char>(value & 0xff);
+            value >>= 8;
+        }
+        return width;
+    }
+    return 0;
+}
+
+void FramedConnection::Impl::write_through(const char* payload,
+        size_t length) {
+
+    const auto& trailer = this->format.delimiter;
+    iovec buffers[] = {
+        SocketUtilities::make_iovec(this->output.data(), this->output.size()),
+        SocketUtilities::make_iovec(payload, length),
+        SocketUtilities::make_iovec(trailer.data(), trailer.size())
+    };
+    iovec* remaining = buffers;
+    size_t count = 3;
+
+    while (count) {
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = remaining;
+        message.msg_iovlen = count;
+
+        auto n = ::sendmsg(this->sock_fd, &message, MSG_NOSIGNAL);
+        count_sent(n);
+        if (n >= 0) {
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("sendmsg", this->sock_fd, remaining, count, n);
+            }
+            SocketUtilities::consume_iovecs(remaining, count,
+                    static_cast<size_t>(n));
+            if (count) {
+                SocketUtilities::detail::count(Metric::PARTIAL_WRITES);
+            }
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        throw SocketException {"Error in sendmsg() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    if (!count) {
+        this->output.clear();
+        return;
+    }
+
+    // keep what a full socket did not take, in order, for the next flush()
+    vector<char> rest;
+    for (size_t i = 0; i < count; ++i) {
+        auto base = static_cast<const char*>(remaining[i].iov_base);
+        rest.insert(rest.end(), base, base + remaining[i].iov_len);
+    }
+    this->output.swap(rest);
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+FrameFormat FrameFormat::varint() {
+    return FrameFormat{Kind::VARINT, 0, ""};
+}
+
+FrameFormat FrameFormat::fixed(size_t prefix_width) {
+    return FrameFormat{Kind::FIXED, prefix_width, ""};
+}
+
+FrameFormat FrameFormat::delimited(const string& delimiter) {
+    return FrameFormat{Kind::DELIMITER, 0, delimiter};
+}
+
+FramedConnection::FramedConnection(SocketType sock_fd, FrameFormat format,
+        size_t max_frame_size, size_t coalesce_limit,
+        size_t max_pending_output) :
+    impl_ptr{new Impl{sock_fd, std::move(format), max_frame_size,
+        coalesce_limit, max_pending_output}} {}
+
+FramedConnection::~FramedConnection() {
+    delete this->impl_ptr;
+}
+
+bool FramedConnection::receive(const MessageCallback& on_message) {
+
+    auto& input = this->impl_ptr->input;
+    int flags {0};
+    while (true) {
+
+        // the ring always has room as it holds at least one whole frame and
+        // every complete frame has been taken out of it by parse()
+        auto room = input.free_size();
+        auto n = ::recv(this->impl_ptr->sock_fd, input.free_space(), room,
+                flags);
+        count_received(n);
+        if (n > 0) {
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("recv", this->impl_ptr->sock_fd,
+                        input.free_space(), n);
+            }
+            input.commit(static_cast<size_t>(n));
+            this->impl_ptr->parse(on_message);
+
+            // a short read on a stream socket means it has been drained,
+            // which saves the read that would only return EAGAIN
+            if (static_cast<size_t>(n) < room) {
+                return true;
+            }
+            flags = MSG_DONTWAIT;
+            continue;
+        }
+
+        if (n == 0) {
+            if (log_enabled(LogLevel::EVENTS) && input.size()) {
+                log_output("Stream on socket "s +
+                        to_string(this->impl_ptr->sock_fd) + " ended with "s +
+                        to_string(input.size()) + " bytes of a frame"s);
+            }
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        throw SocketException {"Error in recv() call : "s +
+            string(std::strerror(errno))};
+    }
+}
+
+void FramedConnection::feed(const char* data, size_t length,
+        const MessageCallback& on_message) {
+
+    auto& input = this->impl_ptr->input;
+    while (length) {
+        auto chunk = std::min(length, input.free_size());
+        std::memcpy(input.free_space(), data, chunk);
+        input.commit(chunk);
+        this->impl_ptr->parse(on_message);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+bool FramedConnection::send(const void* data, size_t length) {
+
+    if (length > this->impl_ptr->max_frame_size) {
+        throw SocketException {"Frame of "s + to_string(length) +
+            " bytes is larger than the maximum of "s +
+            to_string(this->impl_ptr->max_frame_size)};
+    }
+
+    // a peer that does not read would otherwise grow the output for ever
+    auto& output = this->impl_ptr->output;
+    if (output.size() >= this->impl_ptr->max_pending_output) {
+        throw SocketException {"Output of "s + to_string(output.size()) +
+            " bytes not written, at least the maximum of "s +
+            to_string(this->impl_ptr->max_pending_output)};
+    }
+
+    char prefix[MAX_VARINT_LENGTH];
+    auto prefix_length = this->impl_ptr->encode_prefix(prefix, length);
+    output.insert(output.end(), prefix, prefix + prefix_length);
+
+    // large payloads go out from where they are instead of being copied
+    auto payload = static_cast<const char*>(data);
+    if (length >= this->impl_ptr->coalesce_limit) {
+        this->impl_ptr->write_through(payload, length);
+    } else {
+        const auto& trailer = this->impl_ptr->format.delimiter;
+        output.insert(output.end(), payload, payload + length);
+        output.insert(output.end(), trailer.begin(), trailer.end());
+        if (output.size() >= this->impl_ptr->coalesce_limit) {
+            this->flush();
+        }
+    }
+    return output.size() < this->impl_ptr->max_pending_output;
+}
+
+bool FramedConnection::send(const string& message) {
+    return this->send(message.data(), message.size());
+}
+
+bool FramedConnection::flush() {
+
+    auto& output = this->impl_ptr->output;
+    size_t written {0};
+    while (written < output.size()) {
+        auto n = ::send(this->impl_ptr->sock_fd, output.data() + written,
+                output.size() - written, MSG_NOSIGNAL);
+        count_sent(n);
+        if (n >= 0) {
+            if (static_cast<size_t>(n) < output.size() - written) {
+                SocketUtilities::detail::count(Metric::PARTIAL_WRITES);
+            }
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_transfer("send", this->impl_ptr->sock_fd,
+                        output.data() + written, n);
+            }
+            written += static_cast<size_t>(n);
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        throw SocketException {"Error in send() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    output.erase(output.begin(), output.begin() + written);
+    return output.empty();
+}
+
+size_t FramedConnection::get_pending_output() const {
+    return this->impl_ptr->output.size();
+}
+
+size_t FramedConnection::get_buffered_input() const {
+    return this->impl_ptr->input.size();
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
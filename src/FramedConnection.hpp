@@ -0,0 +1,165 @@
+#ifndef __CPP_SOCKETS_FRAMED_CONNECTION_HPP__
+#define __CPP_SOCKETS_FRAMED_CONNECTION_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace SocketUtilities {
+
+
+/*
+ * How messages are delimited on a stream.
+ *
+ *  VARINT      : each message is preceded by its length as an unsigned LEB128
+ *                varint, the encoding protobuf uses, 1 byte for messages of
+ *                up to 127 bytes
+ *  FIXED       : each message is preceded by its length in prefix_width bytes
+ *                (1, 2, 4 or 8) in network byte order
+ *  DELIMITER   : each message is followed by the delimiter, which is not part
+ *                of the message and must not occur in it
+ */
+struct FrameFormat {
+
+    enum class Kind { VARINT, FIXED, DELIMITER };
+
+    Kind kind;
+    std::size_t prefix_width;
+    std::string delimiter;
+
+    static FrameFormat varint();
+    static FrameFormat fixed(std::size_t prefix_width = 4);
+    static FrameFormat delimited(const std::string& delimiter = "\n");
+};
+
+/*
+ * Turns a byte stream into messages and back.  recv() hands back however many
+ * bytes happen to have arrived, so without this every protocol on top of a
+ * stream socket reassembles its messages itself.
+ *
+ * Incoming bytes are read straight into a ring buffer that is mapped twice
+ * back to back in virtual memory, so every message in it is contiguous even
+ * when it wraps around the end of the ring.  Complete messages are passed to
+ * the callback as a pointer into the ring without being copied, the pointer
+ * is only valid for the duration of the call.  Parsing is incremental, a
+ * length prefix or the part of the stream already searched for a delimiter is
+ * not looked at again when more bytes arrive.
+ *
+ * Outgoing frames are gathered in one buffer and written together by flush(),
+ * so the responses to a batch of requests go out in one system call.
+ * Payloads of at least the coalesce limit are not copied, they are written
+ * with writev() along with whatever was gathered before them.
+ *
+ * Frames longer than the maximum frame size are a protocol error, both ways.
+ * The ring buffer holds at least one frame of the maximum size.
+ *
+ * The socket may be blocking or non blocking, a non blocking socket can be
+ * driven from a KernelEventQueue by calling receive() when it is readable and
+ * flush() when it is writable while get_pending_output() is not 0.  Output a
+ * non blocking socket does not take is kept up to the pending output limit,
+ * send() returns false once the limit is reached and the caller should stop
+ * sending until flush() has written the output.  The connection does not own
+ * the socket.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::FramedConnection connection {sock_fd,
+ *          SocketUtilities::FrameFormat::varint()};
+ *      while (connection.receive([&](const char* data, std::size_t length) {
+ *          auto response = handle(data, length);
+ *          connection.send(response.data(), response.size());
+ *      })) {
+ *          connection.flush();
+ *      }
+ */
+class FramedConnection {
+public:
+
+    using MessageCallback = std::function<void (const char* data,
+            std::size_t length)>;
+
+    /* The defaults for the constructor */
+    static constexpr std::size_t DEFAULT_MAX_FRAME_SIZE = 1024 * 1024;
+    static constexpr std::size_t DEFAULT_COALESCE_LIMIT = 64 * 1024;
+    static constexpr std::size_t DEFAULT_MAX_PENDING_OUTPUT = 4 * 1024 * 1024;
+
+    /*
+     * ERRORS : Throws an exception if the format is not valid or the ring
+     *          buffer cannot be mapped
+     */
+    FramedConnection(SocketType sock_fd, FrameFormat format,
+            std::size_t max_frame_size = DEFAULT_MAX_FRAME_SIZE,
+            std::size_t coalesce_limit = DEFAULT_COALESCE_LIMIT,
+            std::size_t max_pending_output = DEFAULT_MAX_PENDING_OUTPUT);
+    ~FramedConnection();
+    FramedConnection(const FramedConnection&) = delete;
+    FramedConnection& operator=(const FramedConnection&) = delete;
+
+    /*
+     * Reads from the socket and calls the callback with every complete
+     * message.  The first read blocks if the socket is blocking, after that
+     * the socket is read without blocking until it has nothing more, so one
+     * call drains an edge triggered socket.  Returns false once the peer has
+     * closed the stream, after the messages before the end have been passed
+     * on.
+     *
+     * The callback may call send() but not receive() or feed().
+     *
+     * ERRORS : Throws an exception if recv() fails or a frame is larger than
+     *          the maximum frame size, the connection cannot be used after
+     *          that
+     */
+    bool receive(const MessageCallback& on_message);
+
+    /*
+     * Parses bytes that were read some other way, for example the ones given
+     * to ConnectionHandler::on_read(), and calls the callback with every
+     * message they complete
+     *
+     * ERRORS : Throws an exception if a frame is too large
+     */
+    void feed(const char* data, std::size_t length,
+            const MessageCallback& on_message);
+
+    /*
+     * Adds a frame with the message to the output, which is written when
+     * flush() is called or once more than the coalesce limit is gathered.
+     * Returns false when the output not yet written has reached the pending
+     * output limit, further sends have to wait for flush() to write it.
+     *
+     * ERRORS : Throws an exception if the message is larger than the maximum
+     *          frame size, the socket cannot be written to or the pending
+     *          output was already at its limit before the call
+     */
+    bool send(const void* data, std::size_t length);
+    bool send(const std::string& message);
+
+    /*
+     * Writes the gathered output, returns true if all of it was written and
+     * false if a non blocking socket was full in which case the rest is
+     * written by the next flush()
+     *
+     * ERRORS : Throws an exception if the socket cannot be written to
+     */
+    bool flush();
+
+    /* The number of output bytes not yet written */
+    std::size_t get_pending_output() const;
+
+    /* The number of received bytes that are not yet a complete message */
+    std::size_t get_buffered_input() const;
+
+private:
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,784 @@
+#include "Http.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <sys/uio.h>
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+using SocketUtilities::Connection;
+using SocketUtilities::ConnectionHandler;
+using SocketUtilities::ConnectionHandlerFactory;
+using SocketUtilities::HttpConnectionHandler;
+using SocketUtilities::HttpRequest;
+using SocketUtilities::HttpRequestHandler;
+using SocketUtilities::HttpResponse;
+using SocketUtilities::HttpString;
+using SocketUtilities::LogLevel;
+using SocketUtilities::HTTP_INCOMPLETE;
+using SocketUtilities::HTTP_MALFORMED;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::size_t;
+using std::string;
+using std::to_string;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/* Chunk size lines longer than this are not worth waiting for */
+static constexpr size_t MAX_CHUNK_LINE = 1024;
+
+static char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/*
+ * Returns the first control character (below 0x20, or DEL) at or after p, or
+ * end.  Line ends are control characters so this finds them while checking
+ * that nothing else is in the way, 16 bytes at a time with SSE2.  Bytes from
+ * 0x80 up are let through, header values may carry them
+ */
+static const char* find_control(const char* p, const char* end) {
+
+#if defined(__SSE2__)
+    const auto last_control = _mm_set1_epi8(0x1f);
+    const auto del = _mm_set1_epi8(0x7f);
+    while (end - p >= 16) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+        // a byte is at most 0x1f (unsigned) if the minimum leaves it as is
+        auto control = _mm_cmpeq_epi8(_mm_min_epu8(bytes, last_control),
+                bytes);
+        auto mask = _mm_movemask_epi8(_mm_or_si128(control,
+                    _mm_cmpeq_epi8(bytes, del)));
+        if (mask) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        p += 16;
+    }
+#endif
+
+    for (; p < end; ++p) {
+        auto c = static_cast<unsigned char>(*p);
+        if (c < 0x20 || c == 0x7f) {
+            return p;
+        }
+    }
+    return end;
+}
+
+/*
+ * Finds the end of the line starting at p.  line_end is set to the CR (or a
+ * bare LF) and next to the start of the next line.  Returns HTTP_INCOMPLETE,
+ * HTTP_MALFORMED for a control character other than a tab, or 1
+ */
+static long find_line(const char* p, const char* end, const char*& line_end,
+        const char*& next) {
+
+    while (true) {
+        p = find_control(p, end);
+        if (p == end) {
+            return HTTP_INCOMPLETE;
+        }
+        if (*p == '\t') {
+            ++p;
+            continue;
+        }
+        if (*p == '\n') {
+            line_end = p;
+            next = p + 1;
+            return 1;
+        }
+        if (*p == '\r') {
+            if (p + 1 == end) {
+                return HTTP_INCOMPLETE;
+            }
+            if (p[1] != '\n') {
+                return HTTP_MALFORMED;
+            }
+            line_end = p;
+            next = p + 2;
+            return 1;
+        }
+        return HTTP_MALFORMED;
+    }
+}
+
+/* Whether the comma separated header value lists the token */
+static bool has_token(const HttpString& value, const char* token) {
+
+    auto p = value.data;
+    auto end = value.data + value.length;
+    while (p < end) {
+        while (p < end && (is_space(*p) || *p == ',')) {
+            ++p;
+        }
+        auto start = p;
+        while (p < end && *p != ',') {
+            ++p;
+        }
+        auto stop = p;
+        while (stop > start && is_space(stop[-1])) {
+            --stop;
+        }
+        if (HttpString{start, static_cast<size_t>(stop - start)}
+                .equals_ignore_case(token)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Walks the chunked body at the start of the buffer.  Returns its encoded
+ * length including the last chunk and trailers, HTTP_INCOMPLETE or
+ * HTTP_MALFORMED.  decoded is set to the size of the body, so far if it is
+ * incomplete.  When out is given the chunk data is moved there, which can be
+ * the buffer itself since the decoded body is never ahead of the encoded one
+ */
+static long walk_chunked(const char* data, size_t length, size_t& decoded,
+        char* out) {
+
+    size_t pos {0};
+    decoded = 0;
+    while (true) {
+
+        // the size in hex, maybe followed by extensions that are ignored
+        auto line = static_cast<const char*>(std::memchr(data + pos, '\n',
+                    length - pos));
+        if (!line) {
+            return length - pos > MAX_CHUNK_LINE ? HTTP_MALFORMED :
+                HTTP_INCOMPLETE;
+        }
+        size_t size {0};
+        size_t digits {0};
+        for (auto p = data + pos; p < line; ++p, ++digits) {
+            auto c = to_lower(*p);
+            int digit = (c >= '0' && c <= '9') ? c - '0' :
+                (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+            if (digit < 0) {
+                if (!digits || (*p != ';' && *p != '\r' && !is_space(*p))) {
+                    return HTTP_MALFORMED;
+                }
+                break;
+            }
+            if (digits == 15) {
+                return HTTP_MALFORMED;
+            }
+            size = size * 16 + static_cast<size_t>(digit);
+        }
+        pos = static_cast<size_t>(line - data) + 1;
+
+        // the last chunk is followed by trailers up to an empty line
+        if (!size) {
+            while (true) {
+                auto trailer = static_cast<const char*>(std::memchr(
+                            data + pos, '\n', length - pos));
+                if (!trailer) {
+                    return HTTP_INCOMPLETE;
+                }
+                auto empty = trailer == data + pos ||
+                    (trailer == data + pos + 1 && data[pos] == '\r');
+                pos = static_cast<size_t>(trailer - data) + 1;
+                if (empty) {
+                    return static_cast<long>(pos);
+                }
+            }
+        }
+
+        if (length - pos < size + 2) {
+            decoded += size;
+            return HTTP_INCOMPLETE;
+        }
+        if (data[pos + size] != '\r' || data[pos + size + 1] != '\n') {
+            return HTTP_MALFORMED;
+        }
+        if (out) {
+            std::memmove(out + decoded, data + pos, size);
+        }
+        decoded += size;
+        pos += size + 2;
+    }
+}
+
+/* Parses an unsigned decimal number, false if it is not one */
+static bool parse_length(const HttpString& value, size_t& length) {
+    if (value.empty() || value.length > 18) {
+        return false;
+    }
+    length = 0;
+    for (size_t i = 0; i < value.length; ++i) {
+        if (value.data[i] < '0' || value.data[i] > '9') {
+            return false;
+        }
+        length = length * 10 + static_cast<size_t>(value.data[i] - '0');
+    }
+    return true;
+}
+
+/* The number of headers with the name */
+static size_t count_headers(const HttpRequest& request, const char* name) {
+    size_t count {0};
+    for (size_t i = 0; i < request.header_count; ++i) {
+        if (request.headers[i].name.equals_ignore_case(name)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/*
+ * Reads the body length from every Content-Length header.  The header may
+ * be repeated, or its value be a comma separated list as proxies merge
+ * repeated headers, but only with the same length every time (RFC 7230
+ * section 3.3.2).  Returns false if a value is not a number or two differ,
+ * found is false if there is no Content-Length at all
+ */
+static bool parse_content_length(const HttpRequest& request, bool& found,
+        size_t& length) {
+
+    found = false;
+    for (size_t i = 0; i < request.header_count; ++i) {
+        if (!request.headers[i].name.equals_ignore_case("Content-Length")) {
+            continue;
+        }
+
+        const auto& value = request.headers[i].value;
+        size_t begin {0};
+        while (begin <= value.length) {
+            auto end = begin;
+            while (end < value.length && value.data[end] != ',') {
+                ++end;
+            }
+            auto first = begin;
+            auto last = end;
+            while (first < last && (value.data[first] == ' ' ||
+                        value.data[first] == '\t')) {
+                ++first;
+            }
+            while (last > first && (value.data[last - 1] == ' ' ||
+                        value.data[last - 1] == '\t')) {
+                --last;
+            }
+
+            size_t element;
+            if (!parse_length(HttpString{value.data + first, last - first},
+                        element) || (found && element != length)) {
+                return false;
+            }
+            found = true;
+            length = element;
+            begin = end + 1;
+        }
+    }
+    return true;
+}
+
+static const char* default_reason(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 411: return "Length Required";
+        case 413: return "Content Too Large";
+        case 414: return "URI Too Long";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return "Unknown";
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+bool HttpString::equals(const char* other) const {
+    return std::strlen(other) == this->length &&
+        !std::memcmp(this->data, other, this->length);
+}
+
+bool HttpString::equals_ignore_case(const char* other) const {
+    for (size_t i = 0; i < this->length; ++i) {
+        if (!other[i] || to_lower(this->data[i]) != to_lower(other[i])) {
+            return false;
+        }
+    }
+    return !other[this->length];
+}
+
+const HttpString* HttpRequest::get_header(const char* name) const {
+    for (size_t i = 0; i < this->header_count; ++i) {
+        if (this->headers[i].name.equals_ignore_case(name)) {
+            return &this->headers[i].value;
+        }
+    }
+    return nullptr;
+}
+
+long SocketUtilities::parse_http_request(const char* data, size_t length,
+        HttpRequest& request) {
+
+    // nothing from an earlier request is left for a caller to trip over if
+    // this one turns out to be malformed
+    request.method = HttpString{};
+    request.target = HttpString{};
+    request.path = HttpString{};
+    request.query = HttpString{};
+    request.minor_version = 1;
+    request.header_count = 0;
+    request.body = HttpString{};
+    request.keep_alive = true;
+
+    auto end = data + length;
+    const char* line_end;
+    const char* next;
+    auto found = find_line(data, end, line_end, next);
+    if (found != 1) {
+        return found;
+    }
+
+    // METHOD SP target SP HTTP/1.x
+    auto method_end = static_cast<const char*>(std::memchr(data, ' ',
+                static_cast<size_t>(line_end - data)));
+    if (!method_end || method_end == data) {
+        return HTTP_MALFORMED;
+    }
+    auto target = method_end + 1;
+    auto target_end = static_cast<const char*>(std::memchr(target, ' ',
+                static_cast<size_t>(line_end - target)));
+    if (!target_end || target_end == target) {
+        return HTTP_MALFORMED;
+    }
+    auto version = target_end + 1;
+    if (line_end - version != 8 || std::memcmp(version, "HTTP/1.", 7) ||
+            (version[7] != '0' && version[7] != '1')) {
+        return HTTP_MALFORMED;
+    }
+    for (auto p = data; p < target_end; ++p) {
+        if (*p == '\t') {
+            return HTTP_MALFORMED;
+        }
+    }
+
+    request.method = HttpString{data, static_cast<size_t>(method_end - data)};
+    request.target = HttpString{target,
+        static_cast<size_t>(target_end - target)};
+    auto question = static_cast<const char*>(std::memchr(target, '?',
+                request.target.length));
+    if (question) {
+        request.path = HttpString{target,
+            static_cast<size_t>(question - target)};
+        request.query = HttpString{question + 1,
+            static_cast<size_t>(target_end - question - 1)};
+    } else {
+        request.path = request.target;
+        request.query = HttpString{};
+    }
+    request.minor_version = version[7] - '0';
+
+    // name: value lines up to an empty line
+    auto p = next;
+    while (true) {
+        found = find_line(p, end, line_end, next);
+        if (found != 1) {
+            return found;
+        }
+        if (line_end == p) {
+            break;
+        }
+
+        // continuation lines are obsolete and a way to smuggle headers
+        if (is_space(*p) ||
+                request.header_count == HttpRequest::MAX_HEADERS) {
+            return HTTP_MALFORMED;
+        }
+        auto colon = static_cast<const char*>(std::memchr(p, ':',
+                    static_cast<size_t>(line_end - p)));
+        if (!colon || colon == p) {
+            return HTTP_MALFORMED;
+        }
+        for (auto q = p; q < colon; ++q) {
+            if (is_space(*q)) {
+                return HTTP_MALFORMED;
+            }
+        }
+        auto value = colon + 1;
+        auto value_end = line_end;
+        while (value < value_end && is_space(*value)) {
+            ++value;
+        }
+        while (value_end > value && is_space(value_end[-1])) {
+            --value_end;
+        }
+
+        auto& header = request.headers[request.header_count++];
+        header.name = HttpString{p, static_cast<size_t>(colon - p)};
+        header.value = HttpString{value, static_cast<size_t>(value_end - value)};
+        p = next;
+    }
+
+    auto connection = request.get_header("Connection");
+    if (request.minor_version == 1) {
+        request.keep_alive = !(connection && has_token(*connection, "close"));
+    } else {
+        request.keep_alive = connection &&
+            has_token(*connection, "keep-alive");
+    }
+    return static_cast<long>(next - data);
+}
+
+HttpResponse::HttpResponse(Connection& connection_in, string& head_in,
+        string& header_lines_in, const HttpRequest& request) :
+        connection(connection_in), head(head_in),
+        header_lines(header_lines_in), keep_alive{request.keep_alive},
+        head_request{request.method.equals("HEAD")},
+        http_1_0{request.minor_version == 0} {
+    this->header_lines.clear();
+}
+
+void HttpResponse::set_status(int status_in, const char* reason_in) {
+    this->status = status_in;
+    this->reason = reason_in;
+}
+
+void HttpResponse::add_header(const string& name, const string& value) {
+    this->header_lines.append(name);
+    this->header_lines.append(": ");
+    this->header_lines.append(value);
+    this->header_lines.append("\r\n");
+}
+
+void HttpResponse::set_body(const void* data, size_t length) {
+    this->body = static_cast<const char*>(data);
+    this->body_length = length;
+}
+
+void HttpResponse::set_body(string body_in) {
+    this->owned_body = std::move(body_in);
+    this->body = this->owned_body.data();
+    this->body_length = this->owned_body.size();
+}
+
+void HttpResponse::write_chunk(const void* data, size_t length) {
+
+    // an empty chunk would end the body
+    if (!length) {
+        return;
+    }
+
+    // HTTP/1.0 has no chunked encoding, the body is gathered and sent with
+    // a length instead
+    if (this->http_1_0) {
+        this->owned_body.append(static_cast<const char*>(data), length);
+        this->body = this->owned_body.data();
+        this->body_length = this->owned_body.size();
+        return;
+    }
+
+    if (!this->chunked) {
+        this->chunked = true;
+        this->serialize_head(true);
+        this->backpressure |= !this->connection.write(this->head);
+    }
+    if (this->head_request) {
+        return;
+    }
+
+    char size_line[24];
+    auto size_length = std::snprintf(size_line, sizeof(size_line), "%zx\r\n",
+            length);
+    iovec buffers[] = {
+        SocketUtilities::make_iovec(size_line,
+                static_cast<size_t>(size_length)),
+        SocketUtilities::make_iovec(data, length),
+        SocketUtilities::make_iovec("\r\n", 2)
+    };
+    this->backpressure |= !this->connection.write(buffers, 3);
+}
+
+void HttpResponse::serialize_head(bool chunked_in) {
+
+    auto& out = this->head;
+    out.clear();
+    out.append("HTTP/1.1 ");
+    out.append(to_string(this->status));
+    out.push_back(' ');
+    out.append(this->reason ? this->reason : default_reason(this->status));
+    out.append("\r\n");
+    out.append(this->header_lines);
+
+    // informational, 204 and 304 responses never have a body
+    auto bodyless = this->status < 200 || this->status == 204 ||
+        this->status == 304;
+    if (chunked_in) {
+        out.append("Transfer-Encoding: chunked\r\n");
+    } else if (!bodyless) {
+        out.append("Content-Length: ");
+        out.append(to_string(this->body_length));
+        out.append("\r\n");
+    }
+    if (!this->keep_alive) {
+        out.append("Connection: close\r\n");
+    } else if (this->http_1_0) {
+        out.append("Connection: keep-alive\r\n");
+    }
+    out.append("\r\n");
+}
+
+void HttpResponse::finish() {
+
+    if (this->chunked) {
+        if (!this->head_request) {
+            this->backpressure |= !this->connection.write("0\r\n\r\n", 5);
+        }
+        return;
+    }
+
+    this->serialize_head(false);
+    auto bodyless = this->head_request || this->status < 200 ||
+        this->status == 204 || this->status == 304;
+    iovec buffers[] = {
+        SocketUtilities::make_iovec(this->head.data(), this->head.size()),
+        SocketUtilities::make_iovec(this->body, this->body_length)
+    };
+    this->backpressure |= !this->connection.write(buffers,
+            (bodyless || !this->body_length) ? 1 : 2);
+}
+
+HttpConnectionHandler::HttpConnectionHandler(HttpRequestHandler handler_in,
+        size_t max_header_size_in, size_t max_body_size_in) :
+    handler{std::move(handler_in)}, max_header_size{max_header_size_in},
+    max_body_size{max_body_size_in} {}
+
+void HttpConnectionHandler::on_read(Connection& connection, const char* data,
+        size_t length) {
+
+    if (this->closed) {
+        return;
+    }
+
+    // when nothing is left over from before the requests are parsed right
+    // out of the event loop's read buffer, and only a partial request at the
+    // end is copied
+    if (this->input.empty() && !this->held_back) {
+        auto used = this->process(connection, data, length, false);
+        if (!this->closed && used < length) {
+            this->input.assign(data + used, length - used);
+            if (this->needs_input_copy) {
+                this->needs_input_copy = false;
+                this->process_input(connection);
+            }
+        }
+        return;
+    }
+
+    this->input.append(data, length);
+    this->process_input(connection);
+}
+
+void HttpConnectionHandler::on_write(Connection& connection) {
+    if (this->held_back) {
+        this->held_back = false;
+        this->process_input(connection);
+    }
+}
+
+void HttpConnectionHandler::process_input(Connection& connection) {
+    if (this->closed || this->held_back) {
+        return;
+    }
+    auto used = this->process(connection, this->input.data(),
+            this->input.size(), true);
+    this->input.erase(0, used);
+}
+
+size_t HttpConnectionHandler::process(Connection& connection,
+        const char* data, size_t length, bool owned) {
+
+    size_t offset {0};
+    while (offset < length && !this->closed && !this->held_back) {
+
+        auto start = data + offset;
+        auto available = length - offset;
+        auto head_length = SocketUtilities::parse_http_request(start,
+                available, this->request);
+        if (head_length == HTTP_MALFORMED) {
+            this->reject(connection, 400);
+            break;
+        }
+        if (head_length == HTTP_INCOMPLETE) {
+            if (available > this->max_header_size) {
+                this->reject(connection, 431);
+            }
+            break;
+        }
+        if (static_cast<size_t>(head_length) > this->max_header_size) {
+            this->reject(connection, 431);
+            break;
+        }
+
+        auto header_size = static_cast<size_t>(head_length);
+        auto body = start + header_size;
+        auto body_available = available - header_size;
+        auto transfer_encoding = this->request.get_header("Transfer-Encoding");
+        size_t consumed {0};
+
+        // conflicting lengths, or a length along with a transfer coding, are
+        // how requests are smuggled past proxies that read them differently
+        bool has_content_length;
+        size_t body_length {0};
+        if (!parse_content_length(this->request, has_content_length,
+                    body_length)) {
+            this->reject(connection, 400);
+            break;
+        }
+
+        if (transfer_encoding) {
+
+            if (has_content_length ||
+                    count_headers(this->request, "Transfer-Encoding") > 1) {
+                this->reject(connection, 400);
+                break;
+            }
+            if (!transfer_encoding->equals_ignore_case("chunked")) {
+                this->reject(connection, 501);
+                break;
+            }
+            if (!owned) {
+                this->needs_input_copy = true;
+                break;
+            }
+
+            size_t decoded;
+            auto encoded = walk_chunked(body, body_available, decoded,
+                    nullptr);
+            if (encoded == HTTP_MALFORMED) {
+                this->reject(connection, 400);
+                break;
+            }
+            if (decoded > this->max_body_size) {
+                this->reject(connection, 413);
+                break;
+            }
+            if (encoded == HTTP_INCOMPLETE) {
+                break;
+            }
+
+            // the input buffer is this handler's own, so the body can be
+            // moved together in place
+            auto writable = &this->input[static_cast<size_t>(body -
+                    this->input.data())];
+            walk_chunked(body, body_available, decoded, writable);
+            this->request.body = HttpString{body, decoded};
+            consumed = header_size + static_cast<size_t>(encoded);
+
+        } else if (has_content_length) {
+            if (body_length > this->max_body_size) {
+                this->reject(connection, 413);
+                break;
+            }
+            if (body_available < body_length) {
+                break;
+            }
+            this->request.body = HttpString{body, body_length};
+            consumed = header_size + body_length;
+
+        } else {
+            consumed = header_size;
+        }
+
+        this->respond(connection);
+        offset += consumed;
+    }
+    return offset;
+}
+
+void HttpConnectionHandler::respond(Connection& connection) {
+
+    HttpResponse response {connection, this->head, this->header_lines,
+        this->request};
+    try {
+        this->handler(this->request, response);
+    } catch (const std::exception& exception) {
+        if (log_enabled(LogLevel::EVENTS)) {
+            log_output("HTTP request handler threw : "s + exception.what());
+        }
+
+        // once chunks have gone out there is no way to report the error
+        if (response.chunked) {
+            connection.close();
+            this->closed = true;
+        } else {
+            this->reject(connection, 500);
+        }
+        return;
+    }
+
+    response.finish();
+    if (!response.keep_alive) {
+        connection.close();
+        this->closed = true;
+    }
+    if (response.backpressure) {
+        this->held_back = true;
+    }
+}
+
+void HttpConnectionHandler::reject(Connection& connection, int status) {
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Rejecting HTTP request on socket "s +
+                to_string(connection.get_socket()) + " with "s +
+                to_string(status));
+    }
+
+    HttpResponse response {connection, this->head, this->header_lines,
+        this->request};
+    response.head_request = false;
+    response.close_connection();
+    response.set_status(status);
+    response.finish();
+    connection.close();
+    this->closed = true;
+}
+
+ConnectionHandlerFactory SocketUtilities::http_handler_factory(
+        HttpRequestHandler handler, size_t max_header_size,
+        size_t max_body_size) {
+    return [handler, max_header_size, max_body_size] {
+        return std::unique_ptr<ConnectionHandler>{new HttpConnectionHandler{
+            handler, max_header_size, max_body_size}};
+    };
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
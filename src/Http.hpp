@@ -0,0 +1,237 @@
+#ifndef __CPP_SOCKETS_HTTP_HPP__
+#define __CPP_SOCKETS_HTTP_HPP__
+
+#include "SocketUtilities.hpp"
+#include "EventLoop.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace SocketUtilities {
+
+
+/*
+ * A string that lives in someone else's buffer, for the parts of a request
+ * which point into the receive buffer of the connection instead of being
+ * copied out of it
+ */
+struct HttpString {
+    const char* data {nullptr};
+    std::size_t length {0};
+
+    std::string to_string() const { return std::string(this->data,
+            this->length); }
+    bool empty() const { return !this->length; }
+
+    /* Comparisons, the second ignores ASCII case as header names do */
+    bool equals(const char* other) const;
+    bool equals_ignore_case(const char* other) const;
+};
+
+struct HttpHeader {
+    HttpString name;
+    HttpString value;
+};
+
+/*
+ * A parsed request.  All the strings point into the receive buffer of the
+ * connection and are only valid while the request handler runs, copy out
+ * what needs to live longer.  The request itself is reused for every request
+ * on a connection so parsing does not allocate.
+ *
+ *  method          : GET, POST etc. as sent
+ *  target          : the request target, path with the query
+ *  path, query     : the target split at the first '?', the query does not
+ *                    include the '?'
+ *  minor_version   : 1 for HTTP/1.1, 0 for HTTP/1.0
+ *  body            : the body, with a chunked body already decoded
+ *  keep_alive      : whether the connection stays open after the response,
+ *                    from the version and the Connection header
+ */
+class HttpRequest {
+public:
+
+    static constexpr std::size_t MAX_HEADERS = 64;
+
+    HttpString method;
+    HttpString target;
+    HttpString path;
+    HttpString query;
+    int minor_version {1};
+    HttpHeader headers[MAX_HEADERS];
+    std::size_t header_count {0};
+    HttpString body;
+    bool keep_alive {true};
+
+    /* The value of the first header with the name, nullptr if there is none */
+    const HttpString* get_header(const char* name) const;
+};
+
+/*
+ * Parses the request line and the headers at the start of the buffer into
+ * the request, the body is left to the caller.  Line ends are found and the
+ * header bytes checked for control characters 16 bytes at a time with SSE2
+ * where it is available.  Returns the length of the request line and headers
+ * including the empty line that ends them, HTTP_INCOMPLETE if the buffer ends
+ * before that and HTTP_MALFORMED if the request is not valid HTTP/1.x.
+ */
+constexpr long HTTP_INCOMPLETE = 0;
+constexpr long HTTP_MALFORMED = -1;
+long parse_http_request(const char* data, std::size_t length,
+        HttpRequest& request);
+
+/*
+ * The response to a request, filled in by the request handler and sent once
+ * the handler returns.  The status line, headers and Content-Length are
+ * written into a buffer the connection reuses, and are sent together with
+ * the body in one vectored write without copying the body.
+ *
+ * A handler that does not know the length of the body up front can call
+ * write_chunk() instead of set_body(), the head is then sent with
+ * Transfer-Encoding: chunked before the first chunk and the last chunk is
+ * sent when the handler returns.
+ */
+class HttpResponse {
+public:
+
+    /* Sets the status, the reason defaults to the standard one */
+    void set_status(int status, const char* reason = nullptr);
+
+    /* Adds a header, Content-Length and Connection are added automatically */
+    void add_header(const std::string& name, const std::string& value);
+
+    /*
+     * Sets the body.  The first version does not copy the data, which has to
+     * stay valid until the handler returns, the second keeps the string
+     */
+    void set_body(const void* data, std::size_t length);
+    void set_body(std::string body);
+
+    /*
+     * Sends a chunk of the body right away using chunked transfer encoding,
+     * the status and headers cannot be changed after the first chunk
+     */
+    void write_chunk(const void* data, std::size_t length);
+
+    /* Closes the connection after this response */
+    void close_connection() { this->keep_alive = false; }
+
+    HttpResponse(const HttpResponse&) = delete;
+    HttpResponse& operator=(const HttpResponse&) = delete;
+
+private:
+    friend class HttpConnectionHandler;
+
+    HttpResponse(Connection& connection_in, std::string& head_in,
+            std::string& header_lines_in, const HttpRequest& request);
+
+    /* Writes the status line and headers into head */
+    void serialize_head(bool chunked);
+
+    /* Sends whatever has not been sent yet, called after the handler */
+    void finish();
+
+    Connection& connection;
+    std::string& head;
+    std::string& header_lines;
+    int status {200};
+    const char* reason {nullptr};
+    const char* body {nullptr};
+    std::size_t body_length {0};
+    std::string owned_body;
+    bool keep_alive;
+    bool head_request;
+    bool http_1_0;
+    bool chunked {false};
+    bool backpressure {false};
+};
+
+using HttpRequestHandler = std::function<void (const HttpRequest& request,
+        HttpResponse& response)>;
+
+/*
+ * The connection handler that speaks HTTP/1.1 on top of the event loop.
+ * Connections are kept alive between requests, and pipelined requests (sent
+ * without waiting for the responses to the ones before) are answered in
+ * order.  Request bodies are read with Content-Length or chunked transfer
+ * encoding.  A request with a head larger than max_header_size or a body
+ * larger than max_body_size is answered with 431 or 413 and the connection
+ * is closed, a malformed one with 400.  Content-Length headers that do not
+ * agree, or one along with Transfer-Encoding, make a request malformed.
+ *
+ * When the connection applies backpressure (Connection::write() returned
+ * false) the pipelined requests already received are held back until the
+ * output has drained.
+ */
+class HttpConnectionHandler : public ConnectionHandler {
+public:
+
+    static constexpr std::size_t DEFAULT_MAX_HEADER_SIZE = 64 * 1024;
+    static constexpr std::size_t DEFAULT_MAX_BODY_SIZE = 1024 * 1024;
+
+    explicit HttpConnectionHandler(HttpRequestHandler handler_in,
+            std::size_t max_header_size_in = DEFAULT_MAX_HEADER_SIZE,
+            std::size_t max_body_size_in = DEFAULT_MAX_BODY_SIZE);
+
+    void on_read(Connection& connection, const char* data,
+            std::size_t length) override;
+    void on_write(Connection& connection) override;
+
+private:
+
+    /*
+     * Answers the complete requests at the front of the buffer and returns
+     * how many bytes they took up.  Chunked bodies are decoded in place, so
+     * they are only handled when the buffer is the handler's own input
+     * buffer (owned is true)
+     */
+    std::size_t process(Connection& connection, const char* data,
+            std::size_t length, bool owned);
+
+    /* Answers the request that has just been parsed */
+    void respond(Connection& connection);
+
+    /* Sends an error response and closes the connection */
+    void reject(Connection& connection, int status);
+
+    /* Answers what can be answered from the input buffer */
+    void process_input(Connection& connection);
+
+    HttpRequestHandler handler;
+    std::size_t max_header_size;
+    std::size_t max_body_size;
+    HttpRequest request;
+
+    // bytes of requests that have not been answered yet, and the buffers the
+    // head of every response is written into, all reused across requests
+    std::string input;
+    std::string head;
+    std::string header_lines;
+    bool held_back {false};
+    bool closed {false};
+    bool needs_input_copy {false};
+};
+
+/*
+ * A handler factory for Server, ShardedServer and EventLoop::add_listener()
+ *
+ * EXAMPLE :
+ *      SocketUtilities::Server server {"8080",
+ *          SocketUtilities::http_handler_factory(
+ *              [](const SocketUtilities::HttpRequest& request,
+ *                      SocketUtilities::HttpResponse& response) {
+ *                  response.add_header("Content-Type", "text/plain");
+ *                  response.set_body("Hello, World!"s);
+ *              })};
+ *      server.run();
+ */
+ConnectionHandlerFactory http_handler_factory(HttpRequestHandler handler,
+        std::size_t max_header_size =
+            HttpConnectionHandler::DEFAULT_MAX_HEADER_SIZE,
+        std::size_t max_body_size =
+            HttpConnectionHandler::DEFAULT_MAX_BODY_SIZE);
+
+
+}
+
+#endif
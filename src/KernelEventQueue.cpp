@@ -0,0 +1,173 @@
+#include "KernelEventQueue.hpp"
+#include "SocketException.hpp"
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using SocketUtilities::KernelEventQueue;
+using SocketUtilities::SocketException;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * The implementation is nothing more than the epoll instance.  epoll is
+ * itself threadsafe so no locking is done here, threads that call
+ * epoll_wait() concurrently are each given a disjoint set of events.
+ */
+class KernelEventQueue::Impl {
+public:
+    Impl() : epoll_fd{::epoll_create1(EPOLL_CLOEXEC)} {
+        if (this->epoll_fd == -1) {
+            throw SocketException {"Error in epoll_create1() call : "s +
+                string(std::strerror(errno))};
+        }
+    }
+    ~Impl() {
+        ::close(this->epoll_fd);
+    }
+
+    int epoll_fd;
+};
+
+/*
+ * Translates the masks of this library into the ones epoll understands.  The
+ * hangup and error conditions are reported by epoll without asking for them
+ * but EPOLLRDHUP is added so that a peer shutting down its write half is
+ * seen without another recv().  Except with EPOLLEXCLUSIVE, which the kernel
+ * only accepts together with EPOLLIN, EPOLLOUT, EPOLLET and EPOLLWAKEUP
+ */
+static std::uint32_t to_epoll_mask(std::uint32_t interest_mask) {
+
+    std::uint32_t epoll_mask {0};
+    if (!(interest_mask & KernelEventQueue::EXCLUSIVE)) {
+        epoll_mask |= EPOLLRDHUP;
+    }
+    if (interest_mask & KernelEventQueue::READ) { epoll_mask |= EPOLLIN; }
+    if (interest_mask & KernelEventQueue::WRITE) { epoll_mask |= EPOLLOUT; }
+    if (interest_mask & KernelEventQueue::EDGE_TRIGGERED) {
+        epoll_mask |= EPOLLET;
+    }
+    if (interest_mask & KernelEventQueue::ONE_SHOT) {
+        epoll_mask |= EPOLLONESHOT;
+    }
+    if (interest_mask & KernelEventQueue::EXCLUSIVE) {
+        epoll_mask |= EPOLLEXCLUSIVE;
+    }
+    return epoll_mask;
+}
+
+static std::uint32_t from_epoll_mask(std::uint32_t epoll_mask) {
+
+    using Event = KernelEventQueue::Event;
+    std::uint32_t flags {0};
+    if (epoll_mask & (EPOLLIN | EPOLLPRI)) { flags |= Event::READABLE; }
+    if (epoll_mask & EPOLLOUT) { flags |= Event::WRITABLE; }
+    if (epoll_mask & (EPOLLHUP | EPOLLRDHUP)) { flags |= Event::HANGUP; }
+    if (epoll_mask & EPOLLERR) { flags |= Event::ERROR; }
+    return flags;
+}
+
+static void control(int epoll_fd, int operation,
+        KernelEventQueue::FileDescriptorType descriptor,
+        std::uint32_t interest_mask, const char* operation_name) {
+
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = to_epoll_mask(interest_mask);
+    event.data.fd = descriptor;
+
+    if (::epoll_ctl(epoll_fd, operation, descriptor, &event) == -1) {
+        throw SocketException {"Error in epoll_ctl("s + operation_name +
+            ") on descriptor "s + to_string(descriptor) + " : "s +
+            string(std::strerror(errno))};
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+KernelEventQueue& KernelEventQueue::get_kernel_event_queue() {
+
+    // initialization of function local statics is threadsafe
+    static KernelEventQueue kernel_event_queue;
+    return kernel_event_queue;
+}
+
+KernelEventQueue::KernelEventQueue() : impl_ptr{new Impl{}} {}
+
+KernelEventQueue::~KernelEventQueue() {
+    delete this->impl_ptr;
+}
+
+void KernelEventQueue::declare_interest(FileDescriptorType descriptor) {
+    this->declare_interest(descriptor, READ);
+}
+
+void KernelEventQueue::declare_interest(FileDescriptorType descriptor,
+        std::uint32_t interest_mask) {
+    control(this->impl_ptr->epoll_fd, EPOLL_CTL_ADD, descriptor,
+            interest_mask, "add");
+}
+
+void KernelEventQueue::modify_interest(FileDescriptorType descriptor,
+        std::uint32_t interest_mask) {
+
+    // EPOLLEXCLUSIVE is only allowed when adding the descriptor
+    control(this->impl_ptr->epoll_fd, EPOLL_CTL_MOD, descriptor,
+            interest_mask & ~EXCLUSIVE, "modify");
+}
+
+void KernelEventQueue::rescind_interest(FileDescriptorType descriptor) {
+    control(this->impl_ptr->epoll_fd, EPOLL_CTL_DEL, descriptor, 0, "delete");
+}
+
+std::size_t KernelEventQueue::get_active_events(vector<Event>& events,
+        int timeout) {
+
+    // each waiting thread gets its own batch buffer, this is allocated once
+    // per thread and not on every call
+    thread_local std::array<epoll_event, MAX_EVENTS_PER_WAIT> ready;
+
+    events.clear();
+    int n = ::epoll_wait(this->impl_ptr->epoll_fd, ready.data(),
+            static_cast<int>(ready.size()), timeout);
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw SocketException {"Error in epoll_wait() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    events.reserve(MAX_EVENTS_PER_WAIT);
+    for (int i = 0; i < n; ++i) {
+        // epoll_event is packed so the fields are copied out before use
+        FileDescriptorType descriptor = ready[i].data.fd;
+        events.emplace_back(descriptor, from_epoll_mask(ready[i].events));
+    }
+    return events.size();
+}
+
+vector<KernelEventQueue::FileDescriptorType>
+KernelEventQueue::get_active_descriptors(int timeout) {
+
+    thread_local vector<Event> events;
+    this->get_active_events(events, timeout);
+
+    vector<FileDescriptorType> descriptors;
+    descriptors.reserve(events.size());
+    for (const auto& event : events) {
+        descriptors.push_back(event.get_descriptor());
+    }
+    return descriptors;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -3,6 +3,7 @@
 
 #include "SocketUtilities.hpp"
 #include <vector>
+#include <cstdint>
 
 namespace SocketUtilities {
 
@@ -11,23 +12,45 @@ namespace SocketUtilities {
  * A generic kernel event queue that is meant to be used for polling
  * purposes on a file desciptor.  The poll() and select() functions are not
  * included in this class becasue they are not made to be used in
- * multithreaded situations and do not scale well with increasing traffic. 
- * Only one kernel queue is meant to be present for one process so this will
- * be a singleton object.
+ * multithreaded situations and do not scale well with increasing traffic.
+ *
+ * A process wide queue is available through get_kernel_event_queue(), but
+ * more queues may be constructed directly, for example one per worker thread
+ * so that each worker only ever sees the descriptors that it owns.
  *
  * To submit file descriptors to the queue to be watched users must call
- * declare_interest(). 
+ * declare_interest() with a mask of the events they care about.  The mask may
+ * be changed later with modify_interest() and the descriptor removed from the
+ * queue with rescind_interest().
  *
- * Users who want to block and get the list of file descriptors that can be
- * read must call get_readable_fds().  Similarly get_writeable_fds() will
- * return a list of file descriptors that can be written to
+ * Users who want to block and get the list of file descriptors that are ready
+ * must call get_active_events() (or get_active_descriptors() when only the
+ * descriptors are needed).  Any number of threads may wait on the same queue
+ * at once, each of them will be handed a disjoint batch of events by the
+ * kernel.  Combine this with ONE_SHOT to guarantee that a descriptor is only
+ * ever being serviced by one thread at a time.  When instead every thread
+ * has a queue of its own and they all watch the same listening socket, add
+ * it to each queue with EXCLUSIVE to avoid waking every one of them on each
+ * new connection.
  *
- * This class is system dependant so it will differ from OS to OS, but in
- * most cases it will either use epoll() for linux and it will use kqueues
- * for BSDs like Darwin (and subsequently OSX)
+ * This class is system dependant so it will differ from OS to OS.  The
+ * current implementation uses epoll() and is therefore Linux only.
  *
  * NOTE : These functions will fail if the socket is set to blocking.  So
- * remember to set the socket to non blocking first. 
+ * remember to set the socket to non blocking first, see make_non_blocking()
+ *
+ * EXAMPLE :
+ *      auto& queue = KernelEventQueue::get_kernel_event_queue();
+ *      queue.declare_interest(client_socket, KernelEventQueue::READ |
+ *          KernelEventQueue::EDGE_TRIGGERED);
+ *
+ *      std::vector<KernelEventQueue::Event> events;
+ *      while (true) {
+ *          queue.get_active_events(events);
+ *          for (auto event : events) {
+ *              if (event.readable()) { // recv() until EAGAIN }
+ *          }
+ *      }
  */
 class KernelEventQueue {
 public:
@@ -37,36 +60,137 @@ public:
     using FileDescriptorType = SocketUtilities::FileDescriptorType;
 
     /*
-     * Returns a reference to the singleton kernel event queue.  This method is
-     * threadsafe.  So there will be no data races when multiple threads try and
-     * get the same kernel queue
+     * The interest mask passed to declare_interest() and modify_interest().
+     * READ and WRITE select the readiness events to be reported, the rest
+     * change how and to whom they are reported
+     *
+     *  READ            : report when the descriptor can be read from, or has
+     *                    a pending connection if it is a listening socket
+     *  WRITE           : report when the descriptor can be written to
+     *  EDGE_TRIGGERED  : report only on changes in readiness, the default is
+     *                    to report for as long as the descriptor is ready.
+     *                    The descriptor must be drained until EAGAIN
+     *  ONE_SHOT        : disable the descriptor after one event has been
+     *                    reported, it must be rearmed with modify_interest()
+     *  EXCLUSIVE       : when the descriptor is watched by several queues,
+     *                    wake only one (or a few) of them rather than all of
+     *                    them.  Only valid with declare_interest() and only
+     *                    together with READ, WRITE and EDGE_TRIGGERED, the
+     *                    kernel rejects it with ONE_SHOT.  Hangups are still
+     *                    reported but a peer shutting down its write half is
+     *                    only seen by reading the end of the stream
+     */
+    enum InterestMask : std::uint32_t {
+        READ            = 1 << 0,
+        WRITE           = 1 << 1,
+        EDGE_TRIGGERED  = 1 << 2,
+        ONE_SHOT        = 1 << 3,
+        EXCLUSIVE       = 1 << 4
+    };
+
+    /*
+     * A single readiness event as reported by the kernel.  The hangup and
+     * error states are always reported regardless of the interest mask
+     */
+    class Event {
+    public:
+        Event() = default;
+        Event(FileDescriptorType descriptor_in, std::uint32_t flags_in) :
+            descriptor{descriptor_in}, flags{flags_in} {}
+
+        FileDescriptorType get_descriptor() const { return this->descriptor; }
+
+        bool readable() const { return this->flags & READABLE; }
+        bool writable() const { return this->flags & WRITABLE; }
+        bool hangup() const { return this->flags & HANGUP; }
+        bool error() const { return this->flags & ERROR; }
+
+        /* bits used to store the state of the event */
+        enum : std::uint32_t {
+            READABLE    = 1 << 0,
+            WRITABLE    = 1 << 1,
+            HANGUP      = 1 << 2,
+            ERROR       = 1 << 3
+        };
+
+    private:
+        FileDescriptorType descriptor {-1};
+        std::uint32_t flags {0};
+    };
+
+    /*
+     * The maximum number of events returned from one call to
+     * get_active_events(), a waiting thread is given at most this many events
+     * and the rest are left for the next call or for other waiting threads
+     */
+    static constexpr int MAX_EVENTS_PER_WAIT = 256;
+
+    /*
+     * Returns a reference to the process wide kernel event queue.  This method
+     * is threadsafe.  So there will be no data races when multiple threads try
+     * and get the same kernel queue
      */
     static KernelEventQueue& get_kernel_event_queue();
 
+    /*
+     * Creates a new independent queue.  Throws an exception if the kernel
+     * refuses to create one.  The queue cannot be copied or moved because
+     * other threads may be blocked on it
+     */
+    KernelEventQueue();
+    ~KernelEventQueue();
+    KernelEventQueue(const KernelEventQueue&) = delete;
+    KernelEventQueue& operator=(const KernelEventQueue&) = delete;
+
     /*
      * Users may call this function to declare interest in a given file
-     * descriptor.  Thread safe with respect to the internals of the queue but
-     * may result in repeated additions when used concurrently without
-     * synchronization. 
+     * descriptor.  Thread safe with respect to the internals of the queue.
+     * Declaring interest in a descriptor that is already in the queue is an
+     * error, use modify_interest() to change the mask instead.
+     *
+     * The single argument version watches the descriptor for reading in level
+     * triggered mode.
      */
     void declare_interest(FileDescriptorType);
+    void declare_interest(FileDescriptorType, std::uint32_t interest_mask);
+
+    /*
+     * Changes the interest mask for a descriptor that is already being
+     * watched.  This is also the way to rearm a ONE_SHOT descriptor
+     */
+    void modify_interest(FileDescriptorType, std::uint32_t interest_mask);
 
     /*
      * This is analogous to the function call above in that this function is
      * used to "unwatch" the required file descriptor.  For example this may be
-     * used when the file descriptor has been sent all required information. 
+     * used when the file descriptor has been sent all required information.
      */
     void rescind_interest(FileDescriptorType);
 
+    /*
+     * Blocks until at least one of the watched descriptors is ready and
+     * stores the ready events in the vector passed in.  The vector is cleared
+     * first and reused, so once it has grown to MAX_EVENTS_PER_WAIT no more
+     * memory is allocated in subsequent calls.  Returns the number of events.
+     *
+     * The timeout parameter contains the number of milliseconds before a
+     * timeout should occur, a negative timeout blocks indefinitely.  On
+     * timeout (or when interrupted by a signal) the function returns 0 with
+     * an empty vector.
+     *
+     * Any number of threads may call this at the same time on the same queue.
+     */
+    std::size_t get_active_events(std::vector<Event>& events,
+            int timeout = -1);
+
     /*
      * This functions is blocks to return a list of file descriptors that are
      * ready for reading or writing.  The timeout parameter will contain the
      * number of milliseconds before a timeout should occur.  And on timeout the
-     * function will return an empty vector.  If one thread is already waiting
-     * on either one of these functions then any other thread calling these will
-     * receive an exception from this library.
+     * function will return an empty vector.  Can be called from multiple
+     * threads at once.
      */
-    std::vector<FileDescriptorType> get_active_descriptors();
+    std::vector<FileDescriptorType> get_active_descriptors(int timeout = -1);
 
 private:
 
@@ -0,0 +1,90 @@
+#ifndef __CPP_SOCKETS_METRIC_COUNTERS_HPP__
+#define __CPP_SOCKETS_METRIC_COUNTERS_HPP__
+
+/*
+ * Private header for the counters behind Metrics.hpp, shared by the
+ * implementation files of this library.  Every call that moves data on a
+ * socket is counted, so a new one has to be as well.  Call sites count right
+ * after the system call, while errno still belongs to it
+ *
+ *      ssize_t n = ::recv(sock_fd, buffer, length, flags);
+ *      count_received(n);
+ */
+
+#include "Metrics.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace SocketUtilities {
+namespace detail {
+
+/*
+ * The counters of one thread.  Only the owning thread writes to them so
+ * updates are a relaxed load and store rather than a locked add, the atomics
+ * are only there so that readers on other threads see whole values
+ */
+struct alignas(64) ThreadCounters {
+    std::atomic<std::uint64_t> values[METRIC_COUNT];
+};
+
+/* The counters of the calling thread, null until it first counts */
+inline ThreadCounters*& thread_counters() {
+    thread_local ThreadCounters* counters {nullptr};
+    return counters;
+}
+
+/*
+ * Gives the calling thread its counters, the slow path of count().  It leaves
+ * errno as it was so that counting never disturbs the caller's error handling
+ */
+ThreadCounters& register_thread_counters();
+
+inline void count(Metric metric, std::uint64_t amount = 1) {
+    auto counters = thread_counters();
+    if (!counters) {
+        counters = &register_thread_counters();
+    }
+    auto& value = counters->values[static_cast<std::size_t>(metric)];
+    value.store(value.load(std::memory_order_relaxed) + amount,
+            std::memory_order_relaxed);
+}
+
+/*
+ * Counts a failed call as would block or as an error going by its errno, an
+ * interrupted call is neither since it is simply made again
+ */
+inline void count_failure(int error) {
+    if (error == EINTR) {
+        return;
+    }
+    count(error == EAGAIN || error == EWOULDBLOCK ? Metric::WOULD_BLOCK :
+            Metric::ERRORS);
+}
+
+/* Counts one send or recv system call that returned n */
+inline void count_sent(ssize_t n) {
+    count(Metric::SEND_CALLS);
+    if (n >= 0) {
+        count(Metric::BYTES_SENT, static_cast<std::uint64_t>(n));
+    } else {
+        count_failure(errno);
+    }
+}
+inline void count_received(ssize_t n) {
+    count(Metric::RECV_CALLS);
+    if (n >= 0) {
+        count(Metric::BYTES_RECEIVED, static_cast<std::uint64_t>(n));
+    } else {
+        count_failure(errno);
+    }
+}
+
+/* Whether the event loop should track the TCP_INFO of its connections */
+extern std::atomic<bool> tcp_info_sampling;
+
+} // namespace detail
+} // namespace SocketUtilities
+
+#endif
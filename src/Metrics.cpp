@@ -0,0 +1,299 @@
+#include "Metrics.hpp"
+#include "MetricCounters.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+using SocketUtilities::Metric;
+using SocketUtilities::MetricsSnapshot;
+using SocketUtilities::SocketType;
+using SocketUtilities::TcpInfoSample;
+using SocketUtilities::TcpInfoSummary;
+using SocketUtilities::detail::ThreadCounters;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::uint64_t;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+std::atomic<bool> SocketUtilities::detail::tcp_info_sampling {false};
+
+/*
+ * Every block of counters ever handed out, and the ones whose threads have
+ * exited.  Those are given to the next new thread, which carries on counting
+ * into them, so the counts of exited threads are kept without folding them
+ * anywhere and a server that starts a thread per connection does not grow
+ * the registry.  Neither the blocks nor the registry are ever freed since
+ * detached threads may exit after static destruction
+ */
+class CounterRegistry {
+public:
+    std::mutex mutex;
+    vector<ThreadCounters*> blocks;
+    vector<ThreadCounters*> free_blocks;
+};
+
+static CounterRegistry& get_counter_registry() {
+    static auto registry = new CounterRegistry;
+    return *registry;
+}
+
+/*
+ * operator new does not align past alignof(max_align_t) before C++17, so the
+ * cache line alignment of the blocks is asked for explicitly
+ */
+static ThreadCounters* allocate_counters() {
+    void* memory;
+    if (::posix_memalign(&memory, alignof(ThreadCounters),
+                sizeof(ThreadCounters))) {
+        throw std::bad_alloc{};
+    }
+    return new (memory) ThreadCounters{};
+}
+
+/* Returns the counters of a thread to the registry when it exits */
+class CountersOwner {
+public:
+    ~CountersOwner() {
+        if (this->counters) {
+            auto& registry = get_counter_registry();
+            std::lock_guard<std::mutex> lck {registry.mutex};
+            registry.free_blocks.push_back(this->counters);
+            SocketUtilities::detail::thread_counters() = nullptr;
+        }
+    }
+    ThreadCounters* counters {nullptr};
+};
+
+/* The sockets whose TCP_INFO is sampled when the metrics are read */
+class TrackedSockets {
+public:
+    std::mutex mutex;
+    std::unordered_set<SocketType> sockets;
+};
+
+static TrackedSockets& get_tracked_sockets() {
+    static auto tracked = new TrackedSockets;
+    return *tracked;
+}
+
+/* The name and HELP text of each metric, in the order of the enum */
+static const char* const METRIC_NAMES[SocketUtilities::METRIC_COUNT] = {
+    "bytes_sent_total", "bytes_received_total", "send_calls_total",
+    "recv_calls_total", "partial_writes_total", "would_block_total",
+    "accepts_total", "errors_total"
+};
+static const char* const METRIC_HELP[SocketUtilities::METRIC_COUNT] = {
+    "Bytes sent on sockets",
+    "Bytes received on sockets",
+    "send system calls made",
+    "recv system calls made",
+    "Sends that took only part of the data given",
+    "Calls on non blocking sockets that failed with EAGAIN",
+    "Connections accepted",
+    "Socket calls that failed with an error other than EAGAIN"
+};
+
+/* Appends one metric in the exposition format */
+static void append_metric(string& output, const char* name, const char* type,
+        const char* help, const string& value) {
+    output += "# HELP cppsockets_"s + name + " "s + help + "\n"s;
+    output += "# TYPE cppsockets_"s + name + " "s + type + "\n"s;
+    output += "cppsockets_"s + name + " "s + value + "\n"s;
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+ThreadCounters& SocketUtilities::detail::register_thread_counters() {
+
+    auto error = errno;
+    thread_local CountersOwner owner;
+    auto& registry = get_counter_registry();
+    {
+        std::lock_guard<std::mutex> lck {registry.mutex};
+        if (registry.free_blocks.empty()) {
+            owner.counters = allocate_counters();
+            registry.blocks.push_back(owner.counters);
+        } else {
+            owner.counters = registry.free_blocks.back();
+            registry.free_blocks.pop_back();
+        }
+    }
+    thread_counters() = owner.counters;
+    errno = error;
+    return *owner.counters;
+}
+
+const char* SocketUtilities::get_metric_name(Metric metric) {
+    return METRIC_NAMES[static_cast<size_t>(metric)];
+}
+
+MetricsSnapshot SocketUtilities::get_metrics() {
+
+    MetricsSnapshot snapshot {};
+    auto& registry = get_counter_registry();
+    std::lock_guard<std::mutex> lck {registry.mutex};
+    for (const auto& block : registry.blocks) {
+        for (size_t i = 0; i < METRIC_COUNT; ++i) {
+            snapshot.values[i] += block->values[i].load(
+                    std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+bool SocketUtilities::sample_tcp_info(SocketType sock_fd,
+        TcpInfoSample& sample) {
+
+    tcp_info info;
+    socklen_t length = sizeof(info);
+    if (::getsockopt(sock_fd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1) {
+        return false;
+    }
+    sample.rtt = info.tcpi_rtt;
+    sample.rtt_variance = info.tcpi_rttvar;
+    sample.congestion_window = info.tcpi_snd_cwnd;
+    sample.slow_start_threshold = info.tcpi_snd_ssthresh;
+    sample.retransmits = info.tcpi_total_retrans;
+    sample.lost = info.tcpi_lost;
+    sample.unacknowledged = info.tcpi_unacked;
+    return true;
+}
+
+void SocketUtilities::set_tcp_info_sampling(bool enable) {
+    detail::tcp_info_sampling.store(enable);
+}
+
+bool SocketUtilities::get_tcp_info_sampling() {
+    return detail::tcp_info_sampling.load();
+}
+
+void SocketUtilities::track_tcp_info(SocketType sock_fd) {
+    auto& tracked = get_tracked_sockets();
+    std::lock_guard<std::mutex> lck {tracked.mutex};
+    tracked.sockets.insert(sock_fd);
+}
+
+void SocketUtilities::untrack_tcp_info(SocketType sock_fd) {
+    auto& tracked = get_tracked_sockets();
+    std::lock_guard<std::mutex> lck {tracked.mutex};
+    tracked.sockets.erase(sock_fd);
+}
+
+vector<std::pair<SocketType, TcpInfoSample>>
+SocketUtilities::sample_tracked_tcp_info() {
+
+    // the lock is held while sampling so that no socket is untracked, closed
+    // and its descriptor reused for something else in the meantime
+    vector<std::pair<SocketType, TcpInfoSample>> samples;
+    auto& tracked = get_tracked_sockets();
+    std::lock_guard<std::mutex> lck {tracked.mutex};
+    samples.reserve(tracked.sockets.size());
+    for (auto sock_fd : tracked.sockets) {
+        TcpInfoSample sample;
+        if (SocketUtilities::sample_tcp_info(sock_fd, sample)) {
+            samples.emplace_back(sock_fd, sample);
+        }
+    }
+    std::sort(samples.begin(), samples.end(), [](const auto& one,
+                const auto& other) { return one.first < other.first; });
+    return samples;
+}
+
+TcpInfoSummary SocketUtilities::summarize_tcp_info() {
+
+    TcpInfoSummary summary {};
+    auto samples = SocketUtilities::sample_tracked_tcp_info();
+    for (const auto& sample : samples) {
+        summary.mean_rtt += sample.second.rtt;
+        summary.max_rtt = std::max(summary.max_rtt, sample.second.rtt);
+        summary.mean_congestion_window += sample.second.congestion_window;
+        summary.retransmits += sample.second.retransmits;
+        summary.lost += sample.second.lost;
+    }
+    summary.connections = samples.size();
+    if (summary.connections) {
+        summary.mean_rtt /= static_cast<double>(summary.connections);
+        summary.mean_congestion_window /=
+            static_cast<double>(summary.connections);
+    }
+    return summary;
+}
+
+string SocketUtilities::format_prometheus_metrics(bool per_connection) {
+
+    string output;
+    auto snapshot = SocketUtilities::get_metrics();
+    for (size_t i = 0; i < METRIC_COUNT; ++i) {
+        append_metric(output, METRIC_NAMES[i], "counter", METRIC_HELP[i],
+                to_string(snapshot.values[i]));
+    }
+
+    // nothing to say about TCP connections when none are tracked
+    auto summary = SocketUtilities::summarize_tcp_info();
+    if (!summary.connections) {
+        return output;
+    }
+    append_metric(output, "tcp_connections_sampled", "gauge",
+            "TCP connections whose TCP_INFO was sampled",
+            to_string(summary.connections));
+    append_metric(output, "tcp_rtt_mean_microseconds", "gauge",
+            "Mean smoothed round trip time of the sampled connections",
+            to_string(summary.mean_rtt));
+    append_metric(output, "tcp_rtt_max_microseconds", "gauge",
+            "Largest smoothed round trip time of the sampled connections",
+            to_string(summary.max_rtt));
+    append_metric(output, "tcp_congestion_window_mean_segments", "gauge",
+            "Mean congestion window of the sampled connections",
+            to_string(summary.mean_congestion_window));
+    append_metric(output, "tcp_retransmits", "gauge",
+            "Segments retransmitted by the sampled connections",
+            to_string(summary.retransmits));
+    append_metric(output, "tcp_lost_segments", "gauge",
+            "Segments currently considered lost on the sampled connections",
+            to_string(summary.lost));
+
+    if (per_connection) {
+        auto samples = SocketUtilities::sample_tracked_tcp_info();
+        output += "# HELP cppsockets_tcp_connection_rtt_microseconds Smoothed "
+            "round trip time of one connection\n"
+            "# TYPE cppsockets_tcp_connection_rtt_microseconds gauge\n";
+        for (const auto& sample : samples) {
+            output += "cppsockets_tcp_connection_rtt_microseconds{socket=\""s +
+                to_string(sample.first) + "\"} "s +
+                to_string(sample.second.rtt) + "\n"s;
+        }
+        output += "# HELP cppsockets_tcp_connection_congestion_window_segments "
+            "Congestion window of one connection\n"
+            "# TYPE cppsockets_tcp_connection_congestion_window_segments "
+            "gauge\n";
+        for (const auto& sample : samples) {
+            output += "cppsockets_tcp_connection_congestion_window_segments"
+                "{socket=\""s + to_string(sample.first) + "\"} "s +
+                to_string(sample.second.congestion_window) + "\n"s;
+        }
+        output += "# HELP cppsockets_tcp_connection_retransmits Segments "
+            "retransmitted by one connection\n"
+            "# TYPE cppsockets_tcp_connection_retransmits gauge\n";
+        for (const auto& sample : samples) {
+            output += "cppsockets_tcp_connection_retransmits{socket=\""s +
+                to_string(sample.first) + "\"} "s +
+                to_string(sample.second.retransmits) + "\n"s;
+        }
+    }
+    return output;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
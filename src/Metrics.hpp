@@ -0,0 +1,137 @@
+#ifndef __CPP_SOCKETS_METRICS_HPP__
+#define __CPP_SOCKETS_METRICS_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SocketUtilities {
+
+
+/*
+ * Counters for what the library does on sockets, always on.  Every send,
+ * receive and accept the library makes itself is counted, for a TLS
+ * connection as the plaintext passed through SSL_read() and SSL_write().
+ * Operations submitted to a CompletionQueue are carried out by the kernel and
+ * are not counted, nor are the reads of zero copy notifications.  Every thread
+ * counts into its own block of counters, aligned to a cache line so no two
+ * threads ever write to the same line, and with plain loads and stores
+ * instead of locked instructions since only the owning thread writes.
+ * Counting is a few nanoseconds next to a system call that takes a
+ * microsecond.  Reading the metrics adds up the blocks of all the threads, the
+ * counts of threads that have exited are kept.
+ *
+ * The counters are monotonic, like Prometheus counters, take the difference
+ * of two snapshots for the rate over an interval.
+ *
+ *  BYTES_SENT, BYTES_RECEIVED  : payload bytes moved by send and recv calls
+ *  SEND_CALLS, RECV_CALLS      : the system calls made, successful or not, a
+ *                                batch of datagrams or a splice() is one
+ *  PARTIAL_WRITES              : sends that took only part of what they were
+ *                                given, send_all() then loops and the event
+ *                                loop buffers the rest
+ *  WOULD_BLOCK                 : calls on non blocking sockets that failed
+ *                                with EAGAIN
+ *  ACCEPTS                     : connections accepted
+ *  ERRORS                      : calls that failed for any other reason
+ */
+enum class Metric {
+    BYTES_SENT,
+    BYTES_RECEIVED,
+    SEND_CALLS,
+    RECV_CALLS,
+    PARTIAL_WRITES,
+    WOULD_BLOCK,
+    ACCEPTS,
+    ERRORS
+};
+constexpr std::size_t METRIC_COUNT = 8;
+
+/* The name of the metric in the Prometheus export, like "bytes_sent_total" */
+const char* get_metric_name(Metric metric);
+
+/* The counters of all threads added up */
+struct MetricsSnapshot {
+    std::uint64_t values[METRIC_COUNT];
+
+    std::uint64_t operator[](Metric metric) const {
+        return this->values[static_cast<std::size_t>(metric)];
+    }
+};
+
+MetricsSnapshot get_metrics();
+
+/*
+ * What the kernel knows about one TCP connection (TCP_INFO)
+ *
+ *  rtt, rtt_variance   : the smoothed round trip time and its variance in
+ *                        microseconds
+ *  congestion_window   : the congestion window in segments
+ *  retransmits         : segments retransmitted over the whole connection
+ *  lost                : segments currently considered lost
+ *  unacknowledged      : segments sent and not acknowledged yet
+ */
+struct TcpInfoSample {
+    std::uint32_t rtt;
+    std::uint32_t rtt_variance;
+    std::uint32_t congestion_window;
+    std::uint32_t slow_start_threshold;
+    std::uint32_t retransmits;
+    std::uint32_t lost;
+    std::uint32_t unacknowledged;
+};
+
+/*
+ * Asks the kernel for the TCP_INFO of one socket, returns false if the
+ * socket is not a TCP socket
+ */
+bool sample_tcp_info(SocketType sock_fd, TcpInfoSample& sample);
+
+/*
+ * TCP_INFO sampling for a set of connections.  The tracked connections are
+ * only looked at when the metrics are read, so tracking costs nothing while
+ * they are served.  With set_tcp_info_sampling() every connection an
+ * EventLoop takes on from then on is tracked until it is closed, other
+ * sockets can be tracked by hand and have to be untracked before they are
+ * closed.
+ */
+void set_tcp_info_sampling(bool enable);
+bool get_tcp_info_sampling();
+void track_tcp_info(SocketType sock_fd);
+void untrack_tcp_info(SocketType sock_fd);
+
+/* Samples every tracked connection */
+std::vector<std::pair<SocketType, TcpInfoSample>> sample_tracked_tcp_info();
+
+/* The samples of the tracked connections aggregated */
+struct TcpInfoSummary {
+    std::size_t connections;
+    double mean_rtt;
+    std::uint32_t max_rtt;
+    double mean_congestion_window;
+    std::uint64_t retransmits;
+    std::uint64_t lost;
+};
+
+TcpInfoSummary summarize_tcp_info();
+
+/*
+ * The counters and the TCP_INFO summary in the Prometheus text exposition
+ * format, every name prefixed with cppsockets_.  With per_connection the
+ * samples of each tracked connection are included as well, labelled with the
+ * descriptor, which makes for many series on a busy server.
+ *
+ * EXAMPLE :
+ *      // answer scrapes on a metrics port with the HTTP module
+ *      response.add_header("Content-Type", "text/plain; version=0.0.4");
+ *      response.set_body(SocketUtilities::format_prometheus_metrics());
+ */
+std::string format_prometheus_metrics(bool per_connection = false);
+
+
+}
+
+#endif
@@ -0,0 +1,380 @@
+#include "NetworkLog.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using SocketUtilities::LogLevel;
+using SocketUtilities::SocketType;
+using std::ostream;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::vector;
+
+/* The standard stream to which logged messages are displayed. */
+static ostream* log_stream = &std::cout;
+
+/* The prefix with which every logged message starts */
+static const char log_prefix[] = "@@@ Network Log @@@  ";
+
+/* define the global network_output_guard variable */
+namespace SocketUtilities {
+    std::atomic<bool> network_output_guard (false);
+namespace detail {
+    std::atomic<int> log_level {static_cast<int>(LogLevel::PAYLOAD)};
+}
+}
+using SocketUtilities::network_output_guard;
+
+
+/*
+ * A single producer single consumer ring of bytes.  The thread that owns the
+ * ring pushes records and the background log thread pops them, neither of
+ * them ever waits on the other.  Records are stored as a length followed by
+ * the bytes of the record and may wrap around the end of the storage.
+ *
+ * The head and tail are padded apart so that the producer and the consumer
+ * do not keep stealing the same cache line from each other.
+ */
+class LogRing {
+public:
+
+    explicit LogRing(size_t capacity) : storage(capacity),
+        mask{capacity - 1} {}
+
+    /*
+     * Pushes one record made of the concatenation of the two pieces of
+     * memory.  Returns false without writing anything if there is not enough
+     * room in the ring
+     */
+    bool push(const char* first, size_t first_length, const char* second,
+            size_t second_length) {
+
+        auto length = static_cast<std::uint32_t>(first_length + second_length);
+        auto tail = this->tail.load(std::memory_order_relaxed);
+        auto head = this->head.load(std::memory_order_acquire);
+        if (this->storage.size() - (tail - head) < sizeof(length) + length) {
+            return false;
+        }
+
+        this->copy_in(tail, reinterpret_cast<const char*>(&length),
+                sizeof(length));
+        this->copy_in(tail + sizeof(length), first, first_length);
+        this->copy_in(tail + sizeof(length) + first_length, second,
+                second_length);
+        this->tail.store(tail + sizeof(length) + length,
+                std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Appends every record currently in the ring to the output string,
+     * returns the number of records that were popped
+     */
+    size_t pop_all(string& output) {
+
+        auto head = this->head.load(std::memory_order_relaxed);
+        auto tail = this->tail.load(std::memory_order_acquire);
+        size_t popped {0};
+        while (head != tail) {
+            std::uint32_t length;
+            this->copy_out(head, reinterpret_cast<char*>(&length),
+                    sizeof(length));
+
+            auto offset = output.size();
+            output.append(log_prefix);
+            output.resize(output.size() + length);
+            this->copy_out(head + sizeof(length),
+                    &output[offset + sizeof(log_prefix) - 1], length);
+            if (output.back() != '\n') {
+                output.push_back('\n');
+            }
+
+            head += sizeof(length) + length;
+            ++popped;
+        }
+        this->head.store(head, std::memory_order_release);
+        return popped;
+    }
+
+    /* Maximum size of a record that will ever fit in the ring */
+    size_t max_record_size() const {
+        return this->storage.size() / 2;
+    }
+
+    /* Set to false when the thread that owns the ring exits */
+    std::atomic<bool> owner_alive {true};
+
+private:
+
+    void copy_in(size_t position, const char* source, size_t length) {
+        if (!length) {
+            return;
+        }
+        auto begin = position & this->mask;
+        auto first_part = std::min(length, this->storage.size() - begin);
+        std::memcpy(&this->storage[begin], source, first_part);
+        std::memcpy(this->storage.data(), source + first_part,
+                length - first_part);
+    }
+
+    void copy_out(size_t position, char* destination, size_t length) const {
+        auto begin = position & this->mask;
+        auto first_part = std::min(length, this->storage.size() - begin);
+        std::memcpy(destination, &this->storage[begin], first_part);
+        std::memcpy(destination + first_part, this->storage.data(),
+                length - first_part);
+    }
+
+    vector<char> storage;
+    size_t mask;
+
+    // the consumer and producer positions, these only ever increase and are
+    // reduced modulo the capacity when indexing into the storage
+    char padding_before[64];
+    std::atomic<size_t> head {0};
+    char padding_between[64];
+    std::atomic<size_t> tail {0};
+    char padding_after[64];
+};
+
+/*
+ * State of the asynchronous sink.  The registry mutex is only taken when a
+ * thread logs for the first time and by the background thread, never on the
+ * path that writes a record.
+ */
+static std::atomic<bool> async_logging_enabled {false};
+static std::atomic<bool> async_logging_stop {false};
+static std::atomic<size_t> async_ring_size {1 << 16};
+static std::atomic<size_t> async_records_dropped {0};
+static std::atomic<size_t> async_writers {0};
+static std::mutex ring_registry_mutex;
+static vector<shared_ptr<LogRing>> ring_registry;
+static std::thread log_thread;
+
+/*
+ * Marks the ring of a thread as orphaned when the thread exits, the
+ * background thread then drains the ring one last time and drops it
+ */
+class RingOwner {
+public:
+    ~RingOwner() {
+        if (this->ring) {
+            this->ring->owner_alive.store(false, std::memory_order_release);
+        }
+    }
+    shared_ptr<LogRing> ring;
+};
+
+static LogRing& get_thread_ring() {
+
+    thread_local RingOwner owner;
+    if (!owner.ring) {
+
+        // round the ring size up to a power of two for cheap indexing
+        size_t capacity {64};
+        while (capacity < async_ring_size.load()) {
+            capacity <<= 1;
+        }
+
+        owner.ring = std::make_shared<LogRing>(capacity);
+        std::lock_guard<std::mutex> lck {ring_registry_mutex};
+        ring_registry.push_back(owner.ring);
+    }
+    return *owner.ring;
+}
+
+/* Writes a batch of already formatted records to the log stream */
+static void write_to_stream(const string& records) {
+
+    // spin and acquire the lock
+    while (network_output_guard.exchange(true)) {}
+        log_stream->write(records.data(), records.size());
+        log_stream->flush();
+    network_output_guard.store(false);
+}
+
+/*
+ * Drains all the rings once, returns the number of records written.  Rings
+ * whose thread has exited are removed once they are empty
+ */
+static size_t drain_rings(string& batch) {
+
+    batch.clear();
+    size_t drained {0};
+    {
+        std::lock_guard<std::mutex> lck {ring_registry_mutex};
+        for (auto it = ring_registry.begin(); it != ring_registry.end();) {
+            bool orphaned = !(*it)->owner_alive.load(std::memory_order_acquire);
+            drained += (*it)->pop_all(batch);
+            it = orphaned ? ring_registry.erase(it) : std::next(it);
+        }
+    }
+
+    auto dropped = async_records_dropped.exchange(0);
+    if (dropped) {
+        batch += log_prefix + std::to_string(dropped) +
+            " log records dropped, ring buffers were full\n";
+    }
+
+    if (!batch.empty()) {
+        write_to_stream(batch);
+    }
+    return drained;
+}
+
+static void log_thread_main() {
+
+    string batch;
+    while (!async_logging_stop.load()) {
+        if (!drain_rings(batch)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // one last pass to get everything that was logged before the stop
+    drain_rings(batch);
+}
+
+/*
+ * Writes one record to the log, either directly to the output stream or into
+ * the calling thread's ring when the asynchronous sink is on
+ */
+static void write_record(const char* header, size_t header_length,
+        const char* payload, size_t payload_length) {
+
+    // a writer announces itself before checking the flag again, so that
+    // disable_async_logging() can wait for the records being pushed and is
+    // sure to drain them.  One that sees the flag cleared writes directly
+    if (async_logging_enabled.load(std::memory_order_acquire)) {
+        async_writers.fetch_add(1);
+        if (async_logging_enabled.load()) {
+            auto& ring = get_thread_ring();
+            payload_length = std::min(payload_length,
+                    ring.max_record_size() - std::min(header_length,
+                        ring.max_record_size()));
+            if (!ring.push(header, header_length, payload, payload_length)) {
+                async_records_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            async_writers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        async_writers.fetch_sub(1, std::memory_order_release);
+    }
+
+    // spin and acquire the lock
+    while (network_output_guard.exchange(true)) {}
+        (*log_stream) << log_prefix;
+        log_stream->write(header, header_length);
+        log_stream->write(payload, payload_length);
+        if ((payload_length ? payload[payload_length - 1]
+                    : header[header_length - 1]) != '\n') {
+            (*log_stream) << '\n';
+        }
+    network_output_guard.store(false);
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+void SocketUtilities::set_output_stream(std::ostream& log_stream_in) {
+
+    // spin and acquire lock
+    while(network_output_guard.exchange(true)) {}
+        log_stream = &log_stream_in;
+    network_output_guard.store(false);
+}
+
+void SocketUtilities::set_log_level(LogLevel level) {
+    detail::log_level.store(static_cast<int>(level));
+}
+
+LogLevel SocketUtilities::get_log_level() {
+    return static_cast<LogLevel>(detail::log_level.load());
+}
+
+void SocketUtilities::enable_async_logging(size_t ring_size) {
+
+    if (async_logging_enabled.load()) {
+        return;
+    }
+
+    async_ring_size.store(ring_size);
+    async_logging_stop.store(false);
+    log_thread = std::thread{log_thread_main};
+    async_logging_enabled.store(true, std::memory_order_release);
+}
+
+void SocketUtilities::disable_async_logging() {
+
+    if (!async_logging_enabled.load()) {
+        return;
+    }
+
+    // new records go straight to the stream from here on, the ones already
+    // on their way into a ring are waited for so that the last drain of the
+    // background thread picks them up
+    async_logging_enabled.store(false);
+    while (async_writers.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    async_logging_stop.store(true);
+    log_thread.join();
+}
+
+void SocketUtilities::detail::log_output(const string& output_message) {
+    if (!output_message.empty()) {
+        write_record(output_message.data(), output_message.size(), nullptr, 0);
+    }
+}
+
+void SocketUtilities::detail::log_transfer(const char* operation,
+        SocketType sock_fd, const void* buffer, ssize_t length) {
+
+    // format the header on the stack, no strings are built for the record
+    char header[128];
+    int header_length = std::snprintf(header, sizeof(header),
+            "Called %s() on socket %d : transferred %zd bytes\n", operation,
+            sock_fd, length);
+    header_length = std::min(header_length,
+            static_cast<int>(sizeof(header)) - 1);
+
+    auto payload_length = (length > 0 && log_enabled(LogLevel::PAYLOAD)) ?
+        static_cast<size_t>(length) : 0;
+    write_record(header, static_cast<size_t>(header_length),
+            reinterpret_cast<const char*>(buffer), payload_length);
+}
+
+void SocketUtilities::detail::log_transfer(const char* operation,
+        SocketType sock_fd, const iovec* buffers, size_t count,
+        ssize_t length) {
+
+    if (length <= 0 || !log_enabled(LogLevel::PAYLOAD)) {
+        log_transfer(operation, sock_fd, nullptr, std::max<ssize_t>(length, 0));
+        return;
+    }
+
+    // gather the payload, this is only done when payloads are being logged
+    thread_local string payload;
+    payload.clear();
+    auto remaining = static_cast<size_t>(length);
+    for (size_t i = 0; i < count && remaining; ++i) {
+        auto piece = std::min(remaining, buffers[i].iov_len);
+        payload.append(reinterpret_cast<const char*>(buffers[i].iov_base),
+                piece);
+        remaining -= piece;
+    }
+    log_transfer(operation, sock_fd, payload.data(), length);
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,65 @@
+#ifndef __CPP_SOCKETS_NETWORK_LOG_HPP__
+#define __CPP_SOCKETS_NETWORK_LOG_HPP__
+
+/*
+ * Private header for the network log shared by the implementation files of
+ * this library.  The public controls for the log are declared in
+ * SocketUtilities.hpp.
+ *
+ * Every call site is meant to be guarded by log_enabled() like so
+ *
+ *      if (log_enabled(LogLevel::EVENTS)) {
+ *          log_output("Created server socket "s + to_string(sock_fd));
+ *      }
+ *
+ * When the library is built without SOCKET_LOG_COMMUNICATION, log_enabled()
+ * is a constant false and the compiler removes the whole block including the
+ * construction of the message, so the disabled log costs nothing.
+ */
+
+#include "SocketUtilities.hpp"
+#include <atomic>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace SocketUtilities {
+namespace detail {
+
+#if defined(SOCKET_LOG_COMMUNICATION)
+constexpr bool log_compiled_in = true;
+#else
+constexpr bool log_compiled_in = false;
+#endif
+
+/* The runtime log level, stored as the underlying integer of LogLevel */
+extern std::atomic<int> log_level;
+
+/* Whether a message of the given level should be written to the log */
+inline bool log_enabled(LogLevel level) {
+    return log_compiled_in &&
+        log_level.load(std::memory_order_relaxed) >= static_cast<int>(level);
+}
+
+/* Writes one free form message to the log */
+void log_output(const std::string& output_message);
+
+/*
+ * Logs one data transfer on a socket, the operation is a string literal like
+ * "recv" or "send".  The payload is only logged at LogLevel::PAYLOAD and is
+ * copied straight into the sink without building intermediate strings.
+ */
+void log_transfer(const char* operation, SocketType sock_fd,
+        const void* buffer, ssize_t length);
+
+/*
+ * The same for a vectored transfer of length bytes over count buffers, the
+ * payload is gathered into one record
+ */
+void log_transfer(const char* operation, SocketType sock_fd,
+        const iovec* buffers, std::size_t count, ssize_t length);
+
+} // namespace detail
+} // namespace SocketUtilities
+
+#endif
@@ -0,0 +1,362 @@
+#include "Resolver.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <netdb.h>
+
+using SocketUtilities::LogLevel;
+using SocketUtilities::Resolution;
+using SocketUtilities::ResolvedAddress;
+using SocketUtilities::Resolver;
+using SocketUtilities::ResolverBackend;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::shared_ptr;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * Shards prune the expired answers they hold once they grow past this many
+ * names, so a stream of distinct names does not grow the cache forever
+ */
+static constexpr size_t PRUNE_THRESHOLD = 1024;
+
+/*
+ * The resolver whose background thread this is, if any.  A blocking
+ * resolve() made from one of its callbacks would wait for a thread that is
+ * busy running that very callback
+ */
+static thread_local const void* current_resolver = nullptr;
+
+/*
+ * A cached answer for one host and port.  While a resolution is in flight
+ * the callbacks of everyone waiting for it are collected here
+ */
+class CacheEntry {
+public:
+    shared_ptr<const Resolution> resolution;
+    Clock::time_point expires;
+    bool pending {false};
+    vector<Resolver::Callback> waiting;
+};
+
+/* One shard of the cache, padded so neighbouring locks do not share a line */
+class CacheShard {
+public:
+    std::mutex mutex;
+    std::unordered_map<string, CacheEntry> entries;
+    char padding[64];
+};
+
+/* A name waiting for a background thread */
+class ResolveTask {
+public:
+    string key;
+    string host;
+    string port;
+};
+
+class Resolver::Impl {
+public:
+
+    Impl(unsigned threads, int ttl_in, int negative_ttl_in,
+            ResolverBackend backend_in, unsigned shards_in);
+    ~Impl();
+
+    CacheShard& get_shard(const string& key) {
+        return this->shards[std::hash<string>{}(key) % this->shards.size()];
+    }
+
+    /*
+     * Returns the cached answer, or registers the callback (when there is
+     * one) to be called with the answer and queues a resolution unless one
+     * is already in flight
+     */
+    shared_ptr<const Resolution> find_or_queue(const string& host,
+            const string& port, Callback* callback);
+
+    /* The loop run by every background thread */
+    void run();
+
+    /* Caches the answer and calls everyone waiting for it */
+    void complete(const ResolveTask& task, shared_ptr<const Resolution> answer);
+
+    std::chrono::milliseconds ttl;
+    std::chrono::milliseconds negative_ttl;
+    ResolverBackend backend;
+    vector<CacheShard> shards;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_condition;
+    std::deque<ResolveTask> queue;
+    bool stopped {false};
+    vector<std::thread> threads;
+};
+
+Resolver::Impl::Impl(unsigned threads_in, int ttl_in, int negative_ttl_in,
+        ResolverBackend backend_in, unsigned shards_in) :
+        ttl{ttl_in}, negative_ttl{negative_ttl_in},
+        backend{std::move(backend_in)}, shards(std::max(shards_in, 1u)) {
+
+    // the destructor does not run when this throws, so the threads already
+    // started have to be stopped here or destroying them terminates
+    try {
+        for (unsigned i = 0; i < std::max(threads_in, 1u); ++i) {
+            this->threads.emplace_back([this] { this->run(); });
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lck {this->queue_mutex};
+            this->stopped = true;
+        }
+        this->queue_condition.notify_all();
+        for (auto& thread : this->threads) {
+            thread.join();
+        }
+        throw;
+    }
+}
+
+Resolver::Impl::~Impl() {
+
+    std::deque<ResolveTask> abandoned;
+    {
+        std::lock_guard<std::mutex> lck {this->queue_mutex};
+        this->stopped = true;
+        abandoned.swap(this->queue);
+    }
+    this->queue_condition.notify_all();
+    for (auto& thread : this->threads) {
+        thread.join();
+    }
+
+    // nobody is left waiting forever, the answer is not cached
+    for (const auto& task : abandoned) {
+        auto& shard = this->get_shard(task.key);
+        vector<Callback> waiting;
+        {
+            std::lock_guard<std::mutex> lck {shard.mutex};
+            auto& entry = shard.entries[task.key];
+            waiting.swap(entry.waiting);
+            shard.entries.erase(task.key);
+        }
+        Resolution cancelled;
+        cancelled.error = EAI_AGAIN;
+        for (auto& callback : waiting) {
+            callback(cancelled);
+        }
+    }
+}
+
+shared_ptr<const Resolution> Resolver::Impl::find_or_queue(const string& host,
+        const string& port, Callback* callback) {
+
+    auto key = host + ":"s + port;
+    auto& shard = this->get_shard(key);
+    {
+        std::lock_guard<std::mutex> lck {shard.mutex};
+        auto& entry = shard.entries[key];
+        if (entry.resolution && Clock::now() < entry.expires) {
+            return entry.resolution;
+        }
+
+        if (callback) {
+            entry.waiting.push_back(std::move(*callback));
+        }
+        if (entry.pending) {
+            return nullptr;
+        }
+        entry.pending = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lck {this->queue_mutex};
+        this->queue.push_back(ResolveTask{std::move(key), host, port});
+    }
+    this->queue_condition.notify_one();
+    return nullptr;
+}
+
+void Resolver::Impl::run() {
+
+    current_resolver = this;
+    while (true) {
+        ResolveTask task;
+        {
+            std::unique_lock<std::mutex> lck {this->queue_mutex};
+            this->queue_condition.wait(lck, [this] {
+                return this->stopped || !this->queue.empty();
+            });
+            if (this->stopped) {
+                return;
+            }
+            task = std::move(this->queue.front());
+            this->queue.pop_front();
+        }
+
+        // a backend that throws is treated like a failed lookup
+        Resolution answer;
+        try {
+            answer = this->backend(task.host, task.port);
+        } catch (...) {
+            answer = Resolution{};
+            answer.error = EAI_FAIL;
+        }
+        if (answer.error == 0 && answer.addresses.empty()) {
+            answer.error = EAI_NONAME;
+        }
+
+        if (log_enabled(LogLevel::EVENTS)) {
+            log_output("Resolved "s + task.key + " to "s +
+                    to_string(answer.addresses.size()) + " addresses"s +
+                    (answer.error ? " : "s + gai_strerror(answer.error) : ""s));
+        }
+        this->complete(task, std::make_shared<const Resolution>(
+                    std::move(answer)));
+    }
+}
+
+void Resolver::Impl::complete(const ResolveTask& task,
+        shared_ptr<const Resolution> answer) {
+
+    auto now = Clock::now();
+    auto lifetime = answer->error ? this->negative_ttl :
+        (answer->ttl >= 0 ? std::chrono::milliseconds{answer->ttl} :
+         this->ttl);
+
+    auto& shard = this->get_shard(task.key);
+    vector<Callback> waiting;
+    {
+        std::lock_guard<std::mutex> lck {shard.mutex};
+        auto& entry = shard.entries[task.key];
+        entry.resolution = answer;
+        entry.expires = now + lifetime;
+        entry.pending = false;
+        waiting.swap(entry.waiting);
+
+        if (shard.entries.size() > PRUNE_THRESHOLD) {
+            for (auto i = shard.entries.begin(); i != shard.entries.end();) {
+                if (!i->second.pending && i->second.expires <= now) {
+                    i = shard.entries.erase(i);
+                } else {
+                    ++i;
+                }
+            }
+        }
+    }
+
+    // callbacks run without any lock held so they may call back in
+    for (auto& callback : waiting) {
+        callback(*answer);
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+Resolution SocketUtilities::resolve_with_getaddrinfo(const string& host,
+        const string& port) {
+
+    addrinfo hints, *address_information;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;        // ipv4 or ipv6
+    hints.ai_socktype = SOCK_STREAM;    // TCP socket
+
+    Resolution resolution;
+    resolution.error = getaddrinfo(host.c_str(), port.c_str(), &hints,
+            &address_information);
+    if (resolution.error) {
+        return resolution;
+    }
+
+    for (auto i = address_information; i; i = i->ai_next) {
+        ResolvedAddress resolved;
+        std::memset(&resolved, 0, sizeof(resolved));
+        resolved.family = i->ai_family;
+        resolved.socket_type = i->ai_socktype;
+        resolved.protocol = i->ai_protocol;
+        std::memcpy(&resolved.address, i->ai_addr, i->ai_addrlen);
+        resolved.address_length = i->ai_addrlen;
+        resolution.addresses.push_back(resolved);
+    }
+    freeaddrinfo(address_information);
+    return resolution;
+}
+
+Resolver::Resolver(unsigned threads, int ttl, int negative_ttl,
+        ResolverBackend backend, unsigned shards) :
+    impl_ptr{new Impl{threads, ttl, negative_ttl, std::move(backend),
+        shards}} {}
+
+Resolver::~Resolver() {
+    delete this->impl_ptr;
+}
+
+void Resolver::resolve(const string& host, const string& port,
+        Callback callback) {
+    auto cached = this->impl_ptr->find_or_queue(host, port, &callback);
+    if (cached) {
+        callback(*cached);
+    }
+}
+
+shared_ptr<const Resolution> Resolver::resolve(const string& host,
+        const string& port) {
+
+    if (current_resolver == this->impl_ptr) {
+        throw SocketException {"Blocking resolve() called from a callback of "
+            "the same Resolver, use the resolve() that takes a callback"s};
+    }
+
+    auto promise = std::make_shared<std::promise<shared_ptr<const Resolution>>>();
+    auto answer = promise->get_future();
+    Callback callback = [promise](const Resolution& resolution) {
+        promise->set_value(std::make_shared<const Resolution>(resolution));
+    };
+
+    auto cached = this->impl_ptr->find_or_queue(host, port, &callback);
+    if (cached) {
+        return cached;
+    }
+    return answer.get();
+}
+
+shared_ptr<const Resolution> Resolver::lookup(const string& host,
+        const string& port) {
+    return this->impl_ptr->find_or_queue(host, port, nullptr);
+}
+
+void Resolver::clear() {
+
+    // entries with a resolution in flight are kept for their waiters
+    for (auto& shard : this->impl_ptr->shards) {
+        std::lock_guard<std::mutex> lck {shard.mutex};
+        for (auto i = shard.entries.begin(); i != shard.entries.end();) {
+            if (!i->second.pending) {
+                i = shard.entries.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
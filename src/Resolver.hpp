@@ -0,0 +1,156 @@
+#ifndef __CPP_SOCKETS_RESOLVER_HPP__
+#define __CPP_SOCKETS_RESOLVER_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+
+namespace SocketUtilities {
+
+/* One address a name resolved to, with what is needed to make a socket */
+struct ResolvedAddress {
+    int family;
+    int socket_type;
+    int protocol;
+    sockaddr_storage address;
+    socklen_t address_length;
+};
+
+/*
+ * The outcome of resolving a host and port.
+ *
+ *  addresses   : in order of preference, empty when resolution failed
+ *  error       : 0 on success, otherwise a getaddrinfo() error code (EAI_*)
+ *                which gai_strerror() describes
+ *  ttl         : how long in milliseconds the answer may be cached, a
+ *                negative value leaves it to the resolver's defaults
+ */
+struct Resolution {
+    std::vector<ResolvedAddress> addresses;
+    int error {0};
+    int ttl {-1};
+};
+
+/*
+ * Performs one resolution, blocking is fine as this is only ever called on
+ * the background threads of a Resolver.  Tests can hand a Resolver their own
+ * function to answer without a network
+ */
+using ResolverBackend = std::function<Resolution (const std::string& host,
+        const std::string& port)>;
+
+/* The default backend, getaddrinfo() for stream sockets */
+Resolution resolve_with_getaddrinfo(const std::string& host,
+        const std::string& port);
+
+/*
+ * A caching name resolver.  Answers are kept in memory for their time to
+ * live, and failures are kept as well (for the shorter negative ttl) so that
+ * a name that does not resolve is not retried on every call.  Resolution
+ * happens on a small pool of background threads, so callers of resolve()
+ * with a callback never block, and concurrent requests for the same name
+ * share one resolution.
+ *
+ * getaddrinfo() does not report the time to live of the records it found so
+ * with the default backend every answer is kept for the default ttl.
+ *
+ * The resolver is threadsafe.  The cache is split into shards each with its
+ * own lock.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::Resolver resolver;
+ *      resolver.resolve("example.com", "80",
+ *          [](const SocketUtilities::Resolution& resolution) {
+ *              // called on a background thread, or right away if cached
+ *          });
+ *
+ *      auto sock = SocketUtilities::create_client_socket(resolver,
+ *              "example.com", "80");
+ */
+class Resolver {
+public:
+
+    using Callback = std::function<void (const Resolution&)>;
+
+    /* The defaults for the constructor */
+    static constexpr unsigned DEFAULT_THREADS = 2;
+    static constexpr int DEFAULT_TTL = 30000;
+    static constexpr int DEFAULT_NEGATIVE_TTL = 5000;
+    static constexpr unsigned DEFAULT_SHARDS = 16;
+
+    /*
+     * ttl and negative_ttl are in milliseconds, ttl applies to answers for
+     * which the backend did not give one
+     */
+    explicit Resolver(unsigned threads = DEFAULT_THREADS,
+            int ttl = DEFAULT_TTL, int negative_ttl = DEFAULT_NEGATIVE_TTL,
+            ResolverBackend backend = resolve_with_getaddrinfo,
+            unsigned shards = DEFAULT_SHARDS);
+
+    /*
+     * Stops the background threads, resolutions still waiting for a thread
+     * are completed with EAI_AGAIN
+     */
+    ~Resolver();
+    Resolver(const Resolver&) = delete;
+    Resolver& operator=(const Resolver&) = delete;
+
+    /*
+     * Calls the callback with the resolution of the host and port.  A cached
+     * answer is passed right away on the calling thread, otherwise the
+     * callback is called on a background thread once the name has been
+     * resolved.  Never blocks on resolution
+     */
+    void resolve(const std::string& host, const std::string& port,
+            Callback callback);
+
+    /*
+     * The same but blocks the calling thread until there is an answer.
+     *
+     * ERRORS : Throws an exception when called from a callback running on
+     *          a background thread of this resolver, which would otherwise
+     *          wait on itself.  Use the resolve() above there instead.
+     */
+    std::shared_ptr<const Resolution> resolve(const std::string& host,
+            const std::string& port);
+
+    /*
+     * Returns the cached answer without waiting, or nullptr when there is
+     * none in which case resolution is started in the background so that a
+     * later call finds it
+     */
+    std::shared_ptr<const Resolution> lookup(const std::string& host,
+            const std::string& port);
+
+    /* Drops every cached answer */
+    void clear();
+
+private:
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+/*
+ * create_client_socket() with the addresses taken from the resolver, see
+ * there for how the addresses are raced against each other.
+ *
+ * ERRORS : Throws an exception if the name does not resolve or no address
+ *          could be connected to.
+ */
+SocketType create_client_socket(Resolver& resolver,
+        const std::string& address, const std::string& port,
+        int attempt_timeout = DEFAULT_CONNECT_ATTEMPT_TIMEOUT,
+        int attempt_delay = DEFAULT_CONNECT_ATTEMPT_DELAY);
+
+}
+
+#endif
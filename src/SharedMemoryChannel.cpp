@@ -0,0 +1,699 @@
+#include "SharedMemoryChannel.hpp"
+#include "DescriptorPassing.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using SocketUtilities::FileDescriptorType;
+using SocketUtilities::LogLevel;
+using SocketUtilities::SharedMemoryChannel;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * The rings are shared between processes, which only works for atomics that
+ * are implemented with plain atomic instructions rather than a lock that
+ * lives in one process
+ */
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+        "SharedMemoryChannel needs lock free atomics");
+
+/* Sent by the client along with the descriptors */
+static constexpr uint32_t HANDSHAKE_MAGIC = 0x63707373;
+static constexpr uint32_t HANDSHAKE_VERSION = 1;
+struct Handshake {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+};
+
+/*
+ * The descriptors in the handshake, in order.  Ring 0 carries messages from
+ * the client to the server and ring 1 the other way
+ */
+enum HandshakeDescriptor {
+    MEMORY_0, MEMORY_1, DATA_0, SPACE_0, DATA_1, SPACE_1, DESCRIPTOR_COUNT
+};
+
+/*
+ * Every message in a ring is its length in 8 bytes followed by the message,
+ * padded so that the next length is aligned
+ */
+static constexpr size_t RECORD_HEADER = sizeof(uint64_t);
+static constexpr size_t MAX_CAPACITY = size_t{1} << 32;
+
+/* Bounds on how many times a side polls the ring before it goes to sleep */
+static constexpr unsigned MIN_SPIN = 16;
+static constexpr unsigned INITIAL_SPIN = 256;
+static constexpr unsigned MAX_SPIN = 4096;
+
+/*
+ * The first page of the memory of a ring, the ring itself follows.  The
+ * positions are byte offsets that only ever grow, each written by one side
+ * and on its own cache line so the two sides do not keep taking the line
+ * away from each other.  A side that goes to sleep sets its waiting flag and
+ * the other side signals the eventfd only when that is set, so a busy channel
+ * makes no system calls
+ */
+struct RingControl {
+    alignas(64) std::atomic<uint64_t> tail {0};
+    alignas(64) std::atomic<uint64_t> head {0};
+    alignas(64) std::atomic<uint32_t> consumer_waiting {0};
+    std::atomic<uint32_t> producer_waiting {0};
+    std::atomic<uint32_t> closed {0};
+};
+
+/*
+ * One direction of the channel as seen from one side.  position is this
+ * side's position, the tail when it produces and the head when it consumes,
+ * and other is the last position of the other side that was read, which is
+ * only read again from shared memory once this side catches up with it
+ */
+class Ring {
+public:
+    char* base {nullptr};
+    RingControl* control {nullptr};
+    char* data {nullptr};
+    int data_fd {-1};
+    int space_fd {-1};
+    uint64_t position {0};
+    uint64_t other {0};
+    bool armed {false};
+};
+
+static size_t get_page_size() {
+    return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+/* Makes the PAUSE hint to the processor while spinning */
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Spins longer next time if what was waited for came while spinning, shorter
+ * if it only came after sleeping.  A limit of 0 turns spinning off for good
+ */
+static void adapt_spin(unsigned& limit, unsigned spins, bool slept) {
+    if (slept && limit) {
+        limit = std::max(limit / 2, MIN_SPIN);
+    } else if (spins) {
+        limit = std::min(limit * 2, MAX_SPIN);
+    }
+}
+
+static size_t record_size(size_t length) {
+    return (RECORD_HEADER + length + RECORD_HEADER - 1) & ~(RECORD_HEADER - 1);
+}
+
+static int create_event() {
+    auto event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) {
+        throw SocketException {"Error in eventfd() call : "s +
+            string(std::strerror(errno))};
+    }
+    return event_fd;
+}
+
+static void signal_event(int event_fd) {
+
+    // the counter only overflows if nobody ever reads it, and then the other
+    // side has already been woken up
+    uint64_t one {1};
+    while (::write(event_fd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+}
+
+static void clear_event(int event_fd) {
+    uint64_t count;
+    while (::read(event_fd, &count, sizeof(count)) == -1 && errno == EINTR) {}
+}
+
+/*
+ * Called by a side after it has moved its position, wakes the other side if
+ * it is asleep.  The fence orders the position store before the flag load,
+ * and pairs with the one in arm() which orders the flag store before the
+ * position load, so one of the two sides always sees the other
+ */
+static void wake_if_waiting(std::atomic<uint32_t>& waiting, int event_fd) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0)) {
+        signal_event(event_fd);
+    }
+}
+
+/* Sets the waiting flag of the ring before this side goes to sleep */
+static void arm(Ring& ring, std::atomic<uint32_t>& waiting) {
+    ring.armed = true;
+    waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/*
+ * Clears the waiting flag once this side is awake, if the other side has
+ * cleared it already it has signalled the eventfd as well, which is reset so
+ * that the descriptor is not left readable
+ */
+static void disarm(Ring& ring, std::atomic<uint32_t>& waiting, int event_fd) {
+    if (ring.armed) {
+        ring.armed = false;
+        if (!waiting.exchange(0)) {
+            clear_event(event_fd);
+        }
+    }
+}
+
+static void wait_readable(SocketType sock_fd) {
+    pollfd descriptor {sock_fd, POLLIN, 0};
+    while (::poll(&descriptor, 1, -1) == -1) {
+        if (errno != EINTR) {
+            throw SocketException {"Error in poll() call : "s +
+                string(std::strerror(errno))};
+        }
+    }
+}
+
+/*
+ * Creates the memory for a ring with a page for the control block followed
+ * by the ring, sealed so that neither side can change its size once the
+ * other has mapped it
+ */
+static int create_ring_memory(size_t capacity) {
+
+    auto memory_fd = ::memfd_create("cppsockets-channel",
+            MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memory_fd == -1) {
+        throw SocketException {"Error in memfd_create() call : "s +
+            string(std::strerror(errno))};
+    }
+    if (::ftruncate(memory_fd, static_cast<off_t>(get_page_size() +
+                    capacity)) == -1 ||
+            ::fcntl(memory_fd, F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        auto error = errno;
+        ::close(memory_fd);
+        throw SocketException {"Error setting up shared memory : "s +
+            string(std::strerror(error))};
+    }
+    return memory_fd;
+}
+
+/*
+ * Maps the control page followed by the ring twice in a row, the same way
+ * the ring buffer of FramedConnection is mapped
+ */
+static void map_ring(Ring& ring, int memory_fd, size_t capacity) {
+
+    auto page_size = get_page_size();
+    auto reserved = ::mmap(nullptr, page_size + capacity * 2, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        throw SocketException {"Error in mmap() call : "s +
+            string(std::strerror(errno))};
+    }
+    ring.base = static_cast<char*>(reserved);
+
+    auto mapped = ::mmap(ring.base, page_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, memory_fd, 0);
+    for (size_t half = 0; half < 2 && mapped != MAP_FAILED; ++half) {
+        mapped = ::mmap(ring.base + page_size + half * capacity, capacity,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memory_fd,
+                static_cast<off_t>(page_size));
+    }
+    if (mapped == MAP_FAILED) {
+        throw SocketException {"Error in mmap() call : "s +
+            string(std::strerror(errno))};
+    }
+
+    ring.control = reinterpret_cast<RingControl*>(ring.base);
+    ring.data = ring.base + page_size;
+}
+
+class SharedMemoryChannel::Impl {
+public:
+
+    Impl(SocketType sock_fd_in, Role role, size_t capacity_in);
+    ~Impl() { this->release(); }
+
+    void handshake_client(size_t capacity_in);
+    void handshake_server();
+    void release();
+
+    /* Throws if the message cannot be sent at all */
+    void check_send(size_t length);
+
+    /* Copies the message into the outgoing ring if there is room */
+    bool write(const void* data, size_t length);
+
+    /* Passes on the messages in the incoming ring */
+    size_t drain(const MessageCallback& on_message, size_t max_messages);
+
+    /*
+     * Arms the incoming ring and returns false if it is still empty, in which
+     * case the eventfd is signalled when that changes
+     */
+    bool arm_receive();
+
+    /* Waits for the eventfd or for the other side to hang up the socket */
+    void wait(int event_fd);
+
+    void check_corrupted(bool corrupted) {
+        if (corrupted) {
+            throw SocketException {"The ring of the shared memory channel on "
+                "socket "s + to_string(this->sock_fd) + " has been corrupted"s};
+        }
+    }
+
+    SocketType sock_fd;
+    size_t capacity {0};
+    Ring incoming;
+    Ring outgoing;
+    int memory_fds[2] {-1, -1};
+    unsigned receive_spin {INITIAL_SPIN};
+    unsigned send_spin {INITIAL_SPIN};
+    bool peer_gone {false};
+    bool closed {false};
+};
+
+SharedMemoryChannel::Impl::Impl(SocketType sock_fd_in, Role role,
+        size_t capacity_in) : sock_fd{sock_fd_in} {
+
+    // with one processor the other side cannot make progress while this one
+    // spins
+    if (std::thread::hardware_concurrency() == 1) {
+        this->receive_spin = this->send_spin = 0;
+    }
+
+    try {
+        if (role == Role::CLIENT) {
+            this->handshake_client(capacity_in);
+        } else {
+            this->handshake_server();
+        }
+    } catch (...) {
+        this->release();
+        throw;
+    }
+
+    // the mappings keep the memory alive
+    for (auto& memory_fd : this->memory_fds) {
+        ::close(memory_fd);
+        memory_fd = -1;
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Set up shared memory channel on socket "s +
+                to_string(this->sock_fd) + " with rings of "s +
+                to_string(this->capacity) + " bytes"s);
+    }
+}
+
+void SharedMemoryChannel::Impl::handshake_client(size_t capacity_in) {
+
+    // a power of two so that positions can be masked into the ring
+    this->capacity = get_page_size();
+    while (this->capacity < capacity_in && this->capacity < MAX_CAPACITY) {
+        this->capacity *= 2;
+    }
+
+    int descriptors[DESCRIPTOR_COUNT];
+    this->memory_fds[0] = descriptors[MEMORY_0] =
+        create_ring_memory(this->capacity);
+    this->memory_fds[1] = descriptors[MEMORY_1] =
+        create_ring_memory(this->capacity);
+    this->outgoing.data_fd = descriptors[DATA_0] = create_event();
+    this->outgoing.space_fd = descriptors[SPACE_0] = create_event();
+    this->incoming.data_fd = descriptors[DATA_1] = create_event();
+    this->incoming.space_fd = descriptors[SPACE_1] = create_event();
+    map_ring(this->outgoing, this->memory_fds[0], this->capacity);
+    map_ring(this->incoming, this->memory_fds[1], this->capacity);
+    new (this->outgoing.control) RingControl{};
+    new (this->incoming.control) RingControl{};
+
+    Handshake handshake {HANDSHAKE_MAGIC, HANDSHAKE_VERSION, this->capacity};
+    SocketUtilities::send_descriptors(this->sock_fd, descriptors,
+            DESCRIPTOR_COUNT, &handshake, sizeof(handshake));
+
+    // the server answers with one byte once it has mapped the memory
+    char acknowledgement;
+    ssize_t n;
+    while (true) {
+        n = ::recv(this->sock_fd, &acknowledgement, 1, 0);
+        count_received(n);
+        if (n != -1) {
+            break;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            wait_readable(this->sock_fd);
+        } else if (errno != EINTR) {
+            throw SocketException {"Error in recv() call : "s +
+                string(std::strerror(errno))};
+        }
+    }
+    if (n == 0) {
+        throw SocketException {"Socket closed during the shared memory "
+            "channel handshake"};
+    }
+}
+
+void SharedMemoryChannel::Impl::handshake_server() {
+
+    Handshake handshake;
+    vector<FileDescriptorType> received;
+    ssize_t n;
+    while ((n = SocketUtilities::recv_descriptors(this->sock_fd, &handshake,
+                    sizeof(handshake), received)) == -1) {
+        wait_readable(this->sock_fd);
+    }
+
+    // take ownership first so that everything received is closed on an error
+    if (received.size() == DESCRIPTOR_COUNT) {
+        this->memory_fds[0] = received[MEMORY_0];
+        this->memory_fds[1] = received[MEMORY_1];
+        this->incoming.data_fd = received[DATA_0];
+        this->incoming.space_fd = received[SPACE_0];
+        this->outgoing.data_fd = received[DATA_1];
+        this->outgoing.space_fd = received[SPACE_1];
+    } else {
+        for (auto descriptor : received) {
+            ::close(descriptor);
+        }
+    }
+
+    auto page_size = get_page_size();
+    if (n != sizeof(handshake) || received.size() != DESCRIPTOR_COUNT ||
+            handshake.magic != HANDSHAKE_MAGIC ||
+            handshake.version != HANDSHAKE_VERSION ||
+            handshake.capacity < page_size ||
+            handshake.capacity > MAX_CAPACITY ||
+            (handshake.capacity & (handshake.capacity - 1))) {
+        throw SocketException {"Invalid shared memory channel handshake on "
+            "socket "s + to_string(this->sock_fd)};
+    }
+    this->capacity = handshake.capacity;
+
+    // the memory has to be as large as the client says and sealed, otherwise
+    // touching it could fault
+    for (auto memory_fd : this->memory_fds) {
+        struct stat status;
+        auto seals = ::fcntl(memory_fd, F_GET_SEALS);
+        if (::fstat(memory_fd, &status) == -1 || seals == -1 ||
+                static_cast<size_t>(status.st_size) !=
+                    page_size + this->capacity ||
+                (seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) !=
+                    (F_SEAL_SHRINK | F_SEAL_SEAL)) {
+            throw SocketException {"Invalid shared memory in the channel "
+                "handshake on socket "s + to_string(this->sock_fd)};
+        }
+    }
+    map_ring(this->incoming, this->memory_fds[0], this->capacity);
+    map_ring(this->outgoing, this->memory_fds[1], this->capacity);
+
+    char acknowledgement {0};
+    SocketUtilities::send_all(this->sock_fd, &acknowledgement, 1);
+}
+
+void SharedMemoryChannel::Impl::release() {
+    for (auto ring : {&this->incoming, &this->outgoing}) {
+        if (ring->base) {
+            ::munmap(ring->base, get_page_size() + this->capacity * 2);
+            ring->base = nullptr;
+        }
+        for (auto event_fd : {&ring->data_fd, &ring->space_fd}) {
+            if (*event_fd != -1) {
+                ::close(*event_fd);
+                *event_fd = -1;
+            }
+        }
+    }
+    for (auto& memory_fd : this->memory_fds) {
+        if (memory_fd != -1) {
+            ::close(memory_fd);
+            memory_fd = -1;
+        }
+    }
+}
+
+void SharedMemoryChannel::Impl::check_send(size_t length) {
+    if (length > this->capacity - RECORD_HEADER) {
+        throw SocketException {"Message of "s + to_string(length) +
+            " bytes does not fit in the shared memory channel"s};
+    }
+    if (this->peer_gone || this->closed) {
+        throw SocketException {"Send on a shared memory channel that has "
+            "been closed"};
+    }
+}
+
+bool SharedMemoryChannel::Impl::write(const void* data, size_t length) {
+
+    auto& ring = this->outgoing;
+
+    // the head is only read from shared memory when the room seen last time
+    // is not enough
+    auto record = record_size(length);
+    if (this->capacity - (ring.position - ring.other) < record) {
+        ring.other = ring.control->head.load(std::memory_order_acquire);
+        this->check_corrupted(ring.position - ring.other > this->capacity);
+        if (this->capacity - (ring.position - ring.other) < record) {
+            return false;
+        }
+    }
+
+    auto slot = ring.data + (ring.position & (this->capacity - 1));
+    uint64_t header {length};
+    std::memcpy(slot, &header, sizeof(header));
+    std::memcpy(slot + RECORD_HEADER, data, length);
+    ring.position += record;
+    ring.control->tail.store(ring.position, std::memory_order_release);
+
+    wake_if_waiting(ring.control->consumer_waiting, ring.data_fd);
+    return true;
+}
+
+size_t SharedMemoryChannel::Impl::drain(const MessageCallback& on_message,
+        size_t max_messages) {
+
+    auto& ring = this->incoming;
+    disarm(ring, ring.control->consumer_waiting, ring.data_fd);
+
+    size_t count {0};
+    while (count < max_messages) {
+        if (ring.position == ring.other) {
+            ring.other = ring.control->tail.load(std::memory_order_acquire);
+            this->check_corrupted(ring.other - ring.position > this->capacity);
+            if (ring.position == ring.other) {
+                break;
+            }
+        }
+
+        // the length is copied out of shared memory before it is checked so
+        // that the other side cannot change it in between
+        auto slot = ring.data + (ring.position & (this->capacity - 1));
+        uint64_t length;
+        std::memcpy(&length, slot, sizeof(length));
+        this->check_corrupted(length > this->capacity - RECORD_HEADER ||
+                record_size(length) > ring.other - ring.position);
+
+        // the position is only published after the callback since the
+        // message stays in the ring until then
+        on_message(slot + RECORD_HEADER, length);
+        ring.position += record_size(length);
+        ring.control->head.store(ring.position, std::memory_order_release);
+        ++count;
+    }
+
+    if (count) {
+        wake_if_waiting(ring.control->producer_waiting, ring.space_fd);
+    }
+    return count;
+}
+
+bool SharedMemoryChannel::Impl::arm_receive() {
+    auto& ring = this->incoming;
+    arm(ring, ring.control->consumer_waiting);
+    return ring.control->tail.load(std::memory_order_acquire) != ring.position;
+}
+
+void SharedMemoryChannel::Impl::wait(int event_fd) {
+
+    pollfd descriptors[2] {{event_fd, POLLIN, 0},
+        {this->sock_fd, POLLIN | POLLRDHUP, 0}};
+    while (::poll(descriptors, 2, -1) == -1) {
+        if (errno != EINTR) {
+            throw SocketException {"Error in poll() call : "s +
+                string(std::strerror(errno))};
+        }
+    }
+    if (descriptors[0].revents & POLLIN) {
+        clear_event(event_fd);
+    }
+
+    // nothing is sent on the socket after the handshake, so it only becomes
+    // readable when the other side closes it
+    if (descriptors[1].revents) {
+        this->peer_gone = true;
+        if (log_enabled(LogLevel::EVENTS)) {
+            log_output("Other side of the shared memory channel on socket "s +
+                    to_string(this->sock_fd) + " has gone away"s);
+        }
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+SharedMemoryChannel::SharedMemoryChannel(SocketType sock_fd, Role role,
+        size_t capacity) : impl_ptr{new Impl{sock_fd, role, capacity}} {}
+
+SharedMemoryChannel::~SharedMemoryChannel() {
+    this->close();
+    delete this->impl_ptr;
+}
+
+bool SharedMemoryChannel::try_send(const void* data, size_t length) {
+
+    auto& impl = *this->impl_ptr;
+    auto& ring = impl.outgoing;
+    impl.check_send(length);
+
+    // the consumer may make room between the check and setting the flag, in
+    // which case it does not see the flag and will not signal, so the ring
+    // is looked at once more after setting it
+    if (!impl.write(data, length)) {
+        arm(ring, ring.control->producer_waiting);
+        if (!impl.write(data, length)) {
+            return false;
+        }
+    }
+    disarm(ring, ring.control->producer_waiting, ring.space_fd);
+    return true;
+}
+
+void SharedMemoryChannel::send(const void* data, size_t length) {
+
+    auto& impl = *this->impl_ptr;
+    auto& ring = impl.outgoing;
+    unsigned spins {0};
+    bool slept {false};
+    impl.check_send(length);
+    while (!impl.write(data, length)) {
+        if (spins < impl.send_spin) {
+            ++spins;
+            cpu_relax();
+            continue;
+        }
+        arm(ring, ring.control->producer_waiting);
+        if (!impl.write(data, length)) {
+            impl.wait(ring.space_fd);
+            slept = true;
+            impl.check_send(length);
+            continue;
+        }
+        break;
+    }
+    disarm(ring, ring.control->producer_waiting, ring.space_fd);
+    adapt_spin(impl.send_spin, spins, slept);
+}
+
+void SharedMemoryChannel::send(const string& message) {
+    this->send(message.data(), message.size());
+}
+
+size_t SharedMemoryChannel::try_receive(const MessageCallback& on_message,
+        size_t max_messages) {
+
+    // arming can find messages that arrived in the meantime, those are taken
+    // as well since the eventfd will not be signalled for them
+    auto& impl = *this->impl_ptr;
+    size_t count {0};
+    do {
+        count += impl.drain(on_message, max_messages - count);
+    } while (count < max_messages && impl.arm_receive());
+    return count;
+}
+
+bool SharedMemoryChannel::receive(const MessageCallback& on_message) {
+
+    auto& impl = *this->impl_ptr;
+    unsigned spins {0};
+    bool slept {false};
+    while (true) {
+        auto count = impl.drain(on_message, static_cast<size_t>(-1));
+        if (count) {
+            adapt_spin(impl.receive_spin, spins, slept);
+            return true;
+        }
+
+        // the flag is set after the last message so one more look at the
+        // ring is needed before giving up
+        if (impl.peer_gone ||
+                impl.incoming.control->closed.load(std::memory_order_acquire)) {
+            return impl.drain(on_message, static_cast<size_t>(-1));
+        }
+
+        if (spins < impl.receive_spin) {
+            ++spins;
+            cpu_relax();
+            continue;
+        }
+        if (!impl.arm_receive()) {
+            impl.wait(impl.incoming.data_fd);
+            slept = true;
+        }
+    }
+}
+
+void SharedMemoryChannel::close() {
+    auto& impl = *this->impl_ptr;
+    if (!impl.closed) {
+        impl.closed = true;
+        impl.outgoing.control->closed.store(1, std::memory_order_release);
+        signal_event(impl.outgoing.data_fd);
+    }
+}
+
+size_t SharedMemoryChannel::get_max_message_size() const {
+    return this->impl_ptr->capacity - RECORD_HEADER;
+}
+
+FileDescriptorType SharedMemoryChannel::get_receive_descriptor() const {
+    return this->impl_ptr->incoming.data_fd;
+}
+
+FileDescriptorType SharedMemoryChannel::get_send_descriptor() const {
+    return this->impl_ptr->outgoing.space_fd;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
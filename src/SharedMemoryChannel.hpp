@@ -0,0 +1,167 @@
+#ifndef __CPP_SOCKETS_SHARED_MEMORY_CHANNEL_HPP__
+#define __CPP_SOCKETS_SHARED_MEMORY_CHANNEL_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace SocketUtilities {
+
+
+/*
+ * A message channel between two processes on the same host that carries
+ * messages through shared memory instead of through the kernel.  A unix
+ * socket is only used to set the channel up: the client creates a pair of
+ * rings in memfd memory, one for each direction, and sends the memory and
+ * the eventfds used for wakeups to the server with send_descriptors().  After
+ * that a message costs a copy into the ring and no system call at all while
+ * the other side is busy, and one eventfd write when the other side is
+ * asleep.
+ *
+ * Each ring has exactly one producer and one consumer, one process each, and
+ * is lock free.  Like the ring buffer of FramedConnection the memory of the
+ * ring is mapped twice in a row, so every message in it is contiguous and is
+ * passed to the receive callback as a pointer into the shared memory without
+ * being copied again.  The pointer is only valid for the duration of the
+ * call.
+ *
+ * A side that has nothing to receive (or no room to send) spins for a while
+ * before it goes to sleep on the eventfd, since the other side usually
+ * answers within a few microseconds.  How long it spins adapts, it spins
+ * longer when spinning has been paying off and shorter when it has not.
+ *
+ * The channel does not own the unix socket but it has to stay open as long
+ * as the channel is used, the other side closing it is how the channel
+ * notices that the other process has gone away.  Nothing else should be
+ * sent on it.  The memory is sealed against resizing so the other side cannot
+ * make this process crash by shrinking it, but it can otherwise write any
+ * garbage into it, so only set up channels with processes that are trusted,
+ * get_peer_credentials() tells who is on the other side.
+ *
+ * One thread may send and one (possibly different) thread may receive at the
+ * same time, the channel is not thread safe beyond that.
+ *
+ * EXAMPLE :
+ *      // server
+ *      auto connection = SocketUtilities::accept(listener);
+ *      SocketUtilities::SharedMemoryChannel channel {connection,
+ *          SocketUtilities::SharedMemoryChannel::Role::SERVER};
+ *      while (channel.receive([&](const char* data, std::size_t length) {
+ *          auto response = handle(data, length);
+ *          channel.send(response.data(), response.size());
+ *      })) {}
+ *
+ *      // client
+ *      auto sock_fd = SocketUtilities::create_client_unix_socket(path);
+ *      SocketUtilities::SharedMemoryChannel channel {sock_fd,
+ *          SocketUtilities::SharedMemoryChannel::Role::CLIENT};
+ *      channel.send(request.data(), request.size());
+ */
+class SharedMemoryChannel {
+public:
+
+    using MessageCallback = std::function<void (const char* data,
+            std::size_t length)>;
+
+    /* The client creates the shared memory, the server maps it */
+    enum class Role { CLIENT, SERVER };
+
+    /* The default size of the ring for each direction */
+    static constexpr std::size_t DEFAULT_CAPACITY = 1024 * 1024;
+
+    /*
+     * Sets the channel up over a connected unix socket, blocking until the
+     * other side has done the same.  The capacity is rounded up to a power
+     * of two of at least a page and is only used by the client, the server
+     * uses the capacity the client chose.
+     *
+     * ERRORS : Throws an exception if the memory cannot be created or mapped,
+     *          or if the other side does not complete the handshake
+     */
+    SharedMemoryChannel(SocketType sock_fd, Role role,
+            std::size_t capacity = DEFAULT_CAPACITY);
+    ~SharedMemoryChannel();
+    SharedMemoryChannel(const SharedMemoryChannel&) = delete;
+    SharedMemoryChannel& operator=(const SharedMemoryChannel&) = delete;
+
+    /*
+     * Copies the message into the ring, returns false without sending
+     * anything if there is not enough room.  When it returns false the
+     * descriptor from get_send_descriptor() becomes readable once the other
+     * side has made room
+     *
+     * ERRORS : Throws an exception if the message is larger than
+     *          get_max_message_size() or the other side has gone away
+     */
+    bool try_send(const void* data, std::size_t length);
+
+    /*
+     * Like try_send() but waits for room
+     *
+     * ERRORS : Throws an exception if the message is larger than
+     *          get_max_message_size() or the other side has gone away
+     */
+    void send(const void* data, std::size_t length);
+    void send(const std::string& message);
+
+    /*
+     * Calls the callback with the messages that are in the ring without
+     * waiting, at most max_messages of them, and returns how many there were.
+     * When the ring is empty the descriptor from get_receive_descriptor()
+     * becomes readable once the next message arrives, so a channel can be
+     * driven from a KernelEventQueue or EventLoop::watch() by calling this
+     * whenever that descriptor is readable.  If it returns max_messages there
+     * may be more, and the descriptor does not become readable for those.
+     *
+     * The callback may call send() but not receive.
+     *
+     * ERRORS : Throws an exception if the ring holds something that is not a
+     *          message
+     */
+    std::size_t try_receive(const MessageCallback& on_message,
+            std::size_t max_messages = static_cast<std::size_t>(-1));
+
+    /*
+     * Waits until there are messages and calls the callback with each of
+     * them.  Returns false once the other side has closed the channel or
+     * gone away, after the messages it sent before that have been passed on
+     *
+     * ERRORS : Throws an exception if the ring holds something that is not a
+     *          message
+     */
+    bool receive(const MessageCallback& on_message);
+
+    /*
+     * Tells the other side that nothing more will be sent, its receive()
+     * returns false once it has received everything before this.  Called by
+     * the destructor
+     */
+    void close();
+
+    /* The largest message that fits in the ring */
+    std::size_t get_max_message_size() const;
+
+    /*
+     * Descriptors to wait on when the channel is driven from an event queue,
+     * they are readable when a message may have arrived and when room may
+     * have been made after try_send() returned false.  Both are owned by the
+     * channel
+     */
+    FileDescriptorType get_receive_descriptor() const;
+    FileDescriptorType get_send_descriptor() const;
+
+private:
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __CPP_SOCKETS_SOCKET_EXCEPTION_HPP__
+#define __CPP_SOCKETS_SOCKET_EXCEPTION_HPP__
+
+/*
+ * Private header shared by the implementation files of this library.  Users
+ * only see the forward declaration in SocketUtilities.hpp and catch the
+ * exception through std::exception
+ */
+
+#include "SocketUtilities.hpp"
+#include <stdexcept>
+
+/* The default exception class, nothing more than a simple runtime_error */
+class SocketUtilities::SocketException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "SocketOptions.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using SocketUtilities::LogLevel;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketOptions;
+using SocketUtilities::SocketType;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::string;
+using std::to_string;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * Older kernel headers do not define the newer options, the values are the
+ * ones from the Linux uapi headers
+ */
+#ifndef SO_BUSY_POLL
+    #define SO_BUSY_POLL 46
+#endif
+#ifndef SO_ZEROCOPY
+    #define SO_ZEROCOPY 60
+#endif
+#ifndef TCP_FASTOPEN
+    #define TCP_FASTOPEN 23
+#endif
+
+/*
+ * Whether the socket is a TCP socket, the TCP level options fail with
+ * ENOPROTOOPT on anything else (unix sockets most commonly)
+ */
+static bool is_tcp_socket(SocketType sock_fd) {
+    int protocol {0};
+    socklen_t length = sizeof(protocol);
+    if (getsockopt(sock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &length)) {
+        return false;
+    }
+    return protocol == IPPROTO_TCP;
+}
+
+/*
+ * Sets one option when it is not UNSET.  Failing to set a best effort option
+ * is only logged
+ */
+static void set_option(SocketType sock_fd, int level, int option_name,
+        int value, const char* name, bool best_effort = false) {
+
+    if (value == SocketOptions::UNSET) {
+        return;
+    }
+
+    if (setsockopt(sock_fd, level, option_name, &value, sizeof(value))) {
+        if (!best_effort) {
+            throw SocketException{"setsockopt("s + name + ") : "s +
+                string(strerror(errno))};
+        }
+        if (log_enabled(LogLevel::EVENTS)) {
+            log_output("Could not set "s + name + " on socket "s +
+                    to_string(sock_fd) + " : "s + string(strerror(errno)));
+        }
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+SocketOptions SocketOptions::low_latency_rpc() {
+    SocketOptions options;
+    options.no_delay = 1;
+    options.quick_ack = 1;
+    options.busy_poll = 50;
+    options.fast_open = 256;
+    return options;
+}
+
+SocketOptions SocketOptions::bulk_transfer() {
+    SocketOptions options;
+    options.no_delay = 0;
+    options.send_buffer = 4 * 1024 * 1024;
+    options.receive_buffer = 4 * 1024 * 1024;
+    options.zero_copy = 1;
+    return options;
+}
+
+SocketOptions SocketOptions::preset(const string& name) {
+    if (name == "default") {
+        return SocketOptions{};
+    } else if (name == "low-latency-rpc") {
+        return SocketOptions::low_latency_rpc();
+    } else if (name == "bulk-transfer") {
+        return SocketOptions::bulk_transfer();
+    }
+    throw SocketException{"Unknown socket options preset "s + name};
+}
+
+void SocketUtilities::apply_socket_options(SocketType sock_fd,
+        const SocketOptions& options) {
+
+    set_option(sock_fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer,
+            "SO_SNDBUF");
+    set_option(sock_fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer,
+            "SO_RCVBUF");
+    set_option(sock_fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll,
+            "SO_BUSY_POLL", true);
+    set_option(sock_fd, SOL_SOCKET, SO_ZEROCOPY, options.zero_copy,
+            "SO_ZEROCOPY", true);
+
+    // the protocol is only looked up when there is a TCP option to set, so
+    // the default options cost nothing on every accepted connection
+    if ((options.no_delay == SocketOptions::UNSET &&
+                options.cork == SocketOptions::UNSET &&
+                options.quick_ack == SocketOptions::UNSET) ||
+            !is_tcp_socket(sock_fd)) {
+        return;
+    }
+    set_option(sock_fd, IPPROTO_TCP, TCP_NODELAY, options.no_delay,
+            "TCP_NODELAY");
+    set_option(sock_fd, IPPROTO_TCP, TCP_CORK, options.cork, "TCP_CORK");
+    set_option(sock_fd, IPPROTO_TCP, TCP_QUICKACK, options.quick_ack,
+            "TCP_QUICKACK");
+}
+
+void SocketUtilities::apply_listener_options(SocketType sock_fd,
+        const SocketOptions& options) {
+
+    set_option(sock_fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer,
+            "SO_SNDBUF");
+    set_option(sock_fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer,
+            "SO_RCVBUF");
+
+    if ((options.defer_accept == SocketOptions::UNSET &&
+                options.fast_open == SocketOptions::UNSET) ||
+            !is_tcp_socket(sock_fd)) {
+        return;
+    }
+    set_option(sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept,
+            "TCP_DEFER_ACCEPT");
+    set_option(sock_fd, IPPROTO_TCP, TCP_FASTOPEN, options.fast_open,
+            "TCP_FASTOPEN", true);
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
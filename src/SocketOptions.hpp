@@ -0,0 +1,118 @@
+#ifndef __CPP_SOCKETS_SOCKET_OPTIONS_HPP__
+#define __CPP_SOCKETS_SOCKET_OPTIONS_HPP__
+
+#include "SocketUtilities.hpp"
+#include <string>
+#include <vector>
+
+namespace SocketUtilities {
+
+/*
+ * A tuning profile for sockets, applied when a socket is created or accepted
+ * so the setsockopt() calls live in one place instead of at every call site.
+ * Every option is left as the kernel default unless it is set to something
+ * other than UNSET.
+ *
+ *  no_delay        : TCP_NODELAY, 1 sends small writes right away instead of
+ *                    coalescing them (Nagle)
+ *  cork            : TCP_CORK, 1 holds back partial frames until uncorked or
+ *                    200ms have passed, for writers that build a response in
+ *                    several writes
+ *  quick_ack       : TCP_QUICKACK, 1 acknowledges right away instead of
+ *                    delaying.  The kernel may drop back to delayed acks on
+ *                    its own, so this is a hint at the start of a connection
+ *  send_buffer     : SO_SNDBUF in bytes.  Setting a size turns off the
+ *  receive_buffer    kernel's automatic tuning of the buffer (SO_RCVBUF)
+ *  busy_poll       : SO_BUSY_POLL, microseconds to busy poll the device queue
+ *                    on a blocking receive instead of sleeping
+ *  defer_accept    : TCP_DEFER_ACCEPT, seconds for which a listener holds
+ *                    back a connection until the client has sent data
+ *  fast_open       : TCP_FASTOPEN, the length of the queue of pending TFO
+ *                    requests on a listener, which lets clients send data in
+ *                    the SYN
+ *  zero_copy       : SO_ZEROCOPY, 1 allows sends with MSG_ZEROCOPY
+ *
+ * TCP options are skipped for sockets that are not TCP sockets.  busy_poll,
+ * fast_open and zero_copy depend on privileges and kernel support and are
+ * best effort, the rest throw if the kernel refuses them.
+ *
+ * EXAMPLE :
+ *      auto options = SocketUtilities::SocketOptions::low_latency_rpc();
+ *      options.send_buffer = 256 * 1024;
+ *      auto listener = SocketUtilities::create_server_socket("8000",
+ *              options);
+ */
+struct SocketOptions {
+
+    static constexpr int UNSET = -1;
+
+    int no_delay {UNSET};
+    int cork {UNSET};
+    int quick_ack {UNSET};
+    int send_buffer {UNSET};
+    int receive_buffer {UNSET};
+    int busy_poll {UNSET};
+    int defer_accept {UNSET};
+    int fast_open {UNSET};
+    int zero_copy {UNSET};
+
+    /*
+     * Small requests and responses where every round trip counts: no Nagle,
+     * immediate acks, a short busy poll and TCP fast open
+     */
+    static SocketOptions low_latency_rpc();
+
+    /*
+     * Large transfers where throughput counts: Nagle left on, large fixed
+     * buffers and zero copy sends allowed
+     */
+    static SocketOptions bulk_transfer();
+
+    /*
+     * A preset by name, one of "default", "low-latency-rpc" and
+     * "bulk-transfer", so the profile can come from configuration.
+     *
+     * ERRORS : Throws an exception for an unknown name.
+     */
+    static SocketOptions preset(const std::string& name);
+};
+
+/*
+ * Applies the options that matter for a connected socket, everything but
+ * defer_accept and fast_open.  Called on accepted and client sockets by the
+ * functions in this library that take a SocketOptions.
+ *
+ * ERRORS : Throws an exception if an option that is not best effort cannot
+ *          be set.
+ */
+void apply_socket_options(SocketType sock_fd, const SocketOptions& options);
+
+/*
+ * Applies the options that matter for a listening socket, defer_accept and
+ * fast_open along with the buffer sizes which accepted connections inherit
+ * (the receive buffer must be sized before the handshake for the window
+ * scale to match it).  Call before listen().
+ *
+ * ERRORS : Same as apply_socket_options()
+ */
+void apply_listener_options(SocketType sock_fd, const SocketOptions& options);
+
+/*
+ * Versions of the socket factories that apply a profile.  Listeners get
+ * apply_listener_options() before they start listening and client sockets
+ * get apply_socket_options() before they connect.  Connections accepted from
+ * a listener still need apply_socket_options(), which EventLoop and the
+ * servers do when given the same options.
+ */
+SocketType create_server_socket(const std::string& port,
+        const SocketOptions& options, int backlog = 10);
+std::vector<SocketType> create_server_sockets(const std::string& port,
+        int count, const SocketOptions& options, int backlog = 10);
+SocketType create_client_socket(const std::string& address,
+        const std::string& port, const SocketOptions& options,
+        int attempt_timeout = DEFAULT_CONNECT_ATTEMPT_TIMEOUT,
+        int attempt_delay = DEFAULT_CONNECT_ATTEMPT_DELAY);
+
+}
+
+#endif
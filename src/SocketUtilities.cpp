@@ -1,4 +1,9 @@
 #include "SocketUtilities.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "Resolver.hpp"
+#include "SocketOptions.hpp"
+#include "MetricCounters.hpp"
 #include <cassert>
 #include <limits>
 #include <unistd.h>
@@ -7,13 +12,20 @@
 #include <sstream>
 #include <string>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <netdb.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <climits>
 #include <cstring>
+#include <algorithm>
 #include <stdexcept>
 #include <limits>
+#include <memory>
+#include <chrono>
+#include <poll.h>
 
 using namespace std::literals::string_literals;
 
@@ -22,15 +34,13 @@ using namespace std::literals::string_literals;
     #define MSG_NOSIGNAL SO_NOSIGPIPE
 #endif
 
-/* The default exception class, nothing more than a simple runtime_error */
-class SocketUtilities::SocketException : public std::runtime_error {
-public:
-    using std::runtime_error::runtime_error;
-};
-    
 /* Redefine standard aliases and alias the STL types used */
 using SocketUtilities::SocketType;
 using SocketUtilities::SocketException;
+using SocketUtilities::Resolver;
+using SocketUtilities::SocketOptions;
+using SocketUtilities::IoResult;
+using SocketUtilities::Metric;
 using std::ostringstream;
 using std::cout;
 using std::cerr;
@@ -41,48 +51,221 @@ using std::to_string;
 using std::vector;
 using namespace std::literals::string_literals; /* for operator "" */
 
-/* The standard stream to which logged messages are displayed. */
-static ostream* log_stream = &std::cout;
+using SocketUtilities::LogLevel;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using SocketUtilities::detail::log_transfer;
+
+/*
+ * Orders the results of getaddrinfo() the way RFC 8305 (happy eyeballs)
+ * suggests, alternating between address families starting with the family
+ * of the first result.  getaddrinfo() already sorts by preference so the
+ * order within each family is kept.
+ */
+static vector<const addrinfo*> interleave_address_families(
+        const vector<const addrinfo*>& addresses) {
 
-/* define the global network_output_guard variable */
-namespace SocketUtilities { 
-    std::atomic<bool> network_output_guard (false); 
+    vector<const addrinfo*> preferred, others;
+    for (auto address : addresses) {
+        (address->ai_family == addresses.front()->ai_family ?
+            preferred : others).push_back(address);
+    }
+
+    vector<const addrinfo*> interleaved;
+    for (size_t i = 0; i < std::max(preferred.size(), others.size()); ++i) {
+        if (i < preferred.size()) {
+            interleaved.push_back(preferred[i]);
+        }
+        if (i < others.size()) {
+            interleaved.push_back(others[i]);
+        }
+    }
+    return interleaved;
 }
-using SocketUtilities::network_output_guard;
 
 /*
- * Logging utility for this class.  Optimized away at compile time when the
- * network log is not required.  One can enable log messages by defining the
- * macro SOCKET_LOG_COMMUNICATION when building.
+ * Puts a socket that was connected in non blocking mode back into blocking
+ * mode.  The socket is closed if that fails since the caller could not use it
  */
-template <bool output> void _log_output(const string& output_message);
-template <> void _log_output<true>(const string& output_message) {
-
-    // spin and acquire the lock
-    while (network_output_guard.exchange(true)) {}
-        (*log_stream) << "@@@ Network Log @@@  " << output_message << 
-            (output_message.back() == '\n' ? "" : "\n");
-    network_output_guard.store(false);
+static void make_blocking_or_close(SocketType sock_fd) {
+
+    int flags = ::fcntl(sock_fd, F_GETFL, 0);
+    if (flags == -1 || ::fcntl(sock_fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        auto error = errno;
+        close(sock_fd);
+        throw SocketException("Error calling fcntl() on socket "s +
+                to_string(sock_fd) + " : "s + string(strerror(error)));
+    }
 }
-template <> void _log_output<false> (__attribute__((unused)) // silence unused 
-        const string& output_message) {}                     // variable warning
-static constexpr void (*log_output) (const string& output_message) = 
-    &_log_output<true>;
 
+/*
+ * Connects to the first of the addresses that answers.  Attempts are started
+ * one after the other, a new attempt being started when the previous one
+ * fails or has not succeeded within attempt_delay milliseconds, without
+ * abandoning the attempts already in flight.  Each attempt is given up after
+ * attempt_timeout milliseconds.  So an address that silently drops packets
+ * costs attempt_delay instead of the full TCP connect timeout of the kernel.
+ *
+ * Every socket is given the options, when there are any, before it
+ * connects.  Returns the connected socket in blocking mode, or -1 with the
+ * error of the last attempt that failed in last_error.
+ */
+static SocketType connect_happy_eyeballs(
+        const vector<const addrinfo*>& addresses, int attempt_timeout,
+        int attempt_delay, const SocketOptions* options, int& last_error) {
+
+    using Clock = std::chrono::steady_clock;
+    using std::chrono::milliseconds;
+
+    class Attempt {
+    public:
+        SocketType sock_fd;
+        Clock::time_point deadline;
+    };
+    vector<Attempt> attempts;
+    vector<pollfd> descriptors;
+    auto close_attempts = [&attempts] {
+        for (const auto& attempt : attempts) {
+            close(attempt.sock_fd);
+        }
+    };
+
+    last_error = EHOSTUNREACH;
+    size_t next_address {0};
+    auto next_start = Clock::now();
+    while (true) {
+
+        // start the next attempt when nothing is in flight or when the ones
+        // in flight have had attempt_delay to connect
+        auto now = Clock::now();
+        if (next_address < addresses.size() &&
+                (attempts.empty() || now >= next_start)) {
+            auto address = addresses[next_address++];
+            auto sock_fd = socket(address->ai_family,
+                    address->ai_socktype | SOCK_NONBLOCK,
+                    address->ai_protocol);
+            if (sock_fd == -1) {
+                last_error = errno;
+                continue;
+            }
+
+            // buffer sizes in particular have to be set before the handshake
+            if (options) {
+                try {
+                    SocketUtilities::apply_socket_options(sock_fd, *options);
+                } catch (...) {
+                    close(sock_fd);
+                    close_attempts();
+                    throw;
+                }
+            }
+
+            if (connect(sock_fd, address->ai_addr, address->ai_addrlen) == 0) {
+                close_attempts();
+                make_blocking_or_close(sock_fd);
+                return sock_fd;
+            }
+            if (errno != EINPROGRESS) {
+                last_error = errno;
+                close(sock_fd);
+                if (log_enabled(LogLevel::EVENTS)) {
+                    log_output("Error connecting to remote server "s +
+                            string(strerror(last_error)));
+                }
+                continue;
+            }
+
+            attempts.push_back(Attempt{sock_fd, attempt_timeout < 0 ?
+                    Clock::time_point::max() :
+                    now + milliseconds{attempt_timeout}});
+            next_start = now + milliseconds{attempt_delay};
+            continue;
+        }
+        if (attempts.empty()) {
+            return -1;
+        }
+
+        // wait until something connects or fails, an attempt times out or
+        // it is time to start the next attempt
+        auto wake_at = Clock::time_point::max();
+        for (const auto& attempt : attempts) {
+            wake_at = std::min(wake_at, attempt.deadline);
+        }
+        if (next_address < addresses.size()) {
+            wake_at = std::min(wake_at, next_start);
+        }
+        int timeout = -1;
+        if (wake_at != Clock::time_point::max()) {
+            timeout = static_cast<int>(std::max<long long>(0,
+                    std::chrono::duration_cast<milliseconds>(
+                        wake_at - now).count() + 1));
+        }
 
-/******************************************************************************
- *                           FUNCTION IMPLEMENTIONS                           *
- ******************************************************************************/
-void SocketUtilities::set_output_stream(std::ostream& log_stream_in) {
+        descriptors.clear();
+        for (const auto& attempt : attempts) {
+            descriptors.push_back(pollfd{attempt.sock_fd, POLLOUT, 0});
+        }
+        if (poll(descriptors.data(), descriptors.size(), timeout) == -1 &&
+                errno != EINTR) {
+            auto error = errno;
+            close_attempts();
+            throw SocketException("Error in poll() call : "s +
+                    string(strerror(error)));
+        }
 
-    // spin and acquire lock
-    while(network_output_guard.exchange(true)) {}
-        log_stream = &log_stream_in;
-    network_output_guard.store(false);
+        // the first attempt to finish its handshake wins, the rest are closed
+        now = Clock::now();
+        vector<Attempt> remaining;
+        for (size_t i = 0; i < attempts.size(); ++i) {
+            auto sock_fd = attempts[i].sock_fd;
+            if (descriptors[i].revents) {
+                int socket_error {0};
+                socklen_t size = sizeof(socket_error);
+                if (getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, &socket_error,
+                            &size) == -1) {
+                    socket_error = errno;
+                }
+                if (!socket_error) {
+                    for (const auto& attempt : remaining) {
+                        close(attempt.sock_fd);
+                    }
+                    for (auto j = i + 1; j < attempts.size(); ++j) {
+                        close(attempts[j].sock_fd);
+                    }
+                    make_blocking_or_close(sock_fd);
+                    return sock_fd;
+                }
+                last_error = socket_error;
+            } else if (now >= attempts[i].deadline) {
+                last_error = ETIMEDOUT;
+            } else {
+                remaining.push_back(attempts[i]);
+                continue;
+            }
+
+            // a failed attempt makes way for the next one right away
+            close(sock_fd);
+            next_start = now;
+            if (log_enabled(LogLevel::EVENTS)) {
+                log_output("Error connecting to remote server "s +
+                        string(strerror(last_error)));
+            }
+        }
+        attempts.swap(remaining);
+    }
 }
 
-SocketType SocketUtilities::create_server_socket(const string& port, 
-        int backlog) {
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+/*
+ * Does the work for create_server_socket() and create_server_sockets(), when
+ * reuse_port is set the socket is also given SO_REUSEPORT so that more
+ * sockets can be bound to the same port.  The options, when there are any,
+ * are applied before the socket starts listening
+ */
+static SocketType create_listening_socket(const string& port, int backlog,
+        bool reuse_port, const SocketOptions* options) {
 
     SocketType socket_to_return;
 
@@ -127,11 +310,25 @@ SocketType SocketUtilities::create_server_socket(const string& port,
         // exit if setsockopt fails
         int yes = 1;
         if (setsockopt(socket_to_return, SOL_SOCKET, SO_REUSEADDR, &yes,
-                sizeof(int)) == -1) {
+                sizeof(int)) == -1 || (reuse_port && 
+                    setsockopt(socket_to_return, SOL_SOCKET, SO_REUSEPORT, 
+                        &yes, sizeof(int)) == -1)) {
             cerr << "Error calling setsockopt on server socket " 
                 << strerror(errno) << endl;
+            close(socket_to_return);
+            freeaddrinfo(server_address_information);
             throw SocketException("Error in setsockopt");
         }
+        if (options) {
+            try {
+                SocketUtilities::apply_listener_options(socket_to_return,
+                        *options);
+            } catch (...) {
+                close(socket_to_return);
+                freeaddrinfo(server_address_information);
+                throw;
+            }
+        }
 
         // ********************************************************************
         // *                            STEP 4                                *
@@ -157,19 +354,68 @@ SocketType SocketUtilities::create_server_socket(const string& port,
     // ************************************************************************
     if (listen(socket_to_return, backlog) == -1) {
         perror("listen");
+        close(socket_to_return);
         throw SocketException("error in listen()");
     }
 
     // log output
-    log_output("Created server socket "s + to_string(socket_to_return));
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Created server socket "s + to_string(socket_to_return));
+    }
 
     return socket_to_return;
 }
 
-SocketType SocketUtilities::create_client_socket(const string& address, 
-        const string& port) {
-    
-    SocketType socket_to_return;
+/*
+ * Does the work for create_server_sockets(), no sockets are left open when
+ * one of them cannot be created
+ */
+static vector<SocketType> create_listening_sockets(const string& port,
+        int count, int backlog, const SocketOptions* options) {
+
+    vector<SocketType> sockets;
+    try {
+        for (int i = 0; i < count; ++i) {
+            sockets.push_back(create_listening_socket(port, backlog, true,
+                        options));
+        }
+    } catch (...) {
+        for (auto sock_fd : sockets) {
+            close(sock_fd);
+        }
+        throw;
+    }
+
+    return sockets;
+}
+
+SocketType SocketUtilities::create_server_socket(const string& port, 
+        int backlog) {
+    return create_listening_socket(port, backlog, false, nullptr);
+}
+
+SocketType SocketUtilities::create_server_socket(const string& port,
+        const SocketOptions& options, int backlog) {
+    return create_listening_socket(port, backlog, false, &options);
+}
+
+vector<SocketType> SocketUtilities::create_server_sockets(const string& port,
+        int count, int backlog) {
+    return create_listening_sockets(port, count, backlog, nullptr);
+}
+
+vector<SocketType> SocketUtilities::create_server_sockets(const string& port,
+        int count, const SocketOptions& options, int backlog) {
+    return create_listening_sockets(port, count, backlog, &options);
+}
+
+/*
+ * Does the work for create_client_socket(), the options are applied to the
+ * socket before it connects when there are any
+ */
+static SocketType create_connected_socket(const string& address,
+        const string& port, const SocketOptions* options, int attempt_timeout,
+        int attempt_delay) {
 
     // ************************************************************************
     // *                                STEP 1                                *
@@ -190,49 +436,103 @@ SocketType SocketUtilities::create_client_socket(const string& address,
                 string(gai_strerror(return_value)));
     } 
 
-    addrinfo* i = nullptr;
-    for (i = server_address_information; i; i = i->ai_next) {
-        
-        // ********************************************************************
-        // *                            STEP 2                                *
-        // ********************************************************************
-        // attempt to create a socket with the address info structure returned
-        // by the getaddrinfo call
-        if ((socket_to_return = socket(i->ai_family, i->ai_socktype, 
-                    i->ai_protocol)) == -1)  {
-            cerr << "Error on creating client socket " << strerror(errno) << endl;
-            continue;
-        }
+    // all done with this structure once the addresses have been tried, on
+    // every path out of this function
+    std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> address_guard {
+        server_address_information, &freeaddrinfo};
 
-        // ********************************************************************
-        // *                            STEP 3                                *
-        // ********************************************************************
-        // attempt to connect to the remote server
-        if (connect(socket_to_return, i->ai_addr, i->ai_addrlen) == -1) {
-            close(socket_to_return);
-            cerr << "Error connecting to remote server " << strerror(errno) 
-                << endl;
-            continue;
-        }
+    // ************************************************************************
+    // *                                STEP 2                                *
+    // ************************************************************************
+    // race the addresses against each other, see connect_happy_eyeballs()
+    vector<const addrinfo*> addresses;
+    for (auto i = server_address_information; i; i = i->ai_next) {
+        addresses.push_back(i);
+    }
+    addresses = interleave_address_families(addresses);
+    int last_error {0};
+    auto socket_to_return = connect_happy_eyeballs(addresses,
+            attempt_timeout, attempt_delay, options, last_error);
+    if (socket_to_return == -1) {
+        throw SocketException("Failed to connect to remote server "s +
+                address + ":"s + port + " : "s +
+                string(strerror(last_error)));
+    }
 
-        break;
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Connected client socket "s + to_string(socket_to_return) +
+                " to "s + address + ":"s + port);
     }
 
-    if (!i) {
-        throw SocketException("Failed to connect to remote server");
+    // return the socket
+    return socket_to_return;
+}
 
+SocketType SocketUtilities::create_client_socket(const string& address, 
+        const string& port, int attempt_timeout, int attempt_delay) {
+    return create_connected_socket(address, port, nullptr, attempt_timeout,
+            attempt_delay);
+}
+
+SocketType SocketUtilities::create_client_socket(const string& address,
+        const string& port, const SocketOptions& options, int attempt_timeout,
+        int attempt_delay) {
+    return create_connected_socket(address, port, &options, attempt_timeout,
+            attempt_delay);
+}
+
+SocketType SocketUtilities::create_client_socket(Resolver& resolver,
+        const string& address, const string& port, int attempt_timeout,
+        int attempt_delay) {
+
+    auto resolution = resolver.resolve(address, port);
+    if (resolution->error) {
+        throw SocketException("getaddrinfo: "s +
+                string(gai_strerror(resolution->error)));
     }
 
-    // all done with this structure
-    freeaddrinfo(server_address_information); 
+    // the connection engine works on addrinfo records, these only point into
+    // the cached resolution
+    vector<addrinfo> records(resolution->addresses.size());
+    vector<const addrinfo*> addresses;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto& resolved = resolution->addresses[i];
+        memset(&records[i], 0, sizeof(records[i]));
+        records[i].ai_family = resolved.family;
+        records[i].ai_socktype = resolved.socket_type;
+        records[i].ai_protocol = resolved.protocol;
+        records[i].ai_addr = const_cast<sockaddr*>(
+                reinterpret_cast<const sockaddr*>(&resolved.address));
+        records[i].ai_addrlen = resolved.address_length;
+        addresses.push_back(&records[i]);
+    }
+    addresses = interleave_address_families(addresses);
+
+    int last_error {0};
+    auto socket_to_return = connect_happy_eyeballs(addresses,
+            attempt_timeout, attempt_delay, nullptr, last_error);
+    if (socket_to_return == -1) {
+        throw SocketException("Failed to connect to remote server "s +
+                address + ":"s + port + " : "s +
+                string(strerror(last_error)));
+    }
 
-    // return the socket
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Connected client socket "s + to_string(socket_to_return) +
+                " to "s + address + ":"s + port);
+    }
     return socket_to_return;
 }
 
 SocketType SocketUtilities::create_server_unix_socket(
         const string& socket_path, int backlog) {
     
+    // the path and its null terminator have to fit in sun_path
+    if (socket_path.size() >= sizeof(sockaddr_un::sun_path)) {
+        throw SocketException {"Unix socket path is too long : "s +
+            socket_path};
+    }
+
     // STEP 1 : socket()
     int unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
     if (unix_socket == -1) {
@@ -241,7 +541,8 @@ SocketType SocketUtilities::create_server_unix_socket(
     }
 
     // STEP 2 : bind(), setup the address structures for bind()
-    sockaddr_un local_address;
+    // zeroed so that the path is null terminated
+    sockaddr_un local_address {};
     local_address.sun_family = AF_UNIX;
     std::copy(socket_path.begin(), socket_path.end(), 
             local_address.sun_path);
@@ -263,8 +564,11 @@ SocketType SocketUtilities::create_server_unix_socket(
     }
 
     // log output
-    log_output("Created unix server socket on file descriptor"s + 
-            to_string(unix_socket) + ", connected to file "s + socket_path);
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Created unix server socket on file descriptor "s + 
+                to_string(unix_socket) + ", connected to file "s + 
+                socket_path);
+    }
 
     return unix_socket;
 
@@ -273,6 +577,12 @@ SocketType SocketUtilities::create_server_unix_socket(
 SocketType SocketUtilities::create_client_unix_socket(
         const std::string& socket_path) {
 
+    // the path and its null terminator have to fit in sun_path
+    if (socket_path.size() >= sizeof(sockaddr_un::sun_path)) {
+        throw SocketException {"Unix socket path is too long : "s +
+            socket_path};
+    }
+
     // STEP 1 : socket()
     int unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
     if (unix_socket == -1) {
@@ -281,7 +591,7 @@ SocketType SocketUtilities::create_client_unix_socket(
     }
     
     // STEP 2 : connect()
-    sockaddr_un remote_address;
+    sockaddr_un remote_address {};
     remote_address.sun_family = AF_UNIX;
     std::copy(socket_path.begin(), socket_path.end(), 
             remote_address.sun_path);
@@ -294,17 +604,56 @@ SocketType SocketUtilities::create_client_unix_socket(
     }
 
     // log output
-    log_output("Created unix client socket on file descriptor "s + 
-            to_string(unix_socket) + ", connected to file "s + socket_path);
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Created unix client socket on file descriptor "s + 
+                to_string(unix_socket) + ", connected to file "s + 
+                socket_path);
+    }
 
     return unix_socket;
 }
 
-ssize_t SocketUtilities::recv(SocketType sock_fd, void* buffer,
+IoResult<size_t> SocketUtilities::try_recv(SocketType sock_fd, void* buffer,
         size_t length, int flags) {
 
-    // Make the system call and handle errors
-    ssize_t n = ::recv(sock_fd, buffer, length, flags);
+    ssize_t n;
+    do {
+        n = ::recv(sock_fd, buffer, length, flags);
+        detail::count_received(n);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        return IoResult<size_t>::failure(errno);
+    }
+
+    // Print to the network log, this is compiled out entirely when logging
+    // is not enabled at build time
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_transfer("recv", sock_fd, buffer, n);
+    }
+    return static_cast<size_t>(n);
+}
+
+IoResult<size_t> SocketUtilities::try_send(SocketType sock_fd,
+        const void* buffer, size_t length, int flags) {
+
+    ssize_t n;
+    do {
+        n = ::send(sock_fd, buffer, length, flags);
+        detail::count_sent(n);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        return IoResult<size_t>::failure(errno);
+    }
+
+    // Print to the network log
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_transfer("send", sock_fd, buffer, n);
+    }
+    return static_cast<size_t>(n);
+}
+
+ssize_t SocketUtilities::recv(SocketType sock_fd, void* buffer,
+        size_t length, int flags) {
 
     // Exceptional conditions are not tolerated for stream sockets.  In the
     // case of a non blocking socket, if there is a potential blocking
@@ -316,44 +665,31 @@ ssize_t SocketUtilities::recv(SocketType sock_fd, void* buffer,
     // form of kqueues or epoll then the user should poll the socket file
     // descriptor such that the recv function is not called on a socket that
     // is non blocking when there isnt any data in the socket to read from.
-    if (n == -1) {
+    // Callers that expect that to happen use try_recv() instead.
+    auto result = SocketUtilities::try_recv(sock_fd, buffer, length, flags);
+    if (!result) {
         throw SocketException("recv() on socket "s + 
                 to_string(sock_fd) + " returned with error "s + 
-                string(strerror(errno)));
-
+                string(strerror(result.error_number())));
     }
-
-    // Print to the network log
-    log_output("Called recv() on socket "s + to_string(sock_fd) + " : "s + 
-            "received "s + to_string(n) + " bytes\n"s + 
-            string((char*)buffer, ((char*)buffer) + n));
-
-    return n;
+    return static_cast<ssize_t>(result.value());
 }
 
 ssize_t SocketUtilities::send(SocketType sock_fd, const void* buffer, 
         size_t length, int flags) {
 
-    ssize_t n = ::send(sock_fd, const_cast<void*>(buffer), length, flags);
-
     // Handle exceptional conditions, keep in mind that a return value of 0 is
     // not an exceptional condition.  This is in fact a feature of TCP;  this
     // may indicate that the other side is not keeping up.  If the other side
     // has ended the connection then SIGPIPE would be generated if the flags do
     // not include MSG_NOSIGNAL
-    if (n == -1) {
+    auto result = SocketUtilities::try_send(sock_fd, buffer, length, flags);
+    if (!result) {
         throw SocketException("send() on socket "s + 
                 to_string(sock_fd) + " returned with error "s + 
-                string(strerror(errno)));
+                string(strerror(result.error_number())));
     }
-    
-    // Print to the network log
-    log_output("Called send() on socket "s + to_string(sock_fd) + " : "s + 
-            "sent "s + to_string(n) + " bytes\n"s + 
-            string(reinterpret_cast<const char*>(buffer), 
-                reinterpret_cast<const char*>(buffer) + n));
-
-    return n;
+    return static_cast<ssize_t>(result.value());
 }
 
 void SocketUtilities::send_all(SocketType sock_fd, const void* buffer, 
@@ -370,6 +706,9 @@ void SocketUtilities::send_all(SocketType sock_fd, const void* buffer,
                 reinterpret_cast<const void*>(
                     reinterpret_cast<const char*>(buffer) + bytes_sent),
                 length - bytes_sent, MSG_NOSIGNAL);
+        if (sent < static_cast<int>(length) - bytes_sent) {
+            detail::count(Metric::PARTIAL_WRITES);
+        }
         bytes_sent += sent;
 
         // assert that too many bytes have not been sent.
@@ -386,14 +725,174 @@ void SocketUtilities::send_all(SocketType sock_fd,
             data_to_send.size());
 }
 
-SocketType SocketUtilities::accept(SocketType sock_fd, sockaddr* address, 
-        socklen_t* address_length) {
+IoResult<size_t> SocketUtilities::try_recv(SocketType sock_fd,
+        const iovec* buffers, size_t count, int flags) {
 
-    SocketType to_return_socket = ::accept(sock_fd, address, address_length);
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = const_cast<iovec*>(buffers);
+    message.msg_iovlen = count;
+
+    ssize_t n;
+    do {
+        n = ::recvmsg(sock_fd, &message, flags);
+        detail::count_received(n);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        return IoResult<size_t>::failure(errno);
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_transfer("recvmsg", sock_fd, buffers, count, n);
+    }
+    return static_cast<size_t>(n);
+}
+
+IoResult<size_t> SocketUtilities::try_send(SocketType sock_fd,
+        const iovec* buffers, size_t count, int flags) {
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = const_cast<iovec*>(buffers);
+    message.msg_iovlen = count;
+
+    ssize_t n;
+    do {
+        n = ::sendmsg(sock_fd, &message, flags);
+        detail::count_sent(n);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        return IoResult<size_t>::failure(errno);
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_transfer("sendmsg", sock_fd, buffers, count, n);
+    }
+    return static_cast<size_t>(n);
+}
+
+ssize_t SocketUtilities::recv(SocketType sock_fd, const iovec* buffers,
+        size_t count, int flags) {
+
+    auto result = SocketUtilities::try_recv(sock_fd, buffers, count, flags);
+    if (!result) {
+        throw SocketException("recvmsg() on socket "s + 
+                to_string(sock_fd) + " returned with error "s + 
+                string(strerror(result.error_number())));
+    }
+    return static_cast<ssize_t>(result.value());
+}
+
+ssize_t SocketUtilities::send(SocketType sock_fd, const iovec* buffers,
+        size_t count, int flags) {
+
+    auto result = SocketUtilities::try_send(sock_fd, buffers, count, flags);
+    if (!result) {
+        throw SocketException("sendmsg() on socket "s + 
+                to_string(sock_fd) + " returned with error "s + 
+                string(strerror(result.error_number())));
+    }
+    return static_cast<ssize_t>(result.value());
+}
+
+void SocketUtilities::send_all(SocketType sock_fd, const iovec* buffers,
+        size_t count) {
+
+    // work on a copy of the array since it is modified as bytes are sent,
+    // the copy is kept per thread so that it is only ever allocated once
+    thread_local vector<iovec> remaining;
+    remaining.assign(buffers, buffers + count);
+
+    iovec* current = remaining.data();
+    while (count) {
+
+        // sendmsg() takes at most IOV_MAX buffers at once
+        auto batch = std::min(count, static_cast<size_t>(IOV_MAX));
+        auto sent = SocketUtilities::send(sock_fd, current, batch, 
+                MSG_NOSIGNAL);
+        auto unsent = count - batch;
+        SocketUtilities::consume_iovecs(current, count, 
+                static_cast<size_t>(sent));
+        if (count > unsent) {
+            detail::count(Metric::PARTIAL_WRITES);
+        }
+    }
+}
+
+void SocketUtilities::send_all(SocketType sock_fd, 
+        const vector<iovec>& buffers) {
+    SocketUtilities::send_all(sock_fd, buffers.data(), buffers.size());
+}
+
+void SocketUtilities::consume_iovecs(iovec*& buffers, size_t& count, 
+        size_t bytes) {
+
+    // skip the buffers that have been handled completely, and the empty ones
+    while (count && bytes >= buffers->iov_len) {
+        bytes -= buffers->iov_len;
+        ++buffers;
+        --count;
+    }
+
+    // and move into the one that was only partially handled
+    if (count) {
+        buffers->iov_base = reinterpret_cast<char*>(buffers->iov_base) + bytes;
+        buffers->iov_len -= bytes;
+    }
+}
+
+std::size_t SocketUtilities::send_file(SocketType sock_fd, 
+        FileDescriptorType file_fd, off_t& offset, std::size_t length) {
+
+    std::size_t bytes_sent {0};
+    while (bytes_sent < length) {
+
+        ssize_t n = ::sendfile(sock_fd, file_fd, &offset, length - bytes_sent);
+        detail::count_sent(n);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // the socket is non blocking and full, the caller continues from
+            // the updated offset once the socket is writable again
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            throw SocketException("sendfile() on socket "s + 
+                    to_string(sock_fd) + " returned with error "s + 
+                    string(strerror(errno)));
+        }
+
+        // end of the file
+        if (n == 0) {
+            break;
+        }
+        bytes_sent += static_cast<std::size_t>(n);
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Called sendfile() on socket "s + to_string(sock_fd) + 
+                " : sent "s + to_string(bytes_sent) + " bytes from file "s + 
+                to_string(file_fd));
+    }
+    return bytes_sent;
+}
+
+IoResult<SocketType> SocketUtilities::try_accept(SocketType sock_fd,
+        sockaddr* address, socklen_t* address_length, int flags) {
+
+    SocketType to_return_socket;
+    do {
+        to_return_socket = ::accept4(sock_fd, address, address_length, flags);
+        if (to_return_socket == -1) {
+            detail::count_failure(errno);
+        }
+    } while (to_return_socket == -1 && errno == EINTR);
     if (to_return_socket == -1) {
-        throw SocketException("Error calling accept() on socket "s + 
-                to_string(sock_fd) + " : "s + string(strerror(errno)));
+        return IoResult<SocketType>::failure(errno);
     }
+    detail::count(Metric::ACCEPTS);
 
     // assert that something horribly wrong didn't happen.  stdout, stdin and
     // stderr are protected members of the file descriptor family.
@@ -401,10 +900,79 @@ SocketType SocketUtilities::accept(SocketType sock_fd, sockaddr* address,
            to_return_socket != STDIN_FILENO && 
            to_return_socket != STDERR_FILENO);
 
-    log_output("Accepted new connection on socket "s + 
-            to_string(to_return_socket));
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("Accepted new connection on socket "s + 
+                to_string(to_return_socket));
+    }
     return to_return_socket;
 }
+
+SocketType SocketUtilities::accept(SocketType sock_fd, sockaddr* address, 
+        socklen_t* address_length, int flags) {
+
+    auto result = SocketUtilities::try_accept(sock_fd, address,
+            address_length, flags);
+    if (!result) {
+        throw SocketException("Error calling accept() on socket "s + 
+                to_string(sock_fd) + " : "s +
+                string(strerror(result.error_number())));
+    }
+    return result.value();
+}
+
+std::size_t SocketUtilities::accept_all(SocketType sock_fd, 
+        vector<AcceptedConnection>& connections, int flags, 
+        std::size_t max_connections) {
+
+    connections.clear();
+    while (connections.size() < max_connections) {
+
+        // accept straight into the vector to avoid copying the address
+        connections.emplace_back();
+        auto& connection = connections.back();
+        connection.address_length = sizeof(connection.address);
+        connection.socket = ::accept4(sock_fd, 
+                reinterpret_cast<sockaddr*>(&connection.address), 
+                &connection.address_length, flags);
+        if (connection.socket != -1) {
+            detail::count(Metric::ACCEPTS);
+            continue;
+        }
+
+        detail::count_failure(errno);
+        connections.pop_back();
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || !connections.empty()) {
+            break;
+        }
+        throw SocketException("Error calling accept4() on socket "s + 
+                to_string(sock_fd) + " : "s + string(strerror(errno)));
+    }
+
+    if (log_enabled(LogLevel::EVENTS) && !connections.empty()) {
+        log_output("Accepted "s + to_string(connections.size()) + 
+                " new connections on socket "s + to_string(sock_fd));
+    }
+    return connections.size();
+}
+
+void SocketUtilities::make_non_blocking(SocketType sock_fd) {
+
+    // preserve the flags that are already set on the descriptor
+    int flags = ::fcntl(sock_fd, F_GETFL, 0);
+    if (flags == -1) {
+        throw SocketException("Error calling fcntl(F_GETFL) on socket "s + 
+                to_string(sock_fd) + " : "s + string(strerror(errno)));
+    }
+
+    if (!(flags & O_NONBLOCK) && 
+            ::fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        throw SocketException("Error calling fcntl(F_SETFL) on socket "s + 
+                to_string(sock_fd) + " : "s + string(strerror(errno)));
+    }
+}
 /******************************************************************************
  *                          /FUNCTION IMPLEMENTIONS                           *
  ******************************************************************************/
@@ -13,7 +13,10 @@
  * to prevent interleaving.
  *
  * Note: The functions have logging disabled by default.  To enable compile with
- * the -DSOCKET_LOG_COMMUNICATION flag to g++.  When logging is enabled the
+ * the -DSOCKET_LOG_COMMUNICATION flag to g++.  Without the flag the logging
+ * code is removed entirely at compile time.  With it, how much is logged can
+ * be picked at runtime with set_log_level() and the log can be moved off the
+ * calling threads with enable_async_logging().  When logging is enabled the
  * functions are no longer async safe.  You have been warned.
  *
  * The header is arranged as follows. 
@@ -29,8 +32,13 @@
 #include <iostream>         /* ostream */
 #include <vector>           /* vector<> */
 #include <sys/socket.h>     /* socket() */
+#include <sys/uio.h>        /* iovec */
 #include <atomic>           /* atomic<bool> */
 #include <utility>          /* std::pair<> */
+#include <limits>           /* numeric_limits<> */
+#include <system_error>     /* error_code */
+#include <cassert>          /* assert() */
+#include <cerrno>           /* EAGAIN */
 
 /*
  * Main namespace.  Every utility in this library is within this namespace.  All
@@ -57,6 +65,18 @@ class SocketException;
  */
 class SocketRAII;
 class KernelEventQueue;
+class SpliceRelay;
+class BufferPool;
+class Buffer;
+class ConnectionPool;
+class Resolver;
+struct SocketOptions;
+class ZeroCopySender;
+class FramedConnection;
+class HttpConnectionHandler;
+struct PeerCredentials;
+class SharedMemoryChannel;
+struct MetricsSnapshot;
 
 /*
  * Sets the default logging output stream for this library.  Thread safe.
@@ -84,6 +104,42 @@ void set_output_stream(std::ostream& log_stream_in);
  */
 extern std::atomic<bool> network_output_guard;
 
+/*
+ * The amount of information written to the network log.  NONE turns logging
+ * off, EVENTS logs socket creation, connections and the number of bytes moved
+ * by each call and PAYLOAD additionally logs the bytes themselves.
+ *
+ * The level only has an effect when the library has been built with
+ * SOCKET_LOG_COMMUNICATION defined, in which case it defaults to PAYLOAD.
+ * Thread safe, and cheap enough to be flipped while the program is running.
+ */
+enum class LogLevel : int { NONE = 0, EVENTS = 1, PAYLOAD = 2 };
+void set_log_level(LogLevel level);
+LogLevel get_log_level();
+
+/*
+ * Switches the network log to an asynchronous sink.  Every thread that logs
+ * is given its own lock free ring buffer of ring_size bytes (rounded up to a
+ * power of two) into which log records are copied, and a background thread
+ * drains the rings into the output stream set with set_output_stream().
+ * Logging threads never wait for each other or for the stream, if a ring is
+ * full the record is dropped and the number of dropped records is reported
+ * in the log.
+ *
+ * disable_async_logging() writes out everything that is still buffered,
+ * stops the background thread and goes back to writing to the stream
+ * directly.  Both functions are thread safe but should not be called from
+ * more than one thread at a time.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::set_log_level(SocketUtilities::LogLevel::PAYLOAD);
+ *      SocketUtilities::enable_async_logging();
+ *      // ... serve requests
+ *      SocketUtilities::disable_async_logging();
+ */
+void enable_async_logging(std::size_t ring_size = 1 << 16);
+void disable_async_logging();
+
 /*
  * Creates a socket on which a server may listen.  The socket is created in
  * a manner that is completely IP version agnostic and so will work with
@@ -106,15 +162,48 @@ extern std::atomic<bool> network_output_guard;
  */
 SocketType create_server_socket(const std::string& port, int backlog = 10);
 
+/*
+ * Creates count sockets listening on the same port, each with SO_REUSEPORT
+ * set.  The kernel spreads incoming connections across all of them, so each
+ * socket can be given to a different thread with its own accept() loop or
+ * event loop and no accept queue is ever shared between threads.  See
+ * ShardedServer in EventLoop.hpp.
+ *
+ * ERRORS : Throws an exception in exceptional circumstances, no sockets are
+ *          left open when it does.
+ * EXAMPLE :
+ *      auto listeners = SocketUtilities::create_server_sockets("8000", 4);
+ *      for (auto listener : listeners) {
+ *          std::thread{[listener] { // accept() loop }}.detach();
+ *      }
+ */
+std::vector<SocketType> create_server_sockets(const std::string& port,
+        int count, int backlog = 10);
+
+/*
+ * The default time in milliseconds that create_client_socket() gives each
+ * address to connect, and waits before also trying the next address
+ */
+constexpr int DEFAULT_CONNECT_ATTEMPT_TIMEOUT = 10000;
+constexpr int DEFAULT_CONNECT_ATTEMPT_DELAY = 250;
+
 /*
  * Create a socket though which a client connects to a server on the
  * network. This like the server equivalent of the same function is also IP
  * version agnostic.  
  *
- * getaddrinfo() is called and then the returned lined list is iterated over
- * to find the address values that can be connect()ed to
+ * getaddrinfo() is called and the addresses it returns are raced against
+ * each other as described in RFC 8305 (happy eyeballs).  Addresses are tried
+ * alternating between IPv6 and IPv4, and when an attempt has not connected
+ * within attempt_delay milliseconds the next address is tried as well
+ * without giving up on the first.  The first address to connect wins.  Each
+ * attempt is abandoned after attempt_timeout milliseconds (-1 leaves it to
+ * the kernel), so an unreachable address family delays the connection by
+ * attempt_delay rather than stalling it for minutes.  The socket returned is
+ * in blocking mode.
  *
- * ERRORS : Throws an exception in exceptional circumstances.
+ * ERRORS : Throws an exception in exceptional circumstances, including when
+ *          no address could be connected to.
  * EXAMPLE:
  *      auto sock_to_server = 
  *          SocketUtilities::create_client_socket("localhost", "80");
@@ -122,7 +211,9 @@ SocketType create_server_socket(const std::string& port, int backlog = 10);
  *          request.size());
  */
 SocketType create_client_socket(const std::string& address, 
-        const std::string& port);
+        const std::string& port,
+        int attempt_timeout = DEFAULT_CONNECT_ATTEMPT_TIMEOUT,
+        int attempt_delay = DEFAULT_CONNECT_ATTEMPT_DELAY);
 
 /*
  * Creates a unix socket on which a server may listen, wait for incoming
@@ -143,11 +234,101 @@ SocketType create_server_unix_socket(const std::string& socket_path,
  */
 SocketType create_client_unix_socket(const std::string& socket_path);
 
+/*
+ * The result of the non throwing try_ versions of recv(), send() and
+ * accept(), either a value or the errno of the call that failed.  Checking
+ * for the errors a non blocking server sees all the time, a socket with
+ * nothing to read or no room to write and a peer that has reset the
+ * connection, is a comparison of an int, and nothing is allocated either
+ * way.  The error_code is only made when asked for.
+ *
+ * EXAMPLE :
+ *      auto result = SocketUtilities::try_recv(sock_fd, buffer, length);
+ *      if (!result) {
+ *          if (result.would_block()) {
+ *              return; // wait for the next readable event
+ *          }
+ *          if (result.disconnected()) {
+ *              close_connection(sock_fd);
+ *              return;
+ *          }
+ *          throw std::system_error {result.error()};
+ *      }
+ *      handle(buffer, result.value());
+ */
+template <typename Value>
+class IoResult {
+public:
+
+    IoResult(Value value_in) : result{value_in} {}
+
+    /* A failed result with the errno of the call */
+    static IoResult failure(int error_number_in) {
+        IoResult failed {Value{}};
+        failed.errno_value = error_number_in;
+        return failed;
+    }
+
+    /* True if the call succeeded */
+    explicit operator bool() const { return !this->errno_value; }
+
+    /* The value of a successful call */
+    Value value() const {
+        assert(!this->errno_value);
+        return this->result;
+    }
+
+    /* The errno of a failed call, 0 on success */
+    int error_number() const { return this->errno_value; }
+    std::error_code error() const {
+        return std::error_code{this->errno_value, std::system_category()};
+    }
+
+    /* A non blocking socket had nothing to read, no room or nothing to accept */
+    bool would_block() const {
+        return this->errno_value == EAGAIN || this->errno_value == EWOULDBLOCK;
+    }
+
+    /* The peer reset the connection or it was already shut down */
+    bool disconnected() const {
+        return this->errno_value == ECONNRESET || this->errno_value == EPIPE;
+    }
+
+private:
+    Value result;
+    int errno_value {0};
+};
+
+/*
+ * Versions of recv(), send() and accept() below that do not throw, for the
+ * paths where failures are routine and unwinding an exception for each of
+ * them would cost far more than the system call.  Interrupted calls are
+ * retried.  The throwing versions are built on these.
+ */
+__attribute__((warn_unused_result))
+IoResult<std::size_t> try_recv(SocketType sock_fd, void* buffer,
+        std::size_t length, int flags = 0);
+__attribute__((warn_unused_result))
+IoResult<std::size_t> try_send(SocketType sock_fd, const void* buffer,
+        std::size_t length, int flags = 0);
+__attribute__((warn_unused_result))
+IoResult<std::size_t> try_recv(SocketType sock_fd, const iovec* buffers,
+        std::size_t count, int flags = 0);
+__attribute__((warn_unused_result))
+IoResult<std::size_t> try_send(SocketType sock_fd, const iovec* buffers,
+        std::size_t count, int flags = 0);
+__attribute__((warn_unused_result))
+IoResult<SocketType> try_accept(SocketType sock_fd, sockaddr* address = nullptr,
+        socklen_t* address_len = nullptr, int flags = 0);
+
 /*
  * A wrapper around the recv() function that takes care of looping while data
  * has not been received, and exceptional conditions.
  *
  * Use the recv() version with the same intent as ::recv() 
+ *
+ * ERRORS : Throws an exception when ::recv() fails, use try_recv() where that
+ *          is expected to happen
  */
 ssize_t recv (SocketType sock_fd, void* buffer, size_t length, int flags = 0);
 
@@ -167,12 +348,79 @@ ssize_t recv (SocketType sock_fd, void* buffer, size_t length, int flags = 0);
  * Use the send_all() function to send all the data that is in the buffer
  * that was passed in.  This loops till all the data has been sent so this
  * function will block.
+ *
+ * ERRORS : Throws an exception when ::send() fails, use try_send() where that
+ *          is expected to happen
  */
 ssize_t send(SocketType sock_fd, const void* buffer, size_t length, 
         int flags = 0);
 void send_all(SocketType sock_fd, const std::vector<char>& data_to_send);
 void send_all(SocketType sock_fd, const void* buffer, size_t length);
 
+/*
+ * Scatter/gather versions of recv(), send() and send_all() built on
+ * recvmsg() and sendmsg().  The buffers are an array of count iovec
+ * structures, for example a header, a body and a trailer that live in
+ * different places in memory.  They are sent or filled in order with one
+ * system call, so framed messages do not have to be copied into one
+ * contiguous buffer first.
+ *
+ * send_all() handles partial writes that end in the middle of any of the
+ * buffers and does not modify the array passed in.
+ *
+ * EXAMPLE :
+ *      iovec buffers[] = {
+ *          SocketUtilities::make_iovec(header.data(), header.size()),
+ *          SocketUtilities::make_iovec(body.data(), body.size())
+ *      };
+ *      SocketUtilities::send_all(sock_fd, buffers, 2);
+ */
+ssize_t recv(SocketType sock_fd, const iovec* buffers, size_t count,
+        int flags = 0);
+ssize_t send(SocketType sock_fd, const iovec* buffers, size_t count,
+        int flags = 0);
+void send_all(SocketType sock_fd, const iovec* buffers, size_t count);
+void send_all(SocketType sock_fd, const std::vector<iovec>& buffers);
+
+/* Creates an iovec for a buffer, hiding the const_cast iovec needs */
+inline iovec make_iovec(const void* buffer, size_t length) {
+    return iovec{const_cast<void*>(buffer), length};
+}
+
+/*
+ * Moves an array of iovecs past the first bytes bytes, which is what is
+ * needed after a vectored send or receive only handled part of the buffers.
+ * buffers and count are updated to refer to the first buffer that has bytes
+ * left, whose base and length are adjusted in place.
+ */
+void consume_iovecs(iovec*& buffers, size_t& count, size_t bytes);
+
+/*
+ * Sends length bytes of the file file_fd starting at offset to the socket with
+ * sendfile(), the data goes from the page cache to the socket without ever
+ * being copied into the memory of this process.  offset is advanced past the
+ * bytes that were sent, so the same offset can be passed in again to carry on
+ * where the last call left off.  Returns the number of bytes sent.
+ *
+ * On a blocking socket this loops until length bytes have been sent or the
+ * end of the file is reached.  On a non blocking socket it returns as soon as
+ * the socket is full, possibly with 0 bytes sent, the caller should wait for
+ * the socket to become writable (see KernelEventQueue) and call it again.
+ *
+ * ERRORS : Throws an exception in exceptional circumstances, a full non
+ *          blocking socket is not one of them.
+ * EXAMPLE :
+ *      off_t offset = 0;
+ *      auto size = static_cast<std::size_t>(file_stat.st_size);
+ *      while (offset < file_stat.st_size) {
+ *          SocketUtilities::send_file(sock_fd, file_fd, offset,
+ *                  size - static_cast<std::size_t>(offset));
+ *          // wait for sock_fd to be writable if it is non blocking
+ *      }
+ */
+std::size_t send_file(SocketType sock_fd, FileDescriptorType file_fd,
+        off_t& offset, std::size_t length);
+
 /*
  * A wrapper function around the accept() network call.  This method adds
  * error handling on top of the usual accept call.
@@ -181,9 +429,55 @@ void send_all(SocketType sock_fd, const void* buffer, size_t length);
  * way to store the returned socket in the context of this library would be
  * to assign it to a SocketRAII object which would close the socket on
  * destruction. 
+ *
+ * The flags are passed on to accept4(), SOCK_NONBLOCK and SOCK_CLOEXEC set
+ * those flags on the new socket as part of the same system call.
+ *
+ * ERRORS : Throws an exception when ::accept4() fails, use try_accept() on
+ *          non blocking listeners
  */
 SocketType accept(SocketType sock_fd, sockaddr* address = nullptr, 
-        socklen_t* address_len = nullptr);
+        socklen_t* address_len = nullptr, int flags = 0);
+
+/*
+ * A connection accepted by accept_all() along with the address of the peer
+ */
+struct AcceptedConnection {
+    SocketType socket;
+    sockaddr_storage address;
+    socklen_t address_length;
+};
+
+/*
+ * Accepts every connection that is pending on a non blocking listening
+ * socket, until accept4() reports EAGAIN or max_connections have been
+ * accepted.  The vector is cleared first and reused, so a caller that keeps
+ * it around does not allocate once it has grown.  Returns the number of
+ * connections accepted, which is 0 when nothing was pending.
+ *
+ * The new sockets are created with the flags passed in, by default they are
+ * already non blocking and close on exec so no more system calls are needed
+ * before adding them to a KernelEventQueue.  The caller owns the sockets.
+ *
+ * ERRORS : An empty backlog, interrupted calls and connections that were
+ *          aborted before they could be accepted are not errors.  Other
+ *          errors (like running out of descriptors) throw an exception if
+ *          nothing could be accepted, otherwise the connections accepted so
+ *          far are returned and the error will show up again on the next call
+ * EXAMPLE :
+ *      std::vector<SocketUtilities::AcceptedConnection> accepted;
+ *      while (true) {
+ *          // wait for the listener to become readable
+ *          SocketUtilities::accept_all(listener, accepted);
+ *          for (auto& connection : accepted) {
+ *              queue.declare_interest(connection.socket, ...);
+ *          }
+ *      }
+ */
+std::size_t accept_all(SocketType sock_fd,
+        std::vector<AcceptedConnection>& connections,
+        int flags = SOCK_NONBLOCK | SOCK_CLOEXEC,
+        std::size_t max_connections = std::numeric_limits<std::size_t>::max());
 
 /*
  * Sets the socket sock_fd to be non-blocking.  Any subsequent calls to blocking
@@ -197,3 +491,10 @@ void make_non_blocking(SocketType sock_fd);
 /* Include the other headers in this library for convenience */
 #include "SocketRAII.hpp"
 #include "KernelEventQueue.hpp"
+#include "SpliceRelay.hpp"
+#include "Datagram.hpp"
+#include "BufferPool.hpp"
+#include "Resolver.hpp"
+#include "SocketOptions.hpp"
+#include "DescriptorPassing.hpp"
+#include "Metrics.hpp"
@@ -0,0 +1,115 @@
+#include "SpliceRelay.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+using SocketUtilities::LogLevel;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::SpliceRelay;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using std::size_t;
+using std::string;
+using std::to_string;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * splice() that retries on EINTR and reports a would block condition as 0.
+ * End of stream also returns 0, and sets *end since it cannot be told apart
+ * from would block otherwise.  count_call is count_received() for a splice
+ * out of the source socket and count_sent() for one into the destination
+ */
+static ssize_t splice_some(int from, int to, size_t length, bool* end,
+        void (*count_call)(ssize_t)) {
+
+    while (true) {
+        ssize_t n = ::splice(from, nullptr, to, nullptr, length,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        count_call(n);
+        if (n > 0) {
+            return n;
+        }
+        if (n == 0) {
+            *end = true;
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        throw SocketException {"Error in splice() call : "s +
+            string(std::strerror(errno))};
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+SpliceRelay::SpliceRelay(size_t pipe_size) {
+
+    int pipe_fds[2];
+    if (::pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        throw SocketException {"Error in pipe2() call : "s +
+            string(std::strerror(errno))};
+    }
+    this->pipe_read_end = pipe_fds[0];
+    this->pipe_write_end = pipe_fds[1];
+
+    // a larger pipe moves more per call, failing to grow it is not an error
+    ::fcntl(this->pipe_write_end, F_SETPIPE_SZ, static_cast<int>(pipe_size));
+}
+
+SpliceRelay::~SpliceRelay() {
+    ::close(this->pipe_read_end);
+    ::close(this->pipe_write_end);
+}
+
+size_t SpliceRelay::relay(SocketType source, SocketType destination,
+        size_t max_length) {
+
+    size_t bytes_relayed {0};
+    bool destination_full {false};
+    while (!destination_full) {
+
+        // fill the pipe from the source unless there is still data in it from
+        // before, in which case that goes out first
+        if (!this->buffered && !this->end_of_source &&
+                bytes_relayed < max_length) {
+            this->buffered = static_cast<size_t>(splice_some(source,
+                        this->pipe_write_end, max_length - bytes_relayed,
+                        &this->end_of_source, count_received));
+        }
+        if (!this->buffered) {
+            break;
+        }
+
+        // drain the pipe into the destination
+        bool unused {false};
+        auto n = static_cast<size_t>(splice_some(this->pipe_read_end,
+                    destination, this->buffered, &unused, count_sent));
+        this->buffered -= n;
+        bytes_relayed += n;
+        destination_full = this->buffered != 0;
+    }
+
+    if (log_enabled(LogLevel::EVENTS) && bytes_relayed) {
+        log_output("Called splice() from socket "s + to_string(source) +
+                " to socket "s + to_string(destination) + " : relayed "s +
+                to_string(bytes_relayed) + " bytes"s);
+    }
+    return bytes_relayed;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,74 @@
+#ifndef __CPP_SOCKETS_SPLICE_RELAY_HPP__
+#define __CPP_SOCKETS_SPLICE_RELAY_HPP__
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+
+namespace SocketUtilities {
+
+
+/*
+ * Moves data from one socket to another with splice() without copying it
+ * into the memory of this process, which is what a proxy does for every byte
+ * it forwards.  splice() needs a pipe on one end, so the relay owns a pipe
+ * through which the bytes travel inside the kernel.
+ *
+ * Both sockets may be non blocking.  Bytes that have been taken from the
+ * source but could not yet be given to the destination stay in the pipe and
+ * are sent first by the next call to relay(), so nothing is lost when the
+ * destination is full.  When used with a KernelEventQueue, wait for the
+ * source to be readable when get_buffered() is 0 and for the destination to
+ * be writable otherwise.
+ *
+ * One relay carries one direction of a connection, a proxy needs two.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::SpliceRelay client_to_server;
+ *      while (!client_to_server.source_closed()) {
+ *          // wait for readiness as described above
+ *          client_to_server.relay(client_socket, server_socket);
+ *      }
+ */
+class SpliceRelay {
+public:
+
+    /*
+     * Creates the pipe, pipe_size is a hint for the capacity of the pipe.
+     * Throws an exception if the pipe cannot be created
+     */
+    explicit SpliceRelay(std::size_t pipe_size = 1 << 16);
+    ~SpliceRelay();
+    SpliceRelay(const SpliceRelay&) = delete;
+    SpliceRelay& operator=(const SpliceRelay&) = delete;
+
+    /*
+     * Moves up to max_length bytes from source to destination.  Returns the
+     * number of bytes that were written to the destination by this call.
+     *
+     * ERRORS : Throws an exception in exceptional circumstances, full or
+     *          empty non blocking sockets are not one of them
+     */
+    std::size_t relay(SocketType source, SocketType destination,
+            std::size_t max_length = 1 << 16);
+
+    /* The number of bytes read from the source and not yet sent */
+    std::size_t get_buffered() const { return this->buffered; }
+
+    /*
+     * True once the source has reached the end of its stream.  Anything still
+     * buffered should be flushed by calling relay() until get_buffered()
+     * returns 0, after which the destination can be shut down
+     */
+    bool source_closed() const { return this->end_of_source; }
+
+private:
+    FileDescriptorType pipe_read_end;
+    FileDescriptorType pipe_write_end;
+    std::size_t buffered {0};
+    bool end_of_source {false};
+};
+
+
+}
+
+#endif
@@ -0,0 +1,419 @@
+#include "TlsConnection.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <unistd.h>
+
+using SocketUtilities::LogLevel;
+using SocketUtilities::Metric;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::TlsConnection;
+using SocketUtilities::TlsContext;
+using SocketUtilities::detail::count;
+using SocketUtilities::detail::count_received;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using SocketUtilities::detail::log_transfer;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::vector;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * How much of a file is read and encrypted at a time when the kernel does
+ * not encrypt, the largest payload of a TLS record is 16KB
+ */
+static constexpr size_t FILE_CHUNK_SIZE = 64 * 1024;
+
+/* The reasons OpenSSL gives for the last failure, emptying its error queue */
+static string get_tls_error() {
+    string reason;
+    while (auto error = ::ERR_get_error()) {
+        char buffer[256];
+        ::ERR_error_string_n(error, buffer, sizeof(buffer));
+        if (!reason.empty()) {
+            reason += ", "s;
+        }
+        reason += buffer;
+    }
+    return reason.empty() ? "unknown error"s : reason;
+}
+
+class TlsContext::Impl {
+public:
+
+    explicit Impl(Role role_in) : role{role_in} {
+
+        this->context = ::SSL_CTX_new(this->role == Role::SERVER ?
+                ::TLS_server_method() : ::TLS_client_method());
+        if (!this->context) {
+            throw SocketException {"Error in SSL_CTX_new() call : "s +
+                get_tls_error()};
+        }
+
+        // OpenSSL installs the keys into the kernel by itself after the
+        // handshake with this option, for the ciphers the kernel supports
+        ::SSL_CTX_set_min_proto_version(this->context, TLS1_2_VERSION);
+        ::SSL_CTX_set_options(this->context, SSL_OP_ENABLE_KTLS);
+        if (this->role == Role::CLIENT) {
+
+            // without a system certificate store only the certificates
+            // passed to trust() are trusted
+            ::SSL_CTX_set_default_verify_paths(this->context);
+            ::ERR_clear_error();
+        }
+        this->set_verify_peer(this->role == Role::CLIENT);
+    }
+
+    ~Impl() {
+        ::SSL_CTX_free(this->context);
+    }
+
+    void set_verify_peer(bool verify) {
+        auto mode = SSL_VERIFY_NONE;
+        if (verify) {
+            mode = this->role == Role::SERVER ? SSL_VERIFY_PEER |
+                SSL_VERIFY_FAIL_IF_NO_PEER_CERT : SSL_VERIFY_PEER;
+        }
+        ::SSL_CTX_set_verify(this->context, mode, nullptr);
+    }
+
+    Role role;
+    SSL_CTX* context;
+};
+
+class TlsConnection::Impl {
+public:
+
+    Impl(SocketType sock_fd_in, TlsContext& context,
+            const string& server_name) : sock_fd{sock_fd_in} {
+
+        this->ssl = ::SSL_new(context.impl_ptr->context);
+        if (!this->ssl) {
+            throw SocketException {"Error in SSL_new() call : "s +
+                get_tls_error()};
+        }
+        try {
+            this->handshake(context.impl_ptr->role, server_name);
+        } catch (...) {
+            ::SSL_free(this->ssl);
+            throw;
+        }
+    }
+
+    ~Impl() {
+        ::SSL_free(this->ssl);
+    }
+
+    void handshake(TlsContext::Role role, const string& server_name);
+
+    /*
+     * Whether an SSL_*() call that returned result should simply be made
+     * again, which on a blocking socket happens when a system call was
+     * interrupted.  Remembers why it failed otherwise
+     */
+    bool should_retry(int result) {
+        this->saved_errno = errno;
+        this->error = ::SSL_get_error(this->ssl, result);
+        return this->error == SSL_ERROR_WANT_READ ||
+            this->error == SSL_ERROR_WANT_WRITE ||
+            (this->error == SSL_ERROR_SYSCALL && this->saved_errno == EINTR);
+    }
+
+    string describe_failure() const {
+        if (this->error == SSL_ERROR_SYSCALL && this->saved_errno) {
+            return string(std::strerror(this->saved_errno));
+        }
+        return get_tls_error();
+    }
+
+    SocketType sock_fd;
+    SSL* ssl;
+    bool kernel_send {false};
+    bool kernel_receive {false};
+    int error {SSL_ERROR_NONE};
+    int saved_errno {0};
+    vector<char> file_buffer;
+};
+
+void TlsConnection::Impl::handshake(TlsContext::Role role,
+        const string& server_name) {
+
+    if (!::SSL_set_fd(this->ssl, this->sock_fd)) {
+        throw SocketException {"Error in SSL_set_fd() call : "s +
+            get_tls_error()};
+    }
+
+    // a certificate chain that verifies proves nothing about which server it
+    // belongs to unless the name in it is checked as well
+    auto verify = ::SSL_get_verify_mode(this->ssl) & SSL_VERIFY_PEER;
+    if (role == TlsContext::Role::CLIENT && verify && server_name.empty()) {
+        throw SocketException {"TLS client on socket "s +
+            to_string(this->sock_fd) + " needs the name of the server to "
+            "verify its certificate"s};
+    }
+    if (!server_name.empty()) {
+        if (::SSL_set_tlsext_host_name(this->ssl, server_name.c_str()) != 1) {
+            throw SocketException {"Error in SSL_set_tlsext_host_name() "
+                "call : "s + get_tls_error()};
+        }
+        if (::SSL_set1_host(this->ssl, server_name.c_str()) != 1) {
+            throw SocketException {"Error in SSL_set1_host() call : "s +
+                get_tls_error()};
+        }
+    }
+    if (role == TlsContext::Role::SERVER) {
+        ::SSL_set_accept_state(this->ssl);
+    } else {
+        ::SSL_set_connect_state(this->ssl);
+    }
+
+    while (true) {
+        ::ERR_clear_error();
+        auto result = ::SSL_do_handshake(this->ssl);
+        if (result == 1) {
+            break;
+        }
+        if (this->should_retry(result)) {
+            continue;
+        }
+
+        auto reason = this->describe_failure();
+        auto verification = ::SSL_get_verify_result(this->ssl);
+        if (verification != X509_V_OK) {
+            reason += " ("s + ::X509_verify_cert_error_string(verification) +
+                ")"s;
+        }
+        throw SocketException {"TLS handshake on socket "s +
+            to_string(this->sock_fd) + " failed : "s + reason};
+    }
+
+    // the BIOs of the session report whether the keys made it into the
+    // kernel, OpenSSL carries on in userspace when they did not
+#ifndef OPENSSL_NO_KTLS
+    this->kernel_send = BIO_get_ktls_send(::SSL_get_wbio(this->ssl));
+    this->kernel_receive = BIO_get_ktls_recv(::SSL_get_rbio(this->ssl));
+#endif
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_output("TLS handshake on socket "s + to_string(this->sock_fd) +
+                " : "s + ::SSL_get_version(this->ssl) + " "s +
+                ::SSL_get_cipher_name(this->ssl) + ", kernel send "s +
+                (this->kernel_send ? "on"s : "off"s) + ", kernel receive "s +
+                (this->kernel_receive ? "on"s : "off"s));
+    }
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+TlsContext::TlsContext(Role role) : impl_ptr{new Impl{role}} {}
+
+TlsContext::~TlsContext() {
+    delete this->impl_ptr;
+}
+
+void TlsContext::use_certificate(const string& certificate_chain_file,
+        const string& private_key_file) {
+
+    auto context = this->impl_ptr->context;
+    if (::SSL_CTX_use_certificate_chain_file(context,
+                certificate_chain_file.c_str()) != 1) {
+        throw SocketException {"Error loading certificate "s +
+            certificate_chain_file + " : "s + get_tls_error()};
+    }
+    if (::SSL_CTX_use_PrivateKey_file(context, private_key_file.c_str(),
+                SSL_FILETYPE_PEM) != 1) {
+        throw SocketException {"Error loading private key "s +
+            private_key_file + " : "s + get_tls_error()};
+    }
+    if (::SSL_CTX_check_private_key(context) != 1) {
+        throw SocketException {"Private key "s + private_key_file +
+            " does not match certificate "s + certificate_chain_file +
+            " : "s + get_tls_error()};
+    }
+}
+
+void TlsContext::trust(const string& certificate_file) {
+
+    if (::SSL_CTX_load_verify_locations(this->impl_ptr->context,
+                certificate_file.c_str(), nullptr) != 1) {
+        throw SocketException {"Error loading certificates "s +
+            certificate_file + " : "s + get_tls_error()};
+    }
+    this->impl_ptr->set_verify_peer(true);
+}
+
+void TlsContext::set_verify_peer(bool verify) {
+    this->impl_ptr->set_verify_peer(verify);
+}
+
+void TlsContext::set_kernel_offload(bool enable) {
+    if (enable) {
+        ::SSL_CTX_set_options(this->impl_ptr->context, SSL_OP_ENABLE_KTLS);
+    } else {
+        ::SSL_CTX_clear_options(this->impl_ptr->context, SSL_OP_ENABLE_KTLS);
+    }
+}
+
+TlsConnection::TlsConnection(SocketType sock_fd, TlsContext& context,
+        const string& server_name) :
+    impl_ptr{new Impl{sock_fd, context, server_name}} {}
+
+TlsConnection::~TlsConnection() {
+    delete this->impl_ptr;
+}
+
+size_t TlsConnection::recv(void* buffer, size_t length) {
+
+    auto& impl = *this->impl_ptr;
+    size_t n {0};
+    while (true) {
+        ::ERR_clear_error();
+        auto result = ::SSL_read_ex(impl.ssl, buffer, length, &n);
+
+        // counted as the plaintext the caller gets, errno is OpenSSL's here
+        if (result == 1) {
+            count_received(static_cast<ssize_t>(n));
+            break;
+        }
+        count(Metric::RECV_CALLS);
+        if (impl.should_retry(result)) {
+            continue;
+        }
+        if (impl.error == SSL_ERROR_ZERO_RETURN) {
+            return 0;
+        }
+        count(Metric::ERRORS);
+        throw SocketException {"Error in SSL_read() call on socket "s +
+            to_string(impl.sock_fd) + " : "s + impl.describe_failure()};
+    }
+
+    if (log_enabled(LogLevel::EVENTS)) {
+        log_transfer("SSL_read", impl.sock_fd, buffer,
+                static_cast<ssize_t>(n));
+    }
+    return n;
+}
+
+void TlsConnection::send_all(const void* buffer, size_t length) {
+
+    // the kernel frames and encrypts whatever is written to the socket
+    auto& impl = *this->impl_ptr;
+    if (impl.kernel_send) {
+        SocketUtilities::send_all(impl.sock_fd, buffer, length);
+        return;
+    }
+
+    auto data = static_cast<const char*>(buffer);
+    while (length) {
+        size_t n {0};
+        ::ERR_clear_error();
+        auto result = ::SSL_write_ex(impl.ssl, data, length, &n);
+        if (result != 1) {
+            count(Metric::SEND_CALLS);
+            if (impl.should_retry(result)) {
+                continue;
+            }
+            count(Metric::ERRORS);
+            throw SocketException {"Error in SSL_write() call on socket "s +
+                to_string(impl.sock_fd) + " : "s + impl.describe_failure()};
+        }
+
+        count_sent(static_cast<ssize_t>(n));
+        if (log_enabled(LogLevel::EVENTS)) {
+            log_transfer("SSL_write", impl.sock_fd, data,
+                    static_cast<ssize_t>(n));
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+void TlsConnection::send_all(const string& data_to_send) {
+    this->send_all(data_to_send.data(), data_to_send.size());
+}
+
+size_t TlsConnection::send_file(FileDescriptorType file_fd, off_t& offset,
+        size_t length) {
+
+    // the socket is blocking so send_file() only stops short at the end of
+    // the file
+    auto& impl = *this->impl_ptr;
+    if (impl.kernel_send) {
+        return SocketUtilities::send_file(impl.sock_fd, file_fd, offset,
+                length);
+    }
+
+    impl.file_buffer.resize(FILE_CHUNK_SIZE);
+    size_t sent {0};
+    while (sent < length) {
+        auto chunk = std::min(length - sent, FILE_CHUNK_SIZE);
+        auto n = ::pread(file_fd, impl.file_buffer.data(), chunk, offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SocketException {"Error in pread() call : "s +
+                string(std::strerror(errno))};
+        }
+        if (n == 0) {
+            break;
+        }
+
+        this->send_all(impl.file_buffer.data(), static_cast<size_t>(n));
+        offset += n;
+        sent += static_cast<size_t>(n);
+    }
+    return sent;
+}
+
+void TlsConnection::shutdown() {
+
+    // only the close_notify is sent, the other side's is not waited for.  A
+    // peer that has already gone away is not an error at this point
+    auto& impl = *this->impl_ptr;
+    while (true) {
+        ::ERR_clear_error();
+        auto result = ::SSL_shutdown(impl.ssl);
+        if (result >= 0 || !impl.should_retry(result)) {
+            break;
+        }
+    }
+    ::ERR_clear_error();
+}
+
+bool TlsConnection::is_kernel_send() const {
+    return this->impl_ptr->kernel_send;
+}
+
+bool TlsConnection::is_kernel_receive() const {
+    return this->impl_ptr->kernel_receive;
+}
+
+string TlsConnection::get_protocol() const {
+    return ::SSL_get_version(this->impl_ptr->ssl);
+}
+
+string TlsConnection::get_cipher() const {
+    return ::SSL_get_cipher_name(this->impl_ptr->ssl);
+}
+
+SocketType TlsConnection::get_socket() const {
+    return this->impl_ptr->sock_fd;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
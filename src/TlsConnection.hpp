@@ -0,0 +1,207 @@
+#ifndef __CPP_SOCKETS_TLS_CONNECTION_HPP__
+#define __CPP_SOCKETS_TLS_CONNECTION_HPP__
+
+/*
+ * TLS on top of the sockets in this library.  This is the only part of the
+ * library that needs something besides the standard library, it is built on
+ * OpenSSL and only compiled in with `make install TLS=1`, programs using it
+ * link with -lssl -lcrypto as well as with libcppsockets.a
+ */
+
+#include "SocketUtilities.hpp"
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+namespace SocketUtilities {
+
+
+/*
+ * The settings shared by many TLS connections, the certificate and key of a
+ * server and the certificates a client trusts.  A context is set up once and
+ * then used for every connection, it must outlive them.
+ *
+ * Clients verify the server's certificate against the system's trusted
+ * certificates by default, servers do not ask clients for one.  TLS 1.2 is
+ * the oldest version negotiated.
+ *
+ * EXAMPLE :
+ *      // server
+ *      SocketUtilities::TlsContext context {
+ *          SocketUtilities::TlsContext::Role::SERVER};
+ *      context.use_certificate("server.crt", "server.key");
+ *
+ *      // client of a server with a self signed certificate
+ *      SocketUtilities::TlsContext context {
+ *          SocketUtilities::TlsContext::Role::CLIENT};
+ *      context.trust("server.crt");
+ *      SocketUtilities::TlsConnection connection {sock_fd, context,
+ *          "localhost"};
+ */
+class TlsContext {
+public:
+
+    enum class Role { CLIENT, SERVER };
+
+    /*
+     * ERRORS : Throws an exception if OpenSSL cannot create the context
+     */
+    explicit TlsContext(Role role);
+    ~TlsContext();
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    /*
+     * Loads the certificate chain and the private key in PEM format that
+     * this side presents to the other
+     *
+     * ERRORS : Throws an exception if the files cannot be read or the key
+     *          does not match the certificate
+     */
+    void use_certificate(const std::string& certificate_chain_file,
+            const std::string& private_key_file);
+
+    /*
+     * Trusts the certificates in the PEM file, in addition to the system's
+     * for a client.  On a server this makes clients present a certificate
+     * signed by one of them
+     *
+     * ERRORS : Throws an exception if the file cannot be read
+     */
+    void trust(const std::string& certificate_file);
+
+    /* Turns verification of the other side's certificate on or off */
+    void set_verify_peer(bool verify);
+
+    /*
+     * Whether the connections should hand their encryption to the kernel
+     * (kTLS) after the handshake, on by default.  See TlsConnection
+     */
+    void set_kernel_offload(bool enable);
+
+private:
+    friend class TlsConnection;
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+/*
+ * A TLS session on a connected socket.  The handshake is done in userspace
+ * by OpenSSL, after which the session keys are installed into the kernel
+ * with kTLS (the "tls" TCP upper layer protocol) whenever the kernel and the
+ * negotiated cipher support it.  From then on the kernel encrypts and
+ * decrypts the records, so
+ *
+ *  - send_all() and send_file() write plaintext straight to the socket with
+ *    SocketUtilities::send_all() and sendfile(), and file data goes from the
+ *    page cache to the network without ever being copied to userspace
+ *  - recv() reads records decrypted by the kernel straight into the caller's
+ *    buffer
+ *
+ * Once is_kernel_send() is true the socket itself can be handed to anything
+ * else in this library that sends, SpliceRelay for example, and what it
+ * sends is encrypted.  Receiving on the socket directly
+ * is not possible even with kernel receive, since records that are not
+ * application data (alerts, key updates) have to go through OpenSSL.
+ *
+ * Without kTLS, when the tls kernel module is not loaded or for a cipher the
+ * kernel does not implement, everything goes through OpenSSL in userspace
+ * and the connection works the same way, only slower.
+ *
+ * The socket must be blocking, and the connection does not own it.  Call
+ * shutdown() before closing the socket so that the other side can tell the
+ * end of the stream from a truncation attack.  OpenSSL writes to the socket
+ * with write() rather than with send(MSG_NOSIGNAL), so programs using TLS
+ * should ignore SIGPIPE.
+ *
+ * EXAMPLE :
+ *      auto sock_fd = SocketUtilities::accept(listener);
+ *      SocketUtilities::TlsConnection connection {sock_fd, context};
+ *      auto n = connection.recv(buffer.data(), buffer.size());
+ *      connection.send_all(response);
+ *      connection.send_file(file_fd, offset, file_size);
+ *      connection.shutdown();
+ *      ::close(sock_fd);
+ */
+class TlsConnection {
+public:
+
+    /*
+     * Performs the handshake, as a client or a server depending on the
+     * context.  A client passes the host name of the server, it is sent to
+     * the server (SNI) and the server's certificate is checked against it.
+     * The name is required when the client verifies the server, which it
+     * does by default, otherwise any valid certificate would be accepted
+     *
+     * ERRORS : Throws an exception if the handshake fails, including when
+     *          the certificate of the other side could not be verified, and
+     *          if a verifying client was not given the server's name
+     */
+    TlsConnection(SocketType sock_fd, TlsContext& context,
+            const std::string& server_name = "");
+    ~TlsConnection();
+    TlsConnection(const TlsConnection&) = delete;
+    TlsConnection& operator=(const TlsConnection&) = delete;
+
+    /*
+     * Receives up to length bytes of plaintext, returns 0 once the other side
+     * has shut the session down
+     *
+     * ERRORS : Throws an exception on a network error, and if the connection
+     *          was closed without the other side shutting the session down
+     */
+    std::size_t recv(void* buffer, std::size_t length);
+
+    /*
+     * Sends all the data, encrypted by the kernel when it can be
+     *
+     * ERRORS : Throws an exception on a network error
+     */
+    void send_all(const void* buffer, std::size_t length);
+    void send_all(const std::string& data_to_send);
+
+    /*
+     * Sends length bytes of the file starting at offset, like
+     * SocketUtilities::send_file().  With kernel send this is a plain
+     * sendfile(), otherwise the file is read in chunks and encrypted in
+     * userspace.  Returns the number of bytes sent, which is less than length
+     * only at the end of the file, and advances offset past them
+     *
+     * ERRORS : Throws an exception if the file cannot be read or on a network
+     *          error
+     */
+    std::size_t send_file(FileDescriptorType file_fd, off_t& offset,
+            std::size_t length);
+
+    /* Tells the other side that nothing more will be sent (close_notify) */
+    void shutdown();
+
+    /* Whether the kernel encrypts what is sent and decrypts what is received */
+    bool is_kernel_send() const;
+    bool is_kernel_receive() const;
+
+    /* The negotiated protocol version and cipher, like "TLSv1.3" */
+    std::string get_protocol() const;
+    std::string get_cipher() const;
+
+    SocketType get_socket() const;
+
+private:
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,407 @@
+#include "ZeroCopySender.hpp"
+#include "BufferPool.hpp"
+#include "SocketException.hpp"
+#include "NetworkLog.hpp"
+#include "MetricCounters.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+using SocketUtilities::Buffer;
+using SocketUtilities::KernelEventQueue;
+using SocketUtilities::LogLevel;
+using SocketUtilities::Metric;
+using SocketUtilities::SocketException;
+using SocketUtilities::SocketType;
+using SocketUtilities::ZeroCopySender;
+using SocketUtilities::detail::count;
+using SocketUtilities::detail::count_sent;
+using SocketUtilities::detail::log_enabled;
+using SocketUtilities::detail::log_output;
+using SocketUtilities::detail::log_transfer;
+using std::size_t;
+using std::string;
+using std::to_string;
+using std::uint32_t;
+using namespace std::literals::string_literals; /* for operator "" */
+
+/*
+ * Older kernel headers do not define these, the values are the ones from the
+ * Linux uapi headers
+ */
+#ifndef SO_ZEROCOPY
+    #define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+    #define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+    #define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+    #define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+/*
+ * One buffer passed to send().  Every sendmsg() with MSG_ZEROCOPY that sends
+ * part of it is given the next number of a 32 bit counter kept by the kernel
+ * for the socket, the calls for one buffer have consecutive numbers starting
+ * at first_call.  Completions name a range of those numbers, the buffer can
+ * be released once all of it has been sent and every one of its calls has
+ * completed
+ */
+class PendingSend {
+public:
+    const char* data;
+    size_t length;
+    size_t sent;
+    bool zero_copy;
+    uint32_t first_call;
+    uint32_t calls;
+    uint32_t completed;
+    ZeroCopySender::ReleaseCallback release;
+
+    bool is_finished() const {
+        return this->sent == this->length && this->completed == this->calls;
+    }
+};
+
+class ZeroCopySender::Impl {
+public:
+
+    Impl(SocketType sock_fd_in, size_t threshold_in) : sock_fd{sock_fd_in},
+            threshold{threshold_in} {
+        int one {1};
+        this->enabled = ::setsockopt(this->sock_fd, SOL_SOCKET, SO_ZEROCOPY,
+                &one, sizeof(one)) == 0;
+        if (!this->enabled && log_enabled(LogLevel::EVENTS)) {
+            log_output("Zero copy not available on socket "s +
+                    to_string(this->sock_fd) + " : "s +
+                    string(std::strerror(errno)));
+        }
+    }
+
+    /*
+     * Sends what it can of the buffers not yet fully sent, returns false if
+     * the socket is full
+     */
+    bool send_queued();
+
+    /* Reads every notification waiting on the error queue */
+    void read_completions();
+
+    /* Whether any zero copy call is still waiting for its completion */
+    bool has_outstanding_calls() const;
+
+    /* Marks the calls numbered first to last (inclusive) as completed */
+    void complete_calls(uint32_t first, uint32_t last);
+
+    /* Releases the finished buffers at the front of the queue */
+    size_t release_finished();
+
+    SocketType sock_fd;
+    size_t threshold;
+    bool enabled;
+    std::uint64_t copied_count {0};
+
+    // the number the kernel gives the next zero copy call
+    uint32_t next_call {0};
+
+    // buffers in the order they were passed in, the ones before first_unsent
+    // have been sent in full and wait for their completions
+    std::deque<PendingSend> pending;
+    size_t first_unsent {0};
+    size_t queued_bytes {0};
+};
+
+bool ZeroCopySender::Impl::send_queued() {
+
+    while (this->first_unsent < this->pending.size()) {
+        auto& send = this->pending[this->first_unsent];
+        bool retried {false};
+        bool copy_this_call {false};
+        while (send.sent < send.length) {
+
+            bool zero_copy = send.zero_copy && !copy_this_call;
+            auto n = ::send(this->sock_fd, send.data + send.sent,
+                    send.length - send.sent,
+                    MSG_NOSIGNAL | (zero_copy ? MSG_ZEROCOPY : 0));
+            count_sent(n);
+            if (n >= 0) {
+                if (static_cast<size_t>(n) < send.length - send.sent) {
+                    count(Metric::PARTIAL_WRITES);
+                }
+                if (log_enabled(LogLevel::EVENTS)) {
+                    log_transfer("send", this->sock_fd, send.data + send.sent,
+                            n);
+                }
+                if (zero_copy) {
+                    if (!send.calls) {
+                        send.first_call = this->next_call;
+                    }
+                    ++send.calls;
+                    ++this->next_call;
+                }
+                send.sent += static_cast<size_t>(n);
+                this->queued_bytes -= static_cast<size_t>(n);
+                copy_this_call = false;
+                continue;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+
+            // the pages pinned for zero copy count against the socket's
+            // option memory, reading completions gives some of it back and
+            // if that is not enough this part is copied instead
+            if (errno == ENOBUFS && zero_copy) {
+                if (!retried) {
+                    retried = true;
+                    this->read_completions();
+                    this->release_finished();
+                } else {
+                    copy_this_call = true;
+                }
+                continue;
+            }
+            throw SocketException {"Error in send() call : "s +
+                string(std::strerror(errno))};
+        }
+        ++this->first_unsent;
+    }
+    return true;
+}
+
+void ZeroCopySender::Impl::read_completions() {
+
+    // sockets without zero copy, unix sockets among them, have no error
+    // queue to read and a recvmsg() with MSG_ERRQUEUE returns 0 there
+    // whenever ordinary data or the end of the stream is waiting
+    if (!this->enabled || !this->has_outstanding_calls()) {
+        return;
+    }
+
+    // every notification is one sock_extended_err in a control message, the
+    // kernel merges consecutive completions into one range when it can
+    char control[CMSG_SPACE(sizeof(sock_extended_err)) * 4];
+    while (true) {
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (::recvmsg(this->sock_fd, &message,
+                    MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            throw SocketException {"Error in recvmsg() call : "s +
+                string(std::strerror(errno))};
+        }
+
+        // notifications carry no data so recvmsg() returns 0 for them too,
+        // only one that came back with a notification is worth repeating
+        bool notified {false};
+        for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg;
+                cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP &&
+                            cmsg->cmsg_type == IP_RECVERR) ||
+                        (cmsg->cmsg_level == SOL_IPV6 &&
+                         cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            sock_extended_err error;
+            std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_errno != 0 ||
+                    error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            notified = true;
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                this->copied_count += static_cast<uint32_t>(
+                        error.ee_data - error.ee_info) + 1;
+            }
+            this->complete_calls(error.ee_info, error.ee_data);
+        }
+        if (!notified) {
+            break;
+        }
+    }
+}
+
+bool ZeroCopySender::Impl::has_outstanding_calls() const {
+    return std::any_of(this->pending.begin(), this->pending.end(),
+            [](const PendingSend& send) {
+                return send.completed != send.calls;
+            });
+}
+
+void ZeroCopySender::Impl::complete_calls(uint32_t first, uint32_t last) {
+
+    // the counter wraps around, so positions are measured from first
+    auto range = static_cast<std::int64_t>(static_cast<uint32_t>(
+                last - first));
+    for (auto& send : this->pending) {
+        if (!send.calls) {
+            continue;
+        }
+        auto begin = static_cast<std::int64_t>(static_cast<std::int32_t>(
+                    send.first_call - first));
+        auto end = begin + send.calls - 1;
+        if (begin > range) {
+            break;
+        }
+        auto overlap = std::min(end, range) - std::max<std::int64_t>(begin, 0)
+            + 1;
+        if (overlap > 0) {
+            send.completed += static_cast<uint32_t>(overlap);
+        }
+    }
+}
+
+size_t ZeroCopySender::Impl::release_finished() {
+
+    size_t released {0};
+    while (!this->pending.empty() && this->first_unsent &&
+            this->pending.front().is_finished()) {
+        auto release = std::move(this->pending.front().release);
+        this->pending.pop_front();
+        --this->first_unsent;
+        ++released;
+        if (release) {
+            release();
+        }
+    }
+    return released;
+}
+
+
+/******************************************************************************
+ *                           FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
+ZeroCopySender::ZeroCopySender(SocketType sock_fd, size_t threshold) :
+    impl_ptr{new Impl{sock_fd, threshold}} {}
+
+ZeroCopySender::~ZeroCopySender() {
+
+    // the callbacks are called after the sender is gone from under them so
+    // that one throwing does not leak the rest
+    auto pending = std::move(this->impl_ptr->pending);
+    delete this->impl_ptr;
+    for (auto& send : pending) {
+        if (send.release) {
+            send.release();
+        }
+    }
+}
+
+bool ZeroCopySender::send(const void* buffer, size_t length,
+        ReleaseCallback release) {
+
+    auto zero_copy = this->impl_ptr->enabled &&
+        length >= this->impl_ptr->threshold;
+    this->impl_ptr->pending.push_back(PendingSend{
+            static_cast<const char*>(buffer), length, 0, zero_copy, 0, 0, 0,
+            std::move(release)});
+    this->impl_ptr->queued_bytes += length;
+    return this->flush();
+}
+
+bool ZeroCopySender::send(const Buffer& buffer) {
+    return this->send(buffer.data(), buffer.size(), [buffer] {});
+}
+
+bool ZeroCopySender::flush() {
+    auto flushed = this->impl_ptr->send_queued();
+    this->impl_ptr->release_finished();
+    return flushed;
+}
+
+size_t ZeroCopySender::process_completions() {
+
+    this->impl_ptr->read_completions();
+    auto released = this->impl_ptr->release_finished();
+    if (released && log_enabled(LogLevel::EVENTS)) {
+        log_output("Released "s + to_string(released) +
+                " zero copy buffers on socket "s +
+                to_string(this->impl_ptr->sock_fd));
+    }
+    return released;
+}
+
+void ZeroCopySender::handle_event(const KernelEventQueue::Event& event) {
+    if (event.writable()) {
+        this->flush();
+    }
+    if (event.error()) {
+        this->process_completions();
+    }
+}
+
+bool ZeroCopySender::wait_for_completions(int timeout) {
+
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds{timeout};
+    while (true) {
+        this->flush();
+        this->process_completions();
+        if (this->impl_ptr->pending.empty()) {
+            return true;
+        }
+
+        int wait_for {-1};
+        if (timeout >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) {
+                return false;
+            }
+            wait_for = static_cast<int>(left);
+        }
+
+        // errors, and so completions, are reported without being asked for
+        pollfd poll_fd {this->impl_ptr->sock_fd, static_cast<short>(
+                this->impl_ptr->queued_bytes ? POLLOUT : 0), 0};
+        if (::poll(&poll_fd, 1, wait_for) == -1 && errno != EINTR) {
+            throw SocketException {"Error in poll() call : "s +
+                string(std::strerror(errno))};
+        }
+    }
+}
+
+size_t ZeroCopySender::get_pending_count() const {
+    return this->impl_ptr->pending.size();
+}
+
+size_t ZeroCopySender::get_queued_bytes() const {
+    return this->impl_ptr->queued_bytes;
+}
+
+bool ZeroCopySender::is_zero_copy_enabled() const {
+    return this->impl_ptr->enabled;
+}
+
+std::uint64_t ZeroCopySender::get_copied_count() const {
+    return this->impl_ptr->copied_count;
+}
+/******************************************************************************
+ *                          /FUNCTION IMPLEMENTIONS                           *
+ ******************************************************************************/
@@ -0,0 +1,135 @@
+#ifndef __CPP_SOCKETS_ZERO_COPY_SENDER_HPP__
+#define __CPP_SOCKETS_ZERO_COPY_SENDER_HPP__
+
+#include "SocketUtilities.hpp"
+#include "KernelEventQueue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace SocketUtilities {
+
+
+/*
+ * Sends large buffers with MSG_ZEROCOPY, the kernel transmits straight from
+ * the pages of the buffer instead of copying it into the socket buffer first.
+ * The price is that the buffer must not be modified or freed until the kernel
+ * says it is done with it, which it does with a notification on the error
+ * queue of the socket.  The sender reads those notifications and calls the
+ * release callback of a buffer once every byte of it has been sent and the
+ * kernel no longer refers to it.  Buffers are released in the order they were
+ * passed in.
+ *
+ * Zero copy only pays off for large sends, setting up the page references
+ * costs more than copying a few kilobytes, so buffers smaller than the
+ * threshold are sent the ordinary way and released as soon as they have been
+ * written.  If the socket does not support SO_ZEROCOPY (old kernels, unix
+ * sockets) everything is sent the ordinary way.  On loopback the kernel
+ * copies anyway and says so in the notification, get_copied_count() reports
+ * how often that happened.
+ *
+ * The socket may be blocking or non blocking.  With a non blocking socket
+ * send() queues whatever does not fit and flush() carries on from there.
+ * When used with a KernelEventQueue, completions arrive as an error event on
+ * the socket (EPOLLERR is always reported) and handle_event() does both the
+ * flushing and the reading of completions.
+ *
+ * The sender does not own the socket.  Buffers still pending when the sender
+ * is destroyed are released then, even though the kernel may still be
+ * sending from them, so call wait_for_completions() before destroying the
+ * sender unless the connection is being abandoned.
+ *
+ * EXAMPLE :
+ *      SocketUtilities::ZeroCopySender sender {sock_fd};
+ *      auto data = new std::vector<char>(1 << 20);
+ *      sender.send(data->data(), data->size(), [data] { delete data; });
+ *      ...
+ *      // on every event for the socket
+ *      sender.handle_event(event);
+ */
+class ZeroCopySender {
+public:
+
+    using ReleaseCallback = std::function<void ()>;
+
+    /* Sends of at least this many bytes use MSG_ZEROCOPY by default */
+    static constexpr std::size_t DEFAULT_THRESHOLD = 64 * 1024;
+
+    /*
+     * Turns on SO_ZEROCOPY for the socket, failing to do so is not an error
+     * and only means every send is copied
+     */
+    explicit ZeroCopySender(SocketType sock_fd,
+            std::size_t threshold = DEFAULT_THRESHOLD);
+    ~ZeroCopySender();
+    ZeroCopySender(const ZeroCopySender&) = delete;
+    ZeroCopySender& operator=(const ZeroCopySender&) = delete;
+
+    /*
+     * Sends the buffer, release is called once the buffer can be reused.
+     * Returns true if the buffer and everything queued before it has been
+     * written to the socket, false if some of it is queued because a non
+     * blocking socket was full.
+     *
+     * ERRORS : Throws an exception in exceptional conditions, the buffer
+     *          stays pending and is released when the sender is destroyed
+     */
+    bool send(const void* buffer, std::size_t length, ReleaseCallback release);
+
+    /* Sends a pooled buffer, holding a reference to it until it is released */
+    bool send(const Buffer& buffer);
+
+    /*
+     * Writes as much of the queued data as the socket takes, returns true
+     * when nothing is left queued
+     */
+    bool flush();
+
+    /*
+     * Reads the completion notifications from the error queue of the socket
+     * and releases the buffers that are done.  Never blocks, returns the
+     * number of buffers released
+     */
+    std::size_t process_completions();
+
+    /*
+     * Flushes on writable events and processes completions on error events,
+     * call with every event the queue reports for the socket
+     */
+    void handle_event(const KernelEventQueue::Event& event);
+
+    /*
+     * Blocks for up to timeout milliseconds (-1 waits forever) until every
+     * buffer has been sent and released.  Returns true if nothing is pending
+     */
+    bool wait_for_completions(int timeout = -1);
+
+    /* The number of buffers not yet released */
+    std::size_t get_pending_count() const;
+
+    /* The number of bytes not yet written to the socket */
+    std::size_t get_queued_bytes() const;
+
+    /* Whether SO_ZEROCOPY could be turned on for the socket */
+    bool is_zero_copy_enabled() const;
+
+    /*
+     * The number of zero copy sends for which the kernel reported it copied
+     * the data after all, if this keeps growing zero copy is not helping
+     */
+    std::uint64_t get_copied_count() const;
+
+private:
+
+    /*
+     * The opaque pointer pimpl idiom.  Defined and declared in the
+     * implementation file for this class.
+     */
+    class Impl;
+    Impl* impl_ptr;
+};
+
+
+}
+
+#endif
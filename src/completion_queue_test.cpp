@@ -0,0 +1 @@
+../tests/completion_queue_test.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../tests/coroutine_server.cpp
\ No newline at end of file
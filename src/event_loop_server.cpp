@@ -0,0 +1 @@
+../tests/event_loop_server.cpp
\ No newline at end of file
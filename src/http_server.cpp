@@ -0,0 +1 @@
+../tests/http_server.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../tests/tls_server.cpp
\ No newline at end of file
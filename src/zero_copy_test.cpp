@@ -0,0 +1 @@
+../tests/zero_copy_test.cpp
\ No newline at end of file
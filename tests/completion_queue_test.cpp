@@ -0,0 +1,84 @@
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SocketUtilities.hpp"
+#include "CompletionQueue.hpp"
+using namespace std;
+using SocketUtilities::CompletionQueue;
+
+/*
+ * Queues many more sends than the submission queue has entries, so that
+ * queueing has to make room by submitting, and more completions than the
+ * completion queue has room for, so that the kernel pushes back while
+ * submitting.  Every send must complete exactly once and every byte arrive
+ */
+int main() {
+
+    // the test fails by hanging if a submission is lost
+    ::alarm(10);
+
+    unique_ptr<CompletionQueue> ring;
+    try {
+        ring = std::make_unique<CompletionQueue>(4);
+    } catch (const std::exception& exception) {
+        cout << " * Skipping, io_uring is not available : "
+            << exception.what() << endl;
+        return 0;
+    }
+
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+        cerr << "socketpair() failed" << endl;
+        return 1;
+    }
+
+    constexpr unsigned SENDS = 256;
+    const char byte {'x'};
+    for (unsigned i = 0; i < SENDS; ++i) {
+        ring->submit_send(sockets[0], &byte, 1, i);
+    }
+
+    vector<unsigned> seen(SENDS);
+    vector<CompletionQueue::Completion> completions;
+    unsigned completed {0};
+    while (completed < SENDS) {
+        ring->get_completions(completions);
+        for (const auto& completion : completions) {
+            if (completion.get_user_data() >= SENDS ||
+                    completion.get_result() != 1) {
+                cerr << "Unexpected completion " << completion.get_user_data()
+                    << " with result " << completion.get_result() << endl;
+                return 1;
+            }
+            ++seen[completion.get_user_data()];
+            ++completed;
+        }
+    }
+    for (unsigned i = 0; i < SENDS; ++i) {
+        if (seen[i] != 1) {
+            cerr << "Send " << i << " completed " << seen[i] << " times"
+                << endl;
+            return 1;
+        }
+    }
+
+    vector<char> received(SENDS);
+    size_t total {0};
+    while (total < SENDS) {
+        auto n = ::recv(sockets[1], received.data() + total, SENDS - total, 0);
+        if (n <= 0) {
+            cerr << "recv() failed after " << total << " bytes" << endl;
+            return 1;
+        }
+        total += static_cast<size_t>(n);
+    }
+
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+    cout << " * " << SENDS << " sends through a queue of 4 entries completed"
+        << endl;
+    return 0;
+}
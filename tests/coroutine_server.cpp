@@ -0,0 +1,58 @@
+#include <array>
+#include <iostream>
+#include <string>
+#include "SocketUtilities.hpp"
+#include "EventLoop.hpp"
+#include "AsyncSocket.hpp"
+#include "Coroutine.hpp"
+using namespace std;
+using SocketUtilities::AsyncSocket;
+using SocketUtilities::Task;
+
+static const string response {
+"HTTP/1.1 200 OK\n\n"
+"Hello, World!"
+};
+
+/*
+ * One of these runs for every connection, the same server as the one in
+ * event_loop_server.cpp but written as a coroutine instead of callbacks
+ */
+static Task<> serve(AsyncSocket sock) {
+
+    // read the request, send data and close once it has all been sent
+    array<char, 4096> buffer;
+    if (co_await SocketUtilities::async_recv(sock, buffer.data(),
+                buffer.size())) {
+        co_await SocketUtilities::async_send_all(sock, response.data(),
+                response.size());
+    }
+}
+
+static Task<> accept_connections(AsyncSocket& listener) {
+    while (true) {
+        auto sock = co_await SocketUtilities::async_accept(listener);
+        SocketUtilities::spawn(serve(AsyncSocket{listener.get_event_loop(),
+                    sock}));
+    }
+}
+
+int main(int argc, char** argv) {
+
+    // Error check command line arguments
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " <port_number>" << endl;
+        return 1;
+    }
+
+    SocketUtilities::EventLoop event_loop;
+    AsyncSocket listener {event_loop,
+        SocketUtilities::create_server_socket(argv[1], 128)};
+    SocketUtilities::spawn(accept_connections(listener));
+
+    // Print serving prompt
+    cout << " * Serving on port " << argv[1] << " (Press CTRL+C to quit)" << endl;
+    event_loop.run();
+
+    return 0;
+}
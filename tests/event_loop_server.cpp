@@ -0,0 +1,54 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include "SocketUtilities.hpp"
+#include "EventLoop.hpp"
+using namespace std;
+
+static const string response {
+"HTTP/1.1 200 OK\n\n"
+"Hello, World!"
+};
+
+/*
+ * One of these is created for every connection, the same server as the one
+ * in tcp_server.cpp but without a thread for each connection
+ */
+class HelloHandler : public SocketUtilities::ConnectionHandler {
+public:
+    void on_read(SocketUtilities::Connection& connection, const char*,
+            std::size_t) override {
+
+        // send data and close once it has all been sent
+        connection.write(response);
+        connection.close();
+    }
+};
+
+int main(int argc, char** argv) {
+
+    // Error check command line arguments
+    if (argc != 2 && argc != 3) {
+        cerr << "Usage: " << argv[0] << " <port_number> [threads]" << endl;
+        return 1;
+    }
+
+    // every connection gets its own handler
+    auto factory = [] { return std::make_unique<HelloHandler>(); };
+
+    // Print serving prompt
+    cout << " * Serving on port " << argv[1] << " (Press CTRL+C to quit)" << endl;
+
+    // with more than one thread each thread gets its own listening socket on
+    // the same port and the kernel balances connections between them
+    if (argc == 3) {
+        SocketUtilities::ShardedServer server {argv[1], factory,
+            static_cast<unsigned>(std::stoul(argv[2]))};
+        server.run();
+    } else {
+        SocketUtilities::Server server {argv[1], factory};
+        server.run();
+    }
+
+    return 0;
+}
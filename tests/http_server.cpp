@@ -0,0 +1,71 @@
+#include <iostream>
+#include <string>
+#include "SocketUtilities.hpp"
+#include "EventLoop.hpp"
+#include "Http.hpp"
+using namespace std;
+
+static const string hello {"Hello, World!"};
+
+/*
+ * The server from tcp_server.cpp done properly, connections stay open across
+ * requests and pipelined requests are answered in order.  Try
+ *
+ *      curl -v http://localhost:8000/ http://localhost:8000/
+ *      curl -d 'some data' http://localhost:8000/echo
+ *      curl http://localhost:8000/count?to=5
+ */
+static void handle(const SocketUtilities::HttpRequest& request,
+        SocketUtilities::HttpResponse& response) {
+
+    // the body is sent from the request buffer without being copied
+    if (request.path.equals("/echo")) {
+        response.add_header("Content-Type", "application/octet-stream");
+        response.set_body(request.body.data, request.body.length);
+        return;
+    }
+
+    // the length is not known up front, so the body goes out in chunks
+    if (request.path.equals("/count")) {
+        auto to = request.query.length > 3 ?
+            std::stoi(request.query.to_string().substr(3)) : 10;
+        response.add_header("Content-Type", "text/plain");
+        for (auto i = 1; i <= to; ++i) {
+            auto line = to_string(i) + "\n";
+            response.write_chunk(line.data(), line.size());
+        }
+        return;
+    }
+
+    if (!request.path.equals("/")) {
+        response.set_status(404);
+        return;
+    }
+    response.add_header("Content-Type", "text/plain");
+    response.set_body(hello.data(), hello.size());
+}
+
+int main(int argc, char** argv) {
+
+    // Error check command line arguments
+    if (argc != 2 && argc != 3) {
+        cerr << "Usage: " << argv[0] << " <port_number> [threads]" << endl;
+        return 1;
+    }
+
+    auto factory = SocketUtilities::http_handler_factory(handle);
+
+    // Print serving prompt
+    cout << " * Serving on port " << argv[1] << " (Press CTRL+C to quit)" << endl;
+
+    if (argc == 3) {
+        SocketUtilities::ShardedServer server {argv[1], factory,
+            static_cast<unsigned>(std::stoul(argv[2]))};
+        server.run();
+    } else {
+        SocketUtilities::Server server {argv[1], factory};
+        server.run();
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <thread>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SocketUtilities.hpp"
+#include "TlsConnection.hpp"
+using namespace std;
+
+/*
+ * The server from tcp_server.cpp over TLS, answering every request with the
+ * contents of a file.  With kTLS the file goes from the page cache to the
+ * network through sendfile() and is encrypted by the kernel.  Create a self
+ * signed certificate and try it with
+ *
+ *      openssl req -x509 -newkey rsa:2048 -nodes -days 30 -subj /CN=localhost \
+ *          -keyout server.key -out server.crt
+ *      ./sampletlsserver 8443 server.crt server.key README.md
+ *      curl --cacert server.crt https://localhost:8443/
+ */
+int main(int argc, char** argv) {
+
+    // Error check command line arguments
+    if (argc != 5) {
+        cerr << "Usage: " << argv[0] << " <port_number> <certificate> <key> "
+            << "<file>" << endl;
+        return 1;
+    }
+
+    // OpenSSL writes to the socket with write() when the kernel does not
+    // encrypt, which raises SIGPIPE if the client has gone away
+    std::signal(SIGPIPE, SIG_IGN);
+
+    SocketUtilities::TlsContext context {
+        SocketUtilities::TlsContext::Role::SERVER};
+    context.use_certificate(argv[2], argv[3]);
+
+    using SocketUtilities::SocketRAII;
+    SocketRAII sockfd {SocketUtilities::create_server_socket(argv[1])};
+    string file {argv[4]};
+
+    cout << " * Serving " << file << " over TLS on port " << argv[1]
+        << " (Press CTRL+C to quit)" << endl;
+
+    while (true) {  // main accept() loop
+
+        auto new_fd = SocketUtilities::accept(sockfd);
+        std::thread ([&context, &file](auto new_fd) {
+
+            SocketRAII auto_close {new_fd};
+            try {
+                SocketUtilities::TlsConnection connection {new_fd, context};
+                cout << " * " << connection.get_protocol() << " "
+                    << connection.get_cipher() << ", kernel send "
+                    << (connection.is_kernel_send() ? "on" : "off")
+                    << ", kernel receive "
+                    << (connection.is_kernel_receive() ? "on" : "off")
+                    << endl;
+
+                array<char, 1024> buffer;
+                connection.recv(buffer.data(), buffer.size());
+
+                SocketRAII file_fd {::open(file.c_str(), O_RDONLY)};
+                struct stat file_stat;
+                if (file_fd == -1 || ::fstat(file_fd, &file_stat) == -1) {
+                    connection.send_all("HTTP/1.1 404 Not Found\r\n"
+                            "Content-Length: 0\r\n\r\n"s);
+                    connection.shutdown();
+                    return;
+                }
+
+                auto size = static_cast<std::size_t>(file_stat.st_size);
+                connection.send_all("HTTP/1.1 200 OK\r\nContent-Length: "s +
+                        to_string(size) + "\r\nConnection: close\r\n\r\n"s);
+                off_t offset {0};
+                connection.send_file(file_fd, offset, size);
+                connection.shutdown();
+
+            } catch (const std::exception& exception) {
+                cerr << exception.what() << endl;
+            }
+        }, new_fd).detach();
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <exception>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SocketUtilities.hpp"
+#include "ZeroCopySender.hpp"
+using namespace std;
+using SocketUtilities::ZeroCopySender;
+
+/*
+ * Unix sockets do not support zero copy so the sender falls back to ordinary
+ * sends.  Data waiting to be read from the peer must not be mistaken for a
+ * completion notification, every byte must arrive and the buffer must be
+ * released once it has been written
+ */
+int main() {
+
+    // the test fails by hanging if reading completions spins
+    ::alarm(10);
+
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+        cerr << "socketpair() failed" << endl;
+        return 1;
+    }
+    ::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+
+    // a byte from the peer waits unread on the sending socket
+    const char byte {'x'};
+    if (::send(sockets[1], &byte, 1, 0) != 1) {
+        cerr << "send() failed" << endl;
+        return 1;
+    }
+
+    try {
+        ZeroCopySender sender {sockets[0]};
+        if (sender.is_zero_copy_enabled()) {
+            cout << " * Zero copy is enabled on a unix socket, "
+                "the fallback is not tested" << endl;
+        }
+
+        vector<char> data(128 * 1024, 'y');
+        bool released {false};
+        sender.send(data.data(), data.size(), [&released] {
+            released = true;
+        });
+        sender.process_completions();
+
+        size_t received {0};
+        vector<char> buffer(16 * 1024);
+        while (received < data.size()) {
+            auto n = ::recv(sockets[1], buffer.data(), buffer.size(), 0);
+            if (n <= 0) {
+                cerr << "recv() failed" << endl;
+                return 1;
+            }
+            received += static_cast<size_t>(n);
+            sender.flush();
+            sender.process_completions();
+        }
+
+        if (!sender.wait_for_completions(1000) || !released) {
+            cerr << "The buffer was not released after it was sent" << endl;
+            return 1;
+        }
+    } catch (const std::exception& exception) {
+        cerr << "Unexpected exception : " << exception.what() << endl;
+        return 1;
+    }
+
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+    cout << " * Sent 128 KiB over a unix socket with data pending" << endl;
+    return 0;
+}